@@ -0,0 +1,546 @@
+#pragma once
+
+// Pieces for taking disk I/O off the generation threads (see gen_shader --threads):
+//  - BoundedQueue: a fixed-size lock-free queue that generators hand finished buffers to the
+//    writer through, and that the writer hands them back through once they're written
+//  - CoalescingFileWriter: appends a whole batch of buffers to one file at once, through io_uring
+//    on Linux kernels that have it, pwritev on other POSIX systems, and plain fwrite on Windows
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define ASYNC_WRITER_HAS_IO_URING 1
+#endif
+#endif
+
+#if !defined(ASYNC_WRITER_HAS_IO_URING)
+#define ASYNC_WRITER_HAS_IO_URING 0
+#endif
+
+// Spins for a bit, then yields, then sleeps, for threads waiting on a queue.
+// Generation is way slower than a queue op, so nobody should be waiting long
+struct QueueBackoff
+{
+	int32_t NumWaits = 0;
+
+	void Wait()
+	{
+		if (NumWaits < 64)
+		{
+			// Just spin
+		}
+		else if (NumWaits < 256)
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		NumWaits++;
+	}
+};
+
+// Multi-producer multi-consumer ring with a sequence number per slot (Vyukov's bounded queue),
+// so pushing and popping are each one CAS when there's no contention
+template<typename T>
+struct BoundedQueue
+{
+	struct Slot
+	{
+		std::atomic<size_t> Sequence;
+		T Value;
+	};
+
+	std::unique_ptr<Slot[]> Slots;
+	size_t Mask = 0;
+
+	// On separate cache lines, producers and the consumer shouldn't fight over them
+	alignas(64) std::atomic<size_t> EnqueuePos{ 0 };
+	alignas(64) std::atomic<size_t> DequeuePos{ 0 };
+
+	// Rounded up to a power of 2
+	explicit BoundedQueue(size_t MinCapacity)
+	{
+		size_t Capacity = 2;
+		while (Capacity < MinCapacity)
+		{
+			Capacity *= 2;
+		}
+
+		Slots.reset(new Slot[Capacity]);
+		Mask = Capacity - 1;
+		for (size_t i = 0; i < Capacity; i++)
+		{
+			Slots[i].Sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool TryPush(const T& Value)
+	{
+		size_t Pos = EnqueuePos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot& Cell = Slots[Pos & Mask];
+			const size_t Sequence = Cell.Sequence.load(std::memory_order_acquire);
+			const intptr_t Diff = (intptr_t)Sequence - (intptr_t)Pos;
+			if (Diff == 0)
+			{
+				if (EnqueuePos.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed))
+				{
+					Cell.Value = Value;
+					Cell.Sequence.store(Pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (Diff < 0)
+			{
+				// Full
+				return false;
+			}
+			else
+			{
+				Pos = EnqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool TryPop(T* OutValue)
+	{
+		size_t Pos = DequeuePos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot& Cell = Slots[Pos & Mask];
+			const size_t Sequence = Cell.Sequence.load(std::memory_order_acquire);
+			const intptr_t Diff = (intptr_t)Sequence - (intptr_t)(Pos + 1);
+			if (Diff == 0)
+			{
+				if (DequeuePos.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed))
+				{
+					*OutValue = Cell.Value;
+					Cell.Sequence.store(Pos + Mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (Diff < 0)
+			{
+				// Empty
+				return false;
+			}
+			else
+			{
+				Pos = DequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void Push(const T& Value)
+	{
+		QueueBackoff Backoff;
+		while (!TryPush(Value))
+		{
+			Backoff.Wait();
+		}
+	}
+
+	T Pop()
+	{
+		T Value;
+		QueueBackoff Backoff;
+		while (!TryPop(&Value))
+		{
+			Backoff.Wait();
+		}
+		return Value;
+	}
+};
+
+struct WriteSegment
+{
+	const void* Data;
+	size_t Length;
+};
+
+// Appends batches of segments to one file, in as few syscalls as it can.
+// Segments only have to stay alive until Append returns, so their buffers can be reused right after
+struct CoalescingFileWriter
+{
+#if defined(_WIN32)
+	FILE* File = nullptr;
+#else
+	int Fd = -1;
+	uint64_t Offset = 0;
+	std::vector<struct iovec> IOVecs;
+#endif
+
+#if ASYNC_WRITER_HAS_IO_URING
+	struct IOUring
+	{
+		int Fd = -1;
+		uint32_t NumEntries = 0;
+		void* SQRing = nullptr;
+		size_t SQRingSize = 0;
+		void* CQRing = nullptr;
+		size_t CQRingSize = 0;
+		struct io_uring_sqe* SQEs = nullptr;
+		size_t SQEsSize = 0;
+
+		uint32_t* SQHead = nullptr;
+		uint32_t* SQTail = nullptr;
+		uint32_t* SQMask = nullptr;
+		uint32_t* SQArray = nullptr;
+		uint32_t* CQHead = nullptr;
+		uint32_t* CQTail = nullptr;
+		uint32_t* CQMask = nullptr;
+		struct io_uring_cqe* CQEs = nullptr;
+	};
+	IOUring Ring;
+
+	bool SetupIOUring(uint32_t Entries)
+	{
+		struct io_uring_params Params;
+		memset(&Params, 0, sizeof(Params));
+		const int RingFd = (int)syscall(__NR_io_uring_setup, Entries, &Params);
+		if (RingFd < 0)
+		{
+			// Old kernel, or a sandbox that blocks it
+			return false;
+		}
+
+		Ring.Fd = RingFd;
+		Ring.NumEntries = Params.sq_entries;
+		Ring.SQRingSize = Params.sq_off.array + Params.sq_entries * sizeof(uint32_t);
+		Ring.CQRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+		const bool bSingleMap = (Params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (bSingleMap)
+		{
+			Ring.SQRingSize = Ring.CQRingSize = std::max(Ring.SQRingSize, Ring.CQRingSize);
+		}
+
+		Ring.SQRing = mmap(nullptr, Ring.SQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQ_RING);
+		Ring.CQRing = bSingleMap ? Ring.SQRing : mmap(nullptr, Ring.CQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_CQ_RING);
+		Ring.SQEsSize = Params.sq_entries * sizeof(struct io_uring_sqe);
+		void* SQEs = mmap(nullptr, Ring.SQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQES);
+		if (Ring.SQRing == MAP_FAILED || Ring.CQRing == MAP_FAILED || SQEs == MAP_FAILED)
+		{
+			Ring.SQRing = (Ring.SQRing == MAP_FAILED) ? nullptr : Ring.SQRing;
+			Ring.CQRing = (Ring.CQRing == MAP_FAILED) ? nullptr : Ring.CQRing;
+			Ring.SQEs = (SQEs == MAP_FAILED) ? nullptr : (struct io_uring_sqe*)SQEs;
+			ShutdownIOUring();
+			return false;
+		}
+		Ring.SQEs = (struct io_uring_sqe*)SQEs;
+
+		char* SQBase = (char*)Ring.SQRing;
+		Ring.SQHead = (uint32_t*)(SQBase + Params.sq_off.head);
+		Ring.SQTail = (uint32_t*)(SQBase + Params.sq_off.tail);
+		Ring.SQMask = (uint32_t*)(SQBase + Params.sq_off.ring_mask);
+		Ring.SQArray = (uint32_t*)(SQBase + Params.sq_off.array);
+
+		char* CQBase = (char*)Ring.CQRing;
+		Ring.CQHead = (uint32_t*)(CQBase + Params.cq_off.head);
+		Ring.CQTail = (uint32_t*)(CQBase + Params.cq_off.tail);
+		Ring.CQMask = (uint32_t*)(CQBase + Params.cq_off.ring_mask);
+		Ring.CQEs = (struct io_uring_cqe*)(CQBase + Params.cq_off.cqes);
+		return true;
+	}
+
+	void ShutdownIOUring()
+	{
+		if (Ring.SQEs != nullptr)
+		{
+			munmap(Ring.SQEs, Ring.SQEsSize);
+		}
+		if (Ring.CQRing != nullptr && Ring.CQRing != Ring.SQRing)
+		{
+			munmap(Ring.CQRing, Ring.CQRingSize);
+		}
+		if (Ring.SQRing != nullptr)
+		{
+			munmap(Ring.SQRing, Ring.SQRingSize);
+		}
+		if (Ring.Fd >= 0)
+		{
+			close(Ring.Fd);
+		}
+		Ring = IOUring();
+	}
+
+	// One IORING_OP_WRITEV per run of up to IOV_MAX segments, all submitted and waited on with one syscall
+	bool AppendWithIOUring(size_t NumIOVecs, uint64_t TotalLength)
+	{
+		struct OpInfo
+		{
+			size_t FirstIOVec;
+			size_t NumIOVecs;
+			uint64_t Offset;
+			uint64_t Length;
+		};
+		std::vector<OpInfo> Ops;
+
+		bool bSuccess = true;
+		size_t NextIOVec = 0;
+		uint64_t NextOffset = Offset;
+		while (NextIOVec < NumIOVecs)
+		{
+			// Fill the submission queue as far as it goes
+			Ops.clear();
+			uint32_t Tail = *Ring.SQTail;
+			while (NextIOVec < NumIOVecs && Ops.size() < Ring.NumEntries)
+			{
+				OpInfo Op;
+				Op.FirstIOVec = NextIOVec;
+				Op.NumIOVecs = std::min<size_t>(NumIOVecs - NextIOVec, IOV_MAX);
+				Op.Offset = NextOffset;
+				Op.Length = 0;
+				for (size_t i = 0; i < Op.NumIOVecs; i++)
+				{
+					Op.Length += IOVecs[Op.FirstIOVec + i].iov_len;
+				}
+
+				const uint32_t Index = Tail & *Ring.SQMask;
+				struct io_uring_sqe* SQE = &Ring.SQEs[Index];
+				memset(SQE, 0, sizeof(*SQE));
+				SQE->opcode = IORING_OP_WRITEV;
+				SQE->fd = Fd;
+				SQE->off = Op.Offset;
+				SQE->addr = (uint64_t)(uintptr_t)&IOVecs[Op.FirstIOVec];
+				SQE->len = (uint32_t)Op.NumIOVecs;
+				SQE->user_data = Ops.size();
+				Ring.SQArray[Index] = Index;
+				Tail++;
+
+				Ops.push_back(Op);
+				NextIOVec += Op.NumIOVecs;
+				NextOffset += Op.Length;
+			}
+			__atomic_store_n(Ring.SQTail, Tail, __ATOMIC_RELEASE);
+
+			const uint32_t NumOps = (uint32_t)Ops.size();
+			uint32_t NumSubmitted = 0;
+			while (NumSubmitted < NumOps)
+			{
+				const int Result = (int)syscall(__NR_io_uring_enter, Ring.Fd, NumOps - NumSubmitted, NumOps - NumSubmitted, IORING_ENTER_GETEVENTS, nullptr, 0);
+				if (Result < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					return false;
+				}
+				NumSubmitted += (uint32_t)Result;
+			}
+
+			// Reap every completion, short writes get finished off synchronously
+			uint32_t NumCompleted = 0;
+			while (NumCompleted < NumOps)
+			{
+				uint32_t Head = *Ring.CQHead;
+				const uint32_t CQTail = __atomic_load_n(Ring.CQTail, __ATOMIC_ACQUIRE);
+				if (Head == CQTail)
+				{
+					if (syscall(__NR_io_uring_enter, Ring.Fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+					{
+						return false;
+					}
+					continue;
+				}
+
+				for (; Head != CQTail; Head++)
+				{
+					const struct io_uring_cqe* CQE = &Ring.CQEs[Head & *Ring.CQMask];
+					const OpInfo& Op = Ops[(size_t)CQE->user_data];
+					if (CQE->res < 0)
+					{
+						bSuccess = false;
+					}
+					else if ((uint64_t)CQE->res < Op.Length)
+					{
+						bSuccess &= PwritevAll(Op.FirstIOVec, Op.NumIOVecs, Op.Offset, (uint64_t)CQE->res);
+					}
+					NumCompleted++;
+				}
+				__atomic_store_n(Ring.CQHead, Head, __ATOMIC_RELEASE);
+			}
+		}
+
+		Offset += TotalLength;
+		return bSuccess;
+	}
+#endif
+
+#if !defined(_WIN32)
+	// Writes IOVecs[First, First + Count) at AtOffset, skipping the first AlreadyWritten bytes,
+	// and keeps going through short writes
+	bool PwritevAll(size_t First, size_t Count, uint64_t AtOffset, uint64_t AlreadyWritten)
+	{
+		std::vector<struct iovec> Remaining(IOVecs.begin() + First, IOVecs.begin() + First + Count);
+		size_t Start = 0;
+		uint64_t Skip = AlreadyWritten;
+		AtOffset += AlreadyWritten;
+
+		while (Start < Remaining.size())
+		{
+			// Drop what's been written off the front
+			while (Start < Remaining.size() && Skip >= Remaining[Start].iov_len)
+			{
+				Skip -= Remaining[Start].iov_len;
+				Start++;
+			}
+			if (Start == Remaining.size())
+			{
+				break;
+			}
+			Remaining[Start].iov_base = (char*)Remaining[Start].iov_base + Skip;
+			Remaining[Start].iov_len -= Skip;
+
+			const int NumVecs = (int)std::min<size_t>(Remaining.size() - Start, IOV_MAX);
+			const ssize_t Written = pwritev(Fd, &Remaining[Start], NumVecs, (off_t)AtOffset);
+			if (Written < 0)
+			{
+				if (errno == EINTR)
+				{
+					Skip = 0;
+					continue;
+				}
+				return false;
+			}
+
+			Skip = (uint64_t)Written;
+			AtOffset += (uint64_t)Written;
+		}
+
+		return true;
+	}
+#endif
+
+	// Truncates the file
+	bool Open(const char* Path, bool bAllowIOUring = true)
+	{
+#if defined(_WIN32)
+		(void)bAllowIOUring;
+		File = fopen(Path, "wb");
+		return File != nullptr;
+#else
+		Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		Offset = 0;
+#if ASYNC_WRITER_HAS_IO_URING
+		if (Fd >= 0 && bAllowIOUring)
+		{
+			SetupIOUring(64);
+		}
+#else
+		(void)bAllowIOUring;
+#endif
+		return Fd >= 0;
+#endif
+	}
+
+	const char* GetBackendName() const
+	{
+#if defined(_WIN32)
+		return "fwrite";
+#elif ASYNC_WRITER_HAS_IO_URING
+		return (Ring.Fd >= 0) ? "io_uring" : "pwritev";
+#else
+		return "pwritev";
+#endif
+	}
+
+	bool Append(const WriteSegment* Segments, size_t NumSegments)
+	{
+#if defined(_WIN32)
+		bool bSuccess = (File != nullptr);
+		for (size_t i = 0; i < NumSegments && bSuccess; i++)
+		{
+			bSuccess = (fwrite(Segments[i].Data, 1, Segments[i].Length, File) == Segments[i].Length);
+		}
+		return bSuccess;
+#else
+		if (Fd < 0)
+		{
+			return false;
+		}
+
+		IOVecs.clear();
+		uint64_t TotalLength = 0;
+		for (size_t i = 0; i < NumSegments; i++)
+		{
+			if (Segments[i].Length > 0)
+			{
+				IOVecs.push_back(iovec{ (void*)Segments[i].Data, Segments[i].Length });
+				TotalLength += Segments[i].Length;
+			}
+		}
+
+#if ASYNC_WRITER_HAS_IO_URING
+		if (Ring.Fd >= 0)
+		{
+			return AppendWithIOUring(IOVecs.size(), TotalLength);
+		}
+#endif
+
+		const bool bSuccess = PwritevAll(0, IOVecs.size(), Offset, 0);
+		Offset += TotalLength;
+		return bSuccess;
+#endif
+	}
+
+	// Gets everything appended so far onto the disk, for callers that record elsewhere that it's there
+	bool Sync()
+	{
+#if defined(_WIN32)
+		return (File != nullptr) && (fflush(File) == 0) && (_commit(_fileno(File)) == 0);
+#elif defined(__APPLE__)
+		return (Fd >= 0) && (fsync(Fd) == 0);
+#else
+		return (Fd >= 0) && (fdatasync(Fd) == 0);
+#endif
+	}
+
+	bool Close()
+	{
+#if defined(_WIN32)
+		const bool bSuccess = (File == nullptr) || (fclose(File) == 0);
+		File = nullptr;
+		return bSuccess;
+#else
+#if ASYNC_WRITER_HAS_IO_URING
+		ShutdownIOUring();
+#endif
+		const bool bSuccess = (Fd < 0) || (close(Fd) == 0);
+		Fd = -1;
+		return bSuccess;
+#endif
+	}
+
+	~CoalescingFileWriter()
+	{
+		Close();
+	}
+};
@@ -0,0 +1,344 @@
+#pragma once
+
+// Checkpoint manifest for long batch runs, so one that gets killed can pick up where it left off
+// instead of starting over at the first seed.
+// Plain text, one record per line:
+//   batch_manifest 1
+//   generator <name> <version>
+//   config <the options that change the output, as one line>
+//   output <path of each seed's output, with the seed as a printf %llu, or of the one packed corpus>
+//   extra <path of another file written per seed, e.g. a sidecar, not hashed>   (optional, any number)
+//   range <first seed> <end seed> <hash>
+// with any number of (sorted, non-overlapping) ranges of finished seeds, end exclusive.
+// Each range's hash is 64-bit FNV-1a over every seed's output in order (see HashBatchOutput),
+// which is its own running state, so a range can keep growing across checkpoints and restarts.
+// Saving writes a temp file next to the manifest and renames it over the old one, so a kill
+// at any point leaves either the previous checkpoint or the new one, never half of each.
+// Relative paths are relative to the directory the manifest is in (tools write it in the working dir),
+// which is what gen_merge uses to find each shard's output.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define BATCH_MANIFEST_VERSION 1
+
+// "A..B", A inclusive and B exclusive
+inline bool ParseBatchSeedRange(const char* Str, uint64_t* OutFirst, uint64_t* OutEnd)
+{
+	unsigned long long First = 0, End = 0;
+	int NumChars = 0;
+	if (sscanf(Str, "%llu..%llu%n", &First, &End, &NumChars) != 2 || Str[NumChars] != '\0' || End < First)
+	{
+		return false;
+	}
+
+	*OutFirst = First;
+	*OutEnd = End;
+	return true;
+}
+
+// "i/N" with i in [0, N)
+inline bool ParseBatchShard(const char* Str, uint32_t* OutIndex, uint32_t* OutCount)
+{
+	unsigned int Index = 0, Count = 0;
+	int NumChars = 0;
+	if (sscanf(Str, "%u/%u%n", &Index, &Count, &NumChars) != 2 || Str[NumChars] != '\0' || Index >= Count)
+	{
+		return false;
+	}
+
+	*OutIndex = Index;
+	*OutCount = Count;
+	return true;
+}
+
+// Narrows [First, End) to shard Index of Count. Shards are contiguous and only depend on the range
+// and the shard count, so every machine works out the same split, and each shard's manifest is one range
+inline void ApplyBatchShard(uint32_t Index, uint32_t Count, uint64_t* InOutFirst, uint64_t* InOutEnd)
+{
+	const uint64_t First = *InOutFirst;
+	const uint64_t NumSeeds = *InOutEnd - First;
+
+	// Split as evenly as possible, the first NumSeeds % Count shards get one extra seed
+	const uint64_t PerShard = NumSeeds / Count;
+	const uint64_t Remainder = NumSeeds % Count;
+	*InOutFirst = First + Index * PerShard + std::min<uint64_t>(Index, Remainder);
+	*InOutEnd = *InOutFirst + PerShard + (Index < Remainder ? 1 : 0);
+}
+
+#define BATCH_MANIFEST_HASH_INIT 0xcbf29ce484222325ULL
+
+inline uint64_t HashBatchOutput(uint64_t Hash, uint64_t Seed, const char* Data, size_t Length)
+{
+	auto HashBytes = [&Hash](const void* Bytes, size_t NumBytes)
+	{
+		for (size_t i = 0; i < NumBytes; i++)
+		{
+			Hash ^= ((const uint8_t*)Bytes)[i];
+			Hash *= 0x100000001b3ULL;
+		}
+	};
+
+	// The seed and length go in too, so moving bytes between seeds changes the hash
+	const uint64_t Length64 = (uint64_t)Length;
+	HashBytes(&Seed, sizeof(Seed));
+	HashBytes(&Length64, sizeof(Length64));
+	HashBytes(Data, Length);
+	return Hash;
+}
+
+// Paths in a manifest are relative to its directory, these go from and to paths relative to the working dir
+inline std::string MakeManifestRelativePath(const char* ManifestPath, const std::string& Path)
+{
+	std::error_code Error;
+	const std::filesystem::path ManifestDir = std::filesystem::absolute(ManifestPath, Error).parent_path();
+	const std::filesystem::path Relative = std::filesystem::absolute(Path, Error).lexically_relative(ManifestDir);
+	return Relative.empty() ? Path : Relative.generic_string();
+}
+
+inline std::string ResolveManifestRelativePath(const char* ManifestPath, const std::string& Path)
+{
+	if (std::filesystem::path(Path).is_absolute())
+	{
+		return Path;
+	}
+	return (std::filesystem::path(ManifestPath).parent_path() / Path).generic_string();
+}
+
+struct BatchManifestRange
+{
+	uint64_t FirstSeed;
+	uint64_t EndSeed;
+	uint64_t Hash;
+};
+
+enum BatchManifestLoadResult
+{
+	BMLR_Ok,
+	BMLR_Missing,
+	BMLR_Bad
+};
+
+struct BatchManifest
+{
+	std::string Generator;
+	uint32_t GeneratorVersion = 0;
+	std::string Config;
+	std::string OutputPattern;
+	std::vector<std::string> ExtraPatterns;
+
+	// Sorted by FirstSeed, never overlapping
+	std::vector<BatchManifestRange> Ranges;
+
+	// Where AddSeed last extended, batches mostly finish seeds in order
+	size_t LastRangeIndex = 0;
+
+	BatchManifestLoadResult Load(const char* Path)
+	{
+		FILE* f = fopen(Path, "rb");
+		if (f == nullptr)
+		{
+			return BMLR_Missing;
+		}
+
+		Ranges.clear();
+		ExtraPatterns.clear();
+		LastRangeIndex = 0;
+
+		bool bValid = true;
+		bool bSawHeader = false;
+		char Line[4096];
+		while (bValid && fgets(Line, sizeof(Line), f) != nullptr)
+		{
+			size_t LineLength = strlen(Line);
+			while (LineLength > 0 && (Line[LineLength - 1] == '\n' || Line[LineLength - 1] == '\r'))
+			{
+				Line[--LineLength] = '\0';
+			}
+
+			char* Value = strchr(Line, ' ');
+			if (Value == nullptr)
+			{
+				bValid = (LineLength == 0);
+				continue;
+			}
+			*Value++ = '\0';
+
+			unsigned int Version = 0;
+			unsigned long long First = 0, End = 0, Hash = 0;
+			int NumChars = 0;
+			if (strcmp(Line, "batch_manifest") == 0)
+			{
+				bSawHeader = (sscanf(Value, "%u", &Version) == 1 && Version == BATCH_MANIFEST_VERSION);
+				bValid = bSawHeader;
+			}
+			else if (strcmp(Line, "generator") == 0)
+			{
+				char* VersionStr = strrchr(Value, ' ');
+				bValid = (VersionStr != nullptr && sscanf(VersionStr + 1, "%u", &Version) == 1);
+				if (bValid)
+				{
+					Generator.assign(Value, VersionStr - Value);
+					GeneratorVersion = Version;
+				}
+			}
+			else if (strcmp(Line, "config") == 0)
+			{
+				Config = Value;
+			}
+			else if (strcmp(Line, "output") == 0)
+			{
+				OutputPattern = Value;
+			}
+			else if (strcmp(Line, "extra") == 0)
+			{
+				ExtraPatterns.push_back(Value);
+			}
+			else if (strcmp(Line, "range") == 0)
+			{
+				bValid = (sscanf(Value, "%llu %llu %llx%n", &First, &End, &Hash, &NumChars) == 3 && Value[NumChars] == '\0' && First < End);
+				bValid = bValid && (Ranges.size() == 0 || Ranges.back().EndSeed <= First);
+				if (bValid)
+				{
+					Ranges.push_back(BatchManifestRange{ First, End, Hash });
+				}
+			}
+			else
+			{
+				bValid = false;
+			}
+		}
+
+		fclose(f);
+		return (bValid && bSawHeader) ? BMLR_Ok : BMLR_Bad;
+	}
+
+	bool Save(const char* Path) const
+	{
+		const std::string TempPath = std::string(Path) + ".tmp";
+		FILE* f = fopen(TempPath.c_str(), "wb");
+		if (f == nullptr)
+		{
+			return false;
+		}
+
+		bool bSuccess = fprintf(f, "batch_manifest %d\ngenerator %s %u\nconfig %s\noutput %s\n",
+			BATCH_MANIFEST_VERSION, Generator.c_str(), GeneratorVersion, Config.c_str(), OutputPattern.c_str()) > 0;
+		for (const auto& Pattern : ExtraPatterns)
+		{
+			bSuccess &= fprintf(f, "extra %s\n", Pattern.c_str()) > 0;
+		}
+		for (const auto& Range : Ranges)
+		{
+			bSuccess &= fprintf(f, "range %llu %llu %016llx\n", (unsigned long long)Range.FirstSeed, (unsigned long long)Range.EndSeed, (unsigned long long)Range.Hash) > 0;
+		}
+
+		// Has to be on disk before the rename, or a crash could leave the new name pointing at nothing
+		bSuccess &= (fflush(f) == 0);
+#if defined(_WIN32)
+		bSuccess &= (_commit(_fileno(f)) == 0);
+#else
+		bSuccess &= (fsync(fileno(f)) == 0);
+#endif
+		bSuccess &= (fclose(f) == 0);
+
+		if (bSuccess)
+		{
+#if defined(_WIN32)
+			bSuccess = (MoveFileExA(TempPath.c_str(), Path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0);
+#else
+			bSuccess = (rename(TempPath.c_str(), Path) == 0);
+#endif
+		}
+
+		return bSuccess;
+	}
+
+	// Resuming with a different generator or options would mix two corpora that don't match,
+	// OutReason gets what differs
+	bool IsCompatibleWith(const BatchManifest& Other, std::string* OutReason) const
+	{
+		if (Generator != Other.Generator || GeneratorVersion != Other.GeneratorVersion)
+		{
+			*OutReason = "generator is " + Other.Generator + " " + std::to_string(Other.GeneratorVersion) + ", manifest has " + Generator + " " + std::to_string(GeneratorVersion);
+		}
+		else if (Config != Other.Config)
+		{
+			*OutReason = "options are '" + Other.Config + "', manifest has '" + Config + "'";
+		}
+		else if (OutputPattern != Other.OutputPattern)
+		{
+			*OutReason = "output is " + Other.OutputPattern + ", manifest has " + OutputPattern;
+		}
+		else
+		{
+			return true;
+		}
+
+		return false;
+	}
+
+	bool ContainsSeed(uint64_t Seed) const
+	{
+		auto It = std::upper_bound(Ranges.begin(), Ranges.end(), Seed, [](uint64_t Value, const BatchManifestRange& Range)
+		{
+			return Value < Range.FirstSeed;
+		});
+		return It != Ranges.begin() && Seed < (It - 1)->EndSeed;
+	}
+
+	uint64_t CountSeeds() const
+	{
+		uint64_t Count = 0;
+		for (const auto& Range : Ranges)
+		{
+			Count += Range.EndSeed - Range.FirstSeed;
+		}
+		return Count;
+	}
+
+	// Records Seed as finished, with its output. Seed must not be in the manifest yet
+	void AddSeed(uint64_t Seed, const char* Data, size_t Length)
+	{
+		if (LastRangeIndex >= Ranges.size() || Ranges[LastRangeIndex].EndSeed != Seed)
+		{
+			auto It = std::upper_bound(Ranges.begin(), Ranges.end(), Seed, [](uint64_t Value, const BatchManifestRange& Range)
+			{
+				return Value < Range.FirstSeed;
+			});
+
+			// Right after an existing range, keep growing it. Ranges aren't merged when the gap
+			// between two closes, since their hashes can't be combined
+			if (It != Ranges.begin() && (It - 1)->EndSeed == Seed)
+			{
+				LastRangeIndex = (It - 1) - Ranges.begin();
+			}
+			else
+			{
+				LastRangeIndex = It - Ranges.begin();
+				Ranges.insert(It, BatchManifestRange{ Seed, Seed, BATCH_MANIFEST_HASH_INIT });
+			}
+		}
+
+		BatchManifestRange& Range = Ranges[LastRangeIndex];
+		Range.Hash = HashBatchOutput(Range.Hash, Seed, Data, Length);
+		Range.EndSeed = Seed + 1;
+	}
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+// What the tools that take shaders one at a time as they're generated (gen_harness, gen_reference) share:
+// the --seeds/--shard/--type/--corpus options, and BatchShaderSource, which hands out the shaders they pick,
+// straight from a context or regenerated from a seed corpus (with the options the corpus was made with).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include "gen_shader.h"
+#include "batch_manifest.h"
+#include "seed_corpus.h"
+
+// Writes all of Data to Path, false if any of it didn't make it
+inline bool WriteWholeFile(const std::string& Path, const std::string& Data)
+{
+	FILE* f = fopen(Path.c_str(), "wb");
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	bool bSuccess = (fwrite(Data.data(), 1, Data.size(), f) == Data.size());
+	bSuccess &= (fclose(f) == 0);
+	return bSuccess;
+}
+
+enum BatchSourceArgResult
+{
+	// Not one of BatchSourceArgs' options
+	BSAR_NotOurs,
+	BSAR_Taken,
+	// One of them, with a bad value (already reported on stderr)
+	BSAR_Bad,
+};
+
+struct BatchSourceArgs
+{
+	GenShaderOptions Options;
+	uint64_t FirstSeed = 0;
+	uint64_t EndSeed = 1024;
+	uint32_t ShardIndex = 0;
+	uint32_t ShardCount = 1;
+	bool bHasSeedRange = false;
+	const char* CorpusPath = nullptr;
+
+	BatchSourceArgs()
+	{
+		GenShader_InitOptions(&Options);
+	}
+
+	// Takes argv[*InOutIndex] (and its value, moving *InOutIndex past it) if it's --seeds, --shard, --type or --corpus.
+	// bAllowCompute says whether --type comp is allowed
+	BatchSourceArgResult ParseArg(int argc, char** argv, int* InOutIndex, bool bAllowCompute)
+	{
+		const int i = *InOutIndex;
+		if (i + 1 >= argc)
+		{
+			return BSAR_NotOurs;
+		}
+
+		const char* Value = argv[i + 1];
+		if (strcmp(argv[i], "--seeds") == 0)
+		{
+			if (!ParseBatchSeedRange(Value, &FirstSeed, &EndSeed))
+			{
+				fprintf(stderr, "Bad seed range '%s'\n", Value);
+				return BSAR_Bad;
+			}
+			bHasSeedRange = true;
+		}
+		else if (strcmp(argv[i], "--shard") == 0)
+		{
+			if (!ParseBatchShard(Value, &ShardIndex, &ShardCount))
+			{
+				fprintf(stderr, "Bad shard '%s'\n", Value);
+				return BSAR_Bad;
+			}
+		}
+		else if (strcmp(argv[i], "--type") == 0)
+		{
+			if (strcmp(Value, "vert") == 0)
+			{
+				Options.ShaderType = GENSHADER_TYPE_VERT;
+			}
+			else if (strcmp(Value, "frag") == 0)
+			{
+				Options.ShaderType = GENSHADER_TYPE_FRAG;
+			}
+			else if (strcmp(Value, "comp") == 0 && bAllowCompute)
+			{
+				Options.ShaderType = GENSHADER_TYPE_COMPUTE;
+			}
+			else
+			{
+				fprintf(stderr, "Bad shader type '%s'\n", Value);
+				return BSAR_Bad;
+			}
+		}
+		else if (strcmp(argv[i], "--corpus") == 0)
+		{
+			CorpusPath = Value;
+		}
+		else
+		{
+			return BSAR_NotOurs;
+		}
+
+		*InOutIndex = i + 1;
+		return BSAR_Taken;
+	}
+};
+
+// Not thread-safe, it has one context (its own or the corpus reader's)
+struct BatchShaderSource
+{
+	SeedCorpusReader Corpus;
+	GenShaderContext* Ctx = nullptr;
+	bool bFromCorpus = false;
+	uint64_t FirstSeed = 0;
+	uint64_t EndSeed = 0;
+	uint64_t NextSeed = 0;
+	size_t NextEntry = 0;
+
+	// Applies the shard. With a corpus, Args.Options.ShaderType becomes the corpus' and, without --seeds,
+	// every seed in it is taken. False (reported on stderr) if the corpus can't be read or the options are bad
+	bool Open(BatchSourceArgs* Args)
+	{
+		ApplyBatchShard(Args->ShardIndex, Args->ShardCount, &Args->FirstSeed, &Args->EndSeed);
+		bFromCorpus = (Args->CorpusPath != nullptr);
+		if (bFromCorpus)
+		{
+			std::string Error;
+			if (!Corpus.Open(Args->CorpusPath, 0, &Error))
+			{
+				fprintf(stderr, "Could not read seed corpus '%s': %s\n", Args->CorpusPath, Error.c_str());
+				return false;
+			}
+			Args->Options.ShaderType = (GenShaderType)Corpus.Header.Profile.ShaderType;
+			if (!Args->bHasSeedRange)
+			{
+				Args->FirstSeed = 0;
+				Args->EndSeed = UINT64_MAX;
+			}
+		}
+		else
+		{
+			Ctx = GenShader_CreateContext(&Args->Options);
+			if (Ctx == nullptr)
+			{
+				fprintf(stderr, "Bad options\n");
+				return false;
+			}
+		}
+
+		FirstSeed = Args->FirstSeed;
+		EndSeed = Args->EndSeed;
+		NextSeed = FirstSeed;
+		NextEntry = 0;
+		return true;
+	}
+
+	~BatchShaderSource()
+	{
+		GenShader_DestroyContext(Ctx);
+	}
+
+	// The context that made the last shader Next handed out, for e.g. GenShader_GetDialectSource on it
+	GenShaderContext* GetContext() const
+	{
+		return bFromCorpus ? Corpus.Ctx : Ctx;
+	}
+
+	// The next seed to do, false once there are none left. *bOutGenerated is false if its shader couldn't be
+	// generated, or doesn't match what the corpus recorded (reported on stderr), and *OutSource has it otherwise
+	bool Next(uint64_t* OutSeed, std::string* OutSource, bool* bOutGenerated)
+	{
+		if (bFromCorpus)
+		{
+			while (NextEntry < Corpus.GetNumEntries())
+			{
+				const size_t Index = NextEntry++;
+				const SeedCorpusEntry& Entry = Corpus.GetEntry(Index);
+				if (Entry.Seed < FirstSeed || Entry.Seed >= EndSeed)
+				{
+					continue;
+				}
+
+				// Without a cache, materializing always regenerates it, so the reader's context has it afterwards
+				const std::string* Source = nullptr;
+				const SeedCorpusMaterializeResult Result = Corpus.Materialize(Index, &Source);
+				if (Result == SCMR_Mismatch)
+				{
+					fprintf(stderr, "Seed %llu doesn't generate the shader the corpus recorded\n", (unsigned long long)Entry.Seed);
+				}
+				*OutSeed = Entry.Seed;
+				*bOutGenerated = (Result == SCMR_Ok);
+				if (*bOutGenerated)
+				{
+					*OutSource = *Source;
+				}
+				return true;
+			}
+			return false;
+		}
+
+		if (NextSeed >= EndSeed)
+		{
+			return false;
+		}
+
+		*OutSeed = NextSeed++;
+		const GenShaderResult Result = GenShader_GenerateToCallback(Ctx, *OutSeed, [](const char* Source, size_t Length, void* UserData)
+		{
+			((std::string*)UserData)->assign(Source, Length);
+		}, OutSource);
+		if (Result != GENSHADER_OK)
+		{
+			fprintf(stderr, "Seed %llu failed: %s\n", (unsigned long long)*OutSeed, GenShader_GetResultString(Result));
+		}
+		*bOutGenerated = (Result == GENSHADER_OK);
+		return true;
+	}
+};
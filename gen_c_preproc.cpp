@@ -8,6 +8,7 @@
 #include <stdarg.h>
 #include <stdint.h>
 
+#include <string.h>
 #include <assert.h>
 
 #include <random>
@@ -35,29 +36,223 @@ using uint64 = uint64_t;
 
 // Okay, actually scratch that for now we're doing a semantically correct generator for just
 // the proprocessor because I can't make up my mind
+// (The transform exists now too, see InsertNonChangingPreprocessorTransformations and --transform-*)
 
 #include <random>
 #include <vector>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <iterator>
+#include <string_view>
+#include <unordered_map>
+#include <filesystem>
 
-#include <Windows.h>
+#include "packed_corpus.h"
+#include "preproc_reference.h"
+#include "batch_manifest.h"
 
-#define MAX_SOURCE_FILE_SIZE (128*1024)
+// Bump whenever the same seed and options can give a different program than before (see batch_manifest.h)
+#define PREPROC_GENERATOR_VERSION 1
+
+// Big enough for stress programs with tens of thousands of macros, it's allocated once per thread
+#define MAX_SOURCE_FILE_SIZE (16*1024*1024)
 
 using SourceBuffer = StringStackBuffer<MAX_SOURCE_FILE_SIZE>;
-using IdentiferBuffer = StringStackBuffer<8>;
+using IdentiferBuffer = StringStackBuffer<16>;
+
+enum PreprocSymbolKind {
+	// Generated at some point (e.g. a macro param, or a name that was #undef'd), but not currently defined
+	PSK_Unbound,
+	// Object-like, i.e. "#define FOO ..."
+	PSK_Define,
+	// Function-like, i.e. "#define FOO(x, y) ..."
+	PSK_Macro,
+	// Never handed out as a fresh name, since it would change the meaning of the program
+	PSK_Reserved
+};
+
+struct PreprocSymbol {
+	IdentiferBuffer Name;
+	uint32 Hash = 0;
+	PreprocSymbolKind Kind = PSK_Unbound;
+	int32 Arity = 0;
+	// Position in LiveDefines/LiveMacros (whichever Kind says), so #undef can swap-remove in O(1)
+	int32 LiveIndex = -1;
+};
+
+// Every identifier the generator has produced, with a hash index on the name.
+// Lookups, fresh-name generation, defining and undefining are all O(1),
+// so programs with tens of thousands of macros are generated in linear time.
+struct PreprocSymbolTable {
+	std::vector<PreprocSymbol> Symbols;
+	// Open addressing, power of two size, -1 for empty
+	std::vector<int32> HashSlots;
+
+	std::vector<int32> LiveDefines;
+	std::vector<int32> LiveMacros;
+
+	static uint32 HashName(const char* Name) {
+		// FNV-1a
+		uint32 Hash = 2166136261U;
+		for (const char* C = Name; *C != '\0'; C++) {
+			Hash = (Hash ^ (uint8_t)*C) * 16777619U;
+		}
+		return Hash;
+	}
+
+	int32 Find(const char* Name, uint32 Hash) const {
+		if (HashSlots.size() == 0) {
+			return -1;
+		}
+
+		const uint32 Mask = (uint32)HashSlots.size() - 1;
+		for (uint32 Slot = Hash & Mask; ; Slot = (Slot + 1) & Mask) {
+			const int32 Index = HashSlots[Slot];
+			if (Index < 0) {
+				return -1;
+			}
+			if (Symbols[Index].Hash == Hash && strcmp(Symbols[Index].Name.buffer, Name) == 0) {
+				return Index;
+			}
+		}
+	}
+
+	int32 Find(const char* Name) const {
+		return Find(Name, HashName(Name));
+	}
+
+	// Name must not already be in the table
+	int32 Add(const IdentiferBuffer& Name, uint32 Hash, PreprocSymbolKind Kind = PSK_Unbound) {
+		// Keep the load factor under 1/2
+		if ((Symbols.size() + 1) * 2 > HashSlots.size()) {
+			Rehash(std::max<size_t>(64, HashSlots.size() * 2));
+		}
+
+		const int32 Index = (int32)Symbols.size();
+		Symbols.emplace_back();
+		Symbols.back().Name = Name;
+		Symbols.back().Hash = Hash;
+		Symbols.back().Kind = Kind;
+
+		InsertIntoSlots(Index);
+		return Index;
+	}
+
+	void Bind(int32 Index, PreprocSymbolKind Kind, int32 Arity) {
+		PreprocSymbol& Symbol = Symbols[Index];
+		assert(Symbol.Kind == PSK_Unbound);
+		assert(Kind == PSK_Define || Kind == PSK_Macro);
+
+		std::vector<int32>& LiveList = (Kind == PSK_Define) ? LiveDefines : LiveMacros;
+		Symbol.Kind = Kind;
+		Symbol.Arity = Arity;
+		Symbol.LiveIndex = (int32)LiveList.size();
+		LiveList.push_back(Index);
+	}
+
+	void Unbind(int32 Index) {
+		PreprocSymbol& Symbol = Symbols[Index];
+		assert(Symbol.Kind == PSK_Define || Symbol.Kind == PSK_Macro);
+
+		std::vector<int32>& LiveList = (Symbol.Kind == PSK_Define) ? LiveDefines : LiveMacros;
+		const int32 MovedIndex = LiveList.back();
+		LiveList[Symbol.LiveIndex] = MovedIndex;
+		Symbols[MovedIndex].LiveIndex = Symbol.LiveIndex;
+		LiveList.pop_back();
+
+		Symbol.Kind = PSK_Unbound;
+		Symbol.LiveIndex = -1;
+	}
+
+	bool IsLive(int32 Index) const {
+		return Symbols[Index].Kind == PSK_Define || Symbols[Index].Kind == PSK_Macro;
+	}
+
+	// Keeps the allocations around for the next program
+	void Clear() {
+		Symbols.clear();
+		std::fill(HashSlots.begin(), HashSlots.end(), -1);
+		LiveDefines.clear();
+		LiveMacros.clear();
+	}
+
+	void InsertIntoSlots(int32 Index) {
+		const uint32 Mask = (uint32)HashSlots.size() - 1;
+		uint32 Slot = Symbols[Index].Hash & Mask;
+		while (HashSlots[Slot] >= 0) {
+			Slot = (Slot + 1) & Mask;
+		}
+		HashSlots[Slot] = Index;
+	}
+
+	void Rehash(size_t NewNumSlots) {
+		HashSlots.assign(NewNumSlots, -1);
+		for (int32 Index = 0; Index < (int32)Symbols.size(); Index++) {
+			InsertIntoSlots(Index);
+		}
+	}
+};
+
+// Shapes for the macro expansion stress mode (see GenerateMacroExpansionStressSource)
+enum struct PreprocStressShape {
+	// Regular random programs
+	None,
+	// Each macro calls the previous one once: expansion is linear in depth
+	Chain,
+	// A chain, plus the final expr calls every macro in it: quadratic in depth
+	Quadratic,
+	// Each macro calls the previous one Fanout times: exponential in depth
+	Tree
+};
+
+struct PreprocGenConfig {
+	// 0 means pick randomly per program
+	int32 NumLines = 0;
+
+	// "defined" inside a macro body is undefined behaviour once it's expanded in an #if,
+	// so turning this off keeps the expected results from PreprocReference fully portable
+	bool bAllowDefinedInMacros = true;
+
+	PreprocStressShape StressShape = PreprocStressShape::None;
+	int32 StressDepth = 8;
+	int32 StressFanout = 2;
+	// Depth gets cut short rather than predicting more than this many tokens from expanding the final expr
+	uint64 StressMaxExpandedTokens = 1ULL << 24;
+};
 
 struct PreprocGenCtx {
 	SourceBuffer* OutSource = nullptr;
 
+	PreprocGenConfig Config;
+
 	std::mt19937_64 RNGState{ 0 };
 
-	std::vector<IdentiferBuffer> Defines;
-	std::vector<std::pair<IdentiferBuffer, int32>> Macros;
+	PreprocSymbolTable Symbols;
 	std::vector<IdentiferBuffer> MacroParamsInScope;
+	bool bGeneratingMacroBody = false;
 
 	int32 IfDepth = 0;
 
+	// Optional, gets told about every directive to work out the expected results
+	PreprocReference* Reference = nullptr;
+
+	// Physical line numbers (1-based) for the reference results,
+	// counted incrementally since programs only ever get appended to
+	int32 LineCountedOffset = 0;
+	int32 LineAtCountedOffset = 1;
+
+	int32 GetCurrentLine() {
+		for (; LineCountedOffset < OutSource->length; LineCountedOffset++) {
+			if (OutSource->buffer[LineCountedOffset] == '\n') {
+				LineAtCountedOffset++;
+			}
+		}
+		return LineAtCountedOffset;
+	}
+
 	int32 GetIntInRange(int32 Min, int32 Max) {
 		std::uniform_int_distribution<int32> Dist(Min, Max);
 		return Dist(RNGState);
@@ -66,11 +261,23 @@ struct PreprocGenCtx {
 	void ResetState() {
 		OutSource->Clear();
 
-		Defines.clear();
-		Macros.clear();
+		Symbols.Clear();
 		MacroParamsInScope.clear();
 
+		static const char* const ReservedNames[] = { "defined", "true", "false" };
+		for (const char* Name : ReservedNames) {
+			Symbols.Add(IdentiferBuffer("%s", Name), PreprocSymbolTable::HashName(Name), PSK_Reserved);
+		}
+
 		IfDepth = 0;
+		bGeneratingMacroBody = false;
+
+		LineCountedOffset = 0;
+		LineAtCountedOffset = 1;
+
+		if (Reference != nullptr) {
+			Reference->Reset();
+		}
 	}
 };
 
@@ -87,18 +294,42 @@ IdentiferBuffer GeneratePreProcessorIdentifier(PreprocGenCtx* Ctx) {
 	return Buff;
 }
 
+// Like GeneratePreProcessorIdentifier, but the name has never been used before in this program
+// Returns its (unbound) index in the symbol table
+int32 GenerateFreshPreProcessorIdentifier(PreprocGenCtx* Ctx) {
+	IdentiferBuffer Buff = GeneratePreProcessorIdentifier(Ctx);
+	uint32 Hash = PreprocSymbolTable::HashName(Buff.buffer);
+
+	// Keep extending it until it's unique. Short names run out fast in big programs,
+	// but each extra letter gives 26x the space so this stays short
+	while (Ctx->Symbols.Find(Buff.buffer, Hash) >= 0) {
+		if (Buff.length >= (int32)sizeof(Buff.buffer) - 1) {
+			Buff = GeneratePreProcessorIdentifier(Ctx);
+		}
+		else {
+			Buff.buffer[Buff.length] = 'a' + Ctx->GetIntInRange(0, 25);
+			Buff.length++;
+			Buff.buffer[Buff.length] = '\0';
+		}
+		Hash = PreprocSymbolTable::HashName(Buff.buffer);
+	}
+
+	return Ctx->Symbols.Add(Buff, Hash);
+}
+
 bool GetRandomIdentifierInScope(PreprocGenCtx* Ctx, IdentiferBuffer* OutIdent) {
+	const auto& Symbols = Ctx->Symbols;
 	int32 Decider = Ctx->GetIntInRange(0, 2);
 	if (Ctx->MacroParamsInScope.size() > 0 && Decider <= 0) {
-		*OutIdent = Ctx->MacroParamsInScope[Ctx->GetIntInRange(0, Ctx->MacroParamsInScope.size() - 1)].buffer;
+		*OutIdent = Ctx->MacroParamsInScope[Ctx->GetIntInRange(0, Ctx->MacroParamsInScope.size() - 1)];
 		return true;
 	}
-	else if (Ctx->Macros.size() > 0 && Decider <= 1) {
-		*OutIdent = Ctx->Macros[Ctx->GetIntInRange(0, Ctx->Macros.size() - 1)].first.buffer;
+	else if (Symbols.LiveMacros.size() > 0 && Decider <= 1) {
+		*OutIdent = Symbols.Symbols[Symbols.LiveMacros[Ctx->GetIntInRange(0, Symbols.LiveMacros.size() - 1)]].Name;
 		return true;
 	}
-	else if (Ctx->Defines.size() > 0 && Decider <= 2) {
-		*OutIdent = Ctx->Defines[Ctx->GetIntInRange(0, Ctx->Defines.size() - 1)].buffer;
+	else if (Symbols.LiveDefines.size() > 0 && Decider <= 2) {
+		*OutIdent = Symbols.Symbols[Symbols.LiveDefines[Ctx->GetIntInRange(0, Symbols.LiveDefines.size() - 1)]].Name;
 		return true;
 	}
 	else {
@@ -124,11 +355,13 @@ void GeneratePreProcessorExpr_Internal(PreprocGenCtx* Ctx, int RecursionDepth) {
 	if (RecursionDepth <= 4) {
 		int32 Decider = Ctx->GetIntInRange(0, 100);
 		
-		if (Ctx->Macros.size() > 0 && Decider <= 30) {
-			int32 MacroIndex = Ctx->GetIntInRange(0, Ctx->Macros.size() - 1);
-			auto MacroInfo = Ctx->Macros[MacroIndex];
-			Ctx->OutSource->AppendFormat("%s(", MacroInfo.first.buffer);
-			for (int32 ParamIndex = 0; ParamIndex < MacroInfo.second; ParamIndex++) {
+		const auto& LiveMacros = Ctx->Symbols.LiveMacros;
+		if (LiveMacros.size() > 0 && Decider <= 30) {
+			int32 MacroIndex = LiveMacros[Ctx->GetIntInRange(0, LiveMacros.size() - 1)];
+			const IdentiferBuffer MacroName = Ctx->Symbols.Symbols[MacroIndex].Name;
+			const int32 MacroArity = Ctx->Symbols.Symbols[MacroIndex].Arity;
+			Ctx->OutSource->AppendFormat("%s(", MacroName.buffer);
+			for (int32 ParamIndex = 0; ParamIndex < MacroArity; ParamIndex++) {
 				if (ParamIndex > 0) {
 					Ctx->OutSource->Append(", ");
 				}
@@ -171,7 +404,7 @@ void GeneratePreProcessorExpr_Internal(PreprocGenCtx* Ctx, int RecursionDepth) {
 		if (Decider < 60 && GetRandomIdentifierInScope(Ctx, &RandomIdentifier)) {
 			Ctx->OutSource->Append(RandomIdentifier.buffer);
 		}
-		else if (Decider < 70) {
+		else if (Decider < 70 && (Ctx->Config.bAllowDefinedInMacros || !Ctx->bGeneratingMacroBody)) {
 			if (Ctx->GetIntInRange(0, 3) != 0 && GetRandomIdentifierInScope(Ctx, &RandomIdentifier)) {
 				Ctx->OutSource->AppendFormat("defined(%s)", RandomIdentifier.buffer);
 			}
@@ -194,7 +427,6 @@ void GeneratePreProcessorExpr_Internal(PreprocGenCtx* Ctx, int RecursionDepth) {
 	//Ctx->OutSource->Append("<expr>");
 }
 
-// TODO: Flags, e.g. whether define(<ident>) is allowed (
 void GeneratePreProcessorExpr(PreprocGenCtx* Ctx) {
 	return GeneratePreProcessorExpr_Internal(Ctx, 0);
 }
@@ -207,7 +439,7 @@ void GeneratePreProcessorSource(PreprocGenCtx* Ctx) {
 	// __VERSION__
 	// __LINE__
 
-	int32 NumLines = Ctx->GetIntInRange(3, 30);
+	int32 NumLines = (Ctx->Config.NumLines > 0) ? Ctx->Config.NumLines : Ctx->GetIntInRange(3, 30);
 
 	for (int32 Line = 0; Line < NumLines; Line++)
 	{
@@ -215,40 +447,67 @@ void GeneratePreProcessorSource(PreprocGenCtx* Ctx) {
 
 		// #define
 		if (Decider < 30) {
-			auto Ident = GeneratePreProcessorIdentifier(Ctx);
-			Ctx->OutSource->AppendFormat("#define %s ", Ident.buffer);
+			int32 SymbolIndex = GenerateFreshPreProcessorIdentifier(Ctx);
+			const char* Name = Ctx->Symbols.Symbols[SymbolIndex].Name.buffer;
+			Ctx->OutSource->AppendFormat("#define %s ", Name);
+
+			const int32 BodyStart = Ctx->OutSource->length;
+			Ctx->bGeneratingMacroBody = true;
 			GeneratePreProcessorExpr(Ctx);
+			Ctx->bGeneratingMacroBody = false;
+
+			if (Ctx->Reference != nullptr) {
+				Ctx->Reference->OnDefine(Name, false, nullptr, 0, &Ctx->OutSource->buffer[BodyStart], Ctx->OutSource->length - BodyStart);
+			}
 			Ctx->OutSource->Append("\n");
 
-			Ctx->Defines.push_back(Ident);
+			Ctx->Symbols.Bind(SymbolIndex, PSK_Define, 0);
 		}
 		// #define ()
 		else if (Decider < 70) {
 			int32 Arity = Ctx->GetIntInRange(0, 5);
 
-			auto MacroName = GeneratePreProcessorIdentifier(Ctx);
-			Ctx->OutSource->AppendFormat("#define %s(", MacroName.buffer);
+			int32 SymbolIndex = GenerateFreshPreProcessorIdentifier(Ctx);
+			Ctx->OutSource->AppendFormat("#define %s(", Ctx->Symbols.Symbols[SymbolIndex].Name.buffer);
 			for (int32 i = 0; i < Arity; i++) {
 				if (i > 0) {
 					Ctx->OutSource->Append(", ");
 				}
-				auto ParamName = GeneratePreProcessorIdentifier(Ctx);
+				// Fresh so that params never clash with each other
+				auto ParamName = Ctx->Symbols.Symbols[GenerateFreshPreProcessorIdentifier(Ctx)].Name;
 				Ctx->OutSource->Append(ParamName.buffer);
 				Ctx->MacroParamsInScope.push_back(ParamName);
 			}
 			Ctx->OutSource->Append(") ");
 
+			const int32 BodyStart = Ctx->OutSource->length;
+			Ctx->bGeneratingMacroBody = true;
 			GeneratePreProcessorExpr(Ctx);
+			Ctx->bGeneratingMacroBody = false;
+
+			if (Ctx->Reference != nullptr) {
+				const char* ParamNames[8];
+				for (int32 i = 0; i < Arity; i++) {
+					ParamNames[i] = Ctx->MacroParamsInScope[i].buffer;
+				}
+				Ctx->Reference->OnDefine(Ctx->Symbols.Symbols[SymbolIndex].Name.buffer, true, ParamNames, Arity,
+					&Ctx->OutSource->buffer[BodyStart], Ctx->OutSource->length - BodyStart);
+			}
 
 			Ctx->OutSource->Append("\n");
-			Ctx->Macros.emplace_back(MacroName, Arity);
+			Ctx->Symbols.Bind(SymbolIndex, PSK_Macro, Arity);
 
 			Ctx->MacroParamsInScope.clear();
 		}
 		// #if
 		else if (Decider < 75) {
 			Ctx->OutSource->Append("#if ");
+			const int32 ExprStart = Ctx->OutSource->length;
 			GeneratePreProcessorExpr(Ctx);
+
+			if (Ctx->Reference != nullptr) {
+				Ctx->Reference->OnIf(Ctx->GetCurrentLine(), &Ctx->OutSource->buffer[ExprStart], Ctx->OutSource->length - ExprStart);
+			}
 			Ctx->OutSource->Append("\n");
 
 			// TODO: Scope the macros defined w/in an #if/#endif block?
@@ -259,31 +518,54 @@ void GeneratePreProcessorSource(PreprocGenCtx* Ctx) {
 		else if (Ctx->IfDepth > 0 && Decider < 80) {
 			Ctx->OutSource->Append("#endif\n");
 			Ctx->IfDepth--;
+
+			if (Ctx->Reference != nullptr) {
+				Ctx->Reference->OnEndif();
+			}
 		}
 		// #line
 		else if (Decider < 90) {
-			if (Ctx->GetIntInRange(0, 3) == 0) {
-				Ctx->OutSource->AppendFormat("#line %d %d\n", Ctx->GetIntInRange(-1, 30), Ctx->GetIntInRange(-1, 5));
+			const bool bHasSecondArg = (Ctx->GetIntInRange(0, 3) == 0);
+			const int32 LineNumber = Ctx->GetIntInRange(-1, 30);
+			if (Ctx->Reference != nullptr) {
+				Ctx->Reference->OnLine(Ctx->GetCurrentLine(), LineNumber, bHasSecondArg);
+			}
+
+			if (bHasSecondArg) {
+				Ctx->OutSource->AppendFormat("#line %d %d\n", LineNumber, Ctx->GetIntInRange(-1, 5));
 			}
 			else {
-				Ctx->OutSource->AppendFormat("#line %d\n", Ctx->GetIntInRange(-1, 30));
+				Ctx->OutSource->AppendFormat("#line %d\n", LineNumber);
 			}
 		}
 		// #undef
 		else if (Decider <= 100) {
 			int32 UndefDecider = Ctx->GetIntInRange(0, 2);
-			if (Ctx->Defines.size() > 0 && UndefDecider == 0) {
-				int32 IndexToErase = Ctx->GetIntInRange(0, Ctx->Defines.size() - 1);
-				Ctx->OutSource->AppendFormat("#undef %s\n", Ctx->Defines[IndexToErase].buffer);
-				Ctx->Defines.erase(Ctx->Defines.begin() + IndexToErase);
+			const auto& LiveDefines = Ctx->Symbols.LiveDefines;
+			const auto& LiveMacros = Ctx->Symbols.LiveMacros;
+			IdentiferBuffer UndefName;
+			if (LiveDefines.size() > 0 && UndefDecider == 0) {
+				int32 IndexToErase = LiveDefines[Ctx->GetIntInRange(0, LiveDefines.size() - 1)];
+				UndefName = Ctx->Symbols.Symbols[IndexToErase].Name;
+				Ctx->Symbols.Unbind(IndexToErase);
 			}
-			else if (Ctx->Macros.size() > 0 && UndefDecider == 1) {
-				int32 IndexToErase = Ctx->GetIntInRange(0, Ctx->Macros.size() - 1);
-				Ctx->OutSource->AppendFormat("#undef %s\n", Ctx->Macros[IndexToErase].first.buffer);
-				Ctx->Macros.erase(Ctx->Macros.begin() + IndexToErase);
+			else if (LiveMacros.size() > 0 && UndefDecider == 1) {
+				int32 IndexToErase = LiveMacros[Ctx->GetIntInRange(0, LiveMacros.size() - 1)];
+				UndefName = Ctx->Symbols.Symbols[IndexToErase].Name;
+				Ctx->Symbols.Unbind(IndexToErase);
 			}
 			else {
-				Ctx->OutSource->AppendFormat("#undef %s\n", GeneratePreProcessorIdentifier(Ctx).buffer);
+				// Usually nothing, but short random names do hit live ones, which have to stop being used
+				UndefName = GeneratePreProcessorIdentifier(Ctx);
+				const int32 UndefIndex = Ctx->Symbols.Find(UndefName.buffer);
+				if (UndefIndex >= 0 && Ctx->Symbols.IsLive(UndefIndex)) {
+					Ctx->Symbols.Unbind(UndefIndex);
+				}
+			}
+
+			Ctx->OutSource->AppendFormat("#undef %s\n", UndefName.buffer);
+			if (Ctx->Reference != nullptr) {
+				Ctx->Reference->OnUndef(UndefName.buffer);
 			}
 		}
 		else {
@@ -296,40 +578,1207 @@ void GeneratePreProcessorSource(PreprocGenCtx* Ctx) {
 	while (Ctx->IfDepth > 0) {
 		Ctx->OutSource->Append("#endif\n");
 		Ctx->IfDepth--;
+
+		if (Ctx->Reference != nullptr) {
+			Ctx->Reference->OnEndif();
+		}
 	}
 
 
 	// Add in an expr
+	const int32 ExprStart = Ctx->OutSource->length;
 	GeneratePreProcessorExpr(Ctx);
+
+	if (Ctx->Reference != nullptr) {
+		Ctx->Reference->OnFinalExpr(Ctx->GetCurrentLine(), &Ctx->OutSource->buffer[ExprStart], Ctx->OutSource->length - ExprStart);
+	}
 }
 
-//void InsertNonChangingPreprocessorTransformations(const SourceBuffer* InSrc, SourceBuffer* OutSrc, uint64 Seed)
-//{
-//}
+// Transforms for InsertNonChangingPreprocessorTransformations, as percentages per token/line
+struct PreprocTransformConfig {
+	int32 NumVariants = 4;
 
-int main()
-{
-	OutputDebugStringA("sdf");
+	// Per identifier/number: wrap it in an identity macro call
+	int32 IdentityPercent = 10;
+	// Per identifier: replace it with an object-like macro defined as it
+	int32 AliasPercent = 5;
+	// Per identifier: rebuild it out of two halves with ##
+	int32 PastePercent = 5;
+	// GLSL before 3.00 ES/4.x doesn't define ##, so it can be turned off
+	bool bAllowTokenPasting = true;
+
+	// Per line: open an always-taken #if group (closed on some later line)
+	int32 IfWrapPercent = 10;
+	// Per line: emit a #line that puts the line numbers back to what they were in the input
+	int32 LinePercent = 3;
+};
+
+// A token of the input, pointing into it. We only split things as finely as the transforms need
+enum struct SourceTokenKind {
+	Identifier,
+	Number,
+	// Whitespace, comments, line continuations
+	Whitespace,
+	Newline,
+	// A whole directive line, including its newline
+	Directive,
+	// Punctuation, string/char literals, anything else
+	Other,
+	End
+};
+
+struct SourceToken {
+	SourceTokenKind Kind = SourceTokenKind::End;
+	const char* Start = nullptr;
+	int32 Length = 0;
+};
+
+struct SourceTokenizer {
+	const char* Cur = nullptr;
+	const char* End = nullptr;
+	bool bAtLineStart = true;
+
+	static bool IsIdentStart(char c) {
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+	}
+
+	static bool IsIdentChar(char c) {
+		return IsIdentStart(c) || (c >= '0' && c <= '9');
+	}
+
+	bool IsLineContinuation(const char* At) const {
+		return At[0] == '\\' && ((At + 1 < End && At[1] == '\n') || (At + 2 < End && At[1] == '\r' && At[2] == '\n'));
+	}
+
+	// Skips a /* */ comment starting at At, returns where it ends
+	const char* SkipBlockComment(const char* At) const {
+		At += 2;
+		while (At + 1 < End && !(At[0] == '*' && At[1] == '/')) {
+			At++;
+		}
+		return std::min(At + 2, End);
+	}
+
+	SourceToken Next() {
+		SourceToken Token;
+		Token.Start = Cur;
+
+		if (Cur >= End) {
+			Token.Kind = SourceTokenKind::End;
+			return Token;
+		}
+
+		if (bAtLineStart) {
+			// Directives can have whitespace before the #, so look past it
+			const char* Hash = Cur;
+			while (Hash < End && (*Hash == ' ' || *Hash == '\t')) {
+				Hash++;
+			}
+
+			if (Hash < End && *Hash == '#') {
+				const char* At = Hash + 1;
+				while (At < End && *At != '\n') {
+					if (IsLineContinuation(At)) {
+						At += (At[1] == '\r') ? 3 : 2;
+					}
+					else if (At + 1 < End && At[0] == '/' && At[1] == '*') {
+						At = SkipBlockComment(At);
+					}
+					else {
+						At++;
+					}
+				}
+				if (At < End) {
+					At++;
+				}
+
+				Cur = At;
+				Token.Kind = SourceTokenKind::Directive;
+				Token.Length = (int32)(Cur - Token.Start);
+				return Token;
+			}
+		}
+
+		const char c = *Cur;
+		if (c == '\n') {
+			Cur++;
+			bAtLineStart = true;
+			Token.Kind = SourceTokenKind::Newline;
+		}
+		else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v' || IsLineContinuation(Cur)
+			|| (c == '/' && Cur + 1 < End && (Cur[1] == '/' || Cur[1] == '*'))) {
+			// Only whitespace keeps us at the start of a line, a comment there is close enough
+			while (Cur < End) {
+				if (*Cur == ' ' || *Cur == '\t' || *Cur == '\r' || *Cur == '\f' || *Cur == '\v') {
+					Cur++;
+				}
+				else if (IsLineContinuation(Cur)) {
+					Cur += (Cur[1] == '\r') ? 3 : 2;
+				}
+				else if (*Cur == '/' && Cur + 1 < End && Cur[1] == '/') {
+					while (Cur < End && *Cur != '\n') {
+						Cur++;
+					}
+				}
+				else if (*Cur == '/' && Cur + 1 < End && Cur[1] == '*') {
+					Cur = SkipBlockComment(Cur);
+				}
+				else {
+					break;
+				}
+			}
+			Token.Kind = SourceTokenKind::Whitespace;
+		}
+		else if (IsIdentStart(c)) {
+			while (Cur < End && IsIdentChar(*Cur)) {
+				Cur++;
+			}
+			bAtLineStart = false;
+			Token.Kind = SourceTokenKind::Identifier;
+		}
+		else if ((c >= '0' && c <= '9') || (c == '.' && Cur + 1 < End && Cur[1] >= '0' && Cur[1] <= '9')) {
+			// pp-number: digits, letters, _, ., and signs right after an exponent
+			Cur++;
+			while (Cur < End) {
+				if ((*Cur == '+' || *Cur == '-') && (Cur[-1] == 'e' || Cur[-1] == 'E' || Cur[-1] == 'p' || Cur[-1] == 'P')) {
+					Cur++;
+				}
+				else if (IsIdentChar(*Cur) || *Cur == '.') {
+					Cur++;
+				}
+				else {
+					break;
+				}
+			}
+			bAtLineStart = false;
+			Token.Kind = SourceTokenKind::Number;
+		}
+		else if (c == '"' || c == '\'') {
+			Cur++;
+			while (Cur < End && *Cur != c && *Cur != '\n') {
+				Cur += (*Cur == '\\' && Cur + 1 < End) ? 2 : 1;
+			}
+			Cur = std::min(Cur + 1, End);
+			bAtLineStart = false;
+			Token.Kind = SourceTokenKind::Other;
+		}
+		else {
+			Cur++;
+			bAtLineStart = false;
+			Token.Kind = SourceTokenKind::Other;
+		}
+
+		Token.Length = (int32)(Cur - Token.Start);
+		return Token;
+	}
+};
+
+// One output of InsertNonChangingPreprocessorTransformations, with its own RNG and macros.
+// Everything it adds is named PPT_<kind>_<n>, so inputs shouldn't use that prefix
+struct PreprocTransformVariant {
+	const PreprocTransformConfig* Config = nullptr;
+
+	std::mt19937_64 RNGState{ 0 };
+
+	std::string Out;
+	// The current line, and directives that have to come before it
+	std::string Line;
+	std::string Pending;
+
+	// Macros we've defined, with the input's #if depth they were defined at:
+	// anything defined inside an input #if group is forgotten when the group ends,
+	// since it might not have been taken
+	struct DefinedMacro {
+		int32 Index;
+		int32 InputIfDepth;
+	};
+	std::unordered_map<std::string_view, DefinedMacro> Aliases;
+	std::vector<DefinedMacro> IdentityMacros;
+	std::vector<DefinedMacro> PasteMacros;
+	int32 NextMacroIndex = 0;
+
+	// Input #if depth each of our open #if groups was opened at
+	std::vector<int32> OpenWrappers;
+
+	// Nothing gets inserted until the first non-directive token, so #version/#extension stay first
+	bool bSeenCode = false;
+
+	int32 GetIntInRange(int32 Min, int32 Max) {
+		std::uniform_int_distribution<int32> Dist(Min, Max);
+		return Dist(RNGState);
+	}
+
+	bool RollPercent(int32 Percent) {
+		return Percent > 0 && GetIntInRange(0, 99) < Percent;
+	}
+
+	void Reset(uint64 Seed) {
+		RNGState.seed(Seed);
+		Out.clear();
+		Line.clear();
+		Pending.clear();
+		Aliases.clear();
+		IdentityMacros.clear();
+		PasteMacros.clear();
+		NextMacroIndex = 0;
+		OpenWrappers.clear();
+		bSeenCode = false;
+	}
+
+	void AppendFormat(std::string* Str, const char* Format, ...) {
+		char Buffer[256];
+		va_list Args;
+		va_start(Args, Format);
+		vsnprintf(Buffer, sizeof(Buffer), Format, Args);
+		va_end(Args);
+		Str->append(Buffer);
+	}
+
+	void ForgetMacrosFromDepth(int32 InputIfDepth) {
+		for (auto It = Aliases.begin(); It != Aliases.end();) {
+			It = (It->second.InputIfDepth >= InputIfDepth) ? Aliases.erase(It) : std::next(It);
+		}
+
+		auto IsTooDeep = [InputIfDepth](const DefinedMacro& Macro) { return Macro.InputIfDepth >= InputIfDepth; };
+		IdentityMacros.erase(std::remove_if(IdentityMacros.begin(), IdentityMacros.end(), IsTooDeep), IdentityMacros.end());
+		PasteMacros.erase(std::remove_if(PasteMacros.begin(), PasteMacros.end(), IsTooDeep), PasteMacros.end());
+	}
+
+	// Returns the index of a "#define PPT_ID_n(x) x" that's usable here, defining a new one sometimes
+	int32 GetIdentityMacro(int32 InputIfDepth) {
+		if (IdentityMacros.size() == 0 || GetIntInRange(0, 9) == 0) {
+			const int32 Index = NextMacroIndex++;
+			AppendFormat(&Pending, "#define PPT_ID_%d(x) x\n", Index);
+			IdentityMacros.push_back({ Index, InputIfDepth });
+			return Index;
+		}
+		return IdentityMacros[GetIntInRange(0, (int32)IdentityMacros.size() - 1)].Index;
+	}
+
+	void OnWord(const SourceToken& Token, int32 InputIfDepth) {
+		bSeenCode = true;
+
+		const bool bIsIdentifier = (Token.Kind == SourceTokenKind::Identifier);
+		const int32 Decider = GetIntInRange(0, 99);
+		int32 Threshold = 0;
+
+		if (bIsIdentifier && Decider < (Threshold += Config->AliasPercent)) {
+			std::string_view Name(Token.Start, Token.Length);
+			auto It = Aliases.find(Name);
+			if (It == Aliases.end()) {
+				It = Aliases.emplace(Name, DefinedMacro{ NextMacroIndex++, InputIfDepth }).first;
+				AppendFormat(&Pending, "#define PPT_AL_%d ", It->second.Index);
+				Pending.append(Token.Start, Token.Length);
+				Pending.append("\n");
+			}
+			AppendFormat(&Line, "PPT_AL_%d", It->second.Index);
+		}
+		else if (bIsIdentifier && Token.Length >= 2 && Config->bAllowTokenPasting && Decider < (Threshold += Config->PastePercent)) {
+			const int32 Split = GetIntInRange(1, Token.Length - 1);
+			if (GetIntInRange(0, 1) == 0) {
+				// "PPT_PA_n(my_to, ken)" with "#define PPT_PA_n(a, b) a ## b"
+				if (PasteMacros.size() == 0 || GetIntInRange(0, 9) == 0) {
+					PasteMacros.push_back({ NextMacroIndex++, InputIfDepth });
+					AppendFormat(&Pending, "#define PPT_PA_%d(a, b) a ## b\n", PasteMacros.back().Index);
+				}
+				AppendFormat(&Line, "PPT_PA_%d(", PasteMacros[GetIntInRange(0, (int32)PasteMacros.size() - 1)].Index);
+				Line.append(Token.Start, Split);
+				Line.append(", ");
+				Line.append(Token.Start + Split, Token.Length - Split);
+				Line.append(")");
+			}
+			else {
+				// "PPT_PR_n(ken)" with "#define PPT_PR_n(PPT_X) my_to ## PPT_X",
+				// the param needs our prefix too since the body has the input's text in it
+				const int32 Index = NextMacroIndex++;
+				AppendFormat(&Pending, "#define PPT_PR_%d(PPT_X) ", Index);
+				Pending.append(Token.Start, Split);
+				Pending.append(" ## PPT_X\n");
+				AppendFormat(&Line, "PPT_PR_%d(", Index);
+				Line.append(Token.Start + Split, Token.Length - Split);
+				Line.append(")");
+			}
+		}
+		else if (Decider < (Threshold += Config->IdentityPercent)) {
+			// Sometimes nest them, args get fully expanded first so this is still the same token
+			const int32 NumWraps = (GetIntInRange(0, 3) == 0) ? 2 : 1;
+			for (int32 i = 0; i < NumWraps; i++) {
+				AppendFormat(&Line, "PPT_ID_%d(", GetIdentityMacro(InputIfDepth));
+			}
+			Line.append(Token.Start, Token.Length);
+			Line.append(NumWraps, ')');
+		}
+		else {
+			Line.append(Token.Start, Token.Length);
+		}
+	}
+
+	void OnOther(const SourceToken& Token) {
+		if (Token.Kind != SourceTokenKind::Whitespace) {
+			bSeenCode = true;
+		}
+		Line.append(Token.Start, Token.Length);
+	}
+
+	void FlushLine() {
+		Out += Pending;
+		Out += Line;
+		Pending.clear();
+		Line.clear();
+	}
+
+	void CloseWrapper() {
+		OpenWrappers.pop_back();
+		Out.append("#endif\n");
+	}
+
+	// NextInputLine is the line number the next line had in the input
+	void OnNewline(const SourceToken& Token, int32 InputIfDepth, int32 NextInputLine) {
+		Line.append(Token.Start, Token.Length);
+		FlushLine();
+
+		if (!bSeenCode) {
+			return;
+		}
+
+		// Our groups can only close where they were opened, so they nest properly with the input's
+		if (OpenWrappers.size() > 0 && OpenWrappers.back() == InputIfDepth && GetIntInRange(0, 3) == 0) {
+			CloseWrapper();
+		}
+
+		if (Aliases.size() > 0 && GetIntInRange(0, 19) == 0) {
+			// Drop an alias now and then, it's fine to #undef it even inside an input group
+			auto It = Aliases.begin();
+			std::advance(It, GetIntInRange(0, (int32)Aliases.size() - 1));
+			AppendFormat(&Out, "#undef PPT_AL_%d\n", It->second.Index);
+			Aliases.erase(It);
+		}
+
+		if (RollPercent(Config->IfWrapPercent)) {
+			OpenWrappers.push_back(InputIfDepth);
+			switch (GetIntInRange(0, 4)) {
+			case 0: {
+				Out.append("#if 1\n");
+			} break;
+			case 1: {
+				AppendFormat(&Out, "#if PPT_UNDEFINED_%d == 0\n", NextMacroIndex++);
+			} break;
+			case 2: {
+				AppendFormat(&Out, "#ifndef PPT_UNDEFINED_%d\n", NextMacroIndex++);
+			} break;
+			case 3: {
+				// Skipped groups only need their directives to be well-formed
+				AppendFormat(&Out, "#if 0\nPPT_SKIPPED_%d ( ] \n#else\n", NextMacroIndex++);
+			} break;
+			case 4: {
+				if (IdentityMacros.size() > 0) {
+					AppendFormat(&Out, "#if defined(PPT_ID_%d) && PPT_ID_%d(1)\n", IdentityMacros[0].Index, IdentityMacros[0].Index);
+				}
+				else {
+					AppendFormat(&Out, "#if (%d + 1) > %d\n", NextMacroIndex, NextMacroIndex);
+				}
+			} break;
+			default: {
+				assert(false && "bad enum");
+			} break;
+			}
+		}
+
+		if (RollPercent(Config->LinePercent)) {
+			AppendFormat(&Out, "#line %d\n", NextInputLine);
+		}
+	}
+
+	// Called before the directive is counted in the input's #if depth
+	void OnDirective(const SourceToken& Token, bool bEndsGroup, int32 InputIfDepth) {
+		if (bEndsGroup) {
+			// #elif/#else/#endif: everything we opened in the group it ends has to be closed first
+			while (OpenWrappers.size() > 0 && OpenWrappers.back() >= InputIfDepth) {
+				CloseWrapper();
+			}
+			ForgetMacrosFromDepth(InputIfDepth);
+		}
+
+		FlushLine();
+		Out.append(Token.Start, Token.Length);
+	}
+
+	void Finish() {
+		FlushLine();
+		if (OpenWrappers.size() > 0 && Out.size() > 0 && Out.back() != '\n') {
+			Out.append("\n");
+		}
+		while (OpenWrappers.size() > 0) {
+			CloseWrapper();
+		}
+	}
+};
+
+// Writes NumVariants transformed copies of the source, which should all mean the same thing as it
+// (assuming the source doesn't use __LINE__), e.g.
+//  - "#if 1"..."#endif" and friends around lines
+//  - "#define PPT_ID_0(x) x" and then changing a token "word" to be "PPT_ID_0(word)"
+//  - "#define PPT_AL_1 vec2" and then replacing a "vec2" token with "PPT_AL_1"
+//  - replacing token "my_token" with "PPT_PA_2(my_to, ken)", or "PPT_PR_3(ken)" and "#define PPT_PR_3(PPT_X) my_to ## PPT_X"
+//  - "#line" directives putting the line numbers back to the input's
+// The source is tokenized once and every variant is fed from that same pass, reading
+// the source in place. Each variant has to be Reset() with its own seed beforehand
+void InsertNonChangingPreprocessorTransformations(const char* InSrc, int32 InLength, PreprocTransformVariant* Variants, int32 NumVariants) {
+	SourceTokenizer Tokenizer;
+	Tokenizer.Cur = InSrc;
+	Tokenizer.End = InSrc + InLength;
+
+	int32 InputIfDepth = 0;
+	int32 InputLine = 1;
+
+	while (true) {
+		const SourceToken Token = Tokenizer.Next();
+		if (Token.Kind == SourceTokenKind::End) {
+			break;
+		}
+
+		for (int32 i = 0; i < Token.Length; i++) {
+			InputLine += (Token.Start[i] == '\n');
+		}
+
+		switch (Token.Kind) {
+		case SourceTokenKind::Identifier:
+		case SourceTokenKind::Number: {
+			for (int32 i = 0; i < NumVariants; i++) {
+				Variants[i].OnWord(Token, InputIfDepth);
+			}
+		} break;
+		case SourceTokenKind::Whitespace:
+		case SourceTokenKind::Other: {
+			for (int32 i = 0; i < NumVariants; i++) {
+				Variants[i].OnOther(Token);
+			}
+		} break;
+		case SourceTokenKind::Newline: {
+			for (int32 i = 0; i < NumVariants; i++) {
+				Variants[i].OnNewline(Token, InputIfDepth, InputLine);
+			}
+		} break;
+		case SourceTokenKind::Directive: {
+			// Just enough of the directive name to track the input's own #if nesting
+			const char* Name = (const char*)memchr(Token.Start, '#', Token.Length) + 1;
+			const char* DirectiveEnd = Token.Start + Token.Length;
+			while (Name < DirectiveEnd && (*Name == ' ' || *Name == '\t')) {
+				Name++;
+			}
+			auto IsDirective = [&](const char* Directive) {
+				const size_t Len = strlen(Directive);
+				return (size_t)(DirectiveEnd - Name) >= Len && memcmp(Name, Directive, Len) == 0
+					&& (Name + Len == DirectiveEnd || !SourceTokenizer::IsIdentChar(Name[Len]));
+			};
 
+			const bool bStartsGroup = IsDirective("if") || IsDirective("ifdef") || IsDirective("ifndef");
+			const bool bEndsGroup = IsDirective("elif") || IsDirective("else") || IsDirective("endif");
 
+			for (int32 i = 0; i < NumVariants; i++) {
+				Variants[i].OnDirective(Token, bEndsGroup, InputIfDepth);
+			}
+
+			if (bStartsGroup) {
+				InputIfDepth++;
+			}
+			else if (IsDirective("endif") && InputIfDepth > 0) {
+				InputIfDepth--;
+			}
+		} break;
+		default: {
+			assert(false && "bad enum");
+		} break;
+		}
+	}
+
+	for (int32 i = 0; i < NumVariants; i++) {
+		Variants[i].Finish();
+	}
+}
+
+// Builds macros whose bodies call the previous function-like macro Fanout times, so that
+// the cost of expanding the final expr grows in a controlled way with depth.
+// Every level is "#define M_i(x) (M_{i-1}(x) op ... op M_{i-1}(x))", bottoming out at "(x op N)",
+// and since args are fully expanded before being substituted, expanding M_i(a) where a expands
+// to A tokens gives T_i(A) = 2 + Fanout * T_{i-1}(A) + (Fanout - 1) tokens, with T_0(A) = A + 4.
+// The prediction is written as a comment at the top, which doesn't change what gets expanded.
+void GenerateMacroExpansionStressSource(PreprocGenCtx* Ctx) {
+	static const char* const BinOps[] = { "+", "-", "*", "|", "^", "&" };
+	static const int32 NumBinOps = sizeof(BinOps) / sizeof(BinOps[0]);
+
+	const PreprocGenConfig& Config = Ctx->Config;
+	const int32 Fanout = (Config.StressShape == PreprocStressShape::Tree) ? std::max(1, Config.StressFanout) : 1;
+
+	// Expansion size of each level when called with a single-token arg,
+	// and how many macro invocations the preprocessor has to do for it
+	std::vector<uint64> LevelTokens;
+	std::vector<uint64> LevelInvocations;
+	std::vector<int32> LevelSymbols;
+
+	auto GetFinalExprTokens = [&](const std::vector<uint64>& Tokens) {
+		if (Config.StressShape == PreprocStressShape::Quadratic) {
+			// M_0(1) + M_1(1) + ... + M_n(1)
+			uint64 Total = Tokens.size() - 1;
+			for (uint64 LevelSize : Tokens) {
+				Total += LevelSize;
+			}
+			return Total;
+		}
+		else {
+			return Tokens.back();
+		}
+	};
+
+	// Emit the macros into a scratch buffer first, so the prediction can go at the top
+	SourceBuffer* MacroSource = new StringStackBuffer<MAX_SOURCE_FILE_SIZE>();
+
+	for (int32 Level = 0; Level < Config.StressDepth; Level++) {
+		uint64 Tokens = 0;
+		uint64 Invocations = 0;
+		if (Level == 0) {
+			Tokens = 1 + 4;
+			Invocations = 1;
+		}
+		else {
+			// Check for overflow before the cap, since Tree can get big fast
+			if (LevelTokens.back() > (UINT64_MAX / 2) / (uint64)Fanout) {
+				break;
+			}
+			Tokens = 2 + Fanout * LevelTokens.back() + (Fanout - 1);
+			Invocations = 1 + Fanout * LevelInvocations.back();
+		}
+
+		std::vector<uint64> CandidateTokens = LevelTokens;
+		CandidateTokens.push_back(Tokens);
+		if (GetFinalExprTokens(CandidateTokens) > Config.StressMaxExpandedTokens) {
+			break;
+		}
+
+		const int32 SymbolIndex = GenerateFreshPreProcessorIdentifier(Ctx);
+		const int32 ParamIndex = GenerateFreshPreProcessorIdentifier(Ctx);
+		const char* ParamName = Ctx->Symbols.Symbols[ParamIndex].Name.buffer;
+		const char* BinOp = BinOps[Ctx->GetIntInRange(0, NumBinOps - 1)];
+
+		MacroSource->AppendFormat("#define %s(%s) ", Ctx->Symbols.Symbols[SymbolIndex].Name.buffer, ParamName);
+		const int32 BodyStart = MacroSource->length;
+		MacroSource->Append("(");
+		if (Level == 0) {
+			MacroSource->AppendFormat("%s %s %d", ParamName, BinOp, Ctx->GetIntInRange(0, 100));
+		}
+		else {
+			const char* PrevName = Ctx->Symbols.Symbols[LevelSymbols.back()].Name.buffer;
+			for (int32 i = 0; i < Fanout; i++) {
+				if (i > 0) {
+					MacroSource->AppendFormat(" %s ", BinOp);
+				}
+				MacroSource->AppendFormat("%s(%s)", PrevName, ParamName);
+			}
+		}
+		MacroSource->Append(")");
+
+		if (Ctx->Reference != nullptr) {
+			Ctx->Reference->OnDefine(Ctx->Symbols.Symbols[SymbolIndex].Name.buffer, true, &ParamName, 1,
+				&MacroSource->buffer[BodyStart], MacroSource->length - BodyStart);
+		}
+		MacroSource->Append("\n");
+
+		Ctx->Symbols.Bind(SymbolIndex, PSK_Macro, 1);
+		LevelSymbols.push_back(SymbolIndex);
+		LevelTokens.push_back(Tokens);
+		LevelInvocations.push_back(Invocations);
+	}
+
+	uint64 PredictedTokens = 0;
+	uint64 PredictedInvocations = 0;
+	if (LevelSymbols.size() > 0) {
+		PredictedTokens = GetFinalExprTokens(LevelTokens);
+		if (Config.StressShape == PreprocStressShape::Quadratic) {
+			for (uint64 LevelInvocationCount : LevelInvocations) {
+				PredictedInvocations += LevelInvocationCount;
+			}
+		}
+		else {
+			PredictedInvocations = LevelInvocations.back();
+		}
+	}
+
+	static const char* const ShapeNames[] = { "none", "chain", "quadratic", "tree" };
+	Ctx->OutSource->AppendFormat("// macro expansion stress: shape=%s depth=%d fanout=%d\n",
+		ShapeNames[(int32)Config.StressShape], (int32)LevelSymbols.size(), Fanout);
+	Ctx->OutSource->AppendFormat("// predicted_expanded_tokens=%llu predicted_macro_invocations=%llu\n",
+		(unsigned long long)PredictedTokens, (unsigned long long)PredictedInvocations);
+	Ctx->OutSource->Append(MacroSource->buffer);
+
+	delete MacroSource;
+
+	if (LevelSymbols.size() == 0) {
+		// Even the first level was over the cap
+		if (Ctx->Reference != nullptr) {
+			Ctx->Reference->OnFinalExpr(Ctx->GetCurrentLine(), "0", 1);
+		}
+		Ctx->OutSource->Append("0\n");
+		return;
+	}
+
+	// The arg is a single token, to match the predictions
+	const int32 ExprStart = Ctx->OutSource->length;
+	if (Config.StressShape == PreprocStressShape::Quadratic) {
+		for (int32 Level = 0; Level < (int32)LevelSymbols.size(); Level++) {
+			Ctx->OutSource->AppendFormat("%s%s(1)", (Level > 0) ? " + " : "", Ctx->Symbols.Symbols[LevelSymbols[Level]].Name.buffer);
+		}
+	}
+	else {
+		Ctx->OutSource->AppendFormat("%s(1)", Ctx->Symbols.Symbols[LevelSymbols.back()].Name.buffer);
+	}
+
+	if (Ctx->Reference != nullptr) {
+		Ctx->Reference->OnFinalExpr(Ctx->GetCurrentLine(), &Ctx->OutSource->buffer[ExprStart], Ctx->OutSource->length - ExprStart);
+	}
+	Ctx->OutSource->Append("\n");
+}
+
+// Returns false if the program didn't fit in OutSource and got cut off
+bool GeneratePreProcessorSourceForSeed(PreprocGenCtx* Ctx, uint64 Seed) {
+	Ctx->ResetState();
+	Ctx->RNGState.seed(Seed);
+
+	if (Ctx->Config.StressShape != PreprocStressShape::None) {
+		GenerateMacroExpansionStressSource(Ctx);
+	}
+	else {
+		GeneratePreProcessorSource(Ctx);
+	}
+
+	if (Ctx->OutSource->length >= MAX_SOURCE_FILE_SIZE - 1) {
+		fprintf(stderr, "Warning: seed %llu was truncated at %d bytes\n", (unsigned long long)Seed, Ctx->OutSource->length);
+		return false;
+	}
+
+	return true;
+}
+
+enum struct PreprocOutputMode {
+	Stdout,
+	Directory,
+	Packed
+};
+
+struct PreprocBatchSettings {
+	// [FirstSeed, EndSeed), already narrowed down to our shard
+	uint64 FirstSeed = 0;
+	uint64 EndSeed = 10;
+	uint32 ShardIndex = 0;
+	uint32 ShardCount = 1;
+	int32 NumThreads = 1;
+
+	// Record what was written in a manifest, so shards can be put back together with gen_merge
+	const char* ManifestPath = nullptr;
+
+	PreprocGenConfig GenConfig;
+
+	// Also write the expected #if/final expr results from PreprocReference
+	bool bWriteExpected = false;
+
+	PreprocOutputMode OutputMode = PreprocOutputMode::Stdout;
+	const char* OutputPath = nullptr;
+
+	// If set, transform the sources in this directory (or packed corpus) instead of generating
+	const char* TransformInputPath = nullptr;
+	bool bTransformInputIsPacked = false;
+	PreprocTransformConfig TransformConfig;
+};
+
+struct PreprocBatchOutput {
+	const PreprocBatchSettings* Settings = nullptr;
+	PackedCorpusWriter Packed;
+	// Only set with --manifest, WriteProgram is always called in seed order then
+	BatchManifest* Manifest = nullptr;
+
+	static bool WriteFile(const char* Path, const char* Data, size_t Length) {
+		FILE* f = fopen(Path, "wb");
+		if (f == nullptr) {
+			return false;
+		}
+		bool bSuccess = fwrite(Data, 1, Length, f) == Length;
+		fclose(f);
+		return bSuccess;
+	}
+
+	// Expected is null unless Settings->bWriteExpected
+	bool WriteProgram(uint64 Seed, const char* Source, int32 Length, const std::string* Expected) {
+		if (Manifest != nullptr) {
+			Manifest->AddSeed(Seed, Source, (size_t)Length);
+		}
+
+		switch (Settings->OutputMode) {
+		case PreprocOutputMode::Stdout: {
+			printf("\n-----------\n");
+			fwrite(Source, 1, Length, stdout);
+			if (Expected != nullptr) {
+				printf("\n----- expected -----\n");
+				fwrite(Expected->data(), 1, Expected->size(), stdout);
+			}
+			printf("\n-----------\n");
+			return true;
+		} break;
+		case PreprocOutputMode::Directory: {
+			const unsigned long long SeedForPath = (unsigned long long)Seed;
+			bool bSuccess = WriteFile(StringStackBuffer<1024>("%s/%06llu.pp", Settings->OutputPath, SeedForPath).buffer, Source, Length);
+			if (Expected != nullptr) {
+				bSuccess &= WriteFile(StringStackBuffer<1024>("%s/%06llu.expected", Settings->OutputPath, SeedForPath).buffer, Expected->data(), Expected->size());
+			}
+			return bSuccess;
+		} break;
+		case PreprocOutputMode::Packed: {
+			bool bSuccess = Packed.WriteRecord(Seed, PCRK_Source, Source, (uint32)Length);
+			if (Expected != nullptr) {
+				bSuccess &= Packed.WriteRecord(Seed, PCRK_Expected, Expected->data(), (uint32)Expected->size());
+			}
+			return bSuccess;
+		} break;
+		default: {
+			assert(false && "bad enum");
+			return false;
+		} break;
+		}
+	}
+};
+
+// Each thread gets its own PreprocGenCtx, and a seed always produces the same program
+// regardless of which thread runs it, so the output matches the serial run.
+// Stdout and packed output have to come out in seed order, so finished programs go into a window
+// of slots that the main thread drains in order, threads stall if they get a whole window ahead.
+bool RunPreprocBatchParallel(const PreprocBatchSettings& Settings, PreprocBatchOutput* Output) {
+	struct ProgramSlot {
+		std::string Source;
+		std::string Expected;
+		bool bReady = false;
+	};
+
+	const bool bNeedsOrdering = (Settings.OutputMode != PreprocOutputMode::Directory || Output->Manifest != nullptr);
+	const uint64 WindowSize = (uint64)Settings.NumThreads * 4;
+
+	std::vector<ProgramSlot> Slots(bNeedsOrdering ? WindowSize : 0);
+	std::mutex SlotMutex;
+	std::condition_variable SlotsChanged;
+	uint64 NextSeedToWrite = Settings.FirstSeed;
+
+	std::atomic<uint64> NextSeedToGenerate{ Settings.FirstSeed };
+	std::atomic<bool> bHadWriteError{ false };
+
+	auto WorkerFunc = [&]() {
+		PreprocGenCtx Ctx;
+		Ctx.Config = Settings.GenConfig;
+		Ctx.OutSource = new StringStackBuffer<MAX_SOURCE_FILE_SIZE>();
+
+		PreprocReference Reference;
+		Ctx.Reference = Settings.bWriteExpected ? &Reference : nullptr;
+
+		while (true) {
+			const uint64 Seed = NextSeedToGenerate.fetch_add(1);
+			if (Seed >= Settings.EndSeed) {
+				break;
+			}
+
+			GeneratePreProcessorSourceForSeed(&Ctx, Seed);
+
+			if (bNeedsOrdering) {
+				std::unique_lock<std::mutex> Lock(SlotMutex);
+				SlotsChanged.wait(Lock, [&]() { return Seed < NextSeedToWrite + WindowSize; });
+
+				ProgramSlot& Slot = Slots[Seed % WindowSize];
+				Slot.Source.assign(Ctx.OutSource->buffer, Ctx.OutSource->length);
+				Slot.Expected.swap(Reference.Results);
+				Slot.bReady = true;
+				SlotsChanged.notify_all();
+			}
+			else if (!Output->WriteProgram(Seed, Ctx.OutSource->buffer, Ctx.OutSource->length, Ctx.Reference ? &Reference.Results : nullptr)) {
+				bHadWriteError = true;
+			}
+		}
+
+		delete Ctx.OutSource;
+	};
+
+	std::vector<std::thread> Workers;
+	for (int32 i = 0; i < Settings.NumThreads; i++) {
+		Workers.emplace_back(WorkerFunc);
+	}
+
+	if (bNeedsOrdering) {
+		std::string Source;
+		std::string Expected;
+		while (NextSeedToWrite < Settings.EndSeed) {
+			{
+				std::unique_lock<std::mutex> Lock(SlotMutex);
+				ProgramSlot& Slot = Slots[NextSeedToWrite % WindowSize];
+				SlotsChanged.wait(Lock, [&]() { return Slot.bReady; });
+
+				// Swap it out so we can write without holding the lock
+				Source.swap(Slot.Source);
+				Expected.swap(Slot.Expected);
+				Slot.bReady = false;
+			}
+
+			if (!Output->WriteProgram(NextSeedToWrite, Source.data(), (int32)Source.size(), Settings.bWriteExpected ? &Expected : nullptr)) {
+				bHadWriteError = true;
+			}
+
+			{
+				std::lock_guard<std::mutex> Lock(SlotMutex);
+				NextSeedToWrite++;
+			}
+			SlotsChanged.notify_all();
+		}
+	}
+
+	for (auto& Worker : Workers) {
+		Worker.join();
+	}
+
+	return !bHadWriteError;
+}
+
+bool RunPreprocBatchSerial(const PreprocBatchSettings& Settings, PreprocBatchOutput* Output) {
 	PreprocGenCtx Ctx;
+	Ctx.Config = Settings.GenConfig;
 	Ctx.OutSource = new StringStackBuffer<MAX_SOURCE_FILE_SIZE>();
 
-	for (int32 i = 0; i < 10; i++)
-	{
-		Ctx.ResetState();
-		Ctx.RNGState.seed(i);
+	PreprocReference Reference;
+	Ctx.Reference = Settings.bWriteExpected ? &Reference : nullptr;
 
-		GeneratePreProcessorSource(&Ctx);
-		OutputDebugStringA("\n-----------\n");
-		OutputDebugStringA(Ctx.OutSource->buffer);
-		OutputDebugStringA("\n-----------\n");
+	bool bSuccess = true;
+	for (uint64 Seed = Settings.FirstSeed; Seed < Settings.EndSeed; Seed++) {
+		GeneratePreProcessorSourceForSeed(&Ctx, Seed);
+		bSuccess &= Output->WriteProgram(Seed, Ctx.OutSource->buffer, Ctx.OutSource->length, Ctx.Reference ? &Reference.Results : nullptr);
 	}
 
 	delete Ctx.OutSource;
 
+	return bSuccess;
+}
 
-	return 0;
+// Variants of one input go out together: consecutive PCRK_Variant records for packed output,
+// and for directories the input's name with the variant number before the extension
+// (e.g. 000012.frag -> 000012.v3.frag) so shader tools can still tell the stage from it
+bool WriteTransformedVariants(PreprocBatchOutput* Output, uint64 Seed, const std::string& Name, const PreprocTransformVariant* Variants, int32 NumVariants) {
+	const PreprocBatchSettings* Settings = Output->Settings;
+	bool bSuccess = true;
+
+	for (int32 i = 0; i < NumVariants; i++) {
+		const std::string& Source = Variants[i].Out;
+		switch (Settings->OutputMode) {
+		case PreprocOutputMode::Stdout: {
+			printf("\n----------- %s variant %d\n", Name.c_str(), i);
+			fwrite(Source.data(), 1, Source.size(), stdout);
+			printf("\n-----------\n");
+		} break;
+		case PreprocOutputMode::Directory: {
+			const size_t Dot = Name.rfind('.');
+			const std::string Stem = Name.substr(0, Dot);
+			const std::string Extension = (Dot != std::string::npos) ? Name.substr(Dot) : std::string();
+			StringStackBuffer<1024> Path("%s/%s.v%d%s", Settings->OutputPath, Stem.c_str(), i, Extension.c_str());
+			bSuccess &= PreprocBatchOutput::WriteFile(Path.buffer, Source.data(), Source.size());
+		} break;
+		case PreprocOutputMode::Packed: {
+			bSuccess &= Output->Packed.WriteRecord(Seed, PCRK_Variant, Source.data(), (uint32)Source.size());
+		} break;
+		default: {
+			assert(false && "bad enum");
+		} break;
+		}
+	}
+
+	return bSuccess;
 }
 
+// Sources --transform-dir picks up: shaders and our own programs, but not their sidecars (.expected, gen_shader's
+// .meta, .gsi and dialect translations) or variants already made from them (<stem>.v<k>.<ext>, from either tool)
+bool IsTransformInput(const std::filesystem::path& Path) {
+	const std::string Extension = Path.extension().string();
+	if (Extension != ".frag" && Extension != ".vert" && Extension != ".comp" && Extension != ".pp") {
+		return false;
+	}
+
+	const std::string Stem = Path.stem().string();
+	const size_t Dot = Stem.rfind('.');
+	const bool bIsVariant = Dot != std::string::npos && Dot + 2 < Stem.size() && Stem[Dot + 1] == 'v'
+		&& Stem.find_first_not_of("0123456789", Dot + 2) == std::string::npos;
+	return !bIsVariant;
+}
+
+// Reads each input once (mapped in place for packed corpora) and writes all its variants
+bool RunPreprocTransform(const PreprocBatchSettings& Settings, PreprocBatchOutput* Output) {
+	const int32 NumVariants = std::max(1, Settings.TransformConfig.NumVariants);
+	std::vector<PreprocTransformVariant> Variants(NumVariants);
+	for (auto& Variant : Variants) {
+		Variant.Config = &Settings.TransformConfig;
+	}
+
+	auto TransformSource = [&](uint64 Seed, const std::string& Name, const char* Source, size_t Length) {
+		if (Length > (size_t)INT32_MAX) {
+			fprintf(stderr, "Skipping '%s', it's too big\n", Name.c_str());
+			return true;
+		}
+
+		for (int32 i = 0; i < NumVariants; i++) {
+			Variants[i].Reset(Seed * 0x9E3779B97F4A7C15ULL + (uint64)i);
+		}
+		InsertNonChangingPreprocessorTransformations(Source, (int32)Length, Variants.data(), NumVariants);
+		return WriteTransformedVariants(Output, Seed, Name, Variants.data(), NumVariants);
+	};
+
+	bool bSuccess = true;
+
+	if (Settings.bTransformInputIsPacked) {
+		PackedCorpusReader Reader;
+		if (!Reader.Open(Settings.TransformInputPath)) {
+			fprintf(stderr, "Could not read packed corpus '%s'\n", Settings.TransformInputPath);
+			return false;
+		}
+
+		PackedCorpusRecord Record;
+		while (Reader.Next(&Record)) {
+			if (Record.Kind == PCRK_Source) {
+				const std::string Name = StringStackBuffer<64>("%06llu.pp", (unsigned long long)Record.Seed).buffer;
+				bSuccess &= TransformSource(Record.Seed, Name, Record.Data, Record.Length);
+			}
+		}
+
+		if (Reader.bTruncated) {
+			fprintf(stderr, "Warning: '%s' ends partway through a record\n", Settings.TransformInputPath);
+		}
+	}
+	else {
+		std::error_code Error;
+		std::vector<std::filesystem::path> Paths;
+		for (const auto& Entry : std::filesystem::directory_iterator(Settings.TransformInputPath, Error)) {
+			if (Entry.is_regular_file() && IsTransformInput(Entry.path())) {
+				Paths.push_back(Entry.path());
+			}
+		}
+
+		if (Error) {
+			fprintf(stderr, "Could not list '%s': %s\n", Settings.TransformInputPath, Error.message().c_str());
+			return false;
+		}
+
+		// Directory order isn't stable, sort so the output is
+		std::sort(Paths.begin(), Paths.end());
+
+		std::vector<char> Source;
+		for (size_t Index = 0; Index < Paths.size(); Index++) {
+			const std::string Name = Paths[Index].filename().string();
+			FILE* f = fopen(Paths[Index].string().c_str(), "rb");
+			if (f == nullptr) {
+				fprintf(stderr, "Could not open '%s'\n", Paths[Index].string().c_str());
+				bSuccess = false;
+				continue;
+			}
+
+			Source.clear();
+			char Chunk[64 * 1024];
+			size_t NumRead = 0;
+			while ((NumRead = fread(Chunk, 1, sizeof(Chunk), f)) > 0) {
+				Source.insert(Source.end(), Chunk, Chunk + NumRead);
+			}
+			fclose(f);
+
+			// Inputs named by seed (like gen_shaders/000012.frag) keep their seed, otherwise it's their index
+			const std::string Stem = Paths[Index].stem().string();
+			const bool bNamedBySeed = Stem.size() > 0 && Stem.find_first_not_of("0123456789") == std::string::npos;
+			const uint64 Seed = bNamedBySeed ? strtoull(Stem.c_str(), nullptr, 10) : (uint64)Index;
+
+			bSuccess &= TransformSource(Seed, Name, Source.data(), Source.size());
+		}
+	}
+
+	return bSuccess;
+}
+
+void PrintUsage() {
+	fprintf(stderr,
+		"usage: gen_c_preproc [--seeds A..B] [--shard I/N] [--threads N] [--num-lines N] [--expected] [--no-defined-in-macros]\n"
+		"                     [--stress chain|quadratic|tree [--depth D] [--fanout F] [--max-expanded-tokens N]]\n"
+		"                     [--stdout | --out-dir DIR | --packed FILE] [--manifest FILE]\n"
+		"       gen_c_preproc (--transform-dir DIR | --transform-packed FILE) [--variants N] [--no-paste]\n"
+		"                     [--stdout | --out-dir DIR | --packed FILE]\n"
+		"  --seeds A..B   generate seeds A (inclusive) to B (exclusive), default 0..10\n"
+		"  --shard I/N    only the I-th of N equal, contiguous slices of the seeds (I from 0)\n"
+		"  --manifest FILE  also write a manifest of the seeds written and hashes of the programs (with --out-dir\n"
+		"                 or --packed), for putting shards back together with gen_merge\n"
+		"  --threads N    generate on N threads, output is the same as with 1\n"
+		"  --num-lines N  emit N directives per program instead of 3-30, e.g. 20000 for symbol table stress\n"
+		"  --expected     also write the expected results of each #if and the final expr under C semantics\n"
+		"                 (<seed>.expected next to each program, or records in the packed corpus, see preproc_reference.h)\n"
+		"  --no-defined-in-macros  don't put defined() in macro bodies, which is UB when expanded in an #if\n"
+		"  --stress SHAPE emit macro expansion stress programs instead, where expanding the final expr\n"
+		"                 is linear (chain), quadratic or exponential (tree, --fanout) in --depth\n"
+		"                 (default 8). The predicted expansion size is in a comment at the top, and depth\n"
+		"                 is cut short to keep it under --max-expanded-tokens (default 16M)\n"
+		"  --stdout       print the programs (default)\n"
+		"  --out-dir DIR  write each program to DIR/<seed>.pp\n"
+		"  --packed FILE  write all programs to one packed corpus file\n"
+		"  --transform-dir DIR, --transform-packed FILE\n"
+		"                 instead of generating, read existing sources (the .frag/.vert/.comp/.pp files in DIR, e.g.\n"
+		"                 gen_shaders/, leaving out <stem>.v<k> variants) and write --variants N\n"
+		"                 (default 4) copies of each with meaning-preserving directives added: #if 1 groups,\n"
+		"                 identity/alias macros, ## pasting (off with --no-paste, GLSL < 3.00 ES lacks it) and #line\n");
+}
+
+int main(int argc, char** argv)
+{
+	PreprocBatchSettings Settings;
+
+	for (int32 i = 1; i < argc; i++) {
+		const bool bHasValue = (i + 1 < argc);
+		if (strcmp(argv[i], "--seeds") == 0 && bHasValue) {
+			if (!ParseBatchSeedRange(argv[++i], &Settings.FirstSeed, &Settings.EndSeed)) {
+				fprintf(stderr, "Bad seed range '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--shard") == 0 && bHasValue) {
+			if (!ParseBatchShard(argv[++i], &Settings.ShardIndex, &Settings.ShardCount)) {
+				fprintf(stderr, "Bad shard '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--manifest") == 0 && bHasValue) {
+			Settings.ManifestPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && bHasValue) {
+			Settings.NumThreads = atoi(argv[++i]);
+			if (Settings.NumThreads < 1) {
+				Settings.NumThreads = (int32)std::max(1U, std::thread::hardware_concurrency());
+			}
+		}
+		else if (strcmp(argv[i], "--num-lines") == 0 && bHasValue) {
+			Settings.GenConfig.NumLines = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--expected") == 0) {
+			Settings.bWriteExpected = true;
+		}
+		else if (strcmp(argv[i], "--no-defined-in-macros") == 0) {
+			Settings.GenConfig.bAllowDefinedInMacros = false;
+		}
+		else if (strcmp(argv[i], "--stress") == 0 && bHasValue) {
+			i++;
+			if (strcmp(argv[i], "chain") == 0) {
+				Settings.GenConfig.StressShape = PreprocStressShape::Chain;
+			}
+			else if (strcmp(argv[i], "quadratic") == 0) {
+				Settings.GenConfig.StressShape = PreprocStressShape::Quadratic;
+			}
+			else if (strcmp(argv[i], "tree") == 0) {
+				Settings.GenConfig.StressShape = PreprocStressShape::Tree;
+			}
+			else {
+				fprintf(stderr, "Unknown stress shape '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--depth") == 0 && bHasValue) {
+			Settings.GenConfig.StressDepth = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--fanout") == 0 && bHasValue) {
+			Settings.GenConfig.StressFanout = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-expanded-tokens") == 0 && bHasValue) {
+			Settings.GenConfig.StressMaxExpandedTokens = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--transform-dir") == 0 && bHasValue) {
+			Settings.TransformInputPath = argv[++i];
+			Settings.bTransformInputIsPacked = false;
+		}
+		else if (strcmp(argv[i], "--transform-packed") == 0 && bHasValue) {
+			Settings.TransformInputPath = argv[++i];
+			Settings.bTransformInputIsPacked = true;
+		}
+		else if (strcmp(argv[i], "--variants") == 0 && bHasValue) {
+			Settings.TransformConfig.NumVariants = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-paste") == 0) {
+			Settings.TransformConfig.bAllowTokenPasting = false;
+		}
+		else if (strcmp(argv[i], "--stdout") == 0) {
+			Settings.OutputMode = PreprocOutputMode::Stdout;
+		}
+		else if (strcmp(argv[i], "--out-dir") == 0 && bHasValue) {
+			Settings.OutputMode = PreprocOutputMode::Directory;
+			Settings.OutputPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--packed") == 0 && bHasValue) {
+			Settings.OutputMode = PreprocOutputMode::Packed;
+			Settings.OutputPath = argv[++i];
+		}
+		else {
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	ApplyBatchShard(Settings.ShardIndex, Settings.ShardCount, &Settings.FirstSeed, &Settings.EndSeed);
+
+	PreprocBatchOutput Output;
+	Output.Settings = &Settings;
+
+	BatchManifest Manifest;
+	if (Settings.ManifestPath != nullptr) {
+		if (Settings.TransformInputPath != nullptr || Settings.OutputMode == PreprocOutputMode::Stdout) {
+			fprintf(stderr, "--manifest needs generated programs written with --out-dir or --packed\n");
+			return 1;
+		}
+
+		const PreprocGenConfig& Config = Settings.GenConfig;
+		Manifest.Generator = "gen_c_preproc";
+		Manifest.GeneratorVersion = PREPROC_GENERATOR_VERSION;
+		Manifest.Config = StringStackBuffer<256>("num-lines=%d defined-in-macros=%d stress=%d depth=%d fanout=%d max-expanded-tokens=%llu expected=%d",
+			Config.NumLines, Config.bAllowDefinedInMacros ? 1 : 0, (int32)Config.StressShape, Config.StressDepth, Config.StressFanout,
+			(unsigned long long)Config.StressMaxExpandedTokens, Settings.bWriteExpected ? 1 : 0).buffer;
+
+		if (Settings.OutputMode == PreprocOutputMode::Packed) {
+			Manifest.OutputPattern = MakeManifestRelativePath(Settings.ManifestPath, Settings.OutputPath);
+		}
+		else {
+			Manifest.OutputPattern = MakeManifestRelativePath(Settings.ManifestPath, std::string(Settings.OutputPath) + "/%06llu.pp");
+			if (Settings.bWriteExpected) {
+				Manifest.ExtraPatterns.push_back(MakeManifestRelativePath(Settings.ManifestPath, std::string(Settings.OutputPath) + "/%06llu.expected"));
+			}
+		}
 
+		Output.Manifest = &Manifest;
+	}
+
+	if (Settings.OutputMode == PreprocOutputMode::Packed && !Output.Packed.Open(Settings.OutputPath)) {
+		fprintf(stderr, "Could not open '%s' for writing\n", Settings.OutputPath);
+		return 1;
+	}
+
+	bool bSuccess = false;
+	if (Settings.TransformInputPath != nullptr) {
+		bSuccess = RunPreprocTransform(Settings, &Output);
+	}
+	else if (Settings.NumThreads > 1) {
+		bSuccess = RunPreprocBatchParallel(Settings, &Output);
+	}
+	else {
+		bSuccess = RunPreprocBatchSerial(Settings, &Output);
+	}
+
+	Output.Packed.Close();
+
+	if (!bSuccess) {
+		fprintf(stderr, "Failed to write some of the output\n");
+		return 1;
+	}
+
+	// Only once everything is written, the manifest vouches for it
+	if (Output.Manifest != nullptr && !Manifest.Save(Settings.ManifestPath)) {
+		fprintf(stderr, "Could not save manifest '%s'\n", Settings.ManifestPath);
+		return 1;
+	}
+
+	return 0;
+}
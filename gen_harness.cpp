@@ -0,0 +1,522 @@
+// Runs a compiler (or anything else that takes a shader) over generated shaders: keeps a pool of
+// compiler processes busy with shaders straight from the generator, kills the ones that run past the
+// time limit, and sorts each result into accept/reject/crash/timeout. Verdicts go into a cache keyed by
+// the shader's content and the compiler's identity (see verdict_cache.h), so runs over a corpus that
+// mostly didn't change only compile what's new. POSIX only, it's built around fork/exec.
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "stack_string.h"
+#include "gen_shader.h"
+#include "batch_manifest.h"
+#include "seed_corpus.h"
+#include "batch_source.h"
+#include "verdict_cache.h"
+
+using int32 = int32_t;
+using uint32 = uint32_t;
+using uint64 = uint64_t;
+
+struct HarnessSettings
+{
+	// The command, with "{}" standing for the shader's path. Without one the shader goes to stdin
+	std::vector<std::string> Command;
+	int32 NumJobs = 1;
+	uint32 TimeoutMs = 10000;
+	// 0 for no limit
+	uint32 MemoryLimitMB = 0;
+	const char* CachePath = nullptr;
+	const char* CompilerIDString = nullptr;
+	const char* VerdictsPath = nullptr;
+	const char* SaveFailuresDir = nullptr;
+	bool bRecheckTimeouts = false;
+};
+
+// One compiler process and the shader it's working on
+struct CompileSlot
+{
+	pid_t Pid = -1;
+	uint64 Seed = 0;
+	uint64 ContentHash = 0;
+	std::string Source;
+	// Where Source gets written for the compiler, reused for every shader this slot runs
+	std::string Path;
+	uint64 DeadlineMs = 0;
+	bool bTimedOut = false;
+};
+
+struct HarnessTally
+{
+	uint64 Counts[CV_Count] = {};
+	uint64 NumCached = 0;
+	uint64 NumGenerationFailures = 0;
+	bool bSawExit127 = false;
+};
+
+static uint64 GetMonotonicMs()
+{
+	timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (uint64)Now.tv_sec * 1000 + (uint64)Now.tv_nsec / 1000000;
+}
+
+static const char* GetShaderTypeExtension(GenShaderType ShaderType)
+{
+	switch (ShaderType)
+	{
+	case GENSHADER_TYPE_VERT:
+		return "vert";
+	case GENSHADER_TYPE_FRAG:
+		return "frag";
+	case GENSHADER_TYPE_COMPUTE:
+		return "comp";
+	default:
+		assert(false && "bad enum");
+		return "frag";
+	}
+}
+
+// Where execvp would find Program, empty if nowhere
+static std::string FindExecutable(const std::string& Program)
+{
+	if (Program.find('/') != std::string::npos)
+	{
+		return Program;
+	}
+
+	const char* PathEnv = getenv("PATH");
+	std::string Dirs = (PathEnv != nullptr) ? PathEnv : "/usr/bin:/bin";
+	size_t Begin = 0;
+	while (Begin <= Dirs.size())
+	{
+		size_t End = Dirs.find(':', Begin);
+		End = (End == std::string::npos) ? Dirs.size() : End;
+		const std::string Candidate = ((End > Begin) ? Dirs.substr(Begin, End - Begin) : std::string(".")) + "/" + Program;
+		if (access(Candidate.c_str(), X_OK) == 0)
+		{
+			return Candidate;
+		}
+		Begin = End + 1;
+	}
+	return std::string();
+}
+
+// Identifies the compiler for the cache: the command line, plus the executable's bytes, so a rebuilt
+// compiler gets its shaders compiled again. --compiler-id replaces all of it (e.g. with a version string)
+static uint64 MakeCompilerID(const HarnessSettings& Settings)
+{
+	if (Settings.CompilerIDString != nullptr)
+	{
+		return HashBatchOutput(BATCH_MANIFEST_HASH_INIT, 0, Settings.CompilerIDString, strlen(Settings.CompilerIDString));
+	}
+
+	uint64 Hash = BATCH_MANIFEST_HASH_INIT;
+	for (const std::string& Arg : Settings.Command)
+	{
+		Hash = HashBatchOutput(Hash, 0, Arg.c_str(), Arg.size() + 1);
+	}
+
+	FILE* f = fopen(FindExecutable(Settings.Command[0]).c_str(), "rb");
+	if (f != nullptr)
+	{
+		char Chunk[64 * 1024];
+		size_t NumRead = 0;
+		while ((NumRead = fread(Chunk, 1, sizeof(Chunk), f)) > 0)
+		{
+			Hash = HashBatchOutput(Hash, 0, Chunk, NumRead);
+		}
+		fclose(f);
+	}
+	return Hash;
+}
+
+// Starts the compiler on the shader in Slot->Path, in a process group of its own so a timeout can
+// take down anything it started too
+static bool SpawnCompiler(const HarnessSettings& Settings, CompileSlot* Slot)
+{
+	std::vector<std::string> Args = Settings.Command;
+	bool bPathInArgs = false;
+	for (std::string& Arg : Args)
+	{
+		const size_t Placeholder = Arg.find("{}");
+		if (Placeholder != std::string::npos)
+		{
+			Arg.replace(Placeholder, 2, Slot->Path);
+			bPathInArgs = true;
+		}
+	}
+
+	std::vector<char*> Argv;
+	for (std::string& Arg : Args)
+	{
+		Argv.push_back(&Arg[0]);
+	}
+	Argv.push_back(nullptr);
+
+	const pid_t Pid = fork();
+	if (Pid < 0)
+	{
+		return false;
+	}
+
+	if (Pid == 0)
+	{
+		setpgid(0, 0);
+
+		if (Settings.MemoryLimitMB > 0)
+		{
+			rlimit Limit;
+			Limit.rlim_cur = Limit.rlim_max = (rlim_t)Settings.MemoryLimitMB * 1024 * 1024;
+			setrlimit(RLIMIT_AS, &Limit);
+		}
+		// Thousands of crashes shouldn't mean thousands of core files
+		rlimit NoCore = { 0, 0 };
+		setrlimit(RLIMIT_CORE, &NoCore);
+
+		const int Input = bPathInArgs ? open("/dev/null", O_RDONLY) : open(Slot->Path.c_str(), O_RDONLY);
+		const int Null = open("/dev/null", O_WRONLY);
+		dup2(Input, STDIN_FILENO);
+		dup2(Null, STDOUT_FILENO);
+		dup2(Null, STDERR_FILENO);
+
+		execvp(Argv[0], Argv.data());
+		_exit(127);
+	}
+
+	// Also from this side, so killing the group works even if the child hasn't got to its setpgid yet
+	setpgid(Pid, Pid);
+	Slot->Pid = Pid;
+	Slot->DeadlineMs = GetMonotonicMs() + Settings.TimeoutMs;
+	Slot->bTimedOut = false;
+	return true;
+}
+
+static CompileVerdict ClassifyExit(int Status, bool bTimedOut, uint16_t* OutDetail)
+{
+	*OutDetail = 0;
+	if (bTimedOut)
+	{
+		return CV_Timeout;
+	}
+	if (WIFSIGNALED(Status))
+	{
+		*OutDetail = (uint16_t)WTERMSIG(Status);
+		return CV_Crash;
+	}
+
+	*OutDetail = (uint16_t)WEXITSTATUS(Status);
+	return (*OutDetail == 0) ? CV_Accept : CV_Reject;
+}
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"usage: gen_harness [--seeds A..B] [--shard I/N] [--type vert|frag|comp] [--corpus FILE] [--jobs N]\n"
+		"                   [--timeout-ms N] [--memory-mb N] [--cache FILE] [--compiler-id STR] [--verdicts FILE]\n"
+		"                   [--save-failures DIR] [--recheck-timeouts] -- COMMAND [ARGS...]\n"
+		"  Generates shaders and runs COMMAND on each, \"{}\" in ARGS is replaced with the shader's path\n"
+		"  (which ends in .<type>), without one the shader is on stdin\n"
+		"  --seeds A..B    seeds A (inclusive) to B (exclusive), default 0..1024\n"
+		"  --shard I/N     only the I-th of N slices of the seeds\n"
+		"  --type          shader stage to generate (default frag)\n"
+		"  --corpus FILE   take the shaders (and the options they're generated with) from a seed corpus\n"
+		"                  (see gen_shader --seed-corpus), only its seeds in --seeds if given\n"
+		"  --jobs N        compiler processes at once (default: one per core)\n"
+		"  --timeout-ms N  kill a compile after N ms and call it a timeout (default 10000)\n"
+		"  --memory-mb N   limit each compile's address space to N MB (running out shows up as a crash or reject)\n"
+		"  --cache FILE    keep verdicts in FILE across runs, shaders with a verdict from the same compiler\n"
+		"                  aren't compiled again\n"
+		"  --compiler-id STR  identify the compiler in the cache by STR instead of its command line and binary\n"
+		"  --verdicts FILE write \"<seed> <verdict> <exit code or signal> <content hash> <cached>\" lines to FILE\n"
+		"  --save-failures DIR  write every shader that wasn't accepted to DIR/<seed>.<type>\n"
+		"  --recheck-timeouts  compile shaders again if their cached verdict is a timeout\n");
+}
+
+int main(int argc, char** argv)
+{
+	HarnessSettings Settings;
+	BatchSourceArgs SourceArgs;
+	Settings.NumJobs = std::max<int32>(1, (int32)sysconf(_SC_NPROCESSORS_ONLN));
+
+	int32 i = 1;
+	for (; i < argc; i++)
+	{
+		const bool bHasValue = (i + 1 < argc);
+		if (strcmp(argv[i], "--") == 0)
+		{
+			i++;
+			break;
+		}
+
+		const BatchSourceArgResult SourceArg = SourceArgs.ParseArg(argc, argv, &i, true);
+		if (SourceArg == BSAR_Bad)
+		{
+			return 1;
+		}
+		else if (SourceArg == BSAR_Taken)
+		{
+			continue;
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && bHasValue)
+		{
+			Settings.NumJobs = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--timeout-ms") == 0 && bHasValue)
+		{
+			Settings.TimeoutMs = (uint32)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--memory-mb") == 0 && bHasValue)
+		{
+			Settings.MemoryLimitMB = (uint32)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--cache") == 0 && bHasValue)
+		{
+			Settings.CachePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--compiler-id") == 0 && bHasValue)
+		{
+			Settings.CompilerIDString = argv[++i];
+		}
+		else if (strcmp(argv[i], "--verdicts") == 0 && bHasValue)
+		{
+			Settings.VerdictsPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--save-failures") == 0 && bHasValue)
+		{
+			Settings.SaveFailuresDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--recheck-timeouts") == 0)
+		{
+			Settings.bRecheckTimeouts = true;
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	for (; i < argc; i++)
+	{
+		Settings.Command.push_back(argv[i]);
+	}
+	if (Settings.Command.size() == 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	BatchShaderSource Shaders;
+	if (!Shaders.Open(&SourceArgs))
+	{
+		return 1;
+	}
+	const char* Extension = GetShaderTypeExtension(SourceArgs.Options.ShaderType);
+
+	// Fills in the next shader to do, false once there are none left
+	HarnessTally Tally;
+	auto GetNextShader = [&](uint64* OutSeed, std::string* OutSource)
+	{
+		bool bGenerated = false;
+		while (Shaders.Next(OutSeed, OutSource, &bGenerated))
+		{
+			if (bGenerated)
+			{
+				return true;
+			}
+			Tally.NumGenerationFailures++;
+		}
+		return false;
+	};
+
+	VerdictCache Cache;
+	if (Settings.CachePath != nullptr)
+	{
+		std::string Error;
+		if (!Cache.Open(Settings.CachePath, &Error))
+		{
+			fprintf(stderr, "Could not use verdict cache '%s': %s\n", Settings.CachePath, Error.c_str());
+			return 1;
+		}
+	}
+	const uint64 CompilerID = MakeCompilerID(Settings);
+
+	FILE* VerdictsFile = nullptr;
+	if (Settings.VerdictsPath != nullptr)
+	{
+		VerdictsFile = fopen(Settings.VerdictsPath, "w");
+		if (VerdictsFile == nullptr)
+		{
+			fprintf(stderr, "Could not open '%s' for writing\n", Settings.VerdictsPath);
+			return 1;
+		}
+	}
+
+	const char* TmpDir = getenv("TMPDIR");
+	std::string WorkDirPattern = std::string((TmpDir != nullptr && TmpDir[0] != '\0') ? TmpDir : "/tmp") + "/gen_harness.XXXXXX";
+	if (mkdtemp(&WorkDirPattern[0]) == nullptr)
+	{
+		fprintf(stderr, "Could not make a work directory\n");
+		return 1;
+	}
+	const std::string WorkDir = WorkDirPattern;
+
+	std::vector<CompileSlot> Slots(Settings.NumJobs);
+	for (int32 s = 0; s < Settings.NumJobs; s++)
+	{
+		Slots[s].Path = WorkDir + StringStackBuffer<64>("/slot%d.%s", s, Extension).buffer;
+	}
+
+	auto RecordVerdict = [&](uint64 Seed, uint64 ContentHash, const std::string& Source, CompileVerdict Verdict, uint16_t Detail, bool bCached)
+	{
+		Tally.Counts[Verdict]++;
+		Tally.NumCached += bCached ? 1 : 0;
+		Tally.bSawExit127 |= (Verdict == CV_Reject && Detail == 127);
+
+		if (VerdictsFile != nullptr)
+		{
+			fprintf(VerdictsFile, "%llu %s %u %016llx %d\n", (unsigned long long)Seed, GetCompileVerdictName(Verdict), (uint32)Detail,
+				(unsigned long long)ContentHash, bCached ? 1 : 0);
+		}
+
+		if (Verdict != CV_Accept && Settings.SaveFailuresDir != nullptr)
+		{
+			const std::string FailurePath = std::string(Settings.SaveFailuresDir) + StringStackBuffer<64>("/%06llu.%s", (unsigned long long)Seed, Extension).buffer;
+			if (!WriteWholeFile(FailurePath, Source))
+			{
+				fprintf(stderr, "Could not write '%s'\n", FailurePath.c_str());
+			}
+		}
+	};
+
+	int32 NumRunning = 0;
+	bool bOutOfShaders = false;
+	bool bSpawnFailed = false;
+	uint64 Seed = 0;
+	std::string Source;
+	while (true)
+	{
+		// Keep every slot busy, cached shaders don't need one
+		for (CompileSlot& Slot : Slots)
+		{
+			while (Slot.Pid < 0 && !bOutOfShaders && !bSpawnFailed)
+			{
+				if (!GetNextShader(&Seed, &Source))
+				{
+					bOutOfShaders = true;
+					break;
+				}
+
+				const uint64 ContentHash = HashShaderContent(Source.data(), Source.size());
+				const VerdictCacheRecord* Cached = Cache.Find(ContentHash, CompilerID, (uint32)Source.size());
+				if (Cached != nullptr && !(Settings.bRecheckTimeouts && Cached->Verdict == CV_Timeout))
+				{
+					RecordVerdict(Seed, ContentHash, Source, (CompileVerdict)Cached->Verdict, Cached->Detail, true);
+					continue;
+				}
+
+				Slot.Seed = Seed;
+				Slot.ContentHash = ContentHash;
+				Slot.Source.swap(Source);
+				if (!WriteWholeFile(Slot.Path, Slot.Source) || !SpawnCompiler(Settings, &Slot))
+				{
+					fprintf(stderr, "Could not start '%s' on seed %llu\n", Settings.Command[0].c_str(), (unsigned long long)Seed);
+					bSpawnFailed = true;
+					break;
+				}
+				NumRunning++;
+			}
+		}
+
+		if (NumRunning == 0)
+		{
+			break;
+		}
+
+		int Status = 0;
+		const pid_t Finished = waitpid(-1, &Status, WNOHANG);
+		if (Finished > 0)
+		{
+			for (CompileSlot& Slot : Slots)
+			{
+				if (Slot.Pid != Finished)
+				{
+					continue;
+				}
+
+				uint16_t Detail = 0;
+				const CompileVerdict Verdict = ClassifyExit(Status, Slot.bTimedOut, &Detail);
+				RecordVerdict(Slot.Seed, Slot.ContentHash, Slot.Source, Verdict, Detail, false);
+
+				// 127 is also what a command that couldn't be run at all exits with, which says nothing about the shader
+				const bool bCacheable = !(Verdict == CV_Reject && Detail == 127);
+				if (Settings.CachePath != nullptr && bCacheable && !Cache.Add(VerdictCacheRecord{ Slot.ContentHash, CompilerID, (uint32)Slot.Source.size(), (uint16_t)Verdict, Detail }))
+				{
+					fprintf(stderr, "Could not write to verdict cache '%s'\n", Settings.CachePath);
+				}
+
+				Slot.Pid = -1;
+				NumRunning--;
+				break;
+			}
+			continue;
+		}
+
+		const uint64 NowMs = GetMonotonicMs();
+		for (CompileSlot& Slot : Slots)
+		{
+			if (Slot.Pid >= 0 && !Slot.bTimedOut && NowMs >= Slot.DeadlineMs)
+			{
+				kill(-Slot.Pid, SIGKILL);
+				Slot.bTimedOut = true;
+			}
+		}
+
+		// Compiles take milliseconds at best, polling this often costs nothing next to them
+		timespec Nap = { 0, 1000000 };
+		nanosleep(&Nap, nullptr);
+	}
+
+	for (CompileSlot& Slot : Slots)
+	{
+		unlink(Slot.Path.c_str());
+	}
+	rmdir(WorkDir.c_str());
+
+	bool bSuccess = !bSpawnFailed;
+	if (Settings.CachePath != nullptr && !Cache.Flush())
+	{
+		fprintf(stderr, "Could not write to verdict cache '%s'\n", Settings.CachePath);
+		bSuccess = false;
+	}
+	if (VerdictsFile != nullptr)
+	{
+		bSuccess &= (fclose(VerdictsFile) == 0);
+	}
+
+	fprintf(stderr, "accept %llu, reject %llu, crash %llu, timeout %llu (%llu from the cache), %llu failed to generate\n",
+		(unsigned long long)Tally.Counts[CV_Accept], (unsigned long long)Tally.Counts[CV_Reject], (unsigned long long)Tally.Counts[CV_Crash],
+		(unsigned long long)Tally.Counts[CV_Timeout], (unsigned long long)Tally.NumCached, (unsigned long long)Tally.NumGenerationFailures);
+	if (Tally.bSawExit127)
+	{
+		fprintf(stderr, "Some compiles exited with 127, which is also what a command that couldn't be run exits with, so they weren't cached\n");
+	}
+
+	return bSuccess ? 0 : 1;
+}
@@ -0,0 +1,432 @@
+// Puts the output of a sharded batch run (gen_shader/gen_c_preproc --shard I/N --manifest FILE on
+// each machine) back together: checks the shards came from the same generator and options, that no
+// seed was generated twice and none is missing, and that every output still matches the hash in
+// its manifest, then copies everything into one corpus with one manifest.
+
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "stack_string.h"
+#include "batch_manifest.h"
+#include "packed_corpus.h"
+
+using int32 = int32_t;
+using uint64 = uint64_t;
+
+struct ShardInfo
+{
+	const char* ManifestPath = nullptr;
+	BatchManifest Manifest;
+	PackedCorpusReader Packed;
+};
+
+struct ShardRange
+{
+	BatchManifestRange Range;
+	int32 ShardIndex;
+};
+
+static bool IsPerSeedPattern(const std::string& Pattern)
+{
+	return Pattern.find('%') != std::string::npos;
+}
+
+static std::string FormatSeedPath(const std::string& Pattern, uint64 Seed)
+{
+	return StringStackBuffer<4096>(Pattern.c_str(), (unsigned long long)Seed).buffer;
+}
+
+static bool ReadWholeFile(const std::string& Path, std::string* OutData)
+{
+	FILE* f = fopen(Path.c_str(), "rb");
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	OutData->clear();
+	char Chunk[64 * 1024];
+	size_t NumRead = 0;
+	while ((NumRead = fread(Chunk, 1, sizeof(Chunk), f)) > 0)
+	{
+		OutData->append(Chunk, NumRead);
+	}
+
+	const bool bSuccess = (ferror(f) == 0);
+	fclose(f);
+	return bSuccess;
+}
+
+static bool WriteWholeFile(const std::string& Path, const std::string& Data)
+{
+	FILE* f = fopen(Path.c_str(), "wb");
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	bool bSuccess = (fwrite(Data.data(), 1, Data.size(), f) == Data.size());
+	bSuccess &= (fclose(f) == 0);
+	return bSuccess;
+}
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"usage: gen_merge [--seeds A..B] [--check | --out MANIFEST (--out-dir DIR | --packed FILE)] SHARD_MANIFEST...\n"
+		"  Merges the output of shards run with --shard I/N --manifest FILE into one corpus\n"
+		"  --seeds A..B    the seeds the shards should cover between them, exactly once each.\n"
+		"                  Without it, they have to cover one contiguous range\n"
+		"  --check         only check coverage and hashes, don't copy anything\n"
+		"  --out MANIFEST  manifest for the merged corpus\n"
+		"  --out-dir DIR   where to copy per-seed files (the shards wrote a file per seed)\n"
+		"  --packed FILE   where to write the merged packed corpus (the shards wrote packed corpora)\n");
+}
+
+int main(int argc, char** argv)
+{
+	bool bHasSeedRange = false;
+	uint64 FirstSeed = 0;
+	uint64 EndSeed = 0;
+	bool bCheckOnly = false;
+	const char* OutManifestPath = nullptr;
+	const char* OutDir = nullptr;
+	const char* OutPackedPath = nullptr;
+	std::vector<ShardInfo> Shards;
+
+	int32 NumShardArgs = 0;
+	for (int32 i = 1; i < argc; i++)
+	{
+		const bool bHasValue = (i + 1 < argc);
+		if (strcmp(argv[i], "--seeds") == 0 && bHasValue)
+		{
+			if (!ParseBatchSeedRange(argv[++i], &FirstSeed, &EndSeed))
+			{
+				fprintf(stderr, "Bad seed range '%s'\n", argv[i]);
+				return 1;
+			}
+			bHasSeedRange = true;
+		}
+		else if (strcmp(argv[i], "--check") == 0)
+		{
+			bCheckOnly = true;
+		}
+		else if (strcmp(argv[i], "--out") == 0 && bHasValue)
+		{
+			OutManifestPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--out-dir") == 0 && bHasValue)
+		{
+			OutDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--packed") == 0 && bHasValue)
+		{
+			OutPackedPath = argv[++i];
+		}
+		else if (argv[i][0] == '-')
+		{
+			PrintUsage();
+			return 1;
+		}
+		else
+		{
+			NumShardArgs++;
+		}
+	}
+
+	if (NumShardArgs == 0 || (!bCheckOnly && (OutManifestPath == nullptr || (OutDir == nullptr) == (OutPackedPath == nullptr))))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// Readers can't be moved once open, so size this up front
+	Shards.resize(NumShardArgs);
+	for (int32 i = 1, ShardIndex = 0; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			// Skip the flag's value too
+			i += (strcmp(argv[i], "--check") != 0) ? 1 : 0;
+			continue;
+		}
+
+		ShardInfo& Shard = Shards[ShardIndex++];
+		Shard.ManifestPath = argv[i];
+		if (Shard.Manifest.Load(Shard.ManifestPath) != BMLR_Ok)
+		{
+			fprintf(stderr, "Could not load manifest '%s'\n", Shard.ManifestPath);
+			return 1;
+		}
+	}
+
+	// Same generator and options everywhere, otherwise the shards are pieces of different corpora
+	const BatchManifest& FirstManifest = Shards[0].Manifest;
+	const bool bPerSeedFiles = IsPerSeedPattern(FirstManifest.OutputPattern);
+	for (int32 i = 1; i < (int32)Shards.size(); i++)
+	{
+		// Output locations are allowed to differ, that's the whole point
+		BatchManifest Other = Shards[i].Manifest;
+		Other.OutputPattern = FirstManifest.OutputPattern;
+
+		std::string Reason;
+		if (!FirstManifest.IsCompatibleWith(Other, &Reason))
+		{
+			fprintf(stderr, "'%s' doesn't match '%s': %s\n", Shards[i].ManifestPath, Shards[0].ManifestPath, Reason.c_str());
+			return 1;
+		}
+
+		if (IsPerSeedPattern(Shards[i].Manifest.OutputPattern) != bPerSeedFiles || Shards[i].Manifest.ExtraPatterns.size() != FirstManifest.ExtraPatterns.size())
+		{
+			fprintf(stderr, "'%s' has a different kind of output than '%s'\n", Shards[i].ManifestPath, Shards[0].ManifestPath);
+			return 1;
+		}
+	}
+
+	if (!bCheckOnly && (OutDir != nullptr) != bPerSeedFiles)
+	{
+		fprintf(stderr, bPerSeedFiles ? "The shards wrote a file per seed, use --out-dir\n" : "The shards wrote packed corpora, use --packed\n");
+		return 1;
+	}
+
+	// Coverage: every range from every shard in seed order, each one has to start where the previous ended
+	std::vector<ShardRange> AllRanges;
+	for (int32 i = 0; i < (int32)Shards.size(); i++)
+	{
+		for (const auto& Range : Shards[i].Manifest.Ranges)
+		{
+			AllRanges.push_back(ShardRange{ Range, i });
+		}
+	}
+
+	std::sort(AllRanges.begin(), AllRanges.end(), [](const ShardRange& LHS, const ShardRange& RHS)
+	{
+		return LHS.Range.FirstSeed < RHS.Range.FirstSeed;
+	});
+
+	if (AllRanges.size() == 0)
+	{
+		fprintf(stderr, "The shards have no seeds in them\n");
+		return 1;
+	}
+
+	if (!bHasSeedRange)
+	{
+		FirstSeed = AllRanges.front().Range.FirstSeed;
+		EndSeed = AllRanges.back().Range.EndSeed;
+	}
+
+	int32 NumErrors = 0;
+	uint64 CoveredUpTo = FirstSeed;
+	for (int32 i = 0; i < (int32)AllRanges.size(); i++)
+	{
+		const BatchManifestRange& Range = AllRanges[i].Range;
+		if (Range.FirstSeed > CoveredUpTo)
+		{
+			fprintf(stderr, "Missing seeds %llu..%llu\n", (unsigned long long)CoveredUpTo, (unsigned long long)std::min(Range.FirstSeed, EndSeed));
+			NumErrors++;
+		}
+		else if (Range.FirstSeed < CoveredUpTo && i > 0)
+		{
+			fprintf(stderr, "Seeds %llu..%llu are in both '%s' and '%s'\n", (unsigned long long)Range.FirstSeed, (unsigned long long)std::min(Range.EndSeed, CoveredUpTo),
+				Shards[AllRanges[i - 1].ShardIndex].ManifestPath, Shards[AllRanges[i].ShardIndex].ManifestPath);
+			NumErrors++;
+		}
+
+		if (Range.FirstSeed < FirstSeed || Range.EndSeed > EndSeed)
+		{
+			fprintf(stderr, "'%s' has seeds %llu..%llu, outside of %llu..%llu\n", Shards[AllRanges[i].ShardIndex].ManifestPath,
+				(unsigned long long)Range.FirstSeed, (unsigned long long)Range.EndSeed, (unsigned long long)FirstSeed, (unsigned long long)EndSeed);
+			NumErrors++;
+		}
+
+		CoveredUpTo = std::max(CoveredUpTo, Range.EndSeed);
+	}
+
+	if (CoveredUpTo < EndSeed)
+	{
+		fprintf(stderr, "Missing seeds %llu..%llu\n", (unsigned long long)CoveredUpTo, (unsigned long long)EndSeed);
+		NumErrors++;
+	}
+
+	if (NumErrors > 0)
+	{
+		fprintf(stderr, "%d coverage errors, not merging\n", NumErrors);
+		return 1;
+	}
+
+	// Now go through every seed's output, checking it against its range's hash and copying it over.
+	// The merged manifest gets its own hash, computed as we go
+	BatchManifest OutManifest;
+	OutManifest.Generator = FirstManifest.Generator;
+	OutManifest.GeneratorVersion = FirstManifest.GeneratorVersion;
+	OutManifest.Config = FirstManifest.Config;
+
+	PackedCorpusWriter OutPacked;
+	std::vector<std::string> OutExtraPatterns;
+	std::string OutPattern;
+	if (!bCheckOnly)
+	{
+		if (bPerSeedFiles)
+		{
+			std::error_code Error;
+			std::filesystem::create_directories(OutDir, Error);
+
+			OutPattern = std::string(OutDir) + "/" + std::filesystem::path(FirstManifest.OutputPattern).filename().generic_string();
+			OutManifest.OutputPattern = MakeManifestRelativePath(OutManifestPath, OutPattern);
+			for (const auto& Extra : FirstManifest.ExtraPatterns)
+			{
+				OutExtraPatterns.push_back(std::string(OutDir) + "/" + std::filesystem::path(Extra).filename().generic_string());
+				OutManifest.ExtraPatterns.push_back(MakeManifestRelativePath(OutManifestPath, OutExtraPatterns.back()));
+			}
+		}
+		else
+		{
+			if (!OutPacked.Open(OutPackedPath))
+			{
+				fprintf(stderr, "Could not open '%s' for writing\n", OutPackedPath);
+				return 1;
+			}
+			OutManifest.OutputPattern = MakeManifestRelativePath(OutManifestPath, OutPackedPath);
+		}
+	}
+
+	if (!bPerSeedFiles)
+	{
+		for (auto& Shard : Shards)
+		{
+			const std::string PackedPath = ResolveManifestRelativePath(Shard.ManifestPath, Shard.Manifest.OutputPattern);
+			if (!Shard.Packed.Open(PackedPath.c_str()))
+			{
+				fprintf(stderr, "Could not open packed corpus '%s'\n", PackedPath.c_str());
+				return 1;
+			}
+		}
+	}
+
+	std::string Data;
+	for (const ShardRange& Entry : AllRanges)
+	{
+		ShardInfo& Shard = Shards[Entry.ShardIndex];
+		const BatchManifestRange& Range = Entry.Range;
+		uint64 Hash = BATCH_MANIFEST_HASH_INIT;
+		bool bRangeOk = true;
+
+		if (bPerSeedFiles)
+		{
+			const std::string Pattern = ResolveManifestRelativePath(Shard.ManifestPath, Shard.Manifest.OutputPattern);
+			for (uint64 Seed = Range.FirstSeed; Seed < Range.EndSeed && bRangeOk; Seed++)
+			{
+				const std::string Path = FormatSeedPath(Pattern, Seed);
+				if (!ReadWholeFile(Path, &Data))
+				{
+					fprintf(stderr, "Could not read '%s'\n", Path.c_str());
+					bRangeOk = false;
+					break;
+				}
+
+				Hash = HashBatchOutput(Hash, Seed, Data.data(), Data.size());
+				if (bCheckOnly)
+				{
+					continue;
+				}
+
+				OutManifest.AddSeed(Seed, Data.data(), Data.size());
+				bRangeOk &= WriteWholeFile(FormatSeedPath(OutPattern, Seed), Data);
+
+				// Extras aren't hashed, and a seed that failed to generate might not have them
+				for (int32 e = 0; e < (int32)OutExtraPatterns.size(); e++)
+				{
+					if (ReadWholeFile(FormatSeedPath(ResolveManifestRelativePath(Shard.ManifestPath, Shard.Manifest.ExtraPatterns[e]), Seed), &Data))
+					{
+						bRangeOk &= WriteWholeFile(FormatSeedPath(OutExtraPatterns[e], Seed), Data);
+					}
+				}
+			}
+		}
+		else
+		{
+			// Shards write their corpus in seed order, so each range is the next run of records.
+			// Anything before it (a seed that's not in the manifest) gets skipped
+			uint64 NumSources = 0;
+			PackedCorpusRecord Record;
+			while (true)
+			{
+				const size_t RecordOffset = Shard.Packed.Offset;
+				if (!Shard.Packed.Next(&Record))
+				{
+					break;
+				}
+
+				if (Record.Seed >= Range.EndSeed)
+				{
+					Shard.Packed.Offset = RecordOffset;
+					break;
+				}
+				else if (Record.Seed < Range.FirstSeed)
+				{
+					continue;
+				}
+
+				if (Record.Kind == PCRK_Source)
+				{
+					Hash = HashBatchOutput(Hash, Record.Seed, Record.Data, Record.Length);
+					NumSources++;
+					if (!bCheckOnly)
+					{
+						OutManifest.AddSeed(Record.Seed, Record.Data, Record.Length);
+					}
+				}
+
+				if (!bCheckOnly && !OutPacked.WriteRecord(Record.Seed, Record.Kind, Record.Data, Record.Length))
+				{
+					fprintf(stderr, "Could not write to '%s'\n", OutPackedPath);
+					return 1;
+				}
+			}
+
+			if (NumSources != Range.EndSeed - Range.FirstSeed)
+			{
+				fprintf(stderr, "'%s' has %llu of the programs for seeds %llu..%llu\n", Shard.Manifest.OutputPattern.c_str(),
+					(unsigned long long)NumSources, (unsigned long long)Range.FirstSeed, (unsigned long long)Range.EndSeed);
+				bRangeOk = false;
+			}
+		}
+
+		if (bRangeOk && Hash != Range.Hash)
+		{
+			fprintf(stderr, "Seeds %llu..%llu from '%s' don't match the hash in its manifest\n", (unsigned long long)Range.FirstSeed, (unsigned long long)Range.EndSeed, Shard.ManifestPath);
+			bRangeOk = false;
+		}
+
+		NumErrors += bRangeOk ? 0 : 1;
+	}
+
+	OutPacked.Close();
+
+	if (NumErrors > 0)
+	{
+		fprintf(stderr, "%d ranges failed to verify\n", NumErrors);
+		return 1;
+	}
+
+	if (!bCheckOnly && !OutManifest.Save(OutManifestPath))
+	{
+		fprintf(stderr, "Could not save manifest '%s'\n", OutManifestPath);
+		return 1;
+	}
+
+	fprintf(stderr, "%llu seeds from %d shards %s\n", (unsigned long long)(EndSeed - FirstSeed), (int32)Shards.size(), bCheckOnly ? "check out" : "merged");
+	return 0;
+}
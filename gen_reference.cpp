@@ -0,0 +1,664 @@
+// Reference results at native speed: generates shaders, translates them to C++ (GENSHADER_DIALECT_CPP,
+// see shader_dialect.h), compiles a batch of them at a time into one shared object with the local C++
+// compiler (split into a translation unit per job, compiled in parallel), loads it, and runs every
+// shader over a grid of points (see shader_reference.h for what the inputs and uniforms get set to there).
+// Prints a hash of each shader's output grid, --packed keeps the grids themselves for comparing against.
+// POSIX only, it's built around fork/exec and dlopen.
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stack_string.h"
+#include "gen_shader.h"
+#include "batch_manifest.h"
+#include "packed_corpus.h"
+#include "seed_corpus.h"
+#include "batch_source.h"
+#include "shader_dialect.h"
+#include "shader_reference.h"
+
+using int32 = int32_t;
+using uint32 = uint32_t;
+using uint64 = uint64_t;
+
+struct ReferenceSettings
+{
+	// Run through the shell, so it can be e.g. "ccache g++"
+	std::string Compiler = "c++";
+	// On top of -std=c++17 -fPIC -fwrapv -fno-math-errno, which the translation needs (see shader_reference.h).
+	// Contraction into FMAs would round differently from one machine to the next
+	std::string CompilerFlags = "-O1 -ffp-contract=off";
+	// GCC 11 and up get -fno-ipa-modref after CompilerFlags whatever they are: GCC 12's mod/ref analysis loses
+	// stores around the libm calls at -O1 and up (see shader_reference.h), and a reference is no use if it's wrong
+	bool bNoIPAModref = false;
+	std::string IncludeDir;
+	std::string WorkDir;
+	int32 NumJobs = 1;
+	int32 GridWidth = 32;
+	int32 GridHeight = 32;
+	uint32 BatchSize = 256;
+	bool bKeepFiles = false;
+};
+
+enum ReferenceStatus
+{
+	RS_Ok,
+	// Generating it failed, or it didn't match what the seed corpus recorded
+	RS_GenerationFailed,
+	// It has array types, which have no C++ translation
+	RS_Untranslatable,
+	// Its translation unit didn't compile, or the batch didn't link
+	RS_CompileFailed,
+};
+
+static const char* GetReferenceStatusName(ReferenceStatus Status)
+{
+	switch (Status)
+	{
+	case RS_Ok: return "ok";
+	case RS_GenerationFailed: return "generation-failed";
+	case RS_Untranslatable: return "untranslatable";
+	case RS_CompileFailed: return "compile-failed";
+	default:
+		assert(false && "bad enum");
+		return "unknown";
+	}
+}
+
+struct ReferenceShader
+{
+	uint64 Seed = 0;
+	// Which of the seed's --variants it is, -1 for the shader itself
+	int32 Variant = -1;
+	ReferenceStatus Status = RS_Ok;
+	std::string Source;
+	std::string CPPSource;
+	// Which translation unit of the batch it's in
+	int32 Unit = -1;
+	const GenShaderReference::ShaderReferenceEntry* Entry = nullptr;
+	// GridWidth * GridHeight points of 4 floats
+	std::vector<float> Grid;
+};
+
+static void CopyToString(const char* Source, size_t Length, void* UserData)
+{
+	((std::string*)UserData)->assign(Source, Length);
+}
+
+// Whether Compiler is GCC 11 or later, which has -fno-ipa-modref (clang defines __GNUC__ too, as 4)
+static bool IsGCCWithIPAModref(const std::string& Compiler)
+{
+	FILE* Pipe = popen((Compiler + " -dM -E -x c++ /dev/null 2> /dev/null").c_str(), "r");
+	if (Pipe == nullptr)
+	{
+		return false;
+	}
+
+	bool bClang = false;
+	int32 GNUMajor = 0;
+	char Line[256];
+	while (fgets(Line, sizeof(Line), Pipe) != nullptr)
+	{
+		bClang |= (strncmp(Line, "#define __clang__ ", 18) == 0);
+		sscanf(Line, "#define __GNUC__ %d", &GNUMajor);
+	}
+	pclose(Pipe);
+	return !bClang && GNUMajor >= 11;
+}
+
+static std::string ShellQuote(const std::string& Arg)
+{
+	std::string Quoted = "'";
+	for (char c : Arg)
+	{
+		Quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+	}
+	return Quoted + "'";
+}
+
+static pid_t SpawnShellCommand(const std::string& Command)
+{
+	const pid_t Pid = fork();
+	if (Pid == 0)
+	{
+		execl("/bin/sh", "sh", "-c", Command.c_str(), (char*)nullptr);
+		_exit(127);
+	}
+	return Pid;
+}
+
+static bool WaitForSuccess(pid_t Pid)
+{
+	int Status = 0;
+	while (waitpid(Pid, &Status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			return false;
+		}
+	}
+	return WIFEXITED(Status) && WEXITSTATUS(Status) == 0;
+}
+
+// Writes the batch's shaders into one translation unit per job (each in a namespace of its own, with a
+// table of their RunShaderGrids to look up), compiles them all at once and links what compiled into
+// one shared object. Shaders in units that didn't compile get RS_CompileFailed. Returns the path of the
+// shared object, empty if nothing compiled or it didn't link
+static std::string BuildBatch(const ReferenceSettings& Settings, uint64 BatchIndex, std::vector<ReferenceShader>* Shaders)
+{
+	std::vector<ReferenceShader*> Translated;
+	for (ReferenceShader& Shader : *Shaders)
+	{
+		if (Shader.Status == RS_Ok)
+		{
+			Translated.push_back(&Shader);
+		}
+	}
+	if (Translated.empty())
+	{
+		return std::string();
+	}
+
+	const int32 NumUnits = std::min<int32>(Settings.NumJobs, (int32)Translated.size());
+	std::vector<std::string> Units(NumUnits);
+	std::vector<std::string> Tables(NumUnits);
+	for (size_t i = 0; i < Translated.size(); i++)
+	{
+		ReferenceShader* Shader = Translated[i];
+		Shader->Unit = (int32)((i * NumUnits) / Translated.size());
+
+		const std::string Namespace = (Shader->Variant < 0) ? StringStackBuffer<64>("shader_%llu", (unsigned long long)Shader->Seed).buffer
+			: StringStackBuffer<64>("shader_%llu_v%d", (unsigned long long)Shader->Seed, Shader->Variant).buffer;
+		std::string& Unit = Units[Shader->Unit];
+		Unit += "#define SHADER_REFERENCE_NAMESPACE " + Namespace + "\n";
+		Unit += Shader->CPPSource;
+		Unit += "#undef SHADER_REFERENCE_NAMESPACE\n\n";
+		Tables[Shader->Unit] += StringStackBuffer<256>("\t{ %lluull, &GenShaderReference::%s::RunShaderGrid },\n", (unsigned long long)Shader->Seed, Namespace.c_str()).buffer;
+	}
+
+	const std::string Prefix = Settings.WorkDir + StringStackBuffer<64>("/batch_%llu", (unsigned long long)BatchIndex).buffer;
+	std::vector<pid_t> Compiles(NumUnits, -1);
+	for (int32 u = 0; u < NumUnits; u++)
+	{
+		const std::string UnitPath = Prefix + StringStackBuffer<64>("_unit_%d", u).buffer;
+		Units[u] += StringStackBuffer<128>("extern \"C\" const GenShaderReference::ShaderReferenceEntry gen_reference_unit_%d[] = {\n", u).buffer;
+		Units[u] += Tables[u] + "};\n";
+		if (!WriteWholeFile(UnitPath + ".cpp", Units[u]))
+		{
+			fprintf(stderr, "Could not write %s.cpp\n", UnitPath.c_str());
+			continue;
+		}
+
+		Compiles[u] = SpawnShellCommand(Settings.Compiler + " -std=c++17 -fPIC -fwrapv -fno-math-errno -w " + Settings.CompilerFlags
+			+ (Settings.bNoIPAModref ? " -fno-ipa-modref" : "") + " -I" + ShellQuote(Settings.IncludeDir)
+			+ " -c " + ShellQuote(UnitPath + ".cpp") + " -o " + ShellQuote(UnitPath + ".o") + " 2> " + ShellQuote(UnitPath + ".log"));
+	}
+
+	std::string Objects;
+	for (int32 u = 0; u < NumUnits; u++)
+	{
+		const std::string UnitPath = Prefix + StringStackBuffer<64>("_unit_%d", u).buffer;
+		if (Compiles[u] > 0 && WaitForSuccess(Compiles[u]))
+		{
+			Objects += " " + ShellQuote(UnitPath + ".o");
+			continue;
+		}
+
+		fprintf(stderr, "Compiling %s.cpp failed, see %s.log\n", UnitPath.c_str(), UnitPath.c_str());
+		for (ReferenceShader* Shader : Translated)
+		{
+			if (Shader->Unit == u)
+			{
+				Shader->Status = RS_CompileFailed;
+			}
+		}
+	}
+	if (Objects.empty())
+	{
+		return std::string();
+	}
+
+	const std::string SharedObjectPath = Prefix + ".so";
+	if (!WaitForSuccess(SpawnShellCommand(Settings.Compiler + " -shared -o " + ShellQuote(SharedObjectPath) + Objects + " 2> " + ShellQuote(Prefix + "_link.log"))))
+	{
+		fprintf(stderr, "Linking %s failed, see %s_link.log\n", SharedObjectPath.c_str(), Prefix.c_str());
+		for (ReferenceShader* Shader : Translated)
+		{
+			Shader->Status = (Shader->Status == RS_Ok) ? RS_CompileFailed : Shader->Status;
+		}
+		return std::string();
+	}
+	return SharedObjectPath;
+}
+
+// Looks up each shader's entry in the shared object and runs them all over the grid, on NumJobs threads
+static bool RunBatch(const ReferenceSettings& Settings, const std::string& SharedObjectPath, std::vector<ReferenceShader>* Shaders)
+{
+	void* Library = dlopen(SharedObjectPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (Library == nullptr)
+	{
+		fprintf(stderr, "Could not load %s: %s\n", SharedObjectPath.c_str(), dlerror());
+		return false;
+	}
+
+	std::vector<ReferenceShader*> ToRun;
+	std::vector<int32> NextInUnit;
+	for (ReferenceShader& Shader : *Shaders)
+	{
+		if (Shader.Status != RS_Ok)
+		{
+			continue;
+		}
+
+		const std::string Symbol = StringStackBuffer<64>("gen_reference_unit_%d", Shader.Unit).buffer;
+		const GenShaderReference::ShaderReferenceEntry* Table = (const GenShaderReference::ShaderReferenceEntry*)dlsym(Library, Symbol.c_str());
+		if (Table == nullptr)
+		{
+			fprintf(stderr, "%s has no %s\n", SharedObjectPath.c_str(), Symbol.c_str());
+			dlclose(Library);
+			return false;
+		}
+
+		// Each unit's table is in the order its shaders were added
+		NextInUnit.resize(std::max<size_t>(NextInUnit.size(), Shader.Unit + 1), 0);
+		Shader.Entry = &Table[NextInUnit[Shader.Unit]++];
+		assert(Shader.Entry->Seed == Shader.Seed);
+		ToRun.push_back(&Shader);
+	}
+
+	std::atomic<size_t> NextShader(0);
+	auto RunShaders = [&]()
+	{
+		for (size_t i = NextShader++; i < ToRun.size(); i = NextShader++)
+		{
+			ReferenceShader* Shader = ToRun[i];
+			Shader->Grid.resize((size_t)Settings.GridWidth * Settings.GridHeight * 4);
+			Shader->Entry->RunShaderGrid(Settings.GridWidth, Settings.GridHeight, Shader->Grid.data());
+		}
+	};
+
+	std::vector<std::thread> Threads;
+	for (int32 i = 1; i < Settings.NumJobs && i < (int32)ToRun.size(); i++)
+	{
+		Threads.emplace_back(RunShaders);
+	}
+	RunShaders();
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+
+	dlclose(Library);
+	return true;
+}
+
+static void RemoveBatchFiles(const ReferenceSettings& Settings, uint64 BatchIndex)
+{
+	const std::string Prefix = StringStackBuffer<64>("batch_%llu", (unsigned long long)BatchIndex).buffer;
+	std::error_code Error;
+	for (const auto& File : std::filesystem::directory_iterator(Settings.WorkDir, Error))
+	{
+		const std::string Name = File.path().filename().string();
+		if (Name.compare(0, Prefix.size(), Prefix) == 0 && (Name.size() == Prefix.size() || Name[Prefix.size()] == '_' || Name[Prefix.size()] == '.'))
+		{
+			std::filesystem::remove(File.path(), Error);
+		}
+	}
+}
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"usage: gen_reference [--seeds A..B] [--shard I/N] [--type vert|frag] [--corpus FILE] [--grid WxH]\n"
+		"                     [--batch N] [--jobs N] [--cxx COMMAND] [--cxxflags FLAGS] [--include DIR]\n"
+		"                     [--work-dir DIR] [--keep] [--packed FILE] [--results FILE] [--variants N]\n"
+		"  Translates shaders to C++, compiles them natively and runs each over a grid, printing\n"
+		"  \"<seed> <status> <hash of the grid> <non-finite values>\" for each (just \"<seed> <status>\" if it\n"
+		"  didn't get to run). Statuses: ok, generation-failed, untranslatable (array types), compile-failed\n"
+		"  --seeds A..B    seeds A (inclusive) to B (exclusive), default 0..1024\n"
+		"  --shard I/N     only the I-th of N slices of the seeds\n"
+		"  --type          shader stage to generate (default frag), there's no C++ for compute shaders\n"
+		"  --corpus FILE   take the shaders (and the options they're generated with) from a seed corpus\n"
+		"                  (see gen_shader --seed-corpus), only its seeds in --seeds if given\n"
+		"  --grid WxH      points to run each shader on (default 32x32), each outputs gl_FragColor or gl_Position\n"
+		"  --batch N       shaders per shared object (default 256)\n"
+		"  --jobs N        compiler processes at once, and threads running the shaders (default: one per core)\n"
+		"  --cxx COMMAND   C++ compiler (default $CXX, or c++)\n"
+		"  --cxxflags FLAGS  instead of the default \"-O1 -ffp-contract=off\" (-std=c++17 -fPIC -fwrapv -fno-math-errno are always on,\n"
+		"                  and -fno-ipa-modref after FLAGS with GCC 11 and up, whose -O1 and up otherwise miscompile some shaders)\n"
+		"  --include DIR   where shader_reference.h is (default: next to gen_reference)\n"
+		"  --work-dir DIR  where the sources, objects and shared objects go (default: a new temporary directory)\n"
+		"  --keep          leave them there afterwards\n"
+		"  --packed FILE   write each shader that ran (PCRK_Source) and its grid (PCRK_Expected, floats) into FILE\n"
+		"  --results FILE  write the result lines to FILE instead of stdout\n"
+		"  --variants N    also run N variants of each shader (see gen_shader --variants), as \"<seed>.v<k>\" lines,\n"
+		"                  with status \"differs\" if one's grid isn't exactly its shader's. Not with --corpus\n");
+}
+
+int main(int argc, char** argv)
+{
+	ReferenceSettings Settings;
+	BatchSourceArgs SourceArgs;
+	const char* PackedPath = nullptr;
+	const char* ResultsPath = nullptr;
+	int32 NumVariants = 0;
+	Settings.NumJobs = std::max<int32>(1, (int32)sysconf(_SC_NPROCESSORS_ONLN));
+	if (getenv("CXX") != nullptr && getenv("CXX")[0] != 0)
+	{
+		Settings.Compiler = getenv("CXX");
+	}
+
+	for (int32 i = 1; i < argc; i++)
+	{
+		const bool bHasValue = (i + 1 < argc);
+		const BatchSourceArgResult SourceArg = SourceArgs.ParseArg(argc, argv, &i, false);
+		if (SourceArg == BSAR_Bad)
+		{
+			return 1;
+		}
+		else if (SourceArg == BSAR_Taken)
+		{
+			continue;
+		}
+		else if (strcmp(argv[i], "--grid") == 0 && bHasValue)
+		{
+			if (sscanf(argv[++i], "%dx%d", &Settings.GridWidth, &Settings.GridHeight) != 2 || Settings.GridWidth < 1 || Settings.GridHeight < 1)
+			{
+				fprintf(stderr, "Bad grid size '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--batch") == 0 && bHasValue)
+		{
+			Settings.BatchSize = (uint32)std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && bHasValue)
+		{
+			Settings.NumJobs = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--cxx") == 0 && bHasValue)
+		{
+			Settings.Compiler = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cxxflags") == 0 && bHasValue)
+		{
+			Settings.CompilerFlags = argv[++i];
+		}
+		else if (strcmp(argv[i], "--include") == 0 && bHasValue)
+		{
+			Settings.IncludeDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--work-dir") == 0 && bHasValue)
+		{
+			Settings.WorkDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--keep") == 0)
+		{
+			Settings.bKeepFiles = true;
+		}
+		else if (strcmp(argv[i], "--packed") == 0 && bHasValue)
+		{
+			PackedPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--results") == 0 && bHasValue)
+		{
+			ResultsPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--variants") == 0 && bHasValue)
+		{
+			NumVariants = std::max(0, atoi(argv[++i]));
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	// The corpus' context doesn't keep what variants are made from
+	if (NumVariants > 0 && SourceArgs.CorpusPath != nullptr)
+	{
+		fprintf(stderr, "--variants doesn't go with --corpus\n");
+		return 1;
+	}
+	SourceArgs.Options.KeepVariantInfo = (NumVariants > 0) ? 1 : 0;
+
+	Settings.bNoIPAModref = IsGCCWithIPAModref(Settings.Compiler);
+
+	// The header is next to the binary in a build tree
+	if (Settings.IncludeDir.empty())
+	{
+		const char* Slash = strrchr(argv[0], '/');
+		Settings.IncludeDir = (Slash != nullptr) ? std::string(argv[0], Slash - argv[0]) : std::string(".");
+	}
+	struct stat HeaderStat;
+	if (stat((Settings.IncludeDir + "/shader_reference.h").c_str(), &HeaderStat) != 0)
+	{
+		fprintf(stderr, "No shader_reference.h in %s, say where it is with --include\n", Settings.IncludeDir.c_str());
+		return 1;
+	}
+	// The compiler runs in the work directory's terms, so relative paths have to survive that
+	Settings.IncludeDir = std::filesystem::absolute(Settings.IncludeDir).string();
+
+	bool bMadeWorkDir = false;
+	if (Settings.WorkDir.empty())
+	{
+		const char* TempDir = getenv("TMPDIR");
+		std::string Template = std::string((TempDir != nullptr && TempDir[0] != 0) ? TempDir : "/tmp") + "/gen_reference.XXXXXX";
+		if (mkdtemp(&Template[0]) == nullptr)
+		{
+			fprintf(stderr, "Could not make a temporary directory\n");
+			return 1;
+		}
+		Settings.WorkDir = Template;
+		bMadeWorkDir = true;
+	}
+	else
+	{
+		std::error_code Error;
+		std::filesystem::create_directories(Settings.WorkDir, Error);
+	}
+
+	BatchShaderSource Shaders;
+	if (!Shaders.Open(&SourceArgs))
+	{
+		return 1;
+	}
+	if (SourceArgs.Options.ShaderType == GENSHADER_TYPE_COMPUTE)
+	{
+		fprintf(stderr, "'%s' has compute shaders, which have no C++ translation\n", SourceArgs.CorpusPath);
+		return 1;
+	}
+
+	FILE* Results = stdout;
+	if (ResultsPath != nullptr && (Results = fopen(ResultsPath, "w")) == nullptr)
+	{
+		fprintf(stderr, "Could not open '%s'\n", ResultsPath);
+		return 1;
+	}
+
+	PackedCorpusWriter Packed;
+	if (PackedPath != nullptr && !Packed.Open(PackedPath))
+	{
+		fprintf(stderr, "Could not open '%s'\n", PackedPath);
+		return 1;
+	}
+
+	// Fills in the next shader, with its translation (or the status saying why it has none).
+	// False once there are none left
+	auto GetNextShader = [&](ReferenceShader* OutShader)
+	{
+		bool bGenerated = false;
+		if (!Shaders.Next(&OutShader->Seed, &OutShader->Source, &bGenerated))
+		{
+			return false;
+		}
+
+		OutShader->Status = RS_Ok;
+		if (!bGenerated)
+		{
+			OutShader->Status = RS_GenerationFailed;
+		}
+		else if (GenShader_GetDialectSource(Shaders.GetContext(), GENSHADER_DIALECT_CPP, CopyToString, &OutShader->CPPSource) != GENSHADER_OK)
+		{
+			OutShader->Status = RS_Untranslatable;
+		}
+		return true;
+	};
+
+	// Fills in variant Index of the shader GetNextShader just made, translated here since the context only
+	// translates what it generated
+	auto GetVariant = [&](const ReferenceShader& Original, int32 Index, ReferenceShader* OutShader)
+	{
+		OutShader->Seed = Original.Seed;
+		OutShader->Variant = Index;
+		OutShader->Status = RS_Ok;
+
+		// Variant seeds are gen_shader --variants' too, so these are the same variants it writes
+		ShaderDialectSource Analysis;
+		std::string Error;
+		if (GenShader_GetVariant(Shaders.GetContext(), Original.Seed * 0x9E3779B97F4A7C15ULL + (uint64)Index, GENSHADER_VARIANT_ALL, CopyToString, &OutShader->Source) != GENSHADER_OK)
+		{
+			OutShader->Status = RS_GenerationFailed;
+		}
+		else if (!Analysis.Analyse(OutShader->Source.data(), OutShader->Source.size(), SourceArgs.Options.ShaderType, &Error)
+			|| !EmitShaderDialect(GENSHADER_DIALECT_CPP, Analysis, &OutShader->CPPSource))
+		{
+			OutShader->Status = RS_Untranslatable;
+		}
+	};
+
+	uint64 Counts[RS_CompileFailed + 1] = {};
+	uint64 NumNonFinite = 0;
+	uint64 NumVariantsDiffering = 0;
+	bool bKeptFailures = false;
+	// Each shader that translated is followed by its variants
+	std::vector<ReferenceShader> Batch(Settings.BatchSize * (1 + NumVariants));
+	for (uint64 BatchIndex = 0;; BatchIndex++)
+	{
+		size_t NumShaders = 0;
+		while (NumShaders < Batch.size() && GetNextShader(&Batch[NumShaders]))
+		{
+			const ReferenceShader& Original = Batch[NumShaders];
+			Batch[NumShaders].Variant = -1;
+			Batch[NumShaders].Unit = -1;
+			Batch[NumShaders].Entry = nullptr;
+			NumShaders++;
+
+			for (int32 v = 0; Original.Status == RS_Ok && v < NumVariants; v++)
+			{
+				GetVariant(Original, v, &Batch[NumShaders]);
+				Batch[NumShaders].Unit = -1;
+				Batch[NumShaders].Entry = nullptr;
+				NumShaders++;
+			}
+		}
+		if (NumShaders == 0)
+		{
+			break;
+		}
+		Batch.resize(NumShaders);
+
+		const std::string SharedObjectPath = BuildBatch(Settings, BatchIndex, &Batch);
+		if (!SharedObjectPath.empty() && !RunBatch(Settings, SharedObjectPath, &Batch))
+		{
+			return 1;
+		}
+
+		const ReferenceShader* Original = nullptr;
+		for (ReferenceShader& Shader : Batch)
+		{
+			Original = (Shader.Variant < 0) ? &Shader : Original;
+			const StringStackBuffer<64> Name = (Shader.Variant < 0) ? StringStackBuffer<64>("%llu", (unsigned long long)Shader.Seed)
+				: StringStackBuffer<64>("%llu.v%d", (unsigned long long)Shader.Seed, Shader.Variant);
+
+			Counts[Shader.Status]++;
+			if (Shader.Status != RS_Ok)
+			{
+				fprintf(Results, "%s %s\n", Name.buffer, GetReferenceStatusName(Shader.Status));
+				bKeptFailures |= (Shader.Status == RS_CompileFailed);
+				continue;
+			}
+
+			// NaNs' sign and payload bits depend on which instructions made them, so they all become the one
+			// NaN and the hash only changes when a result does
+			uint64 ShaderNonFinite = 0;
+			for (float& Value : Shader.Grid)
+			{
+				ShaderNonFinite += !std::isfinite(Value);
+				Value = std::isnan(Value) ? std::numeric_limits<float>::quiet_NaN() : Value;
+			}
+			NumNonFinite += ShaderNonFinite;
+
+			const uint32 GridBytes = (uint32)(Shader.Grid.size() * sizeof(float));
+			const uint64 Hash = HashBatchOutput(BATCH_MANIFEST_HASH_INIT, 0, (const char*)Shader.Grid.data(), GridBytes);
+
+			// Variants compute the same thing, so anything but the same bits is a bug in them or in the compiler
+			// (there's nothing to compare with if the shader itself didn't compile)
+			if (Shader.Variant >= 0)
+			{
+				const bool bDiffers = (Original->Status == RS_Ok) && memcmp(Original->Grid.data(), Shader.Grid.data(), GridBytes) != 0;
+				NumVariantsDiffering += bDiffers ? 1 : 0;
+				fprintf(Results, "%s %s %016llx %llu\n", Name.buffer, bDiffers ? "differs" : "ok", (unsigned long long)Hash, (unsigned long long)ShaderNonFinite);
+				continue;
+			}
+			fprintf(Results, "%s ok %016llx %llu\n", Name.buffer, (unsigned long long)Hash, (unsigned long long)ShaderNonFinite);
+
+			if (PackedPath != nullptr && !(Packed.WriteRecord(Shader.Seed, PCRK_Source, Shader.Source.data(), (uint32)Shader.Source.size())
+				&& Packed.WriteRecord(Shader.Seed, PCRK_Expected, (const char*)Shader.Grid.data(), GridBytes)))
+			{
+				fprintf(stderr, "Could not write to '%s'\n", PackedPath);
+				return 1;
+			}
+		}
+
+		// Failed compiles stay around to look at
+		if (!Settings.bKeepFiles && !bKeptFailures)
+		{
+			RemoveBatchFiles(Settings, BatchIndex);
+		}
+		Batch.resize(Settings.BatchSize);
+	}
+
+	Packed.Close();
+	if (Results != stdout)
+	{
+		fclose(Results);
+	}
+
+	if (bMadeWorkDir && !Settings.bKeepFiles && !bKeptFailures)
+	{
+		std::error_code Error;
+		std::filesystem::remove_all(Settings.WorkDir, Error);
+	}
+	else
+	{
+		fprintf(stderr, "Files are in %s\n", Settings.WorkDir.c_str());
+	}
+
+	fprintf(stderr, "%llu ok (%llu non-finite values), %llu generation-failed, %llu untranslatable, %llu compile-failed\n",
+		(unsigned long long)Counts[RS_Ok], (unsigned long long)NumNonFinite, (unsigned long long)Counts[RS_GenerationFailed],
+		(unsigned long long)Counts[RS_Untranslatable], (unsigned long long)Counts[RS_CompileFailed]);
+	if (NumVariants > 0)
+	{
+		fprintf(stderr, "%llu variants differ from their shader\n", (unsigned long long)NumVariantsDiffering);
+	}
+	return (Counts[RS_GenerationFailed] + Counts[RS_CompileFailed] + NumVariantsDiffering > 0) ? 1 : 0;
+}
@@ -8,21 +8,30 @@
 #include <stdarg.h>
 #include <stdint.h>
 
+#include <string.h>
 #include <assert.h>
 
 #include <random>
 #include <algorithm>
+#include <vector>
 
 #include "stack_string.h"
+#include "gen_shader.h"
+#include "program_image.h"
+#include "shader_dialect.h"
 
 
 #define MAX_SHADER_SOURCE_LEN (128*1024)
 
+// See GenShader_GetGeneratorVersion. New options that leave the defaults alone don't need a bump
+#define GENSHADER_GENERATOR_VERSION 3
+
 using SourceBuffer = StringStackBuffer<MAX_SHADER_SOURCE_LEN>;
 
 using TypeID = int32_t;
 using DataTransformID = int32_t;
 
+using uint8 = uint8_t;
 using int32 = int32_t;
 using int64 = int64_t;
 using uint32 = uint32_t;
@@ -44,14 +53,26 @@ enum BuiltinTypes
 
 struct VariableInfo
 {
-	StringStackBuffer<32> Name;
+	// Room for assignment targets that go a few fields into nested structs, e.g. temp_var_12.field_1.field_3.field_0
+	StringStackBuffer<64> Name;
 	TypeID Type;
+	// Can be read but never assigned, e.g. loop counters
+	bool bReadOnly = false;
+	// Whether anything has read the value since it was last assigned (only tracked with KeepAllCodeLive)
+	bool bRead = false;
 };
 
 struct TypeInfo
 {
 	StringStackBuffer<32> Name;
-	std::vector<VariableInfo> Fields;
+	// Range of ProgramState::TypeFields, kept flat so resetting the state doesn't free a vector per type
+	int32 FirstField = 0;
+	int32 NumFields = 0;
+	// How many scalars a value of this type takes up (see FinishTypeInfo)
+	int32 NumScalarComponents = 1;
+	// > 0 for array types, whose fields are their elements ("[0]", "[1]", ...)
+	int32 ArrayCount = 0;
+	TypeID ElementType = -1;
 };
 
 enum struct ShaderType
@@ -61,24 +82,22 @@ enum struct ShaderType
 	Compute
 };
 
-/*
-struct TypeHandle
-{
-	TypeID ID;
-	int32 ArrayCount = 0; // 0 for scalars, >0 for array types, and it
-};
-*/
-
 enum DataTransformationType
 {
 	DTT_Func,
 	DTT_Op,
-	DTT_FieldAccess
+	DTT_FieldAccess,
+	// Array element at a constant index, picked when the expression is built
+	DTT_ConstIndex,
+	// Array element at an int expression's index, clamped so it's always in range
+	DTT_DynamicIndex
 };
 
 // Also limits user-defined func arity
 #define MAX_DTT_ARITY 8
 
+#define ARRAY_COUNTOF(arr) (sizeof(arr) / sizeof((arr)[0]))
+
 struct DataTransformation
 {
 	DataTransformationType TransformType = DTT_Func;
@@ -86,36 +105,383 @@ struct DataTransformation
 	int32 NumSrcTypes = 0;
 	TypeID SrcTypes[MAX_DTT_ARITY];
 	StringStackBuffer<32> Name;
+
+	// Static cost model: rough scalar ALU ops for one evaluation, not counting its args
+	// (see EstimateBuiltinFuncCost), and how many scalar registers it needs on top of its args' values
+	int32 ALUCost = 0;
+	int32 RegisterFootprint = 0;
+
+	// Index into ProgramState::UserFuncCalled for user-defined funcs, -1 for everything else
+	int32 UserFuncIndex = -1;
+};
+
+// The fields GenerateExpression reads for every transform it tries (and backtracks out of), as columns
+// in ProgramState::DataTransformOrder's order. Trying a candidate touches a few bytes of each
+// column instead of a whole ~90-byte record with its name inline, which only the one that gets picked needs
+struct DataTransformationColumns
+{
+	std::vector<uint8> TransformTypes;
+	std::vector<uint8> NumSrcTypes;
+	std::vector<int32> ALUCosts;
+	// Source types are packed back to back, each transform's start at FirstSrcType
+	std::vector<int32> FirstSrcType;
+	std::vector<TypeID> SrcTypes;
+
+	void Clear()
+	{
+		TransformTypes.clear();
+		NumSrcTypes.clear();
+		ALUCosts.clear();
+		FirstSrcType.clear();
+		SrcTypes.clear();
+	}
+
+	void Append(const DataTransformation& Transform)
+	{
+		TransformTypes.push_back((uint8)Transform.TransformType);
+		NumSrcTypes.push_back((uint8)Transform.NumSrcTypes);
+		ALUCosts.push_back(Transform.ALUCost);
+		FirstSrcType.push_back((int32)SrcTypes.size());
+		SrcTypes.insert(SrcTypes.end(), Transform.SrcTypes, Transform.SrcTypes + Transform.NumSrcTypes);
+	}
+};
+
+// How many recent subexpressions of each type are kept for reuse (see GenShaderOptions::SubexpressionReusePercent)
+#define EXPR_POOL_SIZE_PER_TYPE 16
+// Longer ones aren't kept, or reusing reuses of reuses could double a statement's size every time
+#define EXPR_POOL_MAX_TOKENS 64
+
+// A finished subexpression, kept as its tokens so reusing it is a copy instead of generating it again
+struct PooledExpression
+{
+	std::vector<StringStackBuffer<32>> Tokens;
+	// What it added to ExprCost, and the most scalars it had live at once
+	int64 Cost = 0;
+	int32 PeakScalars = 0;
+	// Reads variables below this index in VarsInScope, it's only valid while they're all still in scope
+	int32 NumVarsNeeded = 0;
+	// What it logged to PendingVarReads/PendingFuncCalls, which a reuse logs again
+	std::vector<int32> VarReads;
+	std::vector<int32> FuncCalls;
+};
+
+struct ExpressionPool
+{
+	std::vector<PooledExpression> Entries;
+	int32 NumEntries = 0;
+	// Where the next one goes once it's full, so the oldest get replaced first
+	int32 NextReplaceIndex = 0;
+};
+
+// What GenShader_GetVariant needs to rewrite a shader without generating it again, recorded while
+// generating when Options->KeepVariantInfo is set. Offsets are into the generated source
+struct VariantVar
+{
+	StringStackBuffer<64> Name;
+	TypeID Type = BT_Float;
+	// Index in VariantLog::Functions, -1 for globals
+	int32 Function = -1;
+	// In scope from the statement after DeclStatement up to and including LastStatement
+	int32 DeclStatement = -1;
+	int32 LastStatement = INT32_MAX;
+	bool bReadOnly = false;
+};
+
+enum VariantStatementKind
+{
+	// Assigns (and maybe first declares) one variable or an output, so it can trade places with
+	// statements that don't touch what it reads or writes
+	VSK_Assign,
+	// Opens or closes a block, returns, or anything else that has to stay where it is
+	VSK_Fixed
+};
+
+struct VariantStatement
+{
+	VariantStatementKind Kind = VSK_Fixed;
+	int32 Function = -1;
+	// From its first tab to just past its last newline
+	int32 Begin = 0;
+	int32 End = 0;
+	// Id of the variable it assigns, -1 for outputs (and fixed statements)
+	int32 DefVar = -1;
+	// Sinks into live_sink, which every other sink reads and writes too
+	bool bUsesSink = false;
+	// Range of VariantLog::Reads, every variable its expressions read
+	int32 FirstRead = 0;
+	int32 NumReads = 0;
+};
+
+struct VariantExpression
+{
+	int32 Begin = 0;
+	int32 End = 0;
+	TypeID Type = BT_Float;
+	int32 Statement = -1;
+	// Range of VariantLog::Reads, a slice of its statement's
+	int32 FirstRead = 0;
+	int32 NumReads = 0;
+};
+
+struct VariantFunction
+{
+	// Where its signature starts
+	int32 Begin = 0;
+	// Its statements are [FirstStatement, EndStatement)
+	int32 FirstStatement = 0;
+	int32 EndStatement = 0;
+};
+
+struct VariantLog
+{
+	std::vector<VariantVar> Vars;
+	std::vector<VariantStatement> Statements;
+	// Every subexpression of every statement, children before their parents
+	std::vector<VariantExpression> Expressions;
+	std::vector<VariantFunction> Functions;
+	std::vector<int32> Reads;
+
+	// While generating: the id of each VarsInScope entry, and the subexpressions of the expression being
+	// built as ranges of ScratchExpressionList and PendingVarReads, until they're written out
+	struct PendingExpression
+	{
+		int32 FirstToken;
+		int32 EndToken;
+		TypeID Type;
+		int32 FirstRead;
+		int32 EndRead;
+	};
+	std::vector<int32> ScopeVarIds;
+	std::vector<PendingExpression> PendingExpressions;
+	std::vector<int32> TokenOffsets;
+	int32 StatementBegin = 0;
+	int32 StatementFirstRead = 0;
+	bool bStatementUsesSink = false;
+
+	void Clear()
+	{
+		Vars.clear();
+		Statements.clear();
+		Expressions.clear();
+		Functions.clear();
+		Reads.clear();
+		ScopeVarIds.clear();
+		PendingExpressions.clear();
+		StatementBegin = 0;
+		StatementFirstRead = 0;
+		bStatementUsesSink = false;
+	}
+
+	// Gives new VarsInScope entries ids, declared after DeclStatement, and ends the ones that went out of scope at LastStatement
+	void SyncScope(const std::vector<VariableInfo>& VarsInScope, int32 DeclStatement, int32 LastStatement)
+	{
+		while (ScopeVarIds.size() > VarsInScope.size())
+		{
+			Vars[ScopeVarIds.back()].LastStatement = LastStatement;
+			ScopeVarIds.pop_back();
+		}
+
+		while (ScopeVarIds.size() < VarsInScope.size())
+		{
+			const VariableInfo& Info = VarsInScope[ScopeVarIds.size()];
+			VariantVar Var;
+			Var.Name = Info.Name;
+			Var.Type = Info.Type;
+			Var.Function = (int32)Functions.size() - 1;
+			Var.DeclStatement = DeclStatement;
+			Var.bReadOnly = Info.bReadOnly;
+
+			ScopeVarIds.push_back((int32)Vars.size());
+			Vars.push_back(Var);
+		}
+	}
+
+	// The pending expressions' reads, by VarsInScope index, become ids in Reads (see ProgramState::CommitPendingUses)
+	void CommitReads(const std::vector<int32>& PendingVarReads)
+	{
+		const int32 FirstRead = (int32)Reads.size();
+		for (int32 VarIndex : PendingVarReads)
+		{
+			assert(VarIndex < (int32)ScopeVarIds.size());
+			Reads.push_back(ScopeVarIds[VarIndex]);
+		}
+
+		for (PendingExpression& Pending : PendingExpressions)
+		{
+			Pending.FirstRead += FirstRead;
+			Pending.EndRead += FirstRead;
+		}
+	}
+
+	// Tokens is the expression being written out at Offset, which its pending subexpressions become part of
+	void CommitExpressions(const std::vector<StringStackBuffer<32>>& Tokens, int32 Offset)
+	{
+		TokenOffsets.resize(Tokens.size() + 1);
+		for (size_t i = 0; i < Tokens.size(); i++)
+		{
+			TokenOffsets[i] = Offset;
+			Offset += Tokens[i].length;
+		}
+		TokenOffsets[Tokens.size()] = Offset;
+
+		for (const PendingExpression& Pending : PendingExpressions)
+		{
+			VariantExpression Expr;
+			Expr.Begin = TokenOffsets[Pending.FirstToken];
+			Expr.End = TokenOffsets[Pending.EndToken];
+			Expr.Type = Pending.Type;
+			Expr.Statement = (int32)Statements.size();
+			Expr.FirstRead = Pending.FirstRead;
+			Expr.NumReads = Pending.EndRead - Pending.FirstRead;
+			Expressions.push_back(Expr);
+		}
+		PendingExpressions.clear();
+	}
 };
 
+// Lives in a GenShaderContext and gets reset for every seed (see ResetProgramState),
+// so once its containers have grown to fit, generating doesn't allocate at all
 struct ProgramState
 {
 	std::vector<TypeInfo> ProgramTypes;
+	std::vector<VariableInfo> TypeFields;
+	// In the order they were added, DataTransformOrder has them sorted
 	std::vector<DataTransformation> DataTransforms;
+
+	// What InitProgramState makes, which is the same every time: the built-in types come first
+	// in ProgramTypes and TypeFields, and the built-in transforms get copied back from here
+	int32 NumBuiltinTypes = 0;
+	int32 NumBuiltinTypeFields = 0;
+	std::vector<DataTransformation> BuiltinDataTransforms;
 	
+	// (DstType, index into DataTransforms) sorted by DstType. DataTransformIndexByDstType's ranges and
+	// DataTransformColumns are in this order
+	std::vector<std::pair<TypeID, int32>> DataTransformOrder;
 	std::vector<std::pair<int32, int32>> DataTransformIndexByDstType;
+	// Hot columns of DataTransforms, rebuilt with the index
+	DataTransformationColumns DataTransformColumns;
 	
 	std::vector<VariableInfo> VarsInScope;
 	
 	// 0th element is the index of the first non-global variable in this context
 	std::vector<int32> VarScopeCountStack;
 
-	int32 CurrentIfStmtDepth = 0;
+	// Open ifs and for loops in the current function
+	int32 CurrentBlockDepth = 0;
+
+	// Knobs from the API, never null while generating
+	const GenShaderOptions* Options = nullptr;
+
+	// Frag shaders keep their original shape (no loops), so old seeds still give the same shaders.
+	// The one exception is targets too big for straight-line code (see GenerateFunctionBody)
+	bool bAllowLoops = false;
+	int32 NumLoopsGenerated = 0;
 	
-	// TODO: For vert shaders, and more generally Vulkan-style shaders
-	//std::vector<VariableInfo> OutVars;
+	// Vert shader outputs, which get written at the end of main
+	std::vector<VariableInfo> OutVars;
+
+	// Compute shader storage buffers, each has a fixed-size array that main loads from and stores to
+	struct StorageBufferInfo
+	{
+		TypeID ElementType;
+		int32 NumElements;
+	};
+	std::vector<StorageBufferInfo> StorageBuffers;
+
+	// Static cost model bookkeeping.
+	// ExprCost is the cost of the expression being built, FunctionCost the running dynamic cost
+	// of the current function: statements count once per iteration of the loops around them,
+	// and ifs count as always taken
+	int64 ExprCost = 0;
+	int64 FunctionCost = 0;
+	int64 CurrentCostScale = 1;
+	// Trip count of each open block, 1 for ifs
+	std::vector<int32> BlockTripCounts;
+
+	// Scalars held by already-evaluated args while building the expression, and the most held at once
+	int32 ExprLiveScalars = 0;
+	int32 ExprPeakScalars = 0;
+	// Peak of locals in scope + expression temporaries over the current function
+	int32 FunctionPeakScalars = 0;
+
+	// When >= 0, expressions stop picking transforms that would take ExprCost past it
+	int64 ExprCostBudget = -1;
+	// When >= 0, main keeps adding statements until FunctionCost reaches it
+	int64 TargetFunctionCost = -1;
+
+	// Work budget (Options->MaxGeneratorSteps), one step per GenerateExpression call.
+	// Once it's spent every expression is forced down to a leaf
+	uint64 NumGeneratorSteps = 0;
+	uint64 MaxGeneratorSteps = 0;
+	bool bOutOfGeneratorSteps = false;
+
+	// Set if main ran out of source buffer before reaching TargetFunctionCost
+	bool bHitCostCap = false;
+
+	// Liveness tracking, so every value ends up feeding an output (Options->KeepAllCodeLive).
+	// Reads and calls in the expression being built are only logged, since a failed attempt gets
+	// thrown away, and they're applied once the statement is final (see CommitPendingUses)
+	bool bKeepAllCodeLive = false;
+	std::vector<int32> PendingVarReads;
+	std::vector<int32> PendingFuncCalls;
+	std::vector<bool> UserFuncCalled;
+
+	// Options->KeepVariantInfo. Reads get logged as for liveness, and everything else straight into Variants
+	bool bRecordVariants = false;
+	VariantLog Variants;
+
+	// Subexpressions for reuse, by TypeID (only filled when Options->SubexpressionReusePercent is non-zero)
+	int32 SubexpressionReusePercent = 0;
+	std::vector<ExpressionPool> ExprPoolsByType;
+	// Highest index in VarsInScope the expression being built reads, so each subtree knows what it depends on
+	int32 ExprMaxVarIndex = -1;
 	
 	std::mt19937_64 RNGState;
+
+	// When non-null, every decision is read from this buffer instead of RNGState,
+	// in the style of FuzzedDataProvider, so a fuzzer's mutations map onto generator choices
+	const uint8_t* DecisionBytes = nullptr;
+	size_t NumDecisionBytesLeft = 0;
+
+	// Reads enough bytes to cover Range (inclusive), once they run out we keep returning 0
+	uint64 ConsumeDecisionBytes(uint64 Range)
+	{
+		uint64 Result = 0;
+		for (int32 Offset = 0; Offset < 64 && (Range >> Offset) > 0 && NumDecisionBytesLeft > 0; Offset += 8)
+		{
+			Result = (Result << 8) | *DecisionBytes;
+			DecisionBytes++;
+			NumDecisionBytesLeft--;
+		}
+
+		if (Range != UINT64_MAX)
+		{
+			Result = Result % (Range + 1);
+		}
+
+		return Result;
+	}
 	
 	// NOTE: It's inclusive
 	int GetIntInRange(int min, int max)
 	{
+		if (DecisionBytes != nullptr)
+		{
+			return (int)((int64)min + (int64)ConsumeDecisionBytes((uint64)((int64)max - (int64)min)));
+		}
+
 		std::uniform_int_distribution<int> Dist(min, max);
 		return Dist(RNGState);
 	}
 
 	float GetFloatInRange(float min, float max)
 	{
+		if (DecisionBytes != nullptr)
+		{
+			const float Fraction = (float)ConsumeDecisionBytes(UINT32_MAX) / (float)UINT32_MAX;
+			return min + (max - min) * Fraction;
+		}
+
 		std::uniform_real_distribution<float> Dist(min, max);
 		return Dist(RNGState);
 	}
@@ -129,9 +495,87 @@ struct ProgramState
 	{
 		RNGState.seed(Seed);
 	}
+
+	void SetDecisionBytes(const uint8_t* Data, size_t Size)
+	{
+		// Can't be null even for an empty buffer, since null means "use the RNG"
+		static const uint8_t EmptyBytes[1] = {};
+		DecisionBytes = (Data != nullptr) ? Data : EmptyBytes;
+		NumDecisionBytesLeft = (Data != nullptr) ? Size : 0;
+	}
 	
 	std::vector<StringStackBuffer<32>> ScratchExpressionList;
 
+	void ResetExpressionCost()
+	{
+		ExprCost = 0;
+		ExprLiveScalars = 0;
+		ExprPeakScalars = 0;
+	}
+
+	// Called once a statement's expression is final, adds it to the function's totals
+	void CommitExpressionCost()
+	{
+		FunctionCost += ExprCost * CurrentCostScale;
+
+		int32 LocalScalars = 0;
+		for (int32 i = (VarScopeCountStack.size() > 0 ? VarScopeCountStack.front() : 0); i < (int32)VarsInScope.size(); i++)
+		{
+			LocalScalars += ProgramTypes[VarsInScope[i].Type].NumScalarComponents;
+		}
+		FunctionPeakScalars = std::max(FunctionPeakScalars, LocalScalars + ExprPeakScalars);
+
+		ResetExpressionCost();
+	}
+
+	void CommitPendingUses()
+	{
+		if (bRecordVariants)
+		{
+			Variants.CommitReads(PendingVarReads);
+		}
+
+		for (int32 VarIndex : PendingVarReads)
+		{
+			VarsInScope[VarIndex].bRead = true;
+		}
+		for (int32 FuncIndex : PendingFuncCalls)
+		{
+			UserFuncCalled[FuncIndex] = true;
+		}
+
+		PendingVarReads.clear();
+		PendingFuncCalls.clear();
+	}
+
+	void BeginFunctionCost()
+	{
+		FunctionCost = 0;
+		FunctionPeakScalars = 0;
+		CurrentCostScale = 1;
+		ResetExpressionCost();
+	}
+
+	const VariableInfo& GetField(const TypeInfo& Info, int32 FieldIndex) const
+	{
+		return TypeFields[Info.FirstField + FieldIndex];
+	}
+
+	// What goes between a value's name and one of its fields' names: "s.field_0" but "a[0]"
+	static const char* GetFieldSeparator(const TypeInfo& Info)
+	{
+		return (Info.ArrayCount > 0) ? "" : ".";
+	}
+
+	// The large uniform arrays' types come after every other type, and nothing else can have them,
+	// so random picks for locals, params and the like only go up to here
+	int32 NumUniformOnlyTypes = 0;
+
+	int32 GetNumValueTypes() const
+	{
+		return (int32)ProgramTypes.size() - NumUniformOnlyTypes;
+	}
+
 	void BeginScope()
 	{
 		VarScopeCountStack.push_back(VarsInScope.size());
@@ -141,52 +585,119 @@ struct ProgramState
 	{
 		VarsInScope.resize(VarScopeCountStack.back());
 		VarScopeCountStack.pop_back();
+
+		// Anything reading a variable that just went out of scope can't be reused anymore
+		for (ExpressionPool& Pool : ExprPoolsByType)
+		{
+			for (int32 i = 0; i < Pool.NumEntries; )
+			{
+				if (Pool.Entries[i].NumVarsNeeded > (int32)VarsInScope.size())
+				{
+					std::swap(Pool.Entries[i], Pool.Entries[Pool.NumEntries - 1]);
+					Pool.NumEntries--;
+				}
+				else
+				{
+					i++;
+				}
+			}
+			Pool.NextReplaceIndex = std::min(Pool.NextReplaceIndex, Pool.NumEntries);
+		}
 	}
 };
 
 
+void FinishTypeInfo(const ProgramState* PS, TypeInfo* Info)
+{
+	if (Info->NumFields > 0)
+	{
+		Info->NumScalarComponents = 0;
+		for (int32 f = 0; f < Info->NumFields; f++)
+		{
+			Info->NumScalarComponents += PS->ProgramTypes[PS->GetField(*Info, f).Type].NumScalarComponents;
+		}
+	}
+}
+
+// Weights are per scalar component, in the ballpark of current GPUs:
+// transcendentals run on a quarter-rate unit, and pow is log2 + mul + exp2.
+// Constructors and swizzles are just register moves, so they're free
+int32 EstimateBuiltinFuncCost(const char* FuncName, int32 NumDstComponents, int32 NumSrcComponents)
+{
+	if (strcmp(FuncName, "dot") == 0)
+	{
+		return 2 * NumSrcComponents - 1;
+	}
+	else if (strcmp(FuncName, "cross") == 0)
+	{
+		return 9;
+	}
+	else if (strcmp(FuncName, "abs") == 0)
+	{
+		return NumDstComponents;
+	}
+	else if (strcmp(FuncName, "clamp") == 0)
+	{
+		return 2 * NumDstComponents;
+	}
+	else if (strcmp(FuncName, "sin") == 0 || strcmp(FuncName, "cos") == 0 || strcmp(FuncName, "sqrt") == 0)
+	{
+		return 4 * NumDstComponents;
+	}
+	else if (strcmp(FuncName, "pow") == 0)
+	{
+		return 9 * NumDstComponents;
+	}
+	else if (strncmp(FuncName, "vec", 3) == 0)
+	{
+		return 0;
+	}
+	else
+	{
+		assert(false && "no cost for builtin");
+		return NumDstComponents;
+	}
+}
+
 void InitProgramState(ProgramState* PS)
 {
 	{
-		TypeInfo Info1 = {"bool", {}};
-		TypeInfo Info2 = {"int", {}};
-		TypeInfo Info3 = {"float", {}};
+		TypeInfo Info1 = {"bool"};
+		TypeInfo Info2 = {"int"};
+		TypeInfo Info3 = {"float"};
 		// Don't both with fields I guess? idk, or maybe do them later
-		TypeInfo Info4 = {"vec2", {}};
-		TypeInfo Info5 = {"vec3", {}};
-		TypeInfo Info6 = {"vec4", {}};
-		//TypeInfo Info7 = {"mat2", {}};
-		//TypeInfo Info8 = {"mat3", {}};
-		//TypeInfo Info9 = {"mat4", {}};
+		TypeInfo Info4 = {"vec2"};
+		TypeInfo Info5 = {"vec3"};
+		TypeInfo Info6 = {"vec4"};
+		//TypeInfo Info7 = {"mat2"};
+		//TypeInfo Info8 = {"mat3"};
+		//TypeInfo Info9 = {"mat4"};
+
+		auto AddVecFields = [PS](TypeInfo* Info, const char* const* FieldNames, int32 NumFields)
+		{
+			Info->FirstField = (int32)PS->TypeFields.size();
+			Info->NumFields = NumFields;
+			for (int32 f = 0; f < NumFields; f++)
+			{
+				PS->TypeFields.emplace_back();
+				PS->TypeFields.back().Type = BT_Float;
+				PS->TypeFields.back().Name.Append(FieldNames[f]);
+			}
+		};
 
 		{
-			Info4.Fields.resize(2);
-			Info4.Fields[0].Type = BT_Float;
-			Info4.Fields[0].Name.Append("x");
-			Info4.Fields[1].Type = BT_Float;
-			Info4.Fields[1].Name.Append("y");
+			static const char* const FieldNames[] = { "x", "y" };
+			AddVecFields(&Info4, FieldNames, 2);
 		}
 
 		{
-			Info5.Fields.resize(3);
-			Info5.Fields[0].Type = BT_Float;
-			Info5.Fields[0].Name.Append("x");
-			Info5.Fields[1].Type = BT_Float;
-			Info5.Fields[1].Name.Append("y");
-			Info5.Fields[2].Type = BT_Float;
-			Info5.Fields[2].Name.Append("z");
+			static const char* const FieldNames[] = { "x", "y", "z" };
+			AddVecFields(&Info5, FieldNames, 3);
 		}
 
 		{
-			Info6.Fields.resize(4);
-			Info6.Fields[0].Type = BT_Float;
-			Info6.Fields[0].Name.Append("x");
-			Info6.Fields[1].Type = BT_Float;
-			Info6.Fields[1].Name.Append("y");
-			Info6.Fields[2].Type = BT_Float;
-			Info6.Fields[2].Name.Append("z");
-			Info6.Fields[3].Type = BT_Float;
-			Info6.Fields[3].Name.Append("z");
+			static const char* const FieldNames[] = { "x", "y", "z", "z" };
+			AddVecFields(&Info6, FieldNames, 4);
 		}
 		
 		PS->ProgramTypes.push_back(Info1);
@@ -198,6 +709,11 @@ void InitProgramState(ProgramState* PS)
 		//PS->ProgramTypes.push_back(Info7);
 		//PS->ProgramTypes.push_back(Info8);
 		//PS->ProgramTypes.push_back(Info9);
+
+		for (auto& Info : PS->ProgramTypes)
+		{
+			FinishTypeInfo(PS, &Info);
+		}
 	}
 	
 	auto AddBuiltinFieldAccess = [PS](TypeID StructType, TypeID FieldType, const char* FieldName)
@@ -208,6 +724,7 @@ void InitProgramState(ProgramState* PS)
 		DataTrans.NumSrcTypes = 1;
 		DataTrans.SrcTypes[0] = StructType;
 		DataTrans.Name.AppendFormat("%s", FieldName);
+		DataTrans.RegisterFootprint = PS->ProgramTypes[FieldType].NumScalarComponents;
 		
 		PS->DataTransforms.push_back(DataTrans);
 	};
@@ -225,6 +742,10 @@ void InitProgramState(ProgramState* PS)
 			DataTrans.NumSrcTypes++;
 		}
 		DataTrans.Name.AppendFormat("%s", FuncName);
+
+		const int32 NumDstComponents = PS->ProgramTypes[OutputType].NumScalarComponents;
+		DataTrans.ALUCost = EstimateBuiltinFuncCost(FuncName, NumDstComponents, PS->ProgramTypes[InputTypes[0]].NumScalarComponents);
+		DataTrans.RegisterFootprint = NumDstComponents;
 		
 		PS->DataTransforms.push_back(DataTrans);
 	};
@@ -238,6 +759,10 @@ void InitProgramState(ProgramState* PS)
 		DataTrans.SrcTypes[0] = LHSType;
 		DataTrans.SrcTypes[1] = RHSType;
 		DataTrans.Name.AppendFormat("%s", OpName);
+
+		// Arithmetic is one op per component, comparisons are on scalars
+		DataTrans.ALUCost = PS->ProgramTypes[LHSType].NumScalarComponents;
+		DataTrans.RegisterFootprint = PS->ProgramTypes[OutputType].NumScalarComponents;
 		
 		PS->DataTransforms.push_back(DataTrans);
 	};
@@ -341,6 +866,73 @@ void InitProgramState(ProgramState* PS)
 	}
 };
 
+// Puts PS back to how InitProgramState leaves it, without giving back any of its containers' memory
+void ResetProgramState(ProgramState* PS)
+{
+	if (PS->NumBuiltinTypes == 0)
+	{
+		InitProgramState(PS);
+		PS->NumBuiltinTypes = (int32)PS->ProgramTypes.size();
+		PS->NumBuiltinTypeFields = (int32)PS->TypeFields.size();
+		PS->BuiltinDataTransforms = PS->DataTransforms;
+	}
+	else
+	{
+		// Same contents in the same order as InitProgramState makes, so sorting them gives the same order too
+		PS->ProgramTypes.resize(PS->NumBuiltinTypes);
+		PS->TypeFields.resize(PS->NumBuiltinTypeFields);
+		PS->DataTransforms.assign(PS->BuiltinDataTransforms.begin(), PS->BuiltinDataTransforms.end());
+	}
+
+	PS->NumUniformOnlyTypes = 0;
+	PS->DataTransformIndexByDstType.clear();
+	PS->DataTransformOrder.clear();
+	PS->DataTransformColumns.Clear();
+	PS->VarsInScope.clear();
+	PS->VarScopeCountStack.clear();
+	PS->CurrentBlockDepth = 0;
+	PS->bAllowLoops = false;
+	PS->NumLoopsGenerated = 0;
+	PS->OutVars.clear();
+	PS->StorageBuffers.clear();
+
+	PS->ExprCost = 0;
+	PS->FunctionCost = 0;
+	PS->CurrentCostScale = 1;
+	PS->BlockTripCounts.clear();
+	PS->ExprLiveScalars = 0;
+	PS->ExprPeakScalars = 0;
+	PS->FunctionPeakScalars = 0;
+	PS->ExprCostBudget = -1;
+	PS->TargetFunctionCost = -1;
+
+	PS->NumGeneratorSteps = 0;
+	PS->MaxGeneratorSteps = 0;
+	PS->bOutOfGeneratorSteps = false;
+	PS->bHitCostCap = false;
+
+	PS->bKeepAllCodeLive = false;
+	PS->PendingVarReads.clear();
+	PS->PendingFuncCalls.clear();
+	PS->UserFuncCalled.clear();
+
+	PS->bRecordVariants = false;
+	PS->Variants.Clear();
+
+	// The pools keep their slots (and the slots their token buffers), they're just emptied
+	PS->SubexpressionReusePercent = 0;
+	for (ExpressionPool& Pool : PS->ExprPoolsByType)
+	{
+		Pool.NumEntries = 0;
+		Pool.NextReplaceIndex = 0;
+	}
+	PS->ExprMaxVarIndex = -1;
+
+	PS->DecisionBytes = nullptr;
+	PS->NumDecisionBytesLeft = 0;
+	PS->ScratchExpressionList.clear();
+}
+
 void GenerateUserDefinedStructs(ProgramState* PS, SourceBuffer* SrcBuff)
 {
 	int32 NumStructs = PS->GetIntInRange(0, 5);
@@ -351,61 +943,173 @@ void GenerateUserDefinedStructs(ProgramState* PS, SourceBuffer* SrcBuff)
 
 		TypeInfo StructTypeInfo;
 		StructTypeInfo.Name.AppendFormat("my_struct_%d", i);
-		StructTypeInfo.Fields.reserve(NumFields);
+		StructTypeInfo.FirstField = (int32)PS->TypeFields.size();
+		StructTypeInfo.NumFields = NumFields;
 
 		SrcBuff->AppendFormat("struct %s {\n", StructTypeInfo.Name.buffer);
 
 		for (int32 f = 0; f < NumFields; f++)
 		{
-			TypeID FieldType = PS->GetIntInRange(0, PS->ProgramTypes.size() - 1);
+			TypeID FieldType = PS->GetIntInRange(0, PS->GetNumValueTypes() - 1);
 
-			StructTypeInfo.Fields.emplace_back();
-			StructTypeInfo.Fields.back().Type = FieldType;
-			StructTypeInfo.Fields.back().Name.AppendFormat("field_%d", f);
+			PS->TypeFields.emplace_back();
+			PS->TypeFields.back().Type = FieldType;
+			PS->TypeFields.back().Name.AppendFormat("field_%d", f);
 
-			SrcBuff->AppendFormat("\t%s %s;\n", PS->ProgramTypes[FieldType].Name.buffer, StructTypeInfo.Fields.back().Name.buffer);
+			SrcBuff->AppendFormat("\t%s %s;\n", PS->ProgramTypes[FieldType].Name.buffer, PS->TypeFields.back().Name.buffer);
 		}
 
 		SrcBuff->Append("};\n\n");
 
+		FinishTypeInfo(PS, &StructTypeInfo);
 		PS->ProgramTypes.push_back(StructTypeInfo);
 		TypeID StructTypeID = (TypeID)(PS->ProgramTypes.size() - 1);
 
-		for (const auto& Field : StructTypeInfo.Fields)
+		for (int32 f = 0; f < NumFields; f++)
 		{
+			const VariableInfo& Field = PS->GetField(StructTypeInfo, f);
 			DataTransformation Trans;
 			Trans.TransformType = DTT_FieldAccess;
 			Trans.NumSrcTypes = 1;
 			Trans.SrcTypes[0] = StructTypeID;
 			Trans.DstType = Field.Type;
 			Trans.Name.Append(Field.Name.buffer);
+			Trans.RegisterFootprint = PS->ProgramTypes[Field.Type].NumScalarComponents;
 
 			PS->DataTransforms.push_back(Trans);
 		}
 	}
 }
 
+// Adds an array type of NumElements ElementTypes, with the transforms that index it (and build it, if
+// it's small enough for a constructor). Uniform-only ones have no fields or registers, since they're
+// never copied around, only indexed in place
+TypeID AddArrayType(ProgramState* PS, TypeID ElementType, int32 NumElements, bool bUniformOnly)
+{
+	TypeInfo ArrayTypeInfo;
+	ArrayTypeInfo.Name.AppendFormat("%s[%d]", PS->ProgramTypes[ElementType].Name.buffer, NumElements);
+	ArrayTypeInfo.ArrayCount = NumElements;
+	ArrayTypeInfo.ElementType = ElementType;
+
+	if (bUniformOnly)
+	{
+		ArrayTypeInfo.NumScalarComponents = 0;
+	}
+	else
+	{
+		ArrayTypeInfo.FirstField = (int32)PS->TypeFields.size();
+		ArrayTypeInfo.NumFields = NumElements;
+		for (int32 e = 0; e < NumElements; e++)
+		{
+			PS->TypeFields.emplace_back();
+			PS->TypeFields.back().Type = ElementType;
+			PS->TypeFields.back().Name.AppendFormat("[%d]", e);
+		}
+		FinishTypeInfo(PS, &ArrayTypeInfo);
+	}
+
+	PS->ProgramTypes.push_back(ArrayTypeInfo);
+	const TypeID ArrayType = (TypeID)(PS->ProgramTypes.size() - 1);
+	const int32 ElementScalars = PS->ProgramTypes[ElementType].NumScalarComponents;
+
+	DataTransformation ConstIndex;
+	ConstIndex.TransformType = DTT_ConstIndex;
+	ConstIndex.DstType = ElementType;
+	ConstIndex.NumSrcTypes = 1;
+	ConstIndex.SrcTypes[0] = ArrayType;
+	ConstIndex.Name.Append("[]");
+	ConstIndex.RegisterFootprint = ElementScalars;
+	PS->DataTransforms.push_back(ConstIndex);
+
+	// The clamp, plus working out the address
+	DataTransformation DynamicIndex;
+	DynamicIndex.TransformType = DTT_DynamicIndex;
+	DynamicIndex.DstType = ElementType;
+	DynamicIndex.NumSrcTypes = 2;
+	DynamicIndex.SrcTypes[0] = ArrayType;
+	DynamicIndex.SrcTypes[1] = BT_Int;
+	DynamicIndex.Name.Append("[]");
+	DynamicIndex.ALUCost = 3;
+	DynamicIndex.RegisterFootprint = ElementScalars;
+	PS->DataTransforms.push_back(DynamicIndex);
+
+	if (!bUniformOnly && NumElements <= MAX_DTT_ARITY)
+	{
+		// e.g. vec2[3](a, b, c), moves only like the vector constructors
+		DataTransformation Constructor;
+		Constructor.TransformType = DTT_Func;
+		Constructor.DstType = ArrayType;
+		Constructor.Name.Append(ArrayTypeInfo.Name.buffer);
+		for (int32 e = 0; e < NumElements; e++)
+		{
+			Constructor.SrcTypes[Constructor.NumSrcTypes++] = ElementType;
+		}
+		Constructor.RegisterFootprint = ArrayTypeInfo.NumScalarComponents;
+		PS->DataTransforms.push_back(Constructor);
+	}
+
+	return ArrayType;
+}
+
+// Array types (Options->NumArrayTypes), then the types of the large uniform arrays (Options->LargeUniformArraySize),
+// which GenerateGlobalVariables declares. Elements are never arrays themselves, arrays of arrays need GLSL 4.30
+void GenerateArrayTypes(ProgramState* PS)
+{
+	static const int32 ArraySizes[] = { 2, 3, 4, 8, 16, 32 };
+
+	const int32 NumElementTypes = (int32)PS->ProgramTypes.size();
+	for (uint32 i = 0; i < PS->Options->NumArrayTypes; i++)
+	{
+		const TypeID ElementType = (TypeID)PS->GetIntInRange(0, NumElementTypes - 1);
+		const int32 NumElements = ArraySizes[PS->GetIntInRange(0, ARRAY_COUNTOF(ArraySizes) - 1)];
+		AddArrayType(PS, ElementType, NumElements, false);
+	}
+
+	if (PS->Options->LargeUniformArraySize > 0)
+	{
+		const int32 NumLargeArrays = PS->GetIntInRange(1, 2);
+		for (int32 i = 0; i < NumLargeArrays; i++)
+		{
+			const TypeID ElementType = (TypeID)PS->GetIntInRange(0, NumElementTypes - 1);
+			AddArrayType(PS, ElementType, (int32)std::min<uint32>(PS->Options->LargeUniformArraySize, INT32_MAX), true);
+			PS->NumUniformOnlyTypes++;
+		}
+	}
+}
+
 void IndexProgramDataTransformations(ProgramState* PS)
 {
 	PS->DataTransformIndexByDstType.clear();
 	PS->DataTransformIndexByDstType.resize(PS->ProgramTypes.size());
 
-	std::sort(PS->DataTransforms.begin(), PS->DataTransforms.end(), [](const DataTransformation& lhs, const DataTransformation& rhs)
+	// The records stay where they are, only (DstType, index) keys get sorted. The ones added since the last
+	// time go on the end of the last order, and sorting compares DstType alone, so std::sort makes the same
+	// comparisons and moves it would on the records themselves, and same-type transforms keep the order they've always had
+	for (int32 i = (int32)PS->DataTransformOrder.size(); i < (int32)PS->DataTransforms.size(); i++)
+	{
+		PS->DataTransformOrder.push_back(std::make_pair(PS->DataTransforms[i].DstType, i));
+	}
+	std::sort(PS->DataTransformOrder.begin(), PS->DataTransformOrder.end(), [](const std::pair<TypeID, int32>& lhs, const std::pair<TypeID, int32>& rhs)
 	{
-		return lhs.DstType < rhs.DstType;
+		return lhs.first < rhs.first;
 	});
 
+	PS->DataTransformColumns.Clear();
+	for (const auto& Key : PS->DataTransformOrder)
+	{
+		PS->DataTransformColumns.Append(PS->DataTransforms[Key.second]);
+	}
 
 	int32 IndexBeginCursor = 0;
 	TypeID CurrentType = 0;
-	for (int32 IndexCursor = 0; IndexCursor < PS->DataTransforms.size(); IndexCursor++)
+	for (int32 IndexCursor = 0; IndexCursor < PS->DataTransformOrder.size(); IndexCursor++)
 	{
-		if (PS->DataTransforms[IndexCursor].DstType != CurrentType)
+		if (PS->DataTransformOrder[IndexCursor].first != CurrentType)
 		{
 			PS->DataTransformIndexByDstType[CurrentType] = std::make_pair(IndexBeginCursor, IndexCursor);
 			IndexBeginCursor = IndexCursor;
 			CurrentType++;
-			while (CurrentType != PS->DataTransforms[IndexCursor].DstType)
+			while (CurrentType != PS->DataTransformOrder[IndexCursor].first)
 			{
 				// Basically, an empty interval since it's lower-inclusive, upper-exclusive
 				PS->DataTransformIndexByDstType[CurrentType] = std::make_pair(IndexCursor, IndexCursor);
@@ -415,12 +1119,39 @@ void IndexProgramDataTransformations(ProgramState* PS)
 	}
 }
 
+// Which types a class of global can be declared with
+enum GlobalVarTypeRule
+{
+	GVTR_Any,
+	GVTR_NoBoolOrInt,
+	// Vertex inputs/outputs: float and vectors only
+	GVTR_FloatOrVector
+};
+
+static bool IsTypeAllowedForGlobal(const ProgramState* PS, TypeID Type, GlobalVarTypeRule Rule)
+{
+	switch (Rule)
+	{
+	case GVTR_Any: return true;
+	// Arrays only as uniforms, interpolated int arrays would need flat
+	case GVTR_NoBoolOrInt: return Type != BT_Bool && Type != BT_Int && PS->ProgramTypes[Type].ArrayCount == 0;
+	case GVTR_FloatOrVector: return Type >= BT_Float && Type <= BT_Vec4;
+	default: {
+		assert(false && "bad enum");
+		return false;
+	}
+	}
+}
+
 void GenerateGlobalVariables(ProgramState* PS, SourceBuffer* SrcBuff, ShaderType InShaderType)
 {
 	int32 NumAttributes = 0;
 	int32 NumVarying = 0;
 	int32 NumIn = 0;
+	int32 NumOut = 0;
 	int32 NumUniforms = 0;
+	int32 NumStorageBuffers = 0;
+	GlobalVarTypeRule InTypeRule = GVTR_NoBoolOrInt;
 	if (InShaderType == ShaderType::Frag)
 	{
 		// Generate varying, uniform, not attribute
@@ -428,41 +1159,119 @@ void GenerateGlobalVariables(ProgramState* PS, SourceBuffer* SrcBuff, ShaderType
 		NumIn = PS->GetIntInRange(0, 5);
 		NumUniforms = PS->GetIntInRange(0, 5);
 	}
+	else if (InShaderType == ShaderType::Vert)
+	{
+		NumIn = PS->GetIntInRange(0, 5);
+		NumOut = PS->GetIntInRange(0, 4);
+		NumUniforms = PS->GetIntInRange(0, 5);
+		InTypeRule = GVTR_FloatOrVector;
+	}
+	else if (InShaderType == ShaderType::Compute)
+	{
+		NumUniforms = PS->GetIntInRange(0, 5);
+		NumStorageBuffers = PS->GetIntInRange(1, 3);
+	}
 	else
 	{
-		assert(false && "TODO");
+		assert(false && "bad enum");
 	}
-	
-	auto DeclareNumGlobalVars = [&](const char* DeclType, int NumVars, bool bAllowBoolAndInt)
+
+	auto GetRandomTypeForGlobal = [&](GlobalVarTypeRule Rule)
 	{
-		for (int32 i = 0; i < NumVars; i++)
-		{
-			PS->VarsInScope.emplace_back();
-			auto& Var = PS->VarsInScope.back();
-			Var.Type = (TypeID)PS->GetIntInRange(0, (int32)PS->ProgramTypes.size() - 1);
+		TypeID Type = (TypeID)PS->GetIntInRange(0, PS->GetNumValueTypes() - 1);
 
-			if (!bAllowBoolAndInt)
+		// If we disallow some types on this declaration class,
+		// keep trying random types until one passes
+		// (but not forever, a decision byte stream that has run out always gives the same answer)
+		for (int32 Retry = 0; !IsTypeAllowedForGlobal(PS, Type, Rule); Retry++)
+		{
+			if (Retry >= 32)
 			{
-				// If we disallow bools and ints on this declaration class,
-				// keep trying random types until one passes
-				while (Var.Type == BT_Bool || Var.Type == BT_Int)
-				{
-					Var.Type = (TypeID)PS->GetIntInRange(0, (int32)PS->ProgramTypes.size() - 1);
-				}
+				Type = BT_Float;
+				break;
 			}
 
-			Var.Name.AppendFormat("glob_%s_%d", DeclType, i);
-			SrcBuff->AppendFormat("%s %s %s;\n", DeclType, PS->ProgramTypes[Var.Type].Name.buffer, Var.Name.buffer);
+			Type = (TypeID)PS->GetIntInRange(0, PS->GetNumValueTypes() - 1);
 		}
+
+		return Type;
 	};
 	
-	DeclareNumGlobalVars("attribute", NumAttributes, false);
-	DeclareNumGlobalVars("varying", NumVarying, false);
-	DeclareNumGlobalVars("in", NumIn, false);
-	DeclareNumGlobalVars("uniform", NumUniforms, true);
-}
-
-void GenerateLiteralExpression(ProgramState* PS, TypeID DstType)
+	auto DeclareNumGlobalVars = [&](const char* DeclType, int NumVars, GlobalVarTypeRule Rule)
+	{
+		for (int32 i = 0; i < NumVars; i++)
+		{
+			PS->VarsInScope.emplace_back();
+			auto& Var = PS->VarsInScope.back();
+			Var.Type = GetRandomTypeForGlobal(Rule);
+			Var.Name.AppendFormat("glob_%s_%d", DeclType, i);
+			SrcBuff->AppendFormat("%s %s %s;\n", DeclType, PS->ProgramTypes[Var.Type].Name.buffer, Var.Name.buffer);
+		}
+	};
+	
+	DeclareNumGlobalVars("attribute", NumAttributes, GVTR_NoBoolOrInt);
+	DeclareNumGlobalVars("varying", NumVarying, GVTR_NoBoolOrInt);
+	DeclareNumGlobalVars("in", NumIn, InTypeRule);
+	DeclareNumGlobalVars("uniform", NumUniforms, GVTR_Any);
+
+	// Large uniform arrays get one variable each
+	for (int32 i = 0; i < PS->NumUniformOnlyTypes; i++)
+	{
+		const TypeID ArrayType = PS->GetNumValueTypes() + i;
+		const TypeInfo& ArrayTypeInfo = PS->ProgramTypes[ArrayType];
+
+		PS->VarsInScope.emplace_back();
+		auto& Var = PS->VarsInScope.back();
+		Var.Type = ArrayType;
+		Var.bReadOnly = true;
+		Var.Name.AppendFormat("glob_uniform_array_%d", i);
+		SrcBuff->AppendFormat("uniform %s %s[%d];\n", PS->ProgramTypes[ArrayTypeInfo.ElementType].Name.buffer, Var.Name.buffer, ArrayTypeInfo.ArrayCount);
+	}
+
+	// Outputs aren't in scope for expressions, main writes them once at the end
+	for (int32 i = 0; i < NumOut; i++)
+	{
+		VariableInfo OutVar;
+		OutVar.Type = GetRandomTypeForGlobal(GVTR_FloatOrVector);
+		OutVar.Name.AppendFormat("glob_out_%d", i);
+		SrcBuff->AppendFormat("out %s %s;\n", PS->ProgramTypes[OutVar.Type].Name.buffer, OutVar.Name.buffer);
+		PS->OutVars.push_back(OutVar);
+	}
+
+	for (int32 i = 0; i < NumStorageBuffers; i++)
+	{
+		// Plain numeric data, the loose fields are readable like any other global
+		static const int32 ArraySizes[] = { 16, 64, 256, 1024 };
+
+		ProgramState::StorageBufferInfo Buffer;
+		Buffer.ElementType = (TypeID)PS->GetIntInRange(BT_Int, BT_Vec4);
+		Buffer.NumElements = ArraySizes[PS->GetIntInRange(0, (int32)(sizeof(ArraySizes) / sizeof(ArraySizes[0])) - 1)];
+
+		SrcBuff->AppendFormat("layout(std430, binding = %d) buffer buf_block_%d {\n", i, i);
+
+		const int32 NumFields = PS->GetIntInRange(0, 3);
+		for (int32 f = 0; f < NumFields; f++)
+		{
+			PS->VarsInScope.emplace_back();
+			auto& Var = PS->VarsInScope.back();
+			Var.Type = (TypeID)PS->GetIntInRange(BT_Int, BT_Vec4);
+			Var.Name.AppendFormat("buf_%d_field_%d", i, f);
+			SrcBuff->AppendFormat("\t%s %s;\n", PS->ProgramTypes[Var.Type].Name.buffer, Var.Name.buffer);
+		}
+
+		SrcBuff->AppendFormat("\t%s buf_%d_data[%d];\n};\n", PS->ProgramTypes[Buffer.ElementType].Name.buffer, i, Buffer.NumElements);
+
+		PS->StorageBuffers.push_back(Buffer);
+	}
+
+	// Compute shaders have no built-in output to mix live_sink into, so they get a buffer of their own
+	if (PS->bKeepAllCodeLive && InShaderType == ShaderType::Compute)
+	{
+		SrcBuff->AppendFormat("layout(std430, binding = %d) buffer live_sink_block {\n\tfloat live_sink_data[];\n};\n", NumStorageBuffers);
+	}
+}
+
+void GenerateLiteralExpression(ProgramState* PS, TypeID DstType)
 {
 	switch (DstType)
 	{
@@ -536,28 +1345,171 @@ void GenerateLiteralExpression(ProgramState* PS, TypeID DstType)
 	}
 }
 
+// Remembers the subexpression that was just built (ScratchExpressionList from FirstToken on) for reuse
+void PoolSubexpression(ProgramState* PS, TypeID Type, int32 FirstToken, int64 Cost, int32 PeakScalars, int32 FirstVarRead, int32 FirstFuncCall)
+{
+	if ((int32)PS->ScratchExpressionList.size() - FirstToken > EXPR_POOL_MAX_TOKENS)
+	{
+		return;
+	}
+
+	if (Type >= (TypeID)PS->ExprPoolsByType.size())
+	{
+		PS->ExprPoolsByType.resize(PS->ProgramTypes.size());
+	}
+
+	ExpressionPool& Pool = PS->ExprPoolsByType[Type];
+	if (Pool.Entries.size() == 0)
+	{
+		// Every slot can take any entry, so they all get room for the biggest one up front
+		Pool.Entries.resize(EXPR_POOL_SIZE_PER_TYPE);
+		for (PooledExpression& Entry : Pool.Entries)
+		{
+			Entry.Tokens.reserve(EXPR_POOL_MAX_TOKENS);
+			Entry.VarReads.reserve(EXPR_POOL_MAX_TOKENS);
+			Entry.FuncCalls.reserve(EXPR_POOL_MAX_TOKENS);
+		}
+	}
+
+	int32 Slot = Pool.NumEntries;
+	if (Pool.NumEntries < EXPR_POOL_SIZE_PER_TYPE)
+	{
+		Pool.NumEntries++;
+	}
+	else
+	{
+		Slot = Pool.NextReplaceIndex;
+		Pool.NextReplaceIndex = (Pool.NextReplaceIndex + 1) % EXPR_POOL_SIZE_PER_TYPE;
+	}
+
+	// assign() keeps each slot's capacity, so a warmed-up pool doesn't allocate
+	PooledExpression& Entry = Pool.Entries[Slot];
+	Entry.Tokens.assign(PS->ScratchExpressionList.begin() + FirstToken, PS->ScratchExpressionList.end());
+	Entry.Cost = Cost;
+	Entry.PeakScalars = PeakScalars;
+	Entry.NumVarsNeeded = PS->ExprMaxVarIndex + 1;
+	Entry.VarReads.assign(PS->PendingVarReads.begin() + FirstVarRead, PS->PendingVarReads.end());
+	Entry.FuncCalls.assign(PS->PendingFuncCalls.begin() + FirstFuncCall, PS->PendingFuncCalls.end());
+}
+
+// Copies a random pooled subexpression of Type onto the expression being built, if the dice and budget allow
+bool TryReuseSubexpression(ProgramState* PS, TypeID Type)
+{
+	if (Type >= (TypeID)PS->ExprPoolsByType.size() || PS->ExprPoolsByType[Type].NumEntries == 0)
+	{
+		return false;
+	}
+
+	if (PS->GetIntInRange(0, 99) >= PS->SubexpressionReusePercent)
+	{
+		return false;
+	}
+
+	const ExpressionPool& Pool = PS->ExprPoolsByType[Type];
+	const PooledExpression& Entry = Pool.Entries[PS->GetIntInRange(0, Pool.NumEntries - 1)];
+	if (PS->ExprCostBudget >= 0 && PS->ExprCost + Entry.Cost > PS->ExprCostBudget)
+	{
+		return false;
+	}
+
+	PS->ScratchExpressionList.insert(PS->ScratchExpressionList.end(), Entry.Tokens.begin(), Entry.Tokens.end());
+	PS->ExprCost += Entry.Cost;
+	PS->ExprPeakScalars = std::max(PS->ExprPeakScalars, PS->ExprLiveScalars + Entry.PeakScalars);
+	PS->ExprMaxVarIndex = std::max(PS->ExprMaxVarIndex, Entry.NumVarsNeeded - 1);
+	PS->PendingVarReads.insert(PS->PendingVarReads.end(), Entry.VarReads.begin(), Entry.VarReads.end());
+	PS->PendingFuncCalls.insert(PS->PendingFuncCalls.end(), Entry.FuncCalls.begin(), Entry.FuncCalls.end());
+	return true;
+}
+
+// Logs the subexpression GenerateExpression just finished, which starts at FirstToken and FirstRead (see VariantLog)
+void RecordVariantExpression(ProgramState* PS, TypeID Type, int32 FirstToken, int32 FirstRead)
+{
+	PS->Variants.PendingExpressions.push_back(VariantLog::PendingExpression{ FirstToken, (int32)PS->ScratchExpressionList.size(), Type, FirstRead, (int32)PS->PendingVarReads.size() });
+}
+
+// Hard cap on recursion, the random path basically never gets near this
+// but decision bytes from a fuzzer can ask for arbitrarily deep expressions
+#define MAX_EXPR_STACK_DEPTH 64
+
 bool GenerateExpression(ProgramState* PS, TypeID DstType, int ExprStackDepth = 0, bool bForceNoRecur = false)
 {
 	const float Decider = PS->GetFloat01();
+	const int32 FirstToken = (int32)PS->ScratchExpressionList.size();
+	const int32 FirstRead = (int32)PS->PendingVarReads.size();
+
+	if (ExprStackDepth >= MAX_EXPR_STACK_DEPTH)
+	{
+		bForceNoRecur = true;
+	}
+
+	PS->NumGeneratorSteps++;
+	if (PS->MaxGeneratorSteps > 0 && PS->NumGeneratorSteps > PS->MaxGeneratorSteps)
+	{
+		PS->bOutOfGeneratorSteps = true;
+	}
+
+	if (PS->bOutOfGeneratorSteps)
+	{
+		bForceNoRecur = true;
+	}
+
+	// Out of cost budget, only leaves from here (they're free)
+	if (PS->ExprCostBudget >= 0 && PS->ExprCost >= PS->ExprCostBudget)
+	{
+		bForceNoRecur = true;
+	}
 
 	// Basically, start out allowing recursion half the time, and then after a certain depth only recur 10% of the time to finish up in a reasonable time
 	if (Decider < 0.3f || (Decider < 0.9f && ExprStackDepth > 3) || bForceNoRecur)
 	{
+		// Reuse an earlier subexpression sometimes
 		// Read a variable of that type if it exists
 		// If it doesn't exist and it's a builtin type, issue a literal
 		// If we don't have a variable and it's not a builtin type, bail out
 
+		if (PS->SubexpressionReusePercent > 0 && TryReuseSubexpression(PS, DstType))
+		{
+			if (PS->bRecordVariants)
+			{
+				RecordVariantExpression(PS, DstType, FirstToken, FirstRead);
+			}
+			return true;
+		}
+
 		if (PS->VarsInScope.size() > 0)
 		{
 			// TODO: Also index variables by type?
 			int32 SearchStartOffset = PS->GetIntInRange(0, PS->VarsInScope.size() - 1);
-			for (int32 i = 0; i < PS->VarsInScope.size(); i++)
+
+			// When keeping everything live, first look for a local nothing has read yet,
+			// so values flow into later statements instead of only getting sunk at the end
+			const int32 FirstLocalIndex = PS->VarScopeCountStack.front();
+			for (int32 Pass = (PS->bKeepAllCodeLive ? 0 : 1); Pass < 2; Pass++)
 			{
-				const auto& VarInfo = PS->VarsInScope[(SearchStartOffset + i) % PS->VarsInScope.size()];
-				if (VarInfo.Type == DstType)
+				for (int32 i = 0; i < PS->VarsInScope.size(); i++)
 				{
-					PS->ScratchExpressionList.push_back(VarInfo.Name);
-					return true;
+					const int32 VarIndex = (SearchStartOffset + i) % PS->VarsInScope.size();
+					const auto& VarInfo = PS->VarsInScope[VarIndex];
+					if (Pass == 0 && (VarIndex < FirstLocalIndex || VarInfo.bRead || VarInfo.bReadOnly))
+					{
+						continue;
+					}
+
+					if (VarInfo.Type == DstType)
+					{
+						PS->ScratchExpressionList.emplace_back(VarInfo.Name);
+						PS->ExprMaxVarIndex = std::max(PS->ExprMaxVarIndex, VarIndex);
+						PS->ExprPeakScalars = std::max(PS->ExprPeakScalars, PS->ExprLiveScalars + PS->ProgramTypes[DstType].NumScalarComponents);
+						if (PS->bKeepAllCodeLive || PS->bRecordVariants)
+						{
+							PS->PendingVarReads.push_back(VarIndex);
+						}
+						if (PS->bRecordVariants)
+						{
+							RecordVariantExpression(PS, DstType, FirstToken, FirstRead);
+						}
+						return true;
+					}
 				}
 			}
 		}
@@ -565,6 +1517,11 @@ bool GenerateExpression(ProgramState* PS, TypeID DstType, int ExprStackDepth = 0
 		if (DstType < BT_Count)
 		{
 			GenerateLiteralExpression(PS, DstType);
+			PS->ExprPeakScalars = std::max(PS->ExprPeakScalars, PS->ExprLiveScalars + PS->ProgramTypes[DstType].NumScalarComponents);
+			if (PS->bRecordVariants)
+			{
+				RecordVariantExpression(PS, DstType, FirstToken, FirstRead);
+			}
 			return true;
 		}
 		else
@@ -589,56 +1546,121 @@ bool GenerateExpression(ProgramState* PS, TypeID DstType, int ExprStackDepth = 0
 		int32 SearchStartOffset = PS->GetIntInRange(0, NumTransforms - 1);
 		for (int32 i = 0; i < NumTransforms; i++)
 		{
-			const auto& CurrentTransform = PS->DataTransforms[StartAndEndDTTIndices.first + ((SearchStartOffset + i) % NumTransforms)];
+			// Only the hot columns get read until this transform works out
+			const DataTransformationColumns& Columns = PS->DataTransformColumns;
+			const int32 TransformIndex = StartAndEndDTTIndices.first + ((SearchStartOffset + i) % NumTransforms);
+			const DataTransformationType TransformType = (DataTransformationType)Columns.TransformTypes[TransformIndex];
+			const int32 NumSrcTypes = Columns.NumSrcTypes[TransformIndex];
+			const int32 ALUCost = Columns.ALUCosts[TransformIndex];
+			const TypeID* SrcTypes = &Columns.SrcTypes[Columns.FirstSrcType[TransformIndex]];
+			const DataTransformation& CurrentTransform = PS->DataTransforms[PS->DataTransformOrder[TransformIndex].second];
 			int32 CurrentSubExprStackSize = PS->ScratchExpressionList.size();
 
+			if (PS->ExprCostBudget >= 0 && PS->ExprCost + ALUCost > PS->ExprCostBudget)
+			{
+				continue;
+			}
+
+			// Our cost goes in up front, so the args see what's left of the budget
+			const int64 SavedExprCost = PS->ExprCost;
+			const int32 SavedLiveScalars = PS->ExprLiveScalars;
+			const int32 SavedPeakScalars = PS->ExprPeakScalars;
+			const int32 SavedNumPendingReads = (int32)PS->PendingVarReads.size();
+			const int32 SavedNumPendingCalls = (int32)PS->PendingFuncCalls.size();
+			const int32 SavedMaxVarIndex = PS->ExprMaxVarIndex;
+			PS->ExprCost += ALUCost;
+
+			// Peak and var reads start over for this subtree, and get folded back in at the end
+			PS->ExprPeakScalars = 0;
+			PS->ExprMaxVarIndex = -1;
+
+			// Each evaluated arg's value stays live until this transform consumes them all
+			auto HoldArgValue = [PS](TypeID ArgType)
+			{
+				PS->ExprLiveScalars += PS->ProgramTypes[ArgType].NumScalarComponents;
+			};
+
 			bool Success = true;
-			if (CurrentTransform.TransformType == DTT_FieldAccess)
+			if (TransformType == DTT_FieldAccess)
 			{
-				assert(CurrentTransform.NumSrcTypes == 1);
+				assert(NumSrcTypes == 1);
 
-				Success = GenerateExpression(PS, CurrentTransform.SrcTypes[0], ExprStackDepth + 1);
+				Success = GenerateExpression(PS, SrcTypes[0], ExprStackDepth + 1);
 				if (Success)
 				{
+					HoldArgValue(SrcTypes[0]);
 					PS->ScratchExpressionList.push_back(StringStackBuffer<32>("."));
 					PS->ScratchExpressionList.push_back(CurrentTransform.Name);
 				}
 			}
-			else if (CurrentTransform.TransformType == DTT_Func)
+			else if (TransformType == DTT_Func)
 			{
-				assert(CurrentTransform.NumSrcTypes >= 1);
+				assert(NumSrcTypes >= 1);
 				PS->ScratchExpressionList.push_back(CurrentTransform.Name);
 				PS->ScratchExpressionList.push_back(StringStackBuffer<32>("("));
 
-				for (int32 i = 0; i < CurrentTransform.NumSrcTypes; i++)
+				for (int32 i = 0; i < NumSrcTypes; i++)
 				{
 					if (i > 0)
 					{
 						PS->ScratchExpressionList.push_back(StringStackBuffer<32>(", "));
 					}
 
-					Success &= GenerateExpression(PS, CurrentTransform.SrcTypes[i], ExprStackDepth + 1);
+					Success &= GenerateExpression(PS, SrcTypes[i], ExprStackDepth + 1);
 					if (!Success)
 					{
 						break;
 					}
+
+					HoldArgValue(SrcTypes[i]);
 				}
 
 				PS->ScratchExpressionList.push_back(StringStackBuffer<32>(")"));
 			}
-			else if (CurrentTransform.TransformType == DTT_Op)
+			else if (TransformType == DTT_ConstIndex)
+			{
+				assert(NumSrcTypes == 1);
+
+				Success = GenerateExpression(PS, SrcTypes[0], ExprStackDepth + 1);
+				if (Success)
+				{
+					HoldArgValue(SrcTypes[0]);
+					const int32 ArrayCount = PS->ProgramTypes[SrcTypes[0]].ArrayCount;
+					PS->ScratchExpressionList.push_back(StringStackBuffer<32>("[%d]", PS->GetIntInRange(0, ArrayCount - 1)));
+				}
+			}
+			else if (TransformType == DTT_DynamicIndex)
+			{
+				assert(NumSrcTypes == 2);
+
+				Success = GenerateExpression(PS, SrcTypes[0], ExprStackDepth + 1);
+				if (Success)
+				{
+					HoldArgValue(SrcTypes[0]);
+					PS->ScratchExpressionList.push_back(StringStackBuffer<32>("[clamp("));
+
+					Success &= GenerateExpression(PS, SrcTypes[1], ExprStackDepth + 1);
+					HoldArgValue(SrcTypes[1]);
+
+					const int32 ArrayCount = PS->ProgramTypes[SrcTypes[0]].ArrayCount;
+					PS->ScratchExpressionList.push_back(StringStackBuffer<32>(", 0, %d)]", ArrayCount - 1));
+				}
+			}
+			else if (TransformType == DTT_Op)
 			{
-				assert(CurrentTransform.NumSrcTypes == 2);
+				assert(NumSrcTypes == 2);
 
 				PS->ScratchExpressionList.push_back(StringStackBuffer<32>("("));
 
-				Success = GenerateExpression(PS, CurrentTransform.SrcTypes[0], ExprStackDepth + 1);
+				Success = GenerateExpression(PS, SrcTypes[0], ExprStackDepth + 1);
 
 				if (Success)
 				{
+					HoldArgValue(SrcTypes[0]);
 					PS->ScratchExpressionList.push_back(CurrentTransform.Name);
 
-					Success &= GenerateExpression(PS, CurrentTransform.SrcTypes[1], ExprStackDepth + 1);
+					Success &= GenerateExpression(PS, SrcTypes[1], ExprStackDepth + 1);
+					HoldArgValue(SrcTypes[1]);
 
 					PS->ScratchExpressionList.push_back(StringStackBuffer<32>(")"));
 				}
@@ -651,11 +1673,41 @@ bool GenerateExpression(ProgramState* PS, TypeID DstType, int ExprStackDepth = 0
 
 			if (Success)
 			{
+				PS->ExprPeakScalars = std::max(PS->ExprPeakScalars, PS->ExprLiveScalars + CurrentTransform.RegisterFootprint);
+				PS->ExprLiveScalars = SavedLiveScalars;
+				if (PS->bKeepAllCodeLive && CurrentTransform.UserFuncIndex >= 0)
+				{
+					PS->PendingFuncCalls.push_back(CurrentTransform.UserFuncIndex);
+				}
+
+				if (PS->SubexpressionReusePercent > 0)
+				{
+					PoolSubexpression(PS, DstType, CurrentSubExprStackSize, PS->ExprCost - SavedExprCost, PS->ExprPeakScalars - SavedLiveScalars, SavedNumPendingReads, SavedNumPendingCalls);
+				}
+
+				PS->ExprPeakScalars = std::max(PS->ExprPeakScalars, SavedPeakScalars);
+				PS->ExprMaxVarIndex = std::max(PS->ExprMaxVarIndex, SavedMaxVarIndex);
+				if (PS->bRecordVariants)
+				{
+					RecordVariantExpression(PS, DstType, FirstToken, FirstRead);
+				}
 				return true;
 			}
 			else
 			{
 				PS->ScratchExpressionList.resize(CurrentSubExprStackSize);
+				PS->ExprCost = SavedExprCost;
+				PS->ExprLiveScalars = SavedLiveScalars;
+				PS->ExprPeakScalars = SavedPeakScalars;
+				PS->ExprMaxVarIndex = SavedMaxVarIndex;
+				PS->PendingVarReads.resize(SavedNumPendingReads);
+				PS->PendingFuncCalls.resize(SavedNumPendingCalls);
+
+				std::vector<VariantLog::PendingExpression>& PendingExprs = PS->Variants.PendingExpressions;
+				while (!PendingExprs.empty() && PendingExprs.back().FirstToken >= CurrentSubExprStackSize)
+				{
+					PendingExprs.pop_back();
+				}
 			}
 		}
 
@@ -665,13 +1717,137 @@ bool GenerateExpression(ProgramState* PS, TypeID DstType, int ExprStackDepth = 0
 
 void WriteOutExpressionStackAsSourceString(ProgramState* PS, SourceBuffer* SrcBuff)
 {
+	if (PS->bRecordVariants)
+	{
+		PS->Variants.CommitExpressions(PS->ScratchExpressionList, SrcBuff->length);
+	}
+
 	for (const auto& ScratchSubexpr : PS->ScratchExpressionList)
 	{
 		SrcBuff->Append(ScratchSubexpr.buffer);
 	}
 }
 
-void GenerateAssignmentStatement(ProgramState* PS, SourceBuffer* SrcBuff, const VariableInfo& VarInfo)
+// Variant recording (see VariantLog): functions and the statements in them get bracketed by these,
+// which do nothing unless Options->KeepVariantInfo is set
+void BeginVariantFunction(ProgramState* PS, SourceBuffer* SrcBuff)
+{
+	if (!PS->bRecordVariants)
+	{
+		return;
+	}
+
+	// Anything new in scope before the first function is a global
+	VariantLog& Log = PS->Variants;
+	Log.SyncScope(PS->VarsInScope, -1, -1);
+
+	VariantFunction Function;
+	Function.Begin = SrcBuff->length;
+	Function.FirstStatement = (int32)Log.Statements.size();
+	Function.EndStatement = Function.FirstStatement;
+	Log.Functions.push_back(Function);
+}
+
+// After the function's scope has ended
+void EndVariantFunction(ProgramState* PS)
+{
+	if (!PS->bRecordVariants)
+	{
+		return;
+	}
+
+	VariantLog& Log = PS->Variants;
+	Log.SyncScope(PS->VarsInScope, -1, (int32)Log.Statements.size() - 1);
+	Log.Functions.back().EndStatement = (int32)Log.Statements.size();
+}
+
+void BeginVariantStatement(ProgramState* PS, SourceBuffer* SrcBuff)
+{
+	if (!PS->bRecordVariants)
+	{
+		return;
+	}
+
+	// Params, and what main loads up front, are in scope from the first statement
+	VariantLog& Log = PS->Variants;
+	const int32 Index = (int32)Log.Statements.size();
+	Log.SyncScope(PS->VarsInScope, Index - 1, Index - 1);
+	Log.StatementBegin = SrcBuff->length;
+	Log.StatementFirstRead = (int32)Log.Reads.size();
+	Log.bStatementUsesSink = false;
+}
+
+// DefVarIndex is the VarsInScope index of what a VSK_Assign statement assigns, -1 for an output
+void EndVariantStatement(ProgramState* PS, SourceBuffer* SrcBuff, VariantStatementKind Kind, int32 DefVarIndex = -1)
+{
+	if (!PS->bRecordVariants)
+	{
+		return;
+	}
+
+	VariantLog& Log = PS->Variants;
+	const int32 Index = (int32)Log.Statements.size();
+	Log.SyncScope(PS->VarsInScope, Index, Index);
+
+	VariantStatement Statement;
+	Statement.Kind = Kind;
+	Statement.Function = (int32)Log.Functions.size() - 1;
+	Statement.Begin = Log.StatementBegin;
+	Statement.End = SrcBuff->length;
+	Statement.DefVar = (DefVarIndex >= 0) ? Log.ScopeVarIds[DefVarIndex] : -1;
+	Statement.bUsesSink = Log.bStatementUsesSink;
+	Statement.FirstRead = Log.StatementFirstRead;
+	Statement.NumReads = (int32)Log.Reads.size() - Log.StatementFirstRead;
+	Log.Statements.push_back(Statement);
+}
+
+// Liveness (KeepAllCodeLive): each function has a float live_sink that values nothing else reads get folded into,
+// and which in turn gets mixed into the function's result, so a compiler can't throw any of the work away
+
+// Appends a float expression that depends on every component of Expr
+void AppendFoldToFloat(ProgramState* PS, SourceBuffer* SrcBuff, const char* Expr, TypeID Type)
+{
+	switch (Type)
+	{
+	case BT_Bool: SrcBuff->AppendFormat("(%s ? 1.0 : 0.0)", Expr); break;
+	case BT_Int: SrcBuff->AppendFormat("float(%s)", Expr); break;
+	case BT_Float: SrcBuff->AppendFormat("%s", Expr); break;
+	case BT_Vec2:
+	case BT_Vec3:
+	case BT_Vec4: {
+		SrcBuff->AppendFormat("dot(%s, %s(1.0))", Expr, PS->ProgramTypes[Type].Name.buffer);
+	} break;
+	default: {
+		// Struct or array, add up all its fields
+		const TypeInfo& StructInfo = PS->ProgramTypes[Type];
+		SrcBuff->Append("(");
+		for (int32 i = 0; i < StructInfo.NumFields; i++)
+		{
+			if (i > 0)
+			{
+				SrcBuff->Append(" + ");
+			}
+
+			const VariableInfo& Field = PS->GetField(StructInfo, i);
+			AppendFoldToFloat(PS, SrcBuff, StringStackBuffer<256>("%s%s%s", Expr, ProgramState::GetFieldSeparator(StructInfo), Field.Name.buffer).buffer, Field.Type);
+		}
+		SrcBuff->Append(")");
+	} break;
+	}
+}
+
+void GenerateSinkStatement(ProgramState* PS, SourceBuffer* SrcBuff, const VariableInfo& VarInfo)
+{
+	SrcBuff->Append("\tlive_sink += ");
+	AppendFoldToFloat(PS, SrcBuff, VarInfo.Name.buffer, VarInfo.Type);
+	SrcBuff->Append(";\n");
+
+	PS->FunctionCost += PS->ProgramTypes[VarInfo.Type].NumScalarComponents * PS->CurrentCostScale;
+	PS->Variants.bStatementUsesSink = true;
+}
+
+// OverwrittenVarIndex is the variable's index in VarsInScope when it already has a value that's about to be lost
+void GenerateAssignmentStatement(ProgramState* PS, SourceBuffer* SrcBuff, const VariableInfo& VarInfo, int32 OverwrittenVarIndex = -1)
 {
 	bool Success = false;
 
@@ -688,62 +1864,194 @@ void GenerateAssignmentStatement(ProgramState* PS, SourceBuffer* SrcBuff, const
 		else
 		{
 			PS->ScratchExpressionList.clear();
+			PS->Variants.PendingExpressions.clear();
+			PS->ResetExpressionCost();
 		}
 	}
 
+	// If nothing read the old value (the new one's expression included), it goes into the sink first
+	auto SinkOverwrittenValue = [&]()
+	{
+		if (PS->bKeepAllCodeLive && OverwrittenVarIndex >= 0 && !PS->VarsInScope[OverwrittenVarIndex].bRead)
+		{
+			GenerateSinkStatement(PS, SrcBuff, PS->VarsInScope[OverwrittenVarIndex]);
+		}
+	};
+
 	if (Success)
 	{
+		PS->CommitPendingUses();
+		SinkOverwrittenValue();
+
 		SrcBuff->AppendFormat("\t%s = ", VarInfo.Name.buffer);
 		WriteOutExpressionStackAsSourceString(PS, SrcBuff);
 		SrcBuff->Append(";\n");
 
 		PS->ScratchExpressionList.clear();
+		PS->CommitExpressionCost();
 	}
 	else
 	{
 		// Can't be one of the builtins, we should have fallbacks or something for those
 		assert(VarInfo.Type >= BT_Count);
 		const TypeInfo& VarTypeInfo = PS->ProgramTypes[VarInfo.Type];
+		SinkOverwrittenValue();
 
-		for (const auto& Field : VarTypeInfo.Fields)
+		for (int32 f = 0; f < VarTypeInfo.NumFields; f++)
 		{
+			const VariableInfo& Field = PS->GetField(VarTypeInfo, f);
 			VariableInfo VarFieldInfo;
 			VarFieldInfo.Type = Field.Type;
-			VarFieldInfo.Name.AppendFormat("%s.%s", VarInfo.Name.buffer, Field.Name.buffer);
+			VarFieldInfo.Name.AppendFormat("%s%s%s", VarInfo.Name.buffer, ProgramState::GetFieldSeparator(VarTypeInfo), Field.Name.buffer);
 			GenerateAssignmentStatement(PS, SrcBuff, VarFieldInfo);
 		}
 	}
 }
 
+// The other direction: makes every component of a result depend on live_sink
+void GenerateMixSinkStatement(ProgramState* PS, SourceBuffer* SrcBuff, const VariableInfo& VarInfo)
+{
+	PS->Variants.bStatementUsesSink = true;
+
+	const char* Name = VarInfo.Name.buffer;
+	switch (VarInfo.Type)
+	{
+	case BT_Bool: SrcBuff->AppendFormat("\t%s = (%s != (live_sink > 0.0));\n", Name, Name); break;
+	case BT_Int: SrcBuff->AppendFormat("\t%s += int(live_sink);\n", Name); break;
+	case BT_Float: SrcBuff->AppendFormat("\t%s += live_sink;\n", Name); break;
+	case BT_Vec2:
+	case BT_Vec3:
+	case BT_Vec4: {
+		SrcBuff->AppendFormat("\t%s += %s(live_sink);\n", Name, PS->ProgramTypes[VarInfo.Type].Name.buffer);
+	} break;
+	default: {
+		const TypeInfo& StructInfo = PS->ProgramTypes[VarInfo.Type];
+		for (int32 f = 0; f < StructInfo.NumFields; f++)
+		{
+			const VariableInfo& Field = PS->GetField(StructInfo, f);
+			VariableInfo FieldInfo;
+			FieldInfo.Type = Field.Type;
+			FieldInfo.Name.AppendFormat("%s%s%s", Name, ProgramState::GetFieldSeparator(StructInfo), Field.Name.buffer);
+			GenerateMixSinkStatement(PS, SrcBuff, FieldInfo);
+		}
+		return;
+	} break;
+	}
+
+	PS->FunctionCost += PS->ProgramTypes[VarInfo.Type].NumScalarComponents * PS->CurrentCostScale;
+}
+
+// Sinks whatever in the innermost scope was assigned but never read, right before it goes out of scope
+void GenerateScopeEndSinks(ProgramState* PS, SourceBuffer* SrcBuff)
+{
+	if (!PS->bKeepAllCodeLive)
+	{
+		return;
+	}
+
+	for (int32 i = PS->VarScopeCountStack.back(); i < (int32)PS->VarsInScope.size(); i++)
+	{
+		auto& VarInfo = PS->VarsInScope[i];
+		if (!VarInfo.bRead && !VarInfo.bReadOnly)
+		{
+			GenerateSinkStatement(PS, SrcBuff, VarInfo);
+			VarInfo.bRead = true;
+		}
+	}
+}
+
+// Assigns a new value to a variable that's already in scope
+void GenerateReassignmentStatement(ProgramState* PS, SourceBuffer* SrcBuff, int32 VarIndex)
+{
+	const VariableInfo VarInfo = PS->VarsInScope[VarIndex];
+	GenerateAssignmentStatement(PS, SrcBuff, VarInfo, VarIndex);
+	PS->VarsInScope[VarIndex].bRead = false;
+}
+
+// Calls every user func nothing has called so far, with freshly assigned args, and sinks the results
+void GenerateUncalledFuncSinks(ProgramState* PS, SourceBuffer* SrcBuff)
+{
+	for (int32 t = 0; t < (int32)PS->DataTransformOrder.size(); t++)
+	{
+		// Copy, the args can't add transforms but this keeps it obviously safe
+		const DataTransformation Transform = PS->DataTransforms[PS->DataTransformOrder[t].second];
+		if (Transform.UserFuncIndex < 0 || PS->UserFuncCalled[Transform.UserFuncIndex])
+		{
+			continue;
+		}
+
+		for (int32 p = 0; p < Transform.NumSrcTypes; p++)
+		{
+			VariableInfo ArgInfo;
+			ArgInfo.Type = Transform.SrcTypes[p];
+			ArgInfo.Name.AppendFormat("live_arg_%d_%d", Transform.UserFuncIndex, p);
+
+			SrcBuff->AppendFormat("\t%s %s;\n", PS->ProgramTypes[ArgInfo.Type].Name.buffer, ArgInfo.Name.buffer);
+			GenerateAssignmentStatement(PS, SrcBuff, ArgInfo);
+		}
+
+		VariableInfo CallInfo;
+		CallInfo.Type = Transform.DstType;
+		CallInfo.Name.AppendFormat("live_call_%d", Transform.UserFuncIndex);
+
+		SrcBuff->AppendFormat("\t%s %s = %s(", PS->ProgramTypes[CallInfo.Type].Name.buffer, CallInfo.Name.buffer, Transform.Name.buffer);
+		for (int32 p = 0; p < Transform.NumSrcTypes; p++)
+		{
+			SrcBuff->AppendFormat((p > 0) ? ", live_arg_%d_%d" : "live_arg_%d_%d", Transform.UserFuncIndex, p);
+		}
+		SrcBuff->Append(");\n");
+
+		PS->FunctionCost += Transform.ALUCost * PS->CurrentCostScale;
+		PS->UserFuncCalled[Transform.UserFuncIndex] = true;
+
+		GenerateSinkStatement(PS, SrcBuff, CallInfo);
+	}
+}
+
 void GenerateStatement(ProgramState* PS, SourceBuffer* SrcBuff)
 {
 	// Assignment or variable declaration
 	// TODO: If statements, while loops, etc.
 
 	const float Decider = PS->GetFloat01();
+	BeginVariantStatement(PS, SrcBuff);
 
+	int32 VarAssignIndex = -1;
 	if (PS->VarScopeCountStack.front() < PS->VarsInScope.size() && Decider < 0.4f)
 	{
-		int32 VarAssignIndex = PS->GetIntInRange(PS->VarScopeCountStack.front(), PS->VarsInScope.size() - 1);
-		GenerateAssignmentStatement(PS, SrcBuff, PS->VarsInScope[VarAssignIndex]);
+		VarAssignIndex = PS->GetIntInRange(PS->VarScopeCountStack.front(), PS->VarsInScope.size() - 1);
+
+		// Loop counters can't be touched, declare something new instead
+		if (PS->VarsInScope[VarAssignIndex].bReadOnly)
+		{
+			VarAssignIndex = -1;
+		}
+	}
+
+	if (VarAssignIndex >= 0)
+	{
+		GenerateReassignmentStatement(PS, SrcBuff, VarAssignIndex);
 	}
 	else
 	{
 		VariableInfo NewVarInfo;
-		NewVarInfo.Type = PS->GetIntInRange(0, PS->ProgramTypes.size() - 1);
+		NewVarInfo.Type = PS->GetIntInRange(0, PS->GetNumValueTypes() - 1);
 		NewVarInfo.Name.AppendFormat("temp_var_%d", (int32)PS->VarsInScope.size());
 
 		SrcBuff->AppendFormat("\t%s %s;\n", PS->ProgramTypes[NewVarInfo.Type].Name.buffer, NewVarInfo.Name.buffer);
 
 		GenerateAssignmentStatement(PS, SrcBuff, NewVarInfo);
 
+		VarAssignIndex = (int32)PS->VarsInScope.size();
 		PS->VarsInScope.push_back(NewVarInfo);
 	}
 
+	EndVariantStatement(PS, SrcBuff, VSK_Assign, VarAssignIndex);
 }
 
 void GenerateBeginIfStatement(ProgramState* PS, SourceBuffer* SrcBuff)
 {
+	BeginVariantStatement(PS, SrcBuff);
 	SrcBuff->Append("\tif (");
 	
 	bool Success = false;
@@ -761,44 +2069,179 @@ void GenerateBeginIfStatement(ProgramState* PS, SourceBuffer* SrcBuff)
 
 	assert(Success && "if statement bool not made");
 
+	PS->CommitPendingUses();
 	WriteOutExpressionStackAsSourceString(PS, SrcBuff);
 	PS->ScratchExpressionList.clear();
+	PS->CommitExpressionCost();
 	SrcBuff->Append(") {\n");
 
 	PS->BeginScope();
-	PS->CurrentIfStmtDepth++;
+	PS->CurrentBlockDepth++;
+	PS->BlockTripCounts.push_back(1);
+	EndVariantStatement(PS, SrcBuff, VSK_Fixed);
+}
+
+// Constant trip count, and the counter is read-only so the loop always terminates
+void GenerateBeginForLoop(ProgramState* PS, SourceBuffer* SrcBuff, int32 TripCount)
+{
+	VariableInfo CounterInfo;
+	CounterInfo.Type = BT_Int;
+	CounterInfo.Name.AppendFormat("loop_i_%d", PS->NumLoopsGenerated);
+	CounterInfo.bReadOnly = true;
+	PS->NumLoopsGenerated++;
+
+	const char* Counter = CounterInfo.Name.buffer;
+	BeginVariantStatement(PS, SrcBuff);
+	SrcBuff->AppendFormat("\tfor (int %s = 0; %s < %d; %s++) {\n", Counter, Counter, TripCount, Counter);
+
+	PS->BeginScope();
+	PS->VarsInScope.push_back(CounterInfo);
+	PS->CurrentBlockDepth++;
+	PS->BlockTripCounts.push_back(TripCount);
+	PS->CurrentCostScale *= TripCount;
+	// The increment and compare, once per iteration
+	PS->FunctionCost += 2 * PS->CurrentCostScale;
+	EndVariantStatement(PS, SrcBuff, VSK_Fixed);
 }
 
-void GenerateEndIfStatement(ProgramState* PS, SourceBuffer* SrcBuff)
+// Closes an if or a for loop
+void GenerateEndBlockStatement(ProgramState* PS, SourceBuffer* SrcBuff)
 {
+	BeginVariantStatement(PS, SrcBuff);
+	GenerateScopeEndSinks(PS, SrcBuff);
 	SrcBuff->Append("\t}\n");
 	PS->EndScope();
-	PS->CurrentIfStmtDepth--;
+	PS->CurrentBlockDepth--;
+	PS->CurrentCostScale /= std::max(1, PS->BlockTripCounts.back());
+	PS->BlockTripCounts.pop_back();
+	EndVariantStatement(PS, SrcBuff, VSK_Fixed);
 }
 
+// With PS->TargetFunctionCost set, NumStatements is ignored and statements keep coming until the function
+// costs that much, with each one's expressions limited to what's left. Targets too big to reach in straight-line
+// code get loops around the rest of the statements, and if even that runs out of room PS->bHitCostCap says so.
+// Only closes the blocks it opened, so it can go inside blocks that belong to the caller (e.g. main's loop nest)
 void GenerateFunctionBody(ProgramState* PS, SourceBuffer* SrcBuff, int32 NumStatements)
 {
-	for (int32 i = 0; i < NumStatements; i++)
+	const int32 OuterBlockDepth = PS->CurrentBlockDepth;
+	const bool bTargetingCost = (PS->TargetFunctionCost >= 0);
+	const int32 MaxLength = MAX_SHADER_SOURCE_LEN * 3 / 4;
+	// Blocks up to this depth stay open until the end, so the loops opened to reach the target keep
+	// scaling everything after them
+	int32 MinOpenBlockDepth = OuterBlockDepth;
+	// Start of the stretch the cost per byte of source is measured over, moved up each time one of those loops opens
+	int64 SampleStartCost = PS->FunctionCost;
+	int32 SampleStartLength = SrcBuff->length;
+	for (int32 i = 0; bTargetingCost ? (PS->FunctionCost < PS->TargetFunctionCost) : (i < NumStatements); i++)
 	{
-		float Decider = PS->GetFloat01();
-
-		if (Decider < 0.1f)
-		{
-			GenerateBeginIfStatement(PS, SrcBuff);
-		}
-		else if (Decider < 0.2f && PS->CurrentIfStmtDepth > 0)
+		if (bTargetingCost)
 		{
-			GenerateEndIfStatement(PS, SrcBuff);
-		}
-		else
-		{
-			GenerateStatement(PS, SrcBuff);
-		}
-	}
+			// Out of steps, all that's left are leaves, which cost nothing
+			if (PS->bOutOfGeneratorSteps)
+			{
+				break;
+			}
 
-	while (PS->CurrentIfStmtDepth > 0)
+			// Statements that cost nothing can't go on forever, the source buffer is finite
+			if (SrcBuff->length >= MaxLength)
+			{
+				PS->bHitCostCap = true;
+				break;
+			}
+
+			// Past half the room, if the rest of it won't comfortably get there at the rate statements have been
+			// adding cost, the rest goes in a loop that runs often enough to make up for it.
+			// Shaders that reach their target before that come out the same as without it
+			const int64 CostLeft = PS->TargetFunctionCost - PS->FunctionCost;
+			const int32 SampleLength = SrcBuff->length - SampleStartLength;
+			if (SrcBuff->length >= MaxLength / 2 && SampleLength >= MaxLength / 16)
+			{
+				const double CostPerByte = (double)(PS->FunctionCost - SampleStartCost) / (double)SampleLength;
+				const double ProjectedCost = CostPerByte * (double)(MaxLength - SrcBuff->length);
+				if (ProjectedCost < 2.0 * (double)CostLeft)
+				{
+					const int64 TripCount = (ProjectedCost >= 1.0) ? (int64)(2.0 * (double)CostLeft / ProjectedCost) + 1 : 64;
+					GenerateBeginForLoop(PS, SrcBuff, (int32)std::min<int64>(64, std::max<int64>(2, TripCount)));
+					MinOpenBlockDepth = PS->CurrentBlockDepth;
+					SampleStartCost = PS->FunctionCost;
+					SampleStartLength = SrcBuff->length;
+					continue;
+				}
+			}
+
+			// Close to the target, anything inside those loops would cost too much, so they're done
+			if (CostLeft < PS->CurrentCostScale && MinOpenBlockDepth > OuterBlockDepth)
+			{
+				while (PS->CurrentBlockDepth > OuterBlockDepth && CostLeft < PS->CurrentCostScale)
+				{
+					GenerateEndBlockStatement(PS, SrcBuff);
+				}
+				MinOpenBlockDepth = std::min(MinOpenBlockDepth, PS->CurrentBlockDepth);
+			}
+
+			PS->ExprCostBudget = CostLeft / PS->CurrentCostScale;
+		}
+
+		float Decider = PS->GetFloat01();
+
+		if (Decider < 0.1f)
+		{
+			if (PS->bAllowLoops && PS->GetIntInRange(0, 2) == 0)
+			{
+				GenerateBeginForLoop(PS, SrcBuff, PS->GetIntInRange(1, 8));
+			}
+			else
+			{
+				GenerateBeginIfStatement(PS, SrcBuff);
+			}
+		}
+		else if (Decider < 0.2f && PS->CurrentBlockDepth > MinOpenBlockDepth)
+		{
+			GenerateEndBlockStatement(PS, SrcBuff);
+		}
+		else
+		{
+			GenerateStatement(PS, SrcBuff);
+		}
+	}
+
+	while (PS->CurrentBlockDepth > OuterBlockDepth)
+	{
+		GenerateEndBlockStatement(PS, SrcBuff);
+	}
+}
+
+// A long run of arithmetic with no control flow, for measuring compile time on heavy kernels.
+// Declares a few accumulators and then keeps reassigning them, so each statement can build on earlier ones.
+// Returns the index in VarsInScope of the first accumulator, the rest follow it
+int32 DeclareALUAccumulators(ProgramState* PS, SourceBuffer* SrcBuff, int32 NumAccumulators)
+{
+	const int32 FirstIndex = (int32)PS->VarsInScope.size();
+	for (int32 i = 0; i < NumAccumulators; i++)
+	{
+		VariableInfo AccumInfo;
+		AccumInfo.Type = (TypeID)PS->GetIntInRange(BT_Float, BT_Vec4);
+		AccumInfo.Name.AppendFormat("alu_acc_%d", i);
+
+		BeginVariantStatement(PS, SrcBuff);
+		SrcBuff->AppendFormat("\t%s %s;\n", PS->ProgramTypes[AccumInfo.Type].Name.buffer, AccumInfo.Name.buffer);
+		GenerateAssignmentStatement(PS, SrcBuff, AccumInfo);
+
+		PS->VarsInScope.push_back(AccumInfo);
+		EndVariantStatement(PS, SrcBuff, VSK_Assign, (int32)PS->VarsInScope.size() - 1);
+	}
+
+	return FirstIndex;
+}
+
+void GenerateStraightLineALUBlock(ProgramState* PS, SourceBuffer* SrcBuff, int32 FirstAccumulator, int32 NumAccumulators, int32 NumStatements)
+{
+	for (int32 i = 0; i < NumStatements; i++)
 	{
-		GenerateEndIfStatement(PS, SrcBuff);
+		const int32 VarIndex = FirstAccumulator + PS->GetIntInRange(0, NumAccumulators - 1);
+		BeginVariantStatement(PS, SrcBuff);
+		GenerateReassignmentStatement(PS, SrcBuff, VarIndex);
+		EndVariantStatement(PS, SrcBuff, VSK_Assign, VarIndex);
 	}
 }
 
@@ -808,11 +2251,19 @@ void GenerateReturnStatement(ProgramState* PS, SourceBuffer* SrcBuff, TypeID Ret
 	RetValInfo.Name.Append("_retval");
 	RetValInfo.Type = RetType;
 
+	BeginVariantStatement(PS, SrcBuff);
 	SrcBuff->AppendFormat("\t%s %s;\n", PS->ProgramTypes[RetType].Name.buffer, RetValInfo.Name.buffer);
 
 	GenerateAssignmentStatement(PS, SrcBuff, RetValInfo);
 
+	if (PS->bKeepAllCodeLive)
+	{
+		GenerateScopeEndSinks(PS, SrcBuff);
+		GenerateMixSinkStatement(PS, SrcBuff, RetValInfo);
+	}
+
 	SrcBuff->AppendFormat("\treturn %s;\n", RetValInfo.Name.buffer);
+	EndVariantStatement(PS, SrcBuff, VSK_Fixed);
 }
 
 void GenerateUserDefinedFuncs(ProgramState* PS, SourceBuffer* SrcBuff)
@@ -822,12 +2273,14 @@ void GenerateUserDefinedFuncs(ProgramState* PS, SourceBuffer* SrcBuff)
 	{
 		PS->BeginScope();
 
-		TypeID RetType = PS->GetIntInRange(0, PS->ProgramTypes.size() - 1);
+		TypeID RetType = PS->GetIntInRange(0, PS->GetNumValueTypes() - 1);
 		const auto& RetTypeInfo = PS->ProgramTypes[RetType];
 
 		int32 NumParams = PS->GetIntInRange(1, 4);
 
+		BeginVariantFunction(PS, SrcBuff);
 		SrcBuff->AppendFormat("%s user_func_%d(", RetTypeInfo.Name.buffer, i);
+		PS->BeginFunctionCost();
 
 		DataTransformation Transform;
 		Transform.TransformType = DTT_Func;
@@ -841,7 +2294,7 @@ void GenerateUserDefinedFuncs(ProgramState* PS, SourceBuffer* SrcBuff)
 				SrcBuff->Append(", ");
 			}
 
-			TypeID ParamType = PS->GetIntInRange(0, PS->ProgramTypes.size() - 1);
+			TypeID ParamType = PS->GetIntInRange(0, PS->GetNumValueTypes() - 1);
 			SrcBuff->AppendFormat("%s param_%d", PS->ProgramTypes[ParamType].Name.buffer, p);
 
 			VariableInfo ParamVarInfo;
@@ -854,6 +2307,11 @@ void GenerateUserDefinedFuncs(ProgramState* PS, SourceBuffer* SrcBuff)
 		}
 		SrcBuff->AppendFormat(") {\n");
 
+		if (PS->bKeepAllCodeLive)
+		{
+			SrcBuff->Append("\tfloat live_sink = 0.0;\n");
+		}
+
 		int32 NumStatements = PS->GetIntInRange(1, 10);
 		GenerateFunctionBody(PS, SrcBuff, NumStatements);
 
@@ -861,8 +2319,15 @@ void GenerateUserDefinedFuncs(ProgramState* PS, SourceBuffer* SrcBuff)
 
 		SrcBuff->AppendFormat("}\n\n");
 
+		// A call costs whatever the body does, and needs its peak on top of the caller's live values
+		Transform.ALUCost = (int32)std::min<int64>(PS->FunctionCost, INT32_MAX);
+		Transform.RegisterFootprint = PS->FunctionPeakScalars;
+		Transform.UserFuncIndex = (int32)PS->UserFuncCalled.size();
+		PS->UserFuncCalled.push_back(false);
+
 		PS->EndScope();
 		assert(PS->VarScopeCountStack.size() == 0);
+		EndVariantFunction(PS);
 
 		PS->DataTransforms.push_back(Transform);
 		// NOTE: We have to re-index them here instead of batching after all user-defined functions,
@@ -871,103 +2336,1232 @@ void GenerateUserDefinedFuncs(ProgramState* PS, SourceBuffer* SrcBuff)
 	}
 }
 
-void GenerateMainFunction(ProgramState* PS, SourceBuffer* SrcBuff)
+void GenerateMainFunction(ProgramState* PS, SourceBuffer* SrcBuff, ShaderType InShaderType)
 {
 	PS->BeginScope();
+	PS->BeginFunctionCost();
 
+	BeginVariantFunction(PS, SrcBuff);
 	SrcBuff->Append("void main() {\n");
 
+	if (PS->bKeepAllCodeLive)
+	{
+		SrcBuff->Append("\tfloat live_sink = 0.0;\n");
+	}
+
+	// Each invocation loads a few elements of each storage buffer up front
+	for (int32 b = 0; b < (int32)PS->StorageBuffers.size(); b++)
+	{
+		const auto& Buffer = PS->StorageBuffers[b];
+		const int32 NumLoads = PS->GetIntInRange(1, 3);
+		for (int32 l = 0; l < NumLoads; l++)
+		{
+			VariableInfo LoadInfo;
+			LoadInfo.Type = Buffer.ElementType;
+			LoadInfo.Name.AppendFormat("buf_%d_load_%d", b, l);
+
+			SrcBuff->AppendFormat("\t%s %s = buf_%d_data[(gl_LocalInvocationIndex + %du) %% %du];\n",
+				PS->ProgramTypes[LoadInfo.Type].Name.buffer, LoadInfo.Name.buffer, b, PS->GetIntInRange(0, Buffer.NumElements - 1), Buffer.NumElements);
+
+			PS->VarsInScope.push_back(LoadInfo);
+		}
+	}
+
 	int32 NumStatements = PS->GetIntInRange(5, 25);
+	if (PS->Options->TargetALUCost > 0)
+	{
+		PS->TargetFunctionCost = (int64)PS->Options->TargetALUCost;
+	}
 	GenerateFunctionBody(PS, SrcBuff, NumStatements);
+	PS->TargetFunctionCost = -1;
+	PS->ExprCostBudget = -1;
+
+	// Heavy-kernel knobs: a nest of bounded loops around a block of straight-line ALU work.
+	// The accumulators live outside the nest so the work feeds into the outputs below
+	const int32 NumALUStatements = (int32)PS->Options->StraightLineALUStatements;
+	const int32 LoopNestDepth = (int32)PS->Options->LoopNestDepth;
+	if (NumALUStatements > 0 || LoopNestDepth > 0)
+	{
+		const int32 NumAccumulators = (NumALUStatements > 0) ? 4 : 0;
+		const int32 FirstAccumulator = DeclareALUAccumulators(PS, SrcBuff, NumAccumulators);
+
+		const int32 TripCount = (PS->Options->LoopTripCount > 0) ? (int32)PS->Options->LoopTripCount : 4;
+		for (int32 i = 0; i < LoopNestDepth; i++)
+		{
+			GenerateBeginForLoop(PS, SrcBuff, TripCount);
+		}
+
+		if (NumALUStatements > 0)
+		{
+			GenerateStraightLineALUBlock(PS, SrcBuff, FirstAccumulator, NumAccumulators, NumALUStatements);
+		}
+		else
+		{
+			GenerateFunctionBody(PS, SrcBuff, PS->GetIntInRange(1, 10));
+		}
+
+		for (int32 i = 0; i < LoopNestDepth; i++)
+		{
+			GenerateEndBlockStatement(PS, SrcBuff);
+		}
+	}
+
+	// Whatever's left of the target goes to the outputs, so they don't overshoot it by much
+	if (PS->Options->TargetALUCost > 0)
+	{
+		PS->ExprCostBudget = std::max<int64>(0, (int64)PS->Options->TargetALUCost - PS->FunctionCost);
+	}
 
-	// TODO: Non-Frag shaders
-	VariableInfo FragColourInfo;
-	FragColourInfo.Name.Append("gl_FragColor");
-	FragColourInfo.Type = BT_Vec4;
-	GenerateAssignmentStatement(PS, SrcBuff, FragColourInfo);
+	if (InShaderType == ShaderType::Frag)
+	{
+		VariableInfo FragColourInfo;
+		FragColourInfo.Name.Append("gl_FragColor");
+		FragColourInfo.Type = BT_Vec4;
+		BeginVariantStatement(PS, SrcBuff);
+		GenerateAssignmentStatement(PS, SrcBuff, FragColourInfo);
+		EndVariantStatement(PS, SrcBuff, VSK_Assign);
+	}
+	else if (InShaderType == ShaderType::Vert)
+	{
+		for (const auto& OutVar : PS->OutVars)
+		{
+			BeginVariantStatement(PS, SrcBuff);
+			GenerateAssignmentStatement(PS, SrcBuff, OutVar);
+			EndVariantStatement(PS, SrcBuff, VSK_Assign);
+		}
+
+		VariableInfo PositionInfo;
+		PositionInfo.Name.Append("gl_Position");
+		PositionInfo.Type = BT_Vec4;
+		BeginVariantStatement(PS, SrcBuff);
+		GenerateAssignmentStatement(PS, SrcBuff, PositionInfo);
+		EndVariantStatement(PS, SrcBuff, VSK_Assign);
+	}
+	else if (InShaderType == ShaderType::Compute)
+	{
+		// Each invocation stores to its own element (modulo the buffer size)
+		for (int32 b = 0; b < (int32)PS->StorageBuffers.size(); b++)
+		{
+			const auto& Buffer = PS->StorageBuffers[b];
+			BeginVariantStatement(PS, SrcBuff);
+			SrcBuff->AppendFormat("\tuint buf_idx_%d = gl_LocalInvocationIndex %% %du;\n", b, Buffer.NumElements);
+
+			VariableInfo StoreInfo;
+			StoreInfo.Type = Buffer.ElementType;
+			StoreInfo.Name.AppendFormat("buf_%d_data[buf_idx_%d]", b, b);
+			GenerateAssignmentStatement(PS, SrcBuff, StoreInfo);
+			EndVariantStatement(PS, SrcBuff, VSK_Assign);
+		}
+	}
+	else
+	{
+		assert(false && "bad enum");
+	}
+
+	PS->ExprCostBudget = -1;
+
+	// Everything the outputs didn't pick up goes through the sink into one of them
+	if (PS->bKeepAllCodeLive)
+	{
+		BeginVariantStatement(PS, SrcBuff);
+		GenerateUncalledFuncSinks(PS, SrcBuff);
+		GenerateScopeEndSinks(PS, SrcBuff);
+
+		if (InShaderType == ShaderType::Frag || InShaderType == ShaderType::Vert)
+		{
+			VariableInfo SinkOutInfo;
+			SinkOutInfo.Name.Append((InShaderType == ShaderType::Frag) ? "gl_FragColor" : "gl_Position");
+			SinkOutInfo.Type = BT_Vec4;
+			GenerateMixSinkStatement(PS, SrcBuff, SinkOutInfo);
+		}
+		else
+		{
+			SrcBuff->Append("\tlive_sink_data[gl_LocalInvocationIndex] = live_sink;\n");
+		}
+		EndVariantStatement(PS, SrcBuff, VSK_Fixed);
+	}
 
 	SrcBuff->Append("}\n\n");
 
 	PS->EndScope();
 	assert(PS->VarScopeCountStack.size() == 0);
+	EndVariantFunction(PS);
 }
 
-#define ARRAY_COUNTOF(arr) (sizeof(arr) / sizeof((arr)[0]))
-
-void GenerateShaderSourceHeader(ProgramState* PS, SourceBuffer* SrcBuff)
+void GenerateShaderSourceHeader(ProgramState* PS, SourceBuffer* SrcBuff, ShaderType InShaderType)
 {
 	const int32 Versions[] = { 130, 300, 330, 400, 410, 430 };
-	const int32 Version = Versions[PS->GetIntInRange(0, ARRAY_COUNTOF(Versions) - 1)];
+	// Compute shaders and std430 buffers need 4.30
+	const int32 Version = (InShaderType == ShaderType::Compute) ? 430 : Versions[PS->GetIntInRange(0, ARRAY_COUNTOF(Versions) - 1)];
 
 	const char* Precisions[] = { "lowp", "mediump", "highp" };
 	const char* Precision = Precisions[PS->GetIntInRange(0, ARRAY_COUNTOF(Precisions) - 1)];
 
 	SrcBuff->AppendFormat("#version %d\n\n", Version);
 	SrcBuff->AppendFormat("precision %s float;\n\n", Precision);
+
+	if (InShaderType == ShaderType::Compute)
+	{
+		// Keep the total at or under 1024, the minimum every implementation supports
+		const int32 SizeX = 1 << PS->GetIntInRange(0, 6);
+		const int32 SizeY = 1 << PS->GetIntInRange(0, 2);
+		const int32 SizeZ = 1 << PS->GetIntInRange(0, 1);
+		SrcBuff->AppendFormat("layout(local_size_x = %d, local_size_y = %d, local_size_z = %d) in;\n\n", SizeX, SizeY, SizeZ);
+	}
 }
 
 void GenerateShaderSource(ProgramState* PS, SourceBuffer* SrcBuff, ShaderType InShaderType)
 {
-	// TODO: Init program outside generation loop once, and restore to it?
-	InitProgramState(PS);
+	PS->bAllowLoops = (InShaderType != ShaderType::Frag);
+	PS->bKeepAllCodeLive = (PS->Options->KeepAllCodeLive != 0);
+	PS->SubexpressionReusePercent = (int32)std::min<uint32>(PS->Options->SubexpressionReusePercent, 100);
+	PS->MaxGeneratorSteps = PS->Options->MaxGeneratorSteps;
+	PS->bRecordVariants = (PS->Options->KeepVariantInfo != 0);
 	
-	GenerateShaderSourceHeader(PS, SrcBuff);
+	GenerateShaderSourceHeader(PS, SrcBuff, InShaderType);
 
 	GenerateUserDefinedStructs(PS, SrcBuff);
+	if (PS->Options->NumArrayTypes > 0 || PS->Options->LargeUniformArraySize > 0)
+	{
+		GenerateArrayTypes(PS);
+	}
 	IndexProgramDataTransformations(PS);
 
 	GenerateGlobalVariables(PS, SrcBuff, InShaderType);
 
 	GenerateUserDefinedFuncs(PS, SrcBuff);
 
-	GenerateMainFunction(PS, SrcBuff);
+	GenerateMainFunction(PS, SrcBuff, InShaderType);
 }
 
 
 
-#if defined(_WIN32)
-#include <Windows.h>
-#endif
+static bool IsShaderTypeSupported(GenShaderType InShaderType)
+{
+	return InShaderType == GENSHADER_TYPE_VERT || InShaderType == GENSHADER_TYPE_FRAG || InShaderType == GENSHADER_TYPE_COMPUTE;
+}
+
+static ShaderType GetInternalShaderType(GenShaderType InShaderType)
+{
+	switch (InShaderType)
+	{
+	case GENSHADER_TYPE_VERT: return ShaderType::Vert;
+	case GENSHADER_TYPE_FRAG: return ShaderType::Frag;
+	case GENSHADER_TYPE_COMPUTE: return ShaderType::Compute;
+	default: {
+		assert(false && "bad enum");
+		return ShaderType::Frag;
+	}
+	}
+}
+
+static_assert(MAX_DTT_ARITY == PROGRAM_IMAGE_MAX_ARITY, "program images store every transform's sources");
+static_assert((int32)DTT_DynamicIndex == (int32)PITT_DynamicIndex, "program images store DataTransformationType as is");
+
+// Turns a generated program into a program image (see program_image.h). Kept in the context so its
+// containers get reused from one image to the next
+struct ProgramImageBuilder
+{
+	std::vector<uint8_t> Image;
+
+	// In the order they were first seen, until SortStringsByUse
+	std::vector<uint32_t> StringOffsets;
+	std::vector<char> StringData;
+	// What a token with each string's text is
+	std::vector<ProgramImageSymbol> StringSymbols;
+	// Open addressing over string indices, -1 for empty slots, never more than half full
+	std::vector<int32> StringLookup;
+
+	std::vector<ProgramImageType> Types;
+	std::vector<ProgramImageField> Fields;
+	std::vector<ProgramImageTransform> Transforms;
+
+	// The source as string indices
+	std::vector<uint32_t> SourceStrings;
+	std::vector<uint8_t> Tokens;
+
+	// For SortStringsByUse
+	std::vector<uint32_t> StringUseCounts;
+	std::vector<uint32_t> StringOrder;
+	std::vector<uint32_t> NewStringIndices;
+	std::vector<uint32_t> SortedStringOffsets;
+	std::vector<char> SortedStringData;
+	uint32 NumSymbols = 0;
+
+	void Reset()
+	{
+		StringOffsets.clear();
+		StringData.clear();
+		StringSymbols.clear();
+		StringLookup.assign(std::max<size_t>(StringLookup.size(), 1024), -1);
+		Types.clear();
+		Fields.clear();
+		Transforms.clear();
+		SourceStrings.clear();
+		Tokens.clear();
+		NumSymbols = 0;
+	}
+
+	static uint64 HashString(const char* Str, size_t Length)
+	{
+		uint64 Hash = 0xcbf29ce484222325ULL;
+		for (size_t i = 0; i < Length; i++)
+		{
+			Hash ^= (uint8_t)Str[i];
+			Hash *= 0x100000001b3ULL;
+		}
+		return Hash;
+	}
+
+	// Index of the string, adding it (as Kind) if it's new
+	uint32 InternString(const char* Str, size_t Length, ProgramImageTokenKind Kind)
+	{
+		const size_t Mask = StringLookup.size() - 1;
+		for (size_t Slot = HashString(Str, Length) & Mask;; Slot = (Slot + 1) & Mask)
+		{
+			const int32 Existing = StringLookup[Slot];
+			if (Existing < 0)
+			{
+				const uint32 Index = (uint32)StringOffsets.size();
+				StringLookup[Slot] = (int32)Index;
+				StringOffsets.push_back((uint32)StringData.size());
+				StringData.insert(StringData.end(), Str, Str + Length);
+				StringData.push_back('\0');
+				StringSymbols.push_back(ProgramImageSymbol{ (uint8_t)Kind, 0, 0 });
+
+				if (StringOffsets.size() * 2 > StringLookup.size())
+				{
+					GrowStringLookup();
+				}
+				return Index;
+			}
+
+			const char* ExistingStr = &StringData[StringOffsets[Existing]];
+			if (strncmp(ExistingStr, Str, Length) == 0 && ExistingStr[Length] == '\0')
+			{
+				return (uint32)Existing;
+			}
+		}
+	}
+
+	void GrowStringLookup()
+	{
+		StringLookup.assign(StringLookup.size() * 2, -1);
+		const size_t Mask = StringLookup.size() - 1;
+		for (uint32 i = 0; i < (uint32)StringOffsets.size(); i++)
+		{
+			const char* Str = &StringData[StringOffsets[i]];
+			size_t Slot = HashString(Str, strlen(Str)) & Mask;
+			while (StringLookup[Slot] >= 0)
+			{
+				Slot = (Slot + 1) & Mask;
+			}
+			StringLookup[Slot] = (int32)i;
+		}
+	}
+
+	void AppendToken(uint32 Symbol)
+	{
+		do
+		{
+			const uint8_t Byte = Symbol & 0x7F;
+			Symbol >>= 7;
+			Tokens.push_back(Byte | (Symbol != 0 ? 0x80 : 0));
+		} while (Symbol != 0);
+	}
+
+	// Identifiers, numbers and the runs of everything else in between
+	void TokenizeSource(const char* Source, size_t Length)
+	{
+		auto IsIdentStart = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; };
+		auto IsDigit = [](char c) { return c >= '0' && c <= '9'; };
+		auto IsIdentChar = [&](char c) { return IsIdentStart(c) || IsDigit(c); };
+
+		size_t Cursor = 0;
+		while (Cursor < Length)
+		{
+			const size_t Begin = Cursor;
+			ProgramImageTokenKind Kind = PITK_Glue;
+			if (IsIdentStart(Source[Cursor]))
+			{
+				Kind = PITK_Ident;
+				while (Cursor < Length && IsIdentChar(Source[Cursor]))
+				{
+					Cursor++;
+				}
+			}
+			else if (IsDigit(Source[Cursor]))
+			{
+				// Exponents' signs end up in the glue after, which is fine since it's all put back as is
+				Kind = PITK_Number;
+				while (Cursor < Length && (IsIdentChar(Source[Cursor]) || Source[Cursor] == '.'))
+				{
+					Cursor++;
+				}
+			}
+			else
+			{
+				while (Cursor < Length && !IsIdentChar(Source[Cursor]))
+				{
+					Cursor++;
+				}
+			}
+
+			SourceStrings.push_back(InternString(Source + Begin, Cursor - Begin, Kind));
+		}
+	}
+
+	// Renumbers the strings so the ones the source uses come first, most used first, which makes them
+	// the symbols and gives the common ones the short varints. Then writes the tokens
+	void SortStringsByUse()
+	{
+		const uint32 NumStrings = (uint32)StringSymbols.size();
+		StringUseCounts.assign(NumStrings, 0);
+		for (uint32 String : SourceStrings)
+		{
+			StringUseCounts[String]++;
+		}
+
+		StringOrder.resize(NumStrings);
+		for (uint32 String = 0; String < NumStrings; String++)
+		{
+			StringOrder[String] = String;
+		}
+		std::stable_sort(StringOrder.begin(), StringOrder.end(), [this](uint32 lhs, uint32 rhs)
+		{
+			return StringUseCounts[lhs] > StringUseCounts[rhs];
+		});
+
+		NewStringIndices.resize(NumStrings);
+		SortedStringOffsets.clear();
+		SortedStringData.clear();
+		for (uint32 NewIndex = 0; NewIndex < NumStrings; NewIndex++)
+		{
+			const uint32 String = StringOrder[NewIndex];
+			NewStringIndices[String] = NewIndex;
+			NumSymbols += (StringUseCounts[String] > 0) ? 1 : 0;
+
+			const char* Str = &StringData[StringOffsets[String]];
+			SortedStringOffsets.push_back((uint32)SortedStringData.size());
+			SortedStringData.insert(SortedStringData.end(), Str, Str + strlen(Str) + 1);
+			// The old symbols are only needed for strings that aren't done yet, which all come after this one
+			StringSymbols.push_back(StringSymbols[String]);
+		}
+		StringSymbols.erase(StringSymbols.begin(), StringSymbols.begin() + NumStrings);
+		StringSymbols.resize(NumSymbols);
+		StringOffsets.swap(SortedStringOffsets);
+		StringData.swap(SortedStringData);
+
+		for (ProgramImageType& Type : Types)
+		{
+			Type.Name = NewStringIndices[Type.Name];
+		}
+		for (ProgramImageField& Field : Fields)
+		{
+			Field.Name = NewStringIndices[Field.Name];
+		}
+		for (ProgramImageTransform& Transform : Transforms)
+		{
+			Transform.Name = NewStringIndices[Transform.Name];
+		}
+		for (uint32 String : SourceStrings)
+		{
+			AppendToken(NewStringIndices[String]);
+		}
+	}
+
+	template<typename T>
+	static ProgramImageSection AppendSection(std::vector<uint8_t>* Image, const T* Elements, size_t Count)
+	{
+		const uint32 Offset = AlignProgramImageOffset((uint32)Image->size());
+		Image->resize(Offset + Count * sizeof(T), 0);
+		if (Count > 0)
+		{
+			memcpy(Image->data() + Offset, Elements, Count * sizeof(T));
+		}
+		return ProgramImageSection{ Offset, (uint32)Count };
+	}
+
+	void Build(const ProgramState* PS, const char* Source, size_t Length, const GenShaderOptions& Options, uint64 Seed, const GenShaderMetadata& Metadata)
+	{
+		Reset();
+
+		// Types and user funcs first, so identifiers with their names come out as references to them
+		for (int32 t = 0; t < (int32)PS->ProgramTypes.size(); t++)
+		{
+			const TypeInfo& Info = PS->ProgramTypes[t];
+			ProgramImageType Type;
+			Type.Name = InternString(Info.Name.buffer, Info.Name.length, PITK_Ident);
+			Type.FirstField = (uint32)Fields.size();
+			Type.NumFields = (uint32)Info.NumFields;
+			Type.NumScalarComponents = Info.NumScalarComponents;
+			Type.ArrayCount = Info.ArrayCount;
+			Type.ElementType = Info.ElementType;
+			if (t <= PROGRAM_IMAGE_MAX_SYMBOL_TARGET)
+			{
+				StringSymbols[Type.Name].Kind = PITK_Type;
+				StringSymbols[Type.Name].Target = (uint16_t)t;
+			}
+			Types.push_back(Type);
+
+			for (int32 f = 0; f < Info.NumFields; f++)
+			{
+				const VariableInfo& Field = PS->GetField(Info, f);
+				Fields.push_back(ProgramImageField{ InternString(Field.Name.buffer, Field.Name.length, PITK_Ident), Field.Type });
+			}
+		}
+
+		// The built-in transforms are the same for every program, only what this one added goes in
+		for (const auto& Key : PS->DataTransformOrder)
+		{
+			const DataTransformation& Transform = PS->DataTransforms[Key.second];
+			bool bAddedByProgram = Transform.UserFuncIndex >= 0 || Transform.DstType >= PS->NumBuiltinTypes;
+			for (int32 i = 0; i < Transform.NumSrcTypes; i++)
+			{
+				bAddedByProgram = bAddedByProgram || Transform.SrcTypes[i] >= PS->NumBuiltinTypes;
+			}
+			if (!bAddedByProgram)
+			{
+				continue;
+			}
+
+			ProgramImageTransform ImageTransform;
+			memset(&ImageTransform, 0, sizeof(ImageTransform));
+			ImageTransform.Name = InternString(Transform.Name.buffer, Transform.Name.length, PITK_Ident);
+			ImageTransform.TransformType = (uint8_t)Transform.TransformType;
+			ImageTransform.NumSrcTypes = (uint8_t)Transform.NumSrcTypes;
+			ImageTransform.DstType = Transform.DstType;
+			for (int32 i = 0; i < Transform.NumSrcTypes; i++)
+			{
+				ImageTransform.SrcTypes[i] = Transform.SrcTypes[i];
+			}
+			ImageTransform.ALUCost = Transform.ALUCost;
+			ImageTransform.RegisterFootprint = Transform.RegisterFootprint;
+			ImageTransform.UserFuncIndex = Transform.UserFuncIndex;
+
+			// Struct constructors share their type's name, which stays the type
+			if (Transform.UserFuncIndex >= 0 && Transforms.size() <= PROGRAM_IMAGE_MAX_SYMBOL_TARGET)
+			{
+				StringSymbols[ImageTransform.Name].Kind = PITK_Transform;
+				StringSymbols[ImageTransform.Name].Target = (uint16_t)Transforms.size();
+			}
+			Transforms.push_back(ImageTransform);
+		}
+
+		TokenizeSource(Source, Length);
+		SortStringsByUse();
+
+		ProgramImageHeader Header;
+		memset(&Header, 0, sizeof(Header));
+		Image.assign(sizeof(Header), 0);
+		Header.Types = AppendSection(&Image, Types.data(), Types.size());
+		Header.Fields = AppendSection(&Image, Fields.data(), Fields.size());
+		Header.Transforms = AppendSection(&Image, Transforms.data(), Transforms.size());
+		Header.Symbols = AppendSection(&Image, StringSymbols.data(), StringSymbols.size());
+		Header.StringOffsets = AppendSection(&Image, StringOffsets.data(), StringOffsets.size());
+		Header.StringData = AppendSection(&Image, StringData.data(), StringData.size());
+		Header.Tokens = AppendSection(&Image, Tokens.data(), Tokens.size());
+		Image.resize(AlignProgramImageOffset((uint32)Image.size()), 0);
+
+		memcpy(Header.Magic, PROGRAM_IMAGE_MAGIC, sizeof(Header.Magic));
+		Header.Version = PROGRAM_IMAGE_VERSION;
+		Header.GeneratorVersion = GENSHADER_GENERATOR_VERSION;
+		Header.ShaderType = (uint32)Options.ShaderType;
+		Header.Seed = Seed;
+		Header.EstimatedALUCost = Metadata.EstimatedALUCost;
+		Header.EstimatedPeakRegisters = Metadata.EstimatedPeakRegisters;
+		Header.SourceLength = (uint32)Length;
+		Header.NumTokens = (uint32)SourceStrings.size();
+		Header.TotalSize = (uint32)Image.size();
+		memcpy(Image.data(), &Header, sizeof(Header));
+	}
+};
+
+// Rewrites the last shader into variants that compute the same thing (see GenShader_GetVariant), from
+// what generating it recorded in PS->Variants. Every rewrite is an edit at an offset in the original
+// source and reordered statements are copied out in their new order, so a variant is one pass over the
+// text. Kept in the context so its containers get reused from one variant to the next
+struct ShaderVariantBuilder
+{
+	struct Edit
+	{
+		// Replaces [Begin, End) of the source with Text, or inserts it at Begin if they're the same
+		int32 Begin;
+		int32 End;
+		// Among edits at the same offset, lower goes first (see AddWrap)
+		int32 Order;
+		std::string Text;
+	};
+
+	std::vector<Edit> Edits;
+	// Which statement goes where, only ever permuted within runs of assignments
+	std::vector<int32> StatementOrder;
+	// Dead branches go in front of a statement, which then has to stay put
+	std::vector<bool> bStatementPinned;
+	// Source ranges of outlined expressions, nothing inside them gets another edit
+	std::vector<std::pair<int32, int32>> OutlinedRanges;
+	std::string Variant;
+
+	std::mt19937_64 RNGState;
+	bool bUsesVariantZero = false;
+	int32 NumNewFuncs = 0;
+	int32 NumDeadVars = 0;
+
+	// NOTE: It's inclusive
+	int32 GetIntInRange(int32 Min, int32 Max)
+	{
+		std::uniform_int_distribution<int32> Dist(Min, Max);
+		return Dist(RNGState);
+	}
+
+	static bool IsVarInScope(const VariantVar& Var, int32 Function, int32 StatementIndex)
+	{
+		return Var.Function < 0 || (Var.Function == Function && Var.DeclStatement < StatementIndex && StatementIndex <= Var.LastStatement);
+	}
+
+	// Whether Expr could be evaluated right before the statement at StatementIndex: everything it reads is in
+	// scope there, and every user func it calls is defined before that statement's function
+	static bool CanEvaluateAt(const VariantLog& Log, const VariantExpression& Expr, int32 StatementIndex)
+	{
+		const int32 Function = Log.Statements[StatementIndex].Function;
+		if (Log.Statements[Expr.Statement].Function > Function)
+		{
+			return false;
+		}
+
+		for (int32 r = Expr.FirstRead; r < Expr.FirstRead + Expr.NumReads; r++)
+		{
+			if (!IsVarInScope(Log.Vars[Log.Reads[r]], Function, StatementIndex))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool IsInsideOutlined(const VariantExpression& Expr) const
+	{
+		for (const auto& Range : OutlinedRanges)
+		{
+			if (Expr.Begin < Range.second && Expr.End > Range.first)
+			{
+				// Expressions nest, so anything overlapping either contains it or is contained by it
+				if (Expr.Begin >= Range.first && Expr.End <= Range.second)
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Opens go outermost first and closes innermost first, so wraps of the same expression nest
+	void AddWrap(const VariantExpression& Expr, const char* Prefix, const char* Suffix)
+	{
+		const int32 Length = Expr.End - Expr.Begin;
+		Edits.push_back(Edit{ Expr.Begin, Expr.Begin, MAX_SHADER_SOURCE_LEN - Length, Prefix });
+		Edits.push_back(Edit{ Expr.End, Expr.End, Length, Suffix });
+	}
+
+	// if (variant_zero > 0.0) { ... } in front of a statement, assigning a copy of an expression that could
+	// be evaluated there to a local of its type (or a new one)
+	void AddDeadBranches(const ProgramState* PS, const char* Source)
+	{
+		const VariantLog& Log = PS->Variants;
+		if (Log.Statements.empty() || Log.Expressions.empty())
+		{
+			return;
+		}
+
+		const int32 NumBranches = GetIntInRange(1, 3);
+		for (int32 b = 0; b < NumBranches; b++)
+		{
+			for (int32 Try = 0; Try < 8; Try++)
+			{
+				const int32 StatementIndex = GetIntInRange(0, (int32)Log.Statements.size() - 1);
+				const VariantExpression& Expr = Log.Expressions[GetIntInRange(0, (int32)Log.Expressions.size() - 1)];
+				if (!CanEvaluateAt(Log, Expr, StatementIndex))
+				{
+					continue;
+				}
+
+				const VariantStatement& Statement = Log.Statements[StatementIndex];
+				const int32 NumVars = (int32)Log.Vars.size();
+				const int32 SearchStart = (NumVars > 0) ? GetIntInRange(0, NumVars - 1) : 0;
+				int32 TargetVar = -1;
+				for (int32 i = 0; i < NumVars && TargetVar < 0; i++)
+				{
+					const VariantVar& Var = Log.Vars[(SearchStart + i) % NumVars];
+					if (Var.Function >= 0 && !Var.bReadOnly && Var.Type == Expr.Type && IsVarInScope(Var, Statement.Function, StatementIndex))
+					{
+						TargetVar = (SearchStart + i) % NumVars;
+					}
+				}
+
+				std::string Text = "\tif (variant_zero > 0.0) {\n\t";
+				if (TargetVar >= 0)
+				{
+					Text += Log.Vars[TargetVar].Name.buffer;
+				}
+				else
+				{
+					Text += StringStackBuffer<128>("%s variant_dead_%d", PS->ProgramTypes[Expr.Type].Name.buffer, NumDeadVars++).buffer;
+				}
+				Text += " = ";
+				Text.append(Source + Expr.Begin, Expr.End - Expr.Begin);
+				Text += ";\n\t}\n";
+
+				Edits.push_back(Edit{ Statement.Begin, Statement.Begin, 0, std::move(Text) });
+				bStatementPinned[StatementIndex] = true;
+				bUsesVariantZero = true;
+				break;
+			}
+		}
+	}
+
+	// Moves a subexpression into a new user func that takes the locals it reads as params (with their
+	// names, so its text doesn't change), defined right before the function it came from
+	void AddOutlines(const ProgramState* PS, const char* Source)
+	{
+		const VariantLog& Log = PS->Variants;
+		if (Log.Expressions.empty())
+		{
+			return;
+		}
+
+		const int32 NumOutlines = GetIntInRange(1, 2);
+		for (int32 o = 0; o < NumOutlines; o++)
+		{
+			for (int32 Try = 0; Try < 8; Try++)
+			{
+				const VariantExpression& Expr = Log.Expressions[GetIntInRange(0, (int32)Log.Expressions.size() - 1)];
+				bool bOverlaps = false;
+				for (const auto& Range : OutlinedRanges)
+				{
+					bOverlaps |= (Expr.Begin < Range.second && Expr.End > Range.first);
+				}
+				if (bOverlaps)
+				{
+					continue;
+				}
+
+				const int32 FuncIndex = (int32)PS->UserFuncCalled.size() + NumNewFuncs++;
+				std::string Definition = StringStackBuffer<128>("%s user_func_%d(", PS->ProgramTypes[Expr.Type].Name.buffer, FuncIndex).buffer;
+				std::string Call = StringStackBuffer<32>("user_func_%d(", FuncIndex).buffer;
+				int32 NumParams = 0;
+				for (int32 r = Expr.FirstRead; r < Expr.FirstRead + Expr.NumReads; r++)
+				{
+					const int32 VarId = Log.Reads[r];
+					const VariantVar& Var = Log.Vars[VarId];
+					if (Var.Function < 0 || std::find(Log.Reads.begin() + Expr.FirstRead, Log.Reads.begin() + r, VarId) != Log.Reads.begin() + r)
+					{
+						continue;
+					}
+
+					const char* Separator = (NumParams > 0) ? ", " : "";
+					Definition += StringStackBuffer<128>("%s%s %s", Separator, PS->ProgramTypes[Var.Type].Name.buffer, Var.Name.buffer).buffer;
+					Call += StringStackBuffer<128>("%s%s", Separator, Var.Name.buffer).buffer;
+					NumParams++;
+				}
+				Definition += ") {\n\treturn ";
+				Definition.append(Source + Expr.Begin, Expr.End - Expr.Begin);
+				Definition += ";\n}\n\n";
+				Call += ")";
+
+				const int32 Function = Log.Statements[Expr.Statement].Function;
+				Edits.push_back(Edit{ Log.Functions[Function].Begin, Log.Functions[Function].Begin, 1, std::move(Definition) });
+				Edits.push_back(Edit{ Expr.Begin, Expr.End, MAX_SHADER_SOURCE_LEN - (Expr.End - Expr.Begin), std::move(Call) });
+				OutlinedRanges.push_back(std::make_pair(Expr.Begin, Expr.End));
+				break;
+			}
+		}
+	}
+
+	// Wraps built-in typed subexpressions in operations that give back the same value, some of them
+	// through variant_zero so the compiler can't fold them away
+	void AddIdentities(const ProgramState* PS)
+	{
+		const VariantLog& Log = PS->Variants;
+		if (Log.Expressions.empty())
+		{
+			return;
+		}
+
+		const int32 NumWraps = 1 + (int32)Log.Expressions.size() / 16;
+		for (int32 w = 0; w < NumWraps; w++)
+		{
+			const VariantExpression& Expr = Log.Expressions[GetIntInRange(0, (int32)Log.Expressions.size() - 1)];
+			if (Expr.Type >= BT_Count || IsInsideOutlined(Expr))
+			{
+				continue;
+			}
+
+			// The last of each uses variant_zero. x - 0.0 rather than x + 0.0, which would turn -0.0 into 0.0.
+			// Vectors only get multiplied by a scalar, the one mixed operation every dialect has for them
+			static const char* FloatSuffixes[] = { " * 1.0)", " - 0.0)", " * (1.0 - variant_zero))" };
+			static const char* VecSuffixes[] = { " * 1.0)", " * (1.0 - variant_zero))" };
+			static const char* IntSuffixes[] = { " + 0)", " * 1)", " + int(variant_zero))" };
+			static const char* BoolSuffixes[] = { " && true)", " || false)", " || (variant_zero > 0.0))" };
+			const char** Suffixes = FloatSuffixes;
+			int32 NumSuffixes = (int32)ARRAY_COUNTOF(FloatSuffixes);
+			switch (Expr.Type)
+			{
+			case BT_Bool: Suffixes = BoolSuffixes; NumSuffixes = (int32)ARRAY_COUNTOF(BoolSuffixes); break;
+			case BT_Int: Suffixes = IntSuffixes; NumSuffixes = (int32)ARRAY_COUNTOF(IntSuffixes); break;
+			case BT_Float: break;
+			default: Suffixes = VecSuffixes; NumSuffixes = (int32)ARRAY_COUNTOF(VecSuffixes); break;
+			}
+
+			const int32 Kind = GetIntInRange(0, NumSuffixes - 1);
+			AddWrap(Expr, "(", Suffixes[Kind]);
+			bUsesVariantZero |= (Kind == NumSuffixes - 1);
+		}
+	}
+
+	static bool DoStatementsConflict(const VariantLog& Log, const VariantStatement& A, const VariantStatement& B)
+	{
+		auto Reads = [&Log](const VariantStatement& Statement, int32 VarId)
+		{
+			const auto Begin = Log.Reads.begin() + Statement.FirstRead;
+			const auto End = Begin + Statement.NumReads;
+			return std::find(Begin, End, VarId) != End;
+		};
+
+		// Outputs are kept in order, even though no two assignments write the same one
+		if (A.DefVar < 0 && B.DefVar < 0)
+		{
+			return true;
+		}
+
+		return (A.bUsesSink && B.bUsesSink) || A.DefVar == B.DefVar
+			|| (A.DefVar >= 0 && Reads(B, A.DefVar)) || (B.DefVar >= 0 && Reads(A, B.DefVar));
+	}
+
+	// Random swaps of neighbouring assignments that don't depend on each other
+	void ReorderStatements(const ProgramState* PS)
+	{
+		const VariantLog& Log = PS->Variants;
+		const int32 NumStatements = (int32)Log.Statements.size();
+		if (NumStatements < 2)
+		{
+			return;
+		}
 
-int main(int argc, char** argv)
+		const int32 NumSwaps = NumStatements / 2;
+		for (int32 s = 0; s < NumSwaps; s++)
+		{
+			const int32 Slot = GetIntInRange(0, NumStatements - 2);
+			const int32 First = StatementOrder[Slot];
+			const int32 Second = StatementOrder[Slot + 1];
+			const VariantStatement& A = Log.Statements[First];
+			const VariantStatement& B = Log.Statements[Second];
+
+			// Slots are back to back when the original statements there were, i.e. same function and nothing in between
+			if (Log.Statements[Slot].End != Log.Statements[Slot + 1].Begin || A.Kind != VSK_Assign || B.Kind != VSK_Assign
+				|| bStatementPinned[First] || bStatementPinned[Second] || DoStatementsConflict(Log, A, B))
+			{
+				continue;
+			}
+
+			std::swap(StatementOrder[Slot], StatementOrder[Slot + 1]);
+		}
+	}
+
+	// Copies [Begin, End) of the source with the edits in it applied
+	void AppendEdited(const char* Source, int32 Begin, int32 End)
+	{
+		auto EditIt = std::lower_bound(Edits.begin(), Edits.end(), Begin, [](const Edit& Lhs, int32 Offset) { return Lhs.Begin < Offset; });
+		int32 Cursor = Begin;
+		for (; EditIt != Edits.end() && EditIt->Begin < End; ++EditIt)
+		{
+			assert(EditIt->Begin >= Cursor && "edits overlap");
+			Variant.append(Source + Cursor, EditIt->Begin - Cursor);
+			Variant += EditIt->Text;
+			Cursor = EditIt->End;
+		}
+		Variant.append(Source + Cursor, End - Cursor);
+	}
+
+	void Build(const ProgramState* PS, const char* Source, int32 Length, uint64 VariantSeed, uint32 Rewrites)
+	{
+		const VariantLog& Log = PS->Variants;
+		const int32 NumStatements = (int32)Log.Statements.size();
+
+		Edits.clear();
+		StatementOrder.resize(NumStatements);
+		for (int32 i = 0; i < NumStatements; i++)
+		{
+			StatementOrder[i] = i;
+		}
+		bStatementPinned.assign(NumStatements, false);
+		OutlinedRanges.clear();
+		RNGState.seed(VariantSeed);
+		bUsesVariantZero = false;
+		NumNewFuncs = 0;
+		NumDeadVars = 0;
+
+		if (Rewrites & GENSHADER_VARIANT_DEAD_BRANCHES)
+		{
+			AddDeadBranches(PS, Source);
+		}
+		// Before the identities, which stay out of outlined expressions
+		if (Rewrites & GENSHADER_VARIANT_OUTLINING)
+		{
+			AddOutlines(PS, Source);
+		}
+		if (Rewrites & GENSHADER_VARIANT_IDENTITIES)
+		{
+			AddIdentities(PS);
+		}
+		if (Rewrites & GENSHADER_VARIANT_REORDERING)
+		{
+			ReorderStatements(PS);
+		}
+
+		// Uniforms are 0 until something sets them, and this one never gets set
+		if (bUsesVariantZero && !Log.Functions.empty())
+		{
+			Edits.push_back(Edit{ Log.Functions[0].Begin, Log.Functions[0].Begin, 0, "uniform float variant_zero;\n" });
+		}
+
+		std::stable_sort(Edits.begin(), Edits.end(), [](const Edit& Lhs, const Edit& Rhs)
+		{
+			return (Lhs.Begin != Rhs.Begin) ? (Lhs.Begin < Rhs.Begin) : (Lhs.Order < Rhs.Order);
+		});
+
+		// Statements go in StatementOrder, what's between them stays where it was
+		Variant.clear();
+		int32 Cursor = 0;
+		for (int32 i = 0; i < NumStatements; i++)
+		{
+			const VariantStatement& Statement = Log.Statements[StatementOrder[i]];
+			AppendEdited(Source, Cursor, Log.Statements[i].Begin);
+			AppendEdited(Source, Statement.Begin, Statement.End);
+			Cursor = Log.Statements[i].End;
+		}
+		AppendEdited(Source, Cursor, Length);
+	}
+};
+
+struct GenShaderContext
+{
+	GenShaderOptions Options;
+
+	// For the last shader generated successfully
+	GenShaderMetadata Metadata;
+
+	// Whether the last shader generated is the one in SrcBuff/PS (it isn't after a failure), and its seed
+	bool bHasLastShader = false;
+	uint64 LastSeed = 0;
+
+	// Made on the first GenShader_GetProgramImage
+	ProgramImageBuilder* ImageBuilder = nullptr;
+
+	// Made on the first GenShader_GetVariant
+	ShaderVariantBuilder* VariantBuilder = nullptr;
+
+	// The last shader analysed for translating to other dialects, done on the first GenShader_GetDialectSource
+	// after generating it and shared by the rest. DialectSource is where the translation goes
+	ShaderDialectSource* DialectAnalysis = nullptr;
+	bool bDialectAnalysisValid = false;
+	bool bDialectAnalysisFailed = false;
+	std::string DialectSource;
+
+	// Heap allocation just cause it's pretty big, and it's reused for every seed
+	SourceBuffer* SrcBuff = nullptr;
+
+	// Reset for every seed rather than made from scratch, so it keeps its memory
+	ProgramState* PS = nullptr;
+};
+
+static GenShaderResult GenerateShaderWithProgramState(GenShaderContext* Ctx, ProgramState* PS)
+{
+	Ctx->SrcBuff->Clear();
+	Ctx->bDialectAnalysisValid = false;
+
+	PS->Options = &Ctx->Options;
+	GenerateShaderSource(PS, Ctx->SrcBuff, GetInternalShaderType(Ctx->Options.ShaderType));
+
+	// StringStackBuffer clamps instead of overflowing, so a full buffer means we lost the end of the shader
+	if (Ctx->SrcBuff->length >= MAX_SHADER_SOURCE_LEN - 1)
+	{
+		Ctx->bHasLastShader = false;
+		return GENSHADER_ERROR_SOURCE_TOO_LONG;
+	}
+	Ctx->bHasLastShader = true;
+
+	// main's totals are what's left in PS, since it's generated last
+	memset(&Ctx->Metadata, 0, sizeof(Ctx->Metadata));
+	Ctx->Metadata.Size = sizeof(GenShaderMetadata);
+	Ctx->Metadata.EstimatedALUCost = (uint64_t)PS->FunctionCost;
+	Ctx->Metadata.EstimatedPeakRegisters = (uint32_t)PS->FunctionPeakScalars;
+	Ctx->Metadata.GeneratorSteps = PS->NumGeneratorSteps;
+	Ctx->Metadata.HitStepBudget = PS->bOutOfGeneratorSteps ? 1 : 0;
+	Ctx->Metadata.HitCostCap = PS->bHitCostCap ? 1 : 0;
+
+	return GENSHADER_OK;
+}
+
+static GenShaderResult GenerateShaderForSeed(GenShaderContext* Ctx, uint64 Seed)
+{
+	ResetProgramState(Ctx->PS);
+	Ctx->PS->SetSeed(Seed);
+	Ctx->LastSeed = Seed;
+
+	return GenerateShaderWithProgramState(Ctx, Ctx->PS);
+}
+
+static GenShaderResult GenerateShaderForDecisionBytes(GenShaderContext* Ctx, const uint8_t* Data, size_t Size)
+{
+	ResetProgramState(Ctx->PS);
+	Ctx->PS->SetDecisionBytes(Data, Size);
+	Ctx->LastSeed = 0;
+
+	return GenerateShaderWithProgramState(Ctx, Ctx->PS);
+}
+
+static GenShaderResult CopyGeneratedSourceToBuffer(GenShaderContext* Ctx, char* OutBuffer, size_t BufferSize, size_t* OutLength)
 {
-	// Heap allocation just cause it's pretty big
+	const size_t Length = (size_t)Ctx->SrcBuff->length;
+	if (OutLength != nullptr)
+	{
+		*OutLength = Length;
+	}
+
+	if (Length + 1 > BufferSize)
+	{
+		return GENSHADER_ERROR_BUFFER_TOO_SMALL;
+	}
+
+	memcpy(OutBuffer, Ctx->SrcBuff->buffer, Length + 1);
+	return GENSHADER_OK;
+}
+
+extern "C" void GenShader_InitOptions(GenShaderOptions* OutOptions)
+{
+	memset(OutOptions, 0, sizeof(*OutOptions));
+	OutOptions->Size = sizeof(GenShaderOptions);
+	OutOptions->ShaderType = GENSHADER_TYPE_FRAG;
+}
+
+extern "C" GenShaderContext* GenShader_CreateContext(const GenShaderOptions* Options)
+{
+	GenShaderContext* Ctx = new GenShaderContext();
+	GenShader_InitOptions(&Ctx->Options);
+	memset(&Ctx->Metadata, 0, sizeof(Ctx->Metadata));
+
+	if (Options != nullptr && GenShader_SetOptions(Ctx, Options) != GENSHADER_OK)
+	{
+		delete Ctx;
+		return nullptr;
+	}
+
 	// Also: typedef as ctor name isn't portable afaik
-	SourceBuffer* SrcBuff = new StringStackBuffer<MAX_SHADER_SOURCE_LEN>;
+	Ctx->SrcBuff = new StringStackBuffer<MAX_SHADER_SOURCE_LEN>;
+	Ctx->PS = new ProgramState();
+
+	return Ctx;
+}
 
-	for (int32 i = 0; i < 1024; i++)
+extern "C" void GenShader_DestroyContext(GenShaderContext* Ctx)
+{
+	if (Ctx != nullptr)
 	{
-		ProgramState PS;
-		PS.SetSeed(i);
+		delete Ctx->SrcBuff;
+		delete Ctx->PS;
+		delete Ctx->ImageBuilder;
+		delete Ctx->VariantBuilder;
+		delete Ctx->DialectAnalysis;
+		delete Ctx;
+	}
+}
 
-		SrcBuff->Clear();
+extern "C" GenShaderResult GenShader_SetOptions(GenShaderContext* Ctx, const GenShaderOptions* Options)
+{
+	if (Ctx == nullptr || Options == nullptr || Options->Size == 0)
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
+	}
 
-		GenerateShaderSource(&PS, SrcBuff, ShaderType::Frag);
+	// Callers built against an older header pass a smaller struct, anything past it keeps the defaults
+	GenShaderOptions NewOptions;
+	GenShader_InitOptions(&NewOptions);
+	memcpy(&NewOptions, Options, std::min<size_t>(Options->Size, sizeof(GenShaderOptions)));
+	NewOptions.Size = sizeof(GenShaderOptions);
+
+	if (!IsShaderTypeSupported(NewOptions.ShaderType))
+	{
+		return GENSHADER_ERROR_UNSUPPORTED_SHADER_TYPE;
+	}
 
-		FILE* f = fopen(StringStackBuffer<256>("gen_shaders/%06d.frag", i).buffer, "w");
-		fprintf(f, "%s", SrcBuff->buffer);
-		fclose(f);
+	Ctx->Options = NewOptions;
+	return GENSHADER_OK;
+}
 
-#if defined(_WIN32)
-		OutputDebugStringA("-----------\n");
-		OutputDebugStringA(SrcBuff->buffer);
-		OutputDebugStringA("\n-----------\n");
-#endif
+extern "C" GenShaderResult GenShader_GenerateToBuffer(GenShaderContext* Ctx, uint64_t Seed, char* OutBuffer, size_t BufferSize, size_t* OutLength)
+{
+	if (Ctx == nullptr || (OutBuffer == nullptr && BufferSize > 0))
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
 	}
 
-	delete SrcBuff;
+	GenShaderResult Result = GenerateShaderForSeed(Ctx, Seed);
+	if (Result != GENSHADER_OK)
+	{
+		return Result;
+	}
 
-	return 0;
+	return CopyGeneratedSourceToBuffer(Ctx, OutBuffer, BufferSize, OutLength);
 }
 
+extern "C" GenShaderResult GenShader_GenerateToCallback(GenShaderContext* Ctx, uint64_t Seed, GenShaderOutputCallback Callback, void* UserData)
+{
+	if (Ctx == nullptr || Callback == nullptr)
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
+	}
 
+	GenShaderResult Result = GenerateShaderForSeed(Ctx, Seed);
+	if (Result != GENSHADER_OK)
+	{
+		return Result;
+	}
+
+	Callback(Ctx->SrcBuff->buffer, (size_t)Ctx->SrcBuff->length, UserData);
+	return GENSHADER_OK;
+}
+
+extern "C" GenShaderResult GenShader_GenerateFromBytesToBuffer(GenShaderContext* Ctx, const uint8_t* Data, size_t Size, char* OutBuffer, size_t BufferSize, size_t* OutLength)
+{
+	if (Ctx == nullptr || (Data == nullptr && Size > 0) || (OutBuffer == nullptr && BufferSize > 0))
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
+	}
+
+	GenShaderResult Result = GenerateShaderForDecisionBytes(Ctx, Data, Size);
+	if (Result != GENSHADER_OK)
+	{
+		return Result;
+	}
+
+	return CopyGeneratedSourceToBuffer(Ctx, OutBuffer, BufferSize, OutLength);
+}
+
+extern "C" GenShaderResult GenShader_GenerateFromBytesToCallback(GenShaderContext* Ctx, const uint8_t* Data, size_t Size, GenShaderOutputCallback Callback, void* UserData)
+{
+	if (Ctx == nullptr || (Data == nullptr && Size > 0) || Callback == nullptr)
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
+	}
+
+	GenShaderResult Result = GenerateShaderForDecisionBytes(Ctx, Data, Size);
+	if (Result != GENSHADER_OK)
+	{
+		return Result;
+	}
+
+	Callback(Ctx->SrcBuff->buffer, (size_t)Ctx->SrcBuff->length, UserData);
+	return GENSHADER_OK;
+}
+
+extern "C" uint32_t GenShader_GetGeneratorVersion(void)
+{
+	return GENSHADER_GENERATOR_VERSION;
+}
+
+extern "C" GenShaderResult GenShader_GetMetadata(const GenShaderContext* Ctx, GenShaderMetadata* OutMetadata)
+{
+	if (Ctx == nullptr || OutMetadata == nullptr || OutMetadata->Size == 0)
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
+	}
+
+	// Same as options: older callers get the prefix of the struct they know about
+	const uint32_t CallerSize = OutMetadata->Size;
+	memcpy(OutMetadata, &Ctx->Metadata, std::min<size_t>(CallerSize, sizeof(GenShaderMetadata)));
+	OutMetadata->Size = CallerSize;
+	return GENSHADER_OK;
+}
 
+extern "C" GenShaderResult GenShader_GetProgramImage(GenShaderContext* Ctx, const void** OutImage, size_t* OutSize)
+{
+	if (Ctx == nullptr || OutImage == nullptr || OutSize == nullptr || !Ctx->bHasLastShader)
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
+	}
 
+	if (Ctx->ImageBuilder == nullptr)
+	{
+		Ctx->ImageBuilder = new ProgramImageBuilder();
+	}
 
+	Ctx->ImageBuilder->Build(Ctx->PS, Ctx->SrcBuff->buffer, (size_t)Ctx->SrcBuff->length, Ctx->Options, Ctx->LastSeed, Ctx->Metadata);
+	*OutImage = Ctx->ImageBuilder->Image.data();
+	*OutSize = Ctx->ImageBuilder->Image.size();
+	return GENSHADER_OK;
+}
 
+extern "C" GenShaderResult GenShader_GetDialectSource(GenShaderContext* Ctx, GenShaderDialect Dialect, GenShaderOutputCallback Callback, void* UserData)
+{
+	if (Ctx == nullptr || Callback == nullptr || !Ctx->bHasLastShader || (uint32_t)Dialect >= GENSHADER_DIALECT_COUNT)
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
+	}
 
+	if (Dialect == GENSHADER_DIALECT_GLSL)
+	{
+		Callback(Ctx->SrcBuff->buffer, (size_t)Ctx->SrcBuff->length, UserData);
+		return GENSHADER_OK;
+	}
 
+	if (!Ctx->bDialectAnalysisValid)
+	{
+		if (Ctx->DialectAnalysis == nullptr)
+		{
+			Ctx->DialectAnalysis = new ShaderDialectSource();
+		}
 
+		std::string Error;
+		Ctx->bDialectAnalysisFailed = !Ctx->DialectAnalysis->Analyse(Ctx->SrcBuff->buffer, (size_t)Ctx->SrcBuff->length, Ctx->Options.ShaderType, &Error);
+		Ctx->bDialectAnalysisValid = true;
+	}
 
+	if (Ctx->bDialectAnalysisFailed || !EmitShaderDialect(Dialect, *Ctx->DialectAnalysis, &Ctx->DialectSource))
+	{
+		return GENSHADER_ERROR_UNSUPPORTED_DIALECT;
+	}
+
+	Callback(Ctx->DialectSource.c_str(), Ctx->DialectSource.size(), UserData);
+	return GENSHADER_OK;
+}
 
+extern "C" GenShaderResult GenShader_GetVariant(GenShaderContext* Ctx, uint64_t VariantSeed, uint32_t Rewrites, GenShaderOutputCallback Callback, void* UserData)
+{
+	if (Ctx == nullptr || Callback == nullptr || !Ctx->bHasLastShader || !Ctx->PS->bRecordVariants || (Rewrites & ~(uint32_t)GENSHADER_VARIANT_ALL) != 0)
+	{
+		return GENSHADER_ERROR_INVALID_ARGUMENT;
+	}
 
+	if (Ctx->VariantBuilder == nullptr)
+	{
+		Ctx->VariantBuilder = new ShaderVariantBuilder();
+	}
+
+	Ctx->VariantBuilder->Build(Ctx->PS, Ctx->SrcBuff->buffer, Ctx->SrcBuff->length, VariantSeed, Rewrites);
+	Callback(Ctx->VariantBuilder->Variant.c_str(), Ctx->VariantBuilder->Variant.size(), UserData);
+	return GENSHADER_OK;
+}
+
+extern "C" const char* GenShader_GetResultString(GenShaderResult Result)
+{
+	switch (Result)
+	{
+	case GENSHADER_OK: return "ok";
+	case GENSHADER_ERROR_INVALID_ARGUMENT: return "invalid argument";
+	case GENSHADER_ERROR_UNSUPPORTED_SHADER_TYPE: return "unsupported shader type";
+	case GENSHADER_ERROR_BUFFER_TOO_SMALL: return "buffer too small";
+	case GENSHADER_ERROR_SOURCE_TOO_LONG: return "source too long";
+	case GENSHADER_ERROR_UNSUPPORTED_DIALECT: return "unsupported in this dialect";
+	default: return "unknown error";
+	}
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+// Embeddable interface to the shader generator (libgenshader)
+// Everything a generation needs lives in a GenShaderContext, so separate contexts can
+// be used from separate threads at the same time. A single context is not thread-safe.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct GenShaderContext GenShaderContext;
+
+typedef enum GenShaderResult
+{
+	GENSHADER_OK = 0,
+	GENSHADER_ERROR_INVALID_ARGUMENT,
+	GENSHADER_ERROR_UNSUPPORTED_SHADER_TYPE,
+	// The caller's buffer can't hold the source + null terminator, OutLength still gets the needed length
+	GENSHADER_ERROR_BUFFER_TOO_SMALL,
+	// The shader didn't fit in the generator's internal source buffer
+	GENSHADER_ERROR_SOURCE_TOO_LONG,
+	// The shader uses something the dialect has no translation for (array types, outside GLSL)
+	GENSHADER_ERROR_UNSUPPORTED_DIALECT
+} GenShaderResult;
+
+typedef enum GenShaderType
+{
+	GENSHADER_TYPE_VERT,
+	GENSHADER_TYPE_FRAG,
+	GENSHADER_TYPE_COMPUTE
+} GenShaderType;
+
+// Shading languages the generated programs can be written in (see shader_dialect.h)
+typedef enum GenShaderDialect
+{
+	GENSHADER_DIALECT_GLSL,
+	GENSHADER_DIALECT_HLSL,
+	GENSHADER_DIALECT_MSL,
+	// For running natively as a reference, see shader_reference.h. Fragment and vertex shaders only
+	GENSHADER_DIALECT_CPP,
+	GENSHADER_DIALECT_COUNT
+} GenShaderDialect;
+
+typedef struct GenShaderOptions
+{
+	// Must be sizeof(GenShaderOptions), GenShader_InitOptions fills it in.
+	// Lets newer versions of the library add fields without breaking older callers
+	uint32_t Size;
+
+	GenShaderType ShaderType;
+
+	// Knobs for compile-time stress kernels, all 0 by default (which leaves them out).
+	// main() gets a nest of LoopNestDepth for loops, each running LoopTripCount times (0 means 4),
+	// around StraightLineALUStatements assignments of arithmetic with no control flow in between
+	uint32_t StraightLineALUStatements;
+	uint32_t LoopNestDepth;
+	uint32_t LoopTripCount;
+
+	// If non-zero, main keeps getting statements until its estimated dynamic cost reaches this many
+	// scalar ALU ops (see GenShaderMetadata), with expressions kept small enough to land close to it.
+	// Targets too big for the source buffer get loops around the later statements, even in frag shaders.
+	// The heavy-kernel knobs above come on top of it
+	uint32_t TargetALUCost;
+
+	// If non-zero, tracks which values get read while generating and makes sure every statement and
+	// user function ends up feeding an output: leaves prefer values nothing has read yet, and whatever
+	// is left unread gets folded into the outputs at the end. Meant for benchmarks, where an optimizer
+	// would otherwise delete most of each shader
+	uint32_t KeepAllCodeLive;
+
+	// Percent chance (0-100) that an expression leaf reuses an earlier subexpression of the same type
+	// that's still in scope, instead of a variable or literal. Gives the compiler common subexpressions
+	// to find, which random trees almost never have. 0 (the default) turns it off
+	uint32_t SubexpressionReusePercent;
+
+	// If non-zero, caps the work put into one shader at this many generator steps (expression nodes
+	// tried, including ones that get backtracked). Past it, expressions only get leaves, so the shader
+	// finishes quickly, and GenShaderMetadata::HitStepBudget says so. Counted in steps rather than time,
+	// so the same seed still gives the same shader on any machine
+	uint32_t MaxGeneratorSteps;
+
+	// Array types, both 0 by default (no arrays).
+	// NumArrayTypes adds that many array types (2 to 32 elements of a built-in or struct type), which
+	// locals, params, returns and uniforms can then have. They're built with constructors or element by
+	// element, and read with constant indices or dynamic ones clamped into range.
+	// LargeUniformArraySize declares a couple of uniform arrays that big, read the same way, for stressing
+	// memory layout and addressing (sizes past the implementation's uniform limits won't link)
+	uint32_t NumArrayTypes;
+	uint32_t LargeUniformArraySize;
+
+	// If non-zero, also records where every statement and subexpression of the shader is and what each
+	// one reads, so GenShader_GetVariant can rewrite it without generating it again. The shader itself
+	// comes out the same, generating it just takes a little longer
+	uint32_t KeepVariantInfo;
+} GenShaderOptions;
+
+// Static estimates for a generated shader, from a rough per-operation cost model
+// (e.g. 1 op per component for arithmetic, 4 for sin/cos/sqrt, 9 for pow, user funcs cost their body)
+typedef struct GenShaderMetadata
+{
+	// Set to sizeof(GenShaderMetadata) before calling GenShader_GetMetadata
+	uint32_t Size;
+
+	// Scalar ALU ops per invocation of main, counting statements once per iteration of the
+	// loops around them and every if as taken
+	uint64_t EstimatedALUCost;
+	// Most scalar registers live at once in main: locals in scope plus expression temporaries
+	uint32_t EstimatedPeakRegisters;
+
+	// Generator steps the whole shader took (see GenShaderOptions::MaxGeneratorSteps)
+	uint64_t GeneratorSteps;
+	// Non-zero if it ran out of steps and the rest of the shader was made of leaves only
+	uint32_t HitStepBudget;
+	// Non-zero if main ran out of room in the source buffer short of GenShaderOptions::TargetALUCost,
+	// even with loops around the later statements
+	uint32_t HitCostCap;
+} GenShaderMetadata;
+
+// Called with the finished source, which is only valid for the duration of the call.
+// Length doesn't include the null terminator (which is always there)
+typedef void (*GenShaderOutputCallback)(const char* Source, size_t Length, void* UserData);
+
+void GenShader_InitOptions(GenShaderOptions* OutOptions);
+
+// Options can be null for defaults
+GenShaderContext* GenShader_CreateContext(const GenShaderOptions* Options);
+void GenShader_DestroyContext(GenShaderContext* Ctx);
+
+GenShaderResult GenShader_SetOptions(GenShaderContext* Ctx, const GenShaderOptions* Options);
+
+// Generates the shader for Seed into OutBuffer (null-terminated). OutLength is optional
+GenShaderResult GenShader_GenerateToBuffer(GenShaderContext* Ctx, uint64_t Seed, char* OutBuffer, size_t BufferSize, size_t* OutLength);
+
+// Generates the shader for Seed and hands it to Callback without any copying
+GenShaderResult GenShader_GenerateToCallback(GenShaderContext* Ctx, uint64_t Seed, GenShaderOutputCallback Callback, void* UserData);
+
+// Same as the above, but every choice the generator makes is read from Data instead of a seeded RNG
+// (FuzzedDataProvider-style). Once Data runs out each choice takes its smallest value, so any input,
+// including an empty one, produces a valid shader. Meant for coverage-guided fuzzers mutating Data
+GenShaderResult GenShader_GenerateFromBytesToBuffer(GenShaderContext* Ctx, const uint8_t* Data, size_t Size, char* OutBuffer, size_t BufferSize, size_t* OutLength);
+GenShaderResult GenShader_GenerateFromBytesToCallback(GenShaderContext* Ctx, const uint8_t* Data, size_t Size, GenShaderOutputCallback Callback, void* UserData);
+
+// Bumped whenever the same seed and options can give a different shader than before,
+// so saved corpora and checkpoints can tell they came from another generator
+uint32_t GenShader_GetGeneratorVersion(void);
+
+// Metadata for the last shader generated successfully with this context
+GenShaderResult GenShader_GetMetadata(const GenShaderContext* Ctx, GenShaderMetadata* OutMetadata);
+
+// Serializes the last shader generated with this context (types, user funcs and the source as a token
+// stream, see program_image.h), for reloading it later without generating it again. Fails if generating
+// it failed. *OutImage belongs to the context, it stays valid until the next call with it
+GenShaderResult GenShader_GetProgramImage(GenShaderContext* Ctx, const void** OutImage, size_t* OutSize);
+
+// Hands the last shader generated with this context to Callback in Dialect (GLSL is the source as generated).
+// The program is only generated once however many dialects are asked for, and analysed once for all
+// of the non-GLSL ones. Fails if generating it failed, and with GENSHADER_ERROR_UNSUPPORTED_DIALECT if the
+// shader has array types, or is a compute shader and Dialect is C++
+GenShaderResult GenShader_GetDialectSource(GenShaderContext* Ctx, GenShaderDialect Dialect, GenShaderOutputCallback Callback, void* UserData);
+
+// Rewrites GenShader_GetVariant can apply, as flags
+typedef enum GenShaderVariantRewrite
+{
+	// ifs that never run (on a uniform variant_zero) around copies of expressions from nearby
+	GENSHADER_VARIANT_DEAD_BRANCHES = 1,
+	// x * 1.0, x - 0.0, x + 0, x && true and the like around subexpressions
+	GENSHADER_VARIANT_IDENTITIES = 2,
+	// Subexpressions moved into new user funcs, numbered after the generated ones
+	GENSHADER_VARIANT_OUTLINING = 4,
+	// Neighbouring assignments swapped when neither reads or writes what the other writes
+	GENSHADER_VARIANT_REORDERING = 8,
+	GENSHADER_VARIANT_ALL = 15
+} GenShaderVariantRewrite;
+
+// Hands Callback a variant of the last shader generated with this context: the same program with a random
+// pick (by VariantSeed) of the Rewrites applied, so it computes the same outputs as long as the uniform
+// variant_zero, declared if a rewrite needs it, is left at 0. Works off what generating the shader recorded
+// (GenShaderOptions::KeepVariantInfo, it fails without it), so a variant costs a fraction of generating one.
+// GLSL only. Meant for finding miscompilations without a reference: every variant should behave the same
+GenShaderResult GenShader_GetVariant(GenShaderContext* Ctx, uint64_t VariantSeed, uint32_t Rewrites, GenShaderOutputCallback Callback, void* UserData);
+
+const char* GenShader_GetResultString(GenShaderResult Result);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,83 @@
+// libFuzzer entry point: the fuzzer's input bytes drive every choice the generator makes
+// (see GenShader_GenerateFromBytesToCallback), so coverage-guided mutation explores shaders
+// instead of blindly enumerating seeds.
+//
+// Build with e.g. `make gen_shader_fuzz` (clang++ -fsanitize=fuzzer).
+// To feed the shaders to something, define GENSHADER_FUZZ_CONSUMER to the name of an
+// extern "C" void(const char* Source, size_t Length) function and link it in.
+// With GENSHADER_FUZZ_STANDALONE it instead builds a small main that prints the shader
+// each input file turns into, for reproducing/inspecting fuzzer findings.
+
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "gen_shader.h"
+
+#if defined(GENSHADER_FUZZ_CONSUMER)
+extern "C" void GENSHADER_FUZZ_CONSUMER(const char* Source, size_t Length);
+#endif
+
+static void ConsumeGeneratedShader(const char* Source, size_t Length, void* UserData)
+{
+#if defined(GENSHADER_FUZZ_CONSUMER)
+	GENSHADER_FUZZ_CONSUMER(Source, Length);
+#elif defined(GENSHADER_FUZZ_STANDALONE)
+	fwrite(Source, 1, Length, stdout);
+#else
+	(void)Source;
+	(void)Length;
+#endif
+	(void)UserData;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* Data, size_t Size)
+{
+	// libFuzzer runs inputs one at a time per process, so one context is plenty
+	static GenShaderContext* Ctx = GenShader_CreateContext(nullptr);
+
+	GenShaderResult Result = GenShader_GenerateFromBytesToCallback(Ctx, Data, Size, ConsumeGeneratedShader, nullptr);
+
+	// Running out of source buffer is an input we don't care about, anything else is a generator bug
+	if (Result != GENSHADER_OK && Result != GENSHADER_ERROR_SOURCE_TOO_LONG)
+	{
+		fprintf(stderr, "Generation failed: %s\n", GenShader_GetResultString(Result));
+		abort();
+	}
+
+	return 0;
+}
+
+#if defined(GENSHADER_FUZZ_STANDALONE)
+int main(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		FILE* f = fopen(argv[i], "rb");
+		if (f == nullptr)
+		{
+			fprintf(stderr, "Could not open '%s'\n", argv[i]);
+			return 1;
+		}
+
+		std::vector<uint8_t> Bytes;
+		uint8_t Chunk[4096];
+		size_t NumRead = 0;
+		while ((NumRead = fread(Chunk, 1, sizeof(Chunk), f)) > 0)
+		{
+			Bytes.insert(Bytes.end(), Chunk, Chunk + NumRead);
+		}
+		fclose(f);
+
+		LLVMFuzzerTestOneInput(Bytes.data(), Bytes.size());
+	}
+
+	return 0;
+}
+#endif
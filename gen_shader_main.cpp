@@ -0,0 +1,895 @@
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stack_string.h"
+#include "gen_shader.h"
+#include "batch_manifest.h"
+#include "packed_corpus.h"
+#include "async_writer.h"
+#include "seed_corpus.h"
+#include "program_image.h"
+#include "shader_dialect.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#endif
+
+using int32 = int32_t;
+
+// One seed's output on its way from a generator thread to the writer. There's a fixed pool of these,
+// the writer hands each one back once it's on disk, so their buffers get reused instead of reallocated
+struct ShaderWriteJob
+{
+	// Position in the list of seeds to do, the writer puts jobs back in this order
+	uint64_t Sequence = 0;
+	uint64_t Seed = 0;
+	GenShaderResult Result = GENSHADER_OK;
+	std::string Source;
+	// Contents of the .meta file, empty if not writing them
+	std::string Metadata;
+	// Program image for --image, empty if not writing them
+	std::string Image;
+	// The source in each dialect --dialects asked for (GLSL is Source), empty for the rest
+	std::string DialectSources[GENSHADER_DIALECT_COUNT];
+	// --variants of the source, empty if not writing them
+	std::vector<std::string> Variants;
+	// For --packed, so the writer can point at them without copying
+	PackedCorpusRecordHeader SourceHeader;
+	PackedCorpusRecordHeader MetadataHeader;
+	PackedCorpusRecordHeader ImageHeader;
+	std::vector<PackedCorpusRecordHeader> VariantHeaders;
+	// For --seed-corpus, filled in by the generator thread
+	SeedCorpusEntry CorpusEntry;
+};
+
+static void CopyToString(const char* Source, size_t Length, void* UserData)
+{
+	((std::string*)UserData)->assign(Source, Length);
+}
+
+static void CopyShaderToJob(const char* Source, size_t Length, void* UserData)
+{
+	ShaderWriteJob* Job = (ShaderWriteJob*)UserData;
+	Job->Source.assign(Source, Length);
+
+#if defined(_WIN32)
+	OutputDebugStringA("-----------\n");
+	OutputDebugStringA(Source);
+	OutputDebugStringA("\n-----------\n");
+#endif
+}
+
+static const char* GetShaderTypeExtension(GenShaderType ShaderType)
+{
+	switch (ShaderType)
+	{
+	case GENSHADER_TYPE_VERT:
+		return "vert";
+	case GENSHADER_TYPE_FRAG:
+		return "frag";
+	case GENSHADER_TYPE_COMPUTE:
+		return "comp";
+	default:
+		assert(false && "bad enum");
+		return "frag";
+	}
+}
+
+// Writes one whole output file, false if any of it didn't make it (a full disk often only shows at fclose).
+// bSync also gets it onto the disk before returning, for when a manifest is about to say it's there
+static bool WriteOutputFile(const char* Path, const char* Mode, const std::string& Data, bool bSync)
+{
+	FILE* f = fopen(Path, Mode);
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	bool bSuccess = (fwrite(Data.data(), 1, Data.size(), f) == Data.size());
+	if (bSync)
+	{
+		bSuccess &= (fflush(f) == 0);
+#if defined(_WIN32)
+		bSuccess &= (_commit(_fileno(f)) == 0);
+#elif defined(__APPLE__)
+		bSuccess &= (fsync(fileno(f)) == 0);
+#else
+		bSuccess &= (fdatasync(fileno(f)) == 0);
+#endif
+	}
+	bSuccess &= (fclose(f) == 0);
+	return bSuccess;
+}
+
+// Writes gen_shaders/<seed>.<type> for each entry of the seed corpus at Path, within [FirstSeed, EndSeed)
+static bool MaterializeSeedCorpus(const char* Path, uint64_t FirstSeed, uint64_t EndSeed)
+{
+	SeedCorpusReader Reader;
+	std::string Error;
+	if (!Reader.Open(Path, 0, &Error))
+	{
+		fprintf(stderr, "Could not read seed corpus '%s': %s\n", Path, Error.c_str());
+		return false;
+	}
+
+	const char* Extension = GetShaderTypeExtension((GenShaderType)Reader.Header.Profile.ShaderType);
+	int32 NumMismatches = 0;
+	for (size_t i = 0; i < Reader.GetNumEntries(); i++)
+	{
+		const SeedCorpusEntry& Entry = Reader.GetEntry(i);
+		if (Entry.Seed < FirstSeed || Entry.Seed >= EndSeed)
+		{
+			continue;
+		}
+
+		const unsigned long long SeedForPath = (unsigned long long)Entry.Seed;
+		const std::string* Source = nullptr;
+		const SeedCorpusMaterializeResult Result = Reader.Materialize(i, &Source);
+		if (Result == SCMR_Mismatch)
+		{
+			fprintf(stderr, "Seed %llu doesn't generate the shader the corpus recorded\n", SeedForPath);
+			NumMismatches++;
+			continue;
+		}
+
+		const StringStackBuffer<256> OutputPath("gen_shaders/%06llu.%s", SeedForPath, Extension);
+		if (!WriteOutputFile(OutputPath.buffer, "w", (Result == SCMR_Ok) ? *Source : std::string(), false))
+		{
+			fprintf(stderr, "Could not write '%s' for seed %llu\n", OutputPath.buffer, SeedForPath);
+			return false;
+		}
+	}
+
+	return NumMismatches == 0;
+}
+
+// Prints the source a program image was made from
+static bool EmitProgramImage(const char* Path)
+{
+	std::vector<uint64_t> Data;
+	size_t Size = 0;
+	if (!ReadProgramImageFile(Path, &Data, &Size))
+	{
+		fprintf(stderr, "Could not read '%s'\n", Path);
+		return false;
+	}
+
+	ProgramImageView View;
+	std::string Error;
+	if (!View.Open(Data.data(), Size, &Error))
+	{
+		fprintf(stderr, "Could not read program image '%s': %s\n", Path, Error.c_str());
+		return false;
+	}
+
+	std::string Source;
+	if (!View.AppendSource(&Source))
+	{
+		fprintf(stderr, "Program image '%s' has a bad token stream\n", Path);
+		return false;
+	}
+
+	fwrite(Source.data(), 1, Source.size(), stdout);
+	return true;
+}
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"usage: gen_shader [--seeds A..B] [--shard I/N] [--type vert|frag|comp] [--alu N] [--loop-depth N] [--loop-trips N]\n"
+		"                  [--target-cost N] [--meta] [--live] [--reuse N] [--max-steps N] [--arrays N] [--uniform-array N]\n"
+		"                  [--image] [--dialects hlsl,msl,cpp] [--variants N] [--manifest FILE [--checkpoint-every N]] [--threads N]\n"
+		"                  [--packed FILE | --seed-corpus FILE]\n"
+		"       gen_shader --materialize FILE [--seeds A..B]\n"
+		"       gen_shader --emit-image FILE\n"
+		"  Writes gen_shaders/<seed>.<type> for each seed\n"
+		"  --seeds A..B    seeds A (inclusive) to B (exclusive), default 0..1024\n"
+		"  --shard I/N     only the I-th of N equal, contiguous slices of the seeds (I from 0), for\n"
+		"                  splitting a run across machines. Merge the results with gen_merge\n"
+		"  --type          shader stage to generate (default frag)\n"
+		"  --alu N         add N straight-line arithmetic statements to main\n"
+		"  --loop-depth N  wrap them in N nested for loops\n"
+		"  --loop-trips N  iterations of each of those loops (default 4)\n"
+		"  --target-cost N grow main until its estimated cost is about N scalar ALU ops, with loops around\n"
+		"                  the later statements if it won't fit otherwise (--meta notes any that fall short)\n"
+		"  --meta          also write <seed>.<type>.meta with the estimated cost and registers\n"
+		"  --live          make every statement and function feed an output (no dead code)\n"
+		"  --reuse N       N%% of expression leaves reuse an earlier subexpression of the same type,\n"
+		"                  so there are common subexpressions for the compiler to find\n"
+		"  --max-steps N   cap each shader at N generator steps, finishing it with leaves only after that,\n"
+		"                  so no seed takes much longer than the rest (--meta then notes which ones hit it)\n"
+		"  --arrays N      add N array types (2 to 32 elements), indexed with constants and clamped ints\n"
+		"  --uniform-array N  also declare uniform arrays of N elements, for memory layout/addressing stress\n"
+		"  --image         also write <seed>.<type>.gsi, a binary program image that reloads without\n"
+		"                  generating or parsing anything (see program_image.h)\n"
+		"  --dialects LIST also write each shader translated to these dialects (hlsl, msl, cpp), as\n"
+		"                  <seed>.<type>.hlsl, .metal and .cpp. Shaders with array types only come out as GLSL,\n"
+		"                  and there's no C++ for compute shaders\n"
+		"  --variants N    also write N equivalent variants of each shader, as <seed>.v<k>.<type> (or variant\n"
+		"                  records with --packed): dead branches, identities, outlined expressions and\n"
+		"                  reordered statements, made from the generator's record of the shader (GenShader_GetVariant)\n"
+		"  --manifest FILE record finished seeds (with hashes of their output) in FILE, and skip\n"
+		"                  the ones already in it, so a killed run can be restarted where it stopped.\n"
+		"                  Refuses to resume if the generator version or options changed\n"
+		"  --checkpoint-every N  save the manifest every N seeds (default 256)\n"
+		"  --threads N     generate on N threads (default 1), a separate thread does all the writing\n"
+		"  --packed FILE   write every shader (and its metadata) into one packed corpus instead,\n"
+		"                  in big sequential writes (see packed_corpus.h). Can't be resumed\n"
+		"  --seed-corpus FILE  only write each shader's seed, metadata and a hash of it into FILE, with the\n"
+		"                  options, for regenerating them later (see seed_corpus.h). Can't be resumed\n"
+		"  --materialize FILE  regenerate the shaders of a seed corpus into gen_shaders/ (only the ones\n"
+		"                  in --seeds, if given), checking each against the hash it was stored with\n"
+		"  --emit-image FILE  print the source a program image was made from\n");
+}
+
+int main(int argc, char** argv)
+{
+	GenShaderOptions Options;
+	GenShader_InitOptions(&Options);
+	const char* Extension = "frag";
+	bool bWriteMetadata = false;
+	bool bWriteImage = false;
+	// Bit per GenShaderDialect, other than GLSL
+	uint32_t DialectMask = 0;
+	int32 NumVariants = 0;
+	const char* ManifestPath = nullptr;
+	int32 CheckpointInterval = 256;
+	uint64_t FirstSeed = 0;
+	uint64_t EndSeed = 1024;
+	uint32_t ShardIndex = 0;
+	uint32_t ShardCount = 1;
+	int32 NumThreads = 1;
+	const char* PackedPath = nullptr;
+	const char* SeedCorpusPath = nullptr;
+	const char* MaterializePath = nullptr;
+	const char* EmitImagePath = nullptr;
+	bool bHasSeedRange = false;
+
+	for (int32 i = 1; i < argc; i++)
+	{
+		const bool bHasValue = (i + 1 < argc);
+		if (strcmp(argv[i], "--seeds") == 0 && bHasValue)
+		{
+			if (!ParseBatchSeedRange(argv[++i], &FirstSeed, &EndSeed))
+			{
+				fprintf(stderr, "Bad seed range '%s'\n", argv[i]);
+				return 1;
+			}
+			bHasSeedRange = true;
+		}
+		else if (strcmp(argv[i], "--shard") == 0 && bHasValue)
+		{
+			if (!ParseBatchShard(argv[++i], &ShardIndex, &ShardCount))
+			{
+				fprintf(stderr, "Bad shard '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--type") == 0 && bHasValue)
+		{
+			Extension = argv[++i];
+			if (strcmp(Extension, "vert") == 0)
+			{
+				Options.ShaderType = GENSHADER_TYPE_VERT;
+			}
+			else if (strcmp(Extension, "frag") == 0)
+			{
+				Options.ShaderType = GENSHADER_TYPE_FRAG;
+			}
+			else if (strcmp(Extension, "comp") == 0)
+			{
+				Options.ShaderType = GENSHADER_TYPE_COMPUTE;
+			}
+			else
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--alu") == 0 && bHasValue)
+		{
+			Options.StraightLineALUStatements = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--loop-depth") == 0 && bHasValue)
+		{
+			Options.LoopNestDepth = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--loop-trips") == 0 && bHasValue)
+		{
+			Options.LoopTripCount = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--target-cost") == 0 && bHasValue)
+		{
+			Options.TargetALUCost = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--meta") == 0)
+		{
+			bWriteMetadata = true;
+		}
+		else if (strcmp(argv[i], "--image") == 0)
+		{
+			bWriteImage = true;
+		}
+		else if (strcmp(argv[i], "--dialects") == 0 && bHasValue)
+		{
+			const std::string List = argv[++i];
+			for (size_t Start = 0; Start <= List.size();)
+			{
+				const size_t Comma = std::min(List.find(',', Start), List.size());
+				const std::string Name = List.substr(Start, Comma - Start);
+				if (Name == "hlsl")
+				{
+					DialectMask |= 1u << GENSHADER_DIALECT_HLSL;
+				}
+				else if (Name == "msl")
+				{
+					DialectMask |= 1u << GENSHADER_DIALECT_MSL;
+				}
+				else if (Name == "cpp")
+				{
+					DialectMask |= 1u << GENSHADER_DIALECT_CPP;
+				}
+				else if (Name != "glsl")
+				{
+					fprintf(stderr, "Unknown dialect '%s'\n", Name.c_str());
+					return 1;
+				}
+				Start = Comma + 1;
+			}
+		}
+		else if (strcmp(argv[i], "--variants") == 0 && bHasValue)
+		{
+			NumVariants = std::max(0, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--live") == 0)
+		{
+			Options.KeepAllCodeLive = 1;
+		}
+		else if (strcmp(argv[i], "--max-steps") == 0 && bHasValue)
+		{
+			Options.MaxGeneratorSteps = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--arrays") == 0 && bHasValue)
+		{
+			Options.NumArrayTypes = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--uniform-array") == 0 && bHasValue)
+		{
+			Options.LargeUniformArraySize = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--reuse") == 0 && bHasValue)
+		{
+			Options.SubexpressionReusePercent = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--manifest") == 0 && bHasValue)
+		{
+			ManifestPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--checkpoint-every") == 0 && bHasValue)
+		{
+			CheckpointInterval = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && bHasValue)
+		{
+			NumThreads = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--packed") == 0 && bHasValue)
+		{
+			PackedPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--seed-corpus") == 0 && bHasValue)
+		{
+			SeedCorpusPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--materialize") == 0 && bHasValue)
+		{
+			MaterializePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--emit-image") == 0 && bHasValue)
+		{
+			EmitImagePath = argv[++i];
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (EmitImagePath != nullptr)
+	{
+		return EmitProgramImage(EmitImagePath) ? 0 : 1;
+	}
+
+	if (MaterializePath != nullptr)
+	{
+		// The corpus has its own options, the range only narrows it down
+		return MaterializeSeedCorpus(MaterializePath, FirstSeed, bHasSeedRange ? EndSeed : UINT64_MAX) ? 0 : 1;
+	}
+
+	// The manifest hashes files gen_merge can re-check, which a seed corpus doesn't have, and it holds the metadata already
+	if (SeedCorpusPath != nullptr && (PackedPath != nullptr || ManifestPath != nullptr || bWriteMetadata || bWriteImage))
+	{
+		fprintf(stderr, "--seed-corpus doesn't go with --packed, --manifest, --meta or --image\n");
+		return 1;
+	}
+
+	// Packed corpora only have record kinds for GLSL
+	if (DialectMask != 0 && (PackedPath != nullptr || SeedCorpusPath != nullptr))
+	{
+		fprintf(stderr, "--dialects only writes to gen_shaders/, not with --packed or --seed-corpus\n");
+		return 1;
+	}
+	if (NumVariants > 0 && SeedCorpusPath != nullptr)
+	{
+		fprintf(stderr, "--variants doesn't go with --seed-corpus\n");
+		return 1;
+	}
+	Options.KeepVariantInfo = (NumVariants > 0) ? 1 : 0;
+	if ((DialectMask & (1u << GENSHADER_DIALECT_CPP)) != 0 && Options.ShaderType == GENSHADER_TYPE_COMPUTE)
+	{
+		fprintf(stderr, "Compute shaders have no C++ translation\n");
+		return 1;
+	}
+
+	ApplyBatchShard(ShardIndex, ShardCount, &FirstSeed, &EndSeed);
+
+	// One context per generator thread, they share nothing
+	std::vector<GenShaderContext*> Contexts;
+	for (int32 i = 0; i < NumThreads; i++)
+	{
+		GenShaderContext* Ctx = GenShader_CreateContext(&Options);
+		if (Ctx == nullptr)
+		{
+			fprintf(stderr, "Bad options\n");
+			return 1;
+		}
+		Contexts.push_back(Ctx);
+	}
+
+	auto DestroyContexts = [&Contexts]()
+	{
+		for (GenShaderContext* Ctx : Contexts)
+		{
+			GenShader_DestroyContext(Ctx);
+		}
+		Contexts.clear();
+	};
+
+	// Everything that changes what a seed's output is, so a restart with other options gets refused
+	BatchManifest Manifest;
+	Manifest.Generator = "gen_shader";
+	Manifest.GeneratorVersion = GenShader_GetGeneratorVersion();
+	Manifest.Config = StringStackBuffer<256>("type=%s alu=%u loop-depth=%u loop-trips=%u target-cost=%u live=%u reuse=%u max-steps=%u arrays=%u uniform-array=%u meta=%d image=%d dialects=%u variants=%d",
+		Extension, Options.StraightLineALUStatements, Options.LoopNestDepth, Options.LoopTripCount, Options.TargetALUCost, Options.KeepAllCodeLive,
+		Options.SubexpressionReusePercent, Options.MaxGeneratorSteps, Options.NumArrayTypes, Options.LargeUniformArraySize, bWriteMetadata ? 1 : 0, bWriteImage ? 1 : 0, DialectMask, NumVariants).buffer;
+
+	if (ManifestPath != nullptr)
+	{
+		if (PackedPath != nullptr)
+		{
+			Manifest.OutputPattern = MakeManifestRelativePath(ManifestPath, PackedPath);
+		}
+		else
+		{
+			Manifest.OutputPattern = MakeManifestRelativePath(ManifestPath, std::string("gen_shaders/%06llu.") + Extension);
+		}
+		if (bWriteMetadata && PackedPath == nullptr)
+		{
+			Manifest.ExtraPatterns.push_back(MakeManifestRelativePath(ManifestPath, std::string("gen_shaders/%06llu.") + Extension + ".meta"));
+		}
+		if (bWriteImage && PackedPath == nullptr)
+		{
+			Manifest.ExtraPatterns.push_back(MakeManifestRelativePath(ManifestPath, std::string("gen_shaders/%06llu.") + Extension + ".gsi"));
+		}
+		for (int32 d = 0; d < GENSHADER_DIALECT_COUNT; d++)
+		{
+			if (DialectMask & (1u << d))
+			{
+				Manifest.ExtraPatterns.push_back(MakeManifestRelativePath(ManifestPath, std::string("gen_shaders/%06llu.") + Extension + GetShaderDialectExtension((GenShaderDialect)d)));
+			}
+		}
+		for (int32 v = 0; v < NumVariants && PackedPath == nullptr; v++)
+		{
+			Manifest.ExtraPatterns.push_back(MakeManifestRelativePath(ManifestPath, std::string("gen_shaders/%06llu.v") + std::to_string(v) + "." + Extension));
+		}
+
+		BatchManifest Existing;
+		const BatchManifestLoadResult LoadResult = Existing.Load(ManifestPath);
+		if (LoadResult == BMLR_Bad)
+		{
+			fprintf(stderr, "Could not parse manifest '%s'\n", ManifestPath);
+			DestroyContexts();
+			return 1;
+		}
+		else if (LoadResult == BMLR_Ok)
+		{
+			std::string Reason;
+			if (!Existing.IsCompatibleWith(Manifest, &Reason))
+			{
+				fprintf(stderr, "Refusing to resume from '%s': %s\n", ManifestPath, Reason.c_str());
+				DestroyContexts();
+				return 1;
+			}
+
+			// Opening the packed corpus again would truncate what the manifest says is in it
+			if (PackedPath != nullptr && Existing.Ranges.size() > 0)
+			{
+				fprintf(stderr, "Refusing to resume from '%s': can't append to a packed corpus, start a new one with another --seeds range\n", ManifestPath);
+				DestroyContexts();
+				return 1;
+			}
+
+			Manifest.Ranges = Existing.Ranges;
+			fprintf(stderr, "Resuming, %llu seeds already done\n", (unsigned long long)Manifest.CountSeeds());
+		}
+	}
+
+	// Seeds left to do, generator threads take them in order
+	std::vector<uint64_t> Todo;
+	Todo.reserve(EndSeed - FirstSeed);
+	for (uint64_t Seed = FirstSeed; Seed < EndSeed; Seed++)
+	{
+		if (ManifestPath == nullptr || !Manifest.ContainsSeed(Seed))
+		{
+			Todo.push_back(Seed);
+		}
+	}
+
+	// Either of the single-file outputs, both start with a header
+	const char* CorpusPath = (PackedPath != nullptr) ? PackedPath : SeedCorpusPath;
+	CoalescingFileWriter CorpusWriter;
+	if (CorpusPath != nullptr)
+	{
+		PackedCorpusFileHeader PackedHeader;
+		memcpy(PackedHeader.Magic, PACKED_CORPUS_MAGIC, sizeof(PackedHeader.Magic));
+		PackedHeader.Version = PACKED_CORPUS_VERSION;
+
+		SeedCorpusFileHeader SeedCorpusHeader;
+		InitSeedCorpusFileHeader(Options, &SeedCorpusHeader);
+
+		const WriteSegment HeaderSegment = (PackedPath != nullptr) ? WriteSegment{ &PackedHeader, sizeof(PackedHeader) } : WriteSegment{ &SeedCorpusHeader, sizeof(SeedCorpusHeader) };
+		if (!CorpusWriter.Open(CorpusPath) || !CorpusWriter.Append(&HeaderSegment, 1))
+		{
+			fprintf(stderr, "Could not open '%s' for writing\n", CorpusPath);
+			DestroyContexts();
+			return 1;
+		}
+	}
+
+	// Generators take jobs from FreeJobs and hand them to the writer (this thread) through ReadyJobs.
+	// Both queues can hold the whole pool, so pushing never has to wait.
+	// The writer only needs the job with the next sequence number, and every job is either free,
+	// being generated, or waiting for an earlier one, so the pool size bounds how far ahead generators get
+	const size_t PoolSize = std::max<size_t>(64, 4 * (size_t)NumThreads);
+	std::unique_ptr<ShaderWriteJob[]> Jobs(new ShaderWriteJob[PoolSize]);
+	BoundedQueue<ShaderWriteJob*> FreeJobs(PoolSize);
+	BoundedQueue<ShaderWriteJob*> ReadyJobs(PoolSize);
+	for (size_t i = 0; i < PoolSize; i++)
+	{
+		FreeJobs.Push(&Jobs[i]);
+	}
+
+	std::atomic<uint64_t> NextSequence{ 0 };
+	// Set when the writer gives up, generators then pass the rest of the seeds through without generating them
+	std::atomic<bool> bAbort{ false };
+
+	auto GenerateShaders = [&](GenShaderContext* Ctx)
+	{
+		while (true)
+		{
+			// Claiming the sequence after getting a job keeps claimed sequences within the pool
+			ShaderWriteJob* Job = FreeJobs.Pop();
+			const uint64_t Sequence = NextSequence.fetch_add(1);
+			if (Sequence >= Todo.size())
+			{
+				FreeJobs.Push(Job);
+				break;
+			}
+
+			Job->Sequence = Sequence;
+			Job->Seed = Todo[Sequence];
+			Job->Source.clear();
+			Job->Metadata.clear();
+			Job->Image.clear();
+			for (std::string& DialectSource : Job->DialectSources)
+			{
+				DialectSource.clear();
+			}
+			Job->Variants.resize(NumVariants);
+			for (std::string& Variant : Job->Variants)
+			{
+				Variant.clear();
+			}
+			Job->Result = GENSHADER_OK;
+			if (!bAbort.load(std::memory_order_relaxed))
+			{
+				Job->Result = GenShader_GenerateToCallback(Ctx, Job->Seed, CopyShaderToJob, Job);
+				if (Job->Result != GENSHADER_OK)
+				{
+					// Failures are deterministic too, so they count as done (with the empty file they leave)
+					Job->Source.clear();
+				}
+				else if (bWriteMetadata)
+				{
+					GenShaderMetadata Metadata;
+					Metadata.Size = sizeof(Metadata);
+					GenShader_GetMetadata(Ctx, &Metadata);
+					Job->Metadata = StringStackBuffer<256>("alu_cost %llu\nregisters %u\n", (unsigned long long)Metadata.EstimatedALUCost, Metadata.EstimatedPeakRegisters).buffer;
+					if (Options.MaxGeneratorSteps > 0)
+					{
+						Job->Metadata += StringStackBuffer<256>("steps %llu\nhit_step_budget %u\n", (unsigned long long)Metadata.GeneratorSteps, Metadata.HitStepBudget).buffer;
+					}
+					if (Options.TargetALUCost > 0)
+					{
+						Job->Metadata += StringStackBuffer<256>("hit_cost_cap %u\n", Metadata.HitCostCap).buffer;
+					}
+				}
+
+				if (Job->Result == GENSHADER_OK && bWriteImage)
+				{
+					const void* Image = nullptr;
+					size_t ImageSize = 0;
+					if (GenShader_GetProgramImage(Ctx, &Image, &ImageSize) == GENSHADER_OK)
+					{
+						Job->Image.assign((const char*)Image, ImageSize);
+					}
+				}
+
+				// Every dialect comes from the one program just generated
+				for (int32 d = 0; Job->Result == GENSHADER_OK && d < GENSHADER_DIALECT_COUNT; d++)
+				{
+					if (DialectMask & (1u << d))
+					{
+						GenShader_GetDialectSource(Ctx, (GenShaderDialect)d, CopyToString, &Job->DialectSources[d]);
+					}
+				}
+
+				// Variant seeds follow gen_c_preproc's, so the same seed's variants don't depend on how many are asked for
+				for (int32 v = 0; Job->Result == GENSHADER_OK && v < NumVariants; v++)
+				{
+					GenShader_GetVariant(Ctx, Job->Seed * 0x9E3779B97F4A7C15ULL + (uint64_t)v, GENSHADER_VARIANT_ALL, CopyToString, &Job->Variants[v]);
+				}
+
+				if (SeedCorpusPath != nullptr)
+				{
+					GenShaderMetadata Metadata;
+					Metadata.Size = sizeof(Metadata);
+					if (Job->Result != GENSHADER_OK || GenShader_GetMetadata(Ctx, &Metadata) != GENSHADER_OK)
+					{
+						memset(&Metadata, 0, sizeof(Metadata));
+					}
+
+					SeedCorpusEntry& Entry = Job->CorpusEntry;
+					Entry.Seed = Job->Seed;
+					Entry.SourceHash = HashBatchOutput(BATCH_MANIFEST_HASH_INIT, Job->Seed, Job->Source.data(), Job->Source.size());
+					Entry.EstimatedALUCost = Metadata.EstimatedALUCost;
+					Entry.EstimatedPeakRegisters = Metadata.EstimatedPeakRegisters;
+					Entry.SourceLength = (uint32_t)Job->Source.size();
+				}
+			}
+
+			ReadyJobs.Push(Job);
+		}
+	};
+
+	std::vector<std::thread> Generators;
+	for (GenShaderContext* Ctx : Contexts)
+	{
+		Generators.emplace_back(GenerateShaders, Ctx);
+	}
+
+	// Writes Batch (consecutive sequences) out, returns false if something couldn't be written
+	std::vector<WriteSegment> Segments;
+	auto WriteBatch = [&](const std::vector<ShaderWriteJob*>& Batch)
+	{
+		if (SeedCorpusPath != nullptr)
+		{
+			Segments.clear();
+			for (ShaderWriteJob* Job : Batch)
+			{
+				Segments.push_back(WriteSegment{ &Job->CorpusEntry, sizeof(Job->CorpusEntry) });
+			}
+
+			if (!CorpusWriter.Append(Segments.data(), Segments.size()))
+			{
+				fprintf(stderr, "Could not write to '%s'\n", SeedCorpusPath);
+				return false;
+			}
+			return true;
+		}
+		else if (PackedPath != nullptr)
+		{
+			// The whole batch goes out as one write
+			Segments.clear();
+			for (ShaderWriteJob* Job : Batch)
+			{
+				Job->SourceHeader = PackedCorpusRecordHeader{ Job->Seed, PCRK_Source, (uint32_t)Job->Source.size() };
+				Segments.push_back(WriteSegment{ &Job->SourceHeader, sizeof(Job->SourceHeader) });
+				Segments.push_back(WriteSegment{ Job->Source.data(), Job->Source.size() });
+				if (Job->Result == GENSHADER_OK && bWriteMetadata)
+				{
+					Job->MetadataHeader = PackedCorpusRecordHeader{ Job->Seed, PCRK_Metadata, (uint32_t)Job->Metadata.size() };
+					Segments.push_back(WriteSegment{ &Job->MetadataHeader, sizeof(Job->MetadataHeader) });
+					Segments.push_back(WriteSegment{ Job->Metadata.data(), Job->Metadata.size() });
+				}
+				if (Job->Result == GENSHADER_OK && bWriteImage)
+				{
+					Job->ImageHeader = PackedCorpusRecordHeader{ Job->Seed, PCRK_ProgramImage, (uint32_t)Job->Image.size() };
+					Segments.push_back(WriteSegment{ &Job->ImageHeader, sizeof(Job->ImageHeader) });
+					Segments.push_back(WriteSegment{ Job->Image.data(), Job->Image.size() });
+				}
+
+				Job->VariantHeaders.resize(Job->Variants.size());
+				for (size_t v = 0; Job->Result == GENSHADER_OK && v < Job->Variants.size(); v++)
+				{
+					Job->VariantHeaders[v] = PackedCorpusRecordHeader{ Job->Seed, PCRK_Variant, (uint32_t)Job->Variants[v].size() };
+					Segments.push_back(WriteSegment{ &Job->VariantHeaders[v], sizeof(Job->VariantHeaders[v]) });
+					Segments.push_back(WriteSegment{ Job->Variants[v].data(), Job->Variants[v].size() });
+				}
+			}
+
+			if (!CorpusWriter.Append(Segments.data(), Segments.size()))
+			{
+				fprintf(stderr, "Could not write to '%s'\n", PackedPath);
+				return false;
+			}
+			return true;
+		}
+
+		// One file per seed can't be coalesced, but at least generators don't wait on it.
+		// A seed only counts as written if the shader and every sidecar it should have got all the way out
+		const bool bSync = (ManifestPath != nullptr);
+		for (ShaderWriteJob* Job : Batch)
+		{
+			const unsigned long long SeedForPath = (unsigned long long)Job->Seed;
+			StringStackBuffer<256> Path("gen_shaders/%06llu.%s", SeedForPath, Extension);
+			bool bSuccess = WriteOutputFile(Path.buffer, "w", Job->Source, bSync);
+
+			if (bSuccess && Job->Result == GENSHADER_OK && bWriteMetadata)
+			{
+				Path.Clear();
+				Path.AppendFormat("gen_shaders/%06llu.%s.meta", SeedForPath, Extension);
+				bSuccess = WriteOutputFile(Path.buffer, "w", Job->Metadata, bSync);
+			}
+
+			if (bSuccess && Job->Result == GENSHADER_OK && bWriteImage)
+			{
+				Path.Clear();
+				Path.AppendFormat("gen_shaders/%06llu.%s.gsi", SeedForPath, Extension);
+				bSuccess = WriteOutputFile(Path.buffer, "wb", Job->Image, bSync);
+			}
+
+			for (int32 d = 0; bSuccess && d < GENSHADER_DIALECT_COUNT; d++)
+			{
+				if (!Job->DialectSources[d].empty())
+				{
+					Path.Clear();
+					Path.AppendFormat("gen_shaders/%06llu.%s%s", SeedForPath, Extension, GetShaderDialectExtension((GenShaderDialect)d));
+					bSuccess = WriteOutputFile(Path.buffer, "w", Job->DialectSources[d], bSync);
+				}
+			}
+
+			for (size_t v = 0; bSuccess && Job->Result == GENSHADER_OK && v < Job->Variants.size(); v++)
+			{
+				Path.Clear();
+				Path.AppendFormat("gen_shaders/%06llu.v%d.%s", SeedForPath, (int32)v, Extension);
+				bSuccess = WriteOutputFile(Path.buffer, "w", Job->Variants[v], bSync);
+			}
+
+			if (!bSuccess)
+			{
+				fprintf(stderr, "Could not write '%s' for seed %llu\n", Path.buffer, SeedForPath);
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// Jobs that came in ahead of the next one to write, by sequence modulo the pool size
+	std::vector<ShaderWriteJob*> Pending(PoolSize, nullptr);
+	std::vector<ShaderWriteJob*> Batch;
+	uint64_t NextToWrite = 0;
+	int32 NumSinceCheckpoint = 0;
+	bool bWriteFailed = false;
+	while (NextToWrite < Todo.size())
+	{
+		// Wait for one, then take whatever else is already there so batches grow when the disk is slow
+		ShaderWriteJob* Job = ReadyJobs.Pop();
+		do
+		{
+			Pending[Job->Sequence % PoolSize] = Job;
+		} while (ReadyJobs.TryPop(&Job));
+
+		Batch.clear();
+		while (NextToWrite < Todo.size() && Pending[NextToWrite % PoolSize] != nullptr)
+		{
+			Batch.push_back(Pending[NextToWrite % PoolSize]);
+			Pending[NextToWrite % PoolSize] = nullptr;
+			NextToWrite++;
+		}
+
+		if (!bWriteFailed && !WriteBatch(Batch))
+		{
+			bWriteFailed = true;
+			bAbort = true;
+		}
+
+		for (ShaderWriteJob* Done : Batch)
+		{
+			if (!bWriteFailed)
+			{
+				if (Done->Result != GENSHADER_OK)
+				{
+					fprintf(stderr, "Seed %llu failed: %s\n", (unsigned long long)Done->Seed, GenShader_GetResultString(Done->Result));
+				}
+
+				if (ManifestPath != nullptr)
+				{
+					Manifest.AddSeed(Done->Seed, Done->Source.data(), Done->Source.size());
+					if (++NumSinceCheckpoint >= CheckpointInterval)
+					{
+						// Per-seed files were synced as they were written, a corpus file gets it here
+						if (CorpusPath != nullptr && !CorpusWriter.Sync())
+						{
+							fprintf(stderr, "Could not write to '%s'\n", CorpusPath);
+							bWriteFailed = true;
+							bAbort = true;
+						}
+						else if (!Manifest.Save(ManifestPath))
+						{
+							fprintf(stderr, "Could not save manifest '%s'\n", ManifestPath);
+						}
+						NumSinceCheckpoint = 0;
+					}
+				}
+			}
+
+			FreeJobs.Push(Done);
+		}
+	}
+
+	for (std::thread& Generator : Generators)
+	{
+		Generator.join();
+	}
+	DestroyContexts();
+
+	if (CorpusPath != nullptr && ((ManifestPath != nullptr && !CorpusWriter.Sync()) | !CorpusWriter.Close()))
+	{
+		fprintf(stderr, "Could not write to '%s'\n", CorpusPath);
+		bWriteFailed = true;
+	}
+
+	if (bWriteFailed)
+	{
+		// The manifest already has everything that made it out before the failure
+		if (ManifestPath != nullptr)
+		{
+			Manifest.Save(ManifestPath);
+		}
+		return 1;
+	}
+
+	if (ManifestPath != nullptr && !Manifest.Save(ManifestPath))
+	{
+		fprintf(stderr, "Could not save manifest '%s'\n", ManifestPath);
+		return 1;
+	}
+
+	return 0;
+}
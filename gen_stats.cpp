@@ -0,0 +1,870 @@
+// Corpus analytics: one pass over generated shaders (a gen_shaders directory, a packed corpus or a
+// seed corpus) that prints histograms of their size, statement count, expression depth, struct count,
+// the builtins/constructors/user functions they call and the #version/precision they use, per shard
+// (each argument) and for all of them together. Packed corpora are memory-mapped and the shaders are
+// scanned on a pool of threads, each keeping its own counts that get added up at the end. Seed corpora
+// only hold metadata, so only the metadata gets counted, nothing is regenerated.
+
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "stack_string.h"
+#include "packed_corpus.h"
+#include "seed_corpus.h"
+
+using int32 = int32_t;
+using uint32 = uint32_t;
+using uint64 = uint64_t;
+
+// Bucket i holds values in [2^(i-1), 2^i), bucket 0 holds 0
+struct Histogram
+{
+	static constexpr int32 NumBuckets = 65;
+
+	uint64 Buckets[NumBuckets] = {};
+	uint64 Count = 0;
+	uint64 Sum = 0;
+	uint64 Min = UINT64_MAX;
+	uint64 Max = 0;
+
+	static int32 GetBucket(uint64 Value)
+	{
+		int32 Bucket = 0;
+		while (Value != 0)
+		{
+			Value >>= 1;
+			Bucket++;
+		}
+		return Bucket;
+	}
+
+	void Add(uint64 Value)
+	{
+		Buckets[GetBucket(Value)]++;
+		Count++;
+		Sum += Value;
+		Min = std::min(Min, Value);
+		Max = std::max(Max, Value);
+	}
+
+	void Merge(const Histogram& Other)
+	{
+		for (int32 i = 0; i < NumBuckets; i++)
+		{
+			Buckets[i] += Other.Buckets[i];
+		}
+		Count += Other.Count;
+		Sum += Other.Sum;
+		Min = std::min(Min, Other.Min);
+		Max = std::max(Max, Other.Max);
+	}
+};
+
+using NameCounts = std::unordered_map<std::string, uint64>;
+
+static void MergeNameCounts(NameCounts* Into, const NameCounts& From)
+{
+	for (const auto& It : From)
+	{
+		(*Into)[It.first] += It.second;
+	}
+}
+
+struct CorpusStats
+{
+	uint64 NumShaders = 0;
+	// Seed corpus entries for seeds that failed to generate
+	uint64 NumFailed = 0;
+	uint64 NumMetadata = 0;
+	// gen_shader --variants of the shaders, counted but not scanned, they'd only repeat their shader's numbers
+	uint64 NumVariants = 0;
+	uint64 NumHitStepBudget = 0;
+	uint64 NumHitCostCap = 0;
+	uint64 NumFieldAccesses = 0;
+	uint64 NumIndexings = 0;
+
+	Histogram SourceBytes;
+	Histogram Lines;
+	Histogram Statements;
+	Histogram Functions;
+	Histogram Structs;
+	Histogram Calls;
+	// Deepest expression in each shader, and the depth of every statement's expression
+	Histogram ShaderExpressionDepth;
+	Histogram StatementExpressionDepth;
+	// From the metadata (.meta files, PCRK_Metadata records or seed corpus entries)
+	Histogram ALUCost;
+	Histogram PeakRegisters;
+
+	NameCounts Versions;
+	NameCounts Precisions;
+	// By callee: builtins and constructors by name, user_func_N and my_struct_N lumped together
+	NameCounts Callees;
+
+	void Merge(const CorpusStats& Other)
+	{
+		NumShaders += Other.NumShaders;
+		NumFailed += Other.NumFailed;
+		NumMetadata += Other.NumMetadata;
+		NumVariants += Other.NumVariants;
+		NumHitStepBudget += Other.NumHitStepBudget;
+		NumHitCostCap += Other.NumHitCostCap;
+		NumFieldAccesses += Other.NumFieldAccesses;
+		NumIndexings += Other.NumIndexings;
+
+		SourceBytes.Merge(Other.SourceBytes);
+		Lines.Merge(Other.Lines);
+		Statements.Merge(Other.Statements);
+		Functions.Merge(Other.Functions);
+		Structs.Merge(Other.Structs);
+		Calls.Merge(Other.Calls);
+		ShaderExpressionDepth.Merge(Other.ShaderExpressionDepth);
+		StatementExpressionDepth.Merge(Other.StatementExpressionDepth);
+		ALUCost.Merge(Other.ALUCost);
+		PeakRegisters.Merge(Other.PeakRegisters);
+
+		MergeNameCounts(&Versions, Other.Versions);
+		MergeNameCounts(&Precisions, Other.Precisions);
+		MergeNameCounts(&Callees, Other.Callees);
+	}
+};
+
+enum WorkItemKind
+{
+	WIK_SourceFile,
+	WIK_MetadataFile,
+	WIK_SourceRecord,
+	WIK_MetadataRecord,
+};
+
+struct WorkItem
+{
+	int32 ShardIndex;
+	WorkItemKind Kind;
+	// Into the shard's mapped packed corpus for records
+	const char* Data;
+	size_t Length;
+	// For files
+	std::string Path;
+};
+
+enum ShardKind
+{
+	SK_Directory,
+	SK_Packed,
+	SK_SeedCorpus,
+};
+
+struct ShardInfo
+{
+	const char* Path = nullptr;
+	ShardKind Kind = SK_Directory;
+	PackedCorpusReader Packed;
+	CorpusStats Stats;
+};
+
+static bool IsIdentifierStart(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool IsIdentifierChar(char c)
+{
+	return IsIdentifierStart(c) || (c >= '0' && c <= '9');
+}
+
+static bool StartsWith(const char* Text, const char* End, const char* Prefix)
+{
+	const size_t PrefixLength = strlen(Prefix);
+	return (size_t)(End - Text) >= PrefixLength && memcmp(Text, Prefix, PrefixLength) == 0;
+}
+
+static const char* FindLineEnd(const char* Text, const char* End)
+{
+	const char* LineEnd = (const char*)memchr(Text, '\n', End - Text);
+	return (LineEnd != nullptr) ? LineEnd : End;
+}
+
+static std::string TrimmedLine(const char* Text, const char* LineEnd)
+{
+	while (Text < LineEnd && (*Text == ' ' || *Text == '\t'))
+	{
+		Text++;
+	}
+	while (LineEnd > Text && (LineEnd[-1] == ' ' || LineEnd[-1] == '\t' || LineEnd[-1] == '\r' || LineEnd[-1] == ';'))
+	{
+		LineEnd--;
+	}
+	return std::string(Text, LineEnd - Text);
+}
+
+// Single pass over the text of one generated shader. It relies on what the generator writes rather than
+// parsing GLSL: declarations at brace depth 0 are one per line, every binary operation is parenthesized
+// (so paren depth is expression depth), and statements are a ';' outside parens, an if or a for.
+static void ScanShaderSource(const char* Source, size_t Length, CorpusStats* Stats)
+{
+	const char* Text = Source;
+	const char* End = Source + Length;
+
+	uint64 NumLines = 0;
+	uint64 NumStatements = 0;
+	uint64 NumFunctions = 0;
+	uint64 NumStructs = 0;
+	uint64 NumCalls = 0;
+	uint64 NumIndexings = 0;
+	uint64 ShaderMaxDepth = 0;
+	uint64 StatementMaxDepth = 0;
+	int32 BraceDepth = 0;
+	int32 ParenDepth = 0;
+	bool bInFunction = false;
+	bool bLineStart = true;
+	std::string Callee;
+
+	while (Text < End)
+	{
+		if (bLineStart)
+		{
+			bLineStart = false;
+			NumLines++;
+			if (BraceDepth == 0)
+			{
+				const char* LineEnd = FindLineEnd(Text, End);
+				if (StartsWith(Text, LineEnd, "#version "))
+				{
+					Stats->Versions[TrimmedLine(Text + 9, LineEnd)]++;
+					Text = LineEnd;
+					continue;
+				}
+				else if (StartsWith(Text, LineEnd, "precision "))
+				{
+					Stats->Precisions[TrimmedLine(Text + 10, LineEnd)]++;
+					Text = LineEnd;
+					continue;
+				}
+				else if (StartsWith(Text, LineEnd, "struct "))
+				{
+					NumStructs++;
+					bInFunction = false;
+				}
+				else if (StartsWith(Text, LineEnd, "layout"))
+				{
+					// Buffer blocks and the compute workgroup size
+					bInFunction = false;
+					const char* BlockOpen = (const char*)memchr(Text, '{', LineEnd - Text);
+					Text = (BlockOpen != nullptr) ? BlockOpen : LineEnd;
+					continue;
+				}
+				else if (memchr(Text, '(', LineEnd - Text) != nullptr && LineEnd > Text && LineEnd[-1] == '{')
+				{
+					// A function definition, its parameters aren't calls
+					NumFunctions++;
+					bInFunction = true;
+					Text = LineEnd - 1;
+					continue;
+				}
+				else
+				{
+					Text = LineEnd;
+					continue;
+				}
+			}
+		}
+
+		const char c = *Text;
+		if (IsIdentifierStart(c))
+		{
+			const char* IdentifierStart = Text;
+			while (Text < End && IsIdentifierChar(*Text))
+			{
+				Text++;
+			}
+
+			if (!bInFunction)
+			{
+				continue;
+			}
+
+			const size_t IdentifierLength = Text - IdentifierStart;
+			if (Text < End && *Text == '(')
+			{
+				if ((IdentifierLength == 2 && memcmp(IdentifierStart, "if", 2) == 0) || (IdentifierLength == 3 && memcmp(IdentifierStart, "for", 3) == 0))
+				{
+					// Its body opens with '{', which records it
+				}
+				else
+				{
+					NumCalls++;
+					if (IdentifierLength > 10 && memcmp(IdentifierStart, "user_func_", 10) == 0)
+					{
+						Callee.assign("user_func_N");
+					}
+					else if (IdentifierLength > 10 && memcmp(IdentifierStart, "my_struct_", 10) == 0)
+					{
+						Callee.assign("my_struct_N");
+					}
+					else
+					{
+						Callee.assign(IdentifierStart, IdentifierLength);
+					}
+					Stats->Callees[Callee]++;
+				}
+			}
+			continue;
+		}
+
+		switch (c)
+		{
+		case '\n':
+			bLineStart = true;
+			break;
+		case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+			// Skip the whole literal so its digits and suffix aren't taken for an identifier or a field
+			while (Text + 1 < End && (IsIdentifierChar(Text[1]) || Text[1] == '.'))
+			{
+				Text++;
+			}
+			break;
+		case '(':
+			ParenDepth++;
+			StatementMaxDepth = std::max(StatementMaxDepth, (uint64)ParenDepth);
+			break;
+		case ')':
+			ParenDepth--;
+			break;
+		case '[':
+			NumIndexings += bInFunction;
+			break;
+		case '.':
+			Stats->NumFieldAccesses += (bInFunction && Text + 1 < End && IsIdentifierStart(Text[1]));
+			break;
+		case ';':
+			if (bInFunction && ParenDepth == 0)
+			{
+				NumStatements++;
+				Stats->StatementExpressionDepth.Add(StatementMaxDepth);
+				ShaderMaxDepth = std::max(ShaderMaxDepth, StatementMaxDepth);
+				StatementMaxDepth = 0;
+			}
+			break;
+		case '{':
+			// The end of an if/for header, or a struct/function opening
+			if (bInFunction && BraceDepth > 0)
+			{
+				NumStatements++;
+				Stats->StatementExpressionDepth.Add(StatementMaxDepth);
+				ShaderMaxDepth = std::max(ShaderMaxDepth, StatementMaxDepth);
+			}
+			StatementMaxDepth = 0;
+			BraceDepth++;
+			break;
+		case '}':
+			BraceDepth--;
+			if (BraceDepth == 0)
+			{
+				bInFunction = false;
+			}
+			break;
+		default:
+			break;
+		}
+		Text++;
+	}
+
+	Stats->NumShaders++;
+	Stats->SourceBytes.Add(Length);
+	Stats->Lines.Add(NumLines);
+	Stats->Statements.Add(NumStatements);
+	Stats->Functions.Add(NumFunctions);
+	Stats->Structs.Add(NumStructs);
+	Stats->Calls.Add(NumCalls);
+	Stats->ShaderExpressionDepth.Add(ShaderMaxDepth);
+	Stats->NumIndexings += NumIndexings;
+}
+
+// Text of a .meta sidecar, as gen_shader --meta writes it
+static void ScanMetadata(const char* Text, size_t Length, CorpusStats* Stats)
+{
+	// Not null-terminated when it comes out of a packed corpus
+	char Buffer[512];
+	Length = std::min(Length, sizeof(Buffer) - 1);
+	memcpy(Buffer, Text, Length);
+	Buffer[Length] = 0;
+
+	Stats->NumMetadata++;
+	for (char* Line = Buffer; Line != nullptr && *Line != 0; )
+	{
+		char* NextLine = strchr(Line, '\n');
+		if (NextLine != nullptr)
+		{
+			*NextLine++ = 0;
+		}
+
+		unsigned long long Value = 0;
+		if (sscanf(Line, "alu_cost %llu", &Value) == 1)
+		{
+			Stats->ALUCost.Add(Value);
+		}
+		else if (sscanf(Line, "registers %llu", &Value) == 1)
+		{
+			Stats->PeakRegisters.Add(Value);
+		}
+		else if (sscanf(Line, "hit_step_budget %llu", &Value) == 1)
+		{
+			Stats->NumHitStepBudget += (Value != 0);
+		}
+		else if (sscanf(Line, "hit_cost_cap %llu", &Value) == 1)
+		{
+			Stats->NumHitCostCap += (Value != 0);
+		}
+		Line = NextLine;
+	}
+}
+
+static bool ReadWholeFile(const std::string& Path, std::string* OutData)
+{
+	FILE* f = fopen(Path.c_str(), "rb");
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	OutData->clear();
+	char Chunk[64 * 1024];
+	size_t NumRead = 0;
+	while ((NumRead = fread(Chunk, 1, sizeof(Chunk), f)) > 0)
+	{
+		OutData->append(Chunk, NumRead);
+	}
+
+	const bool bSuccess = (ferror(f) == 0);
+	fclose(f);
+	return bSuccess;
+}
+
+static bool IsShaderExtension(const std::string& Extension)
+{
+	return Extension == ".frag" || Extension == ".vert" || Extension == ".comp";
+}
+
+// gen_shader --variants writes <seed>.v<k>.<type> next to <seed>.<type>, Stem is the name without the extension
+static bool IsVariantStem(const std::string& Stem)
+{
+	const size_t Dot = Stem.rfind('.');
+	return Dot != std::string::npos && Dot + 2 < Stem.size() && Stem[Dot + 1] == 'v'
+		&& Stem.find_first_not_of("0123456789", Dot + 2) == std::string::npos;
+}
+
+static bool AddDirectoryWork(const char* Path, int32 ShardIndex, std::vector<WorkItem>* OutWork, CorpusStats* OutStats)
+{
+	std::error_code Error;
+	for (std::filesystem::directory_iterator It(Path, Error), ItEnd; !Error && It != ItEnd; It.increment(Error))
+	{
+		if (!It->is_regular_file(Error))
+		{
+			continue;
+		}
+
+		const std::string Extension = It->path().extension().string();
+		if (IsShaderExtension(Extension) && IsVariantStem(It->path().stem().string()))
+		{
+			OutStats->NumVariants++;
+		}
+		else if (IsShaderExtension(Extension))
+		{
+			OutWork->push_back(WorkItem{ ShardIndex, WIK_SourceFile, nullptr, 0, It->path().string() });
+		}
+		else if (Extension == ".meta")
+		{
+			OutWork->push_back(WorkItem{ ShardIndex, WIK_MetadataFile, nullptr, 0, It->path().string() });
+		}
+	}
+	return !Error;
+}
+
+// Goes over the record headers only, the payloads are left to the scanning threads
+static void AddPackedWork(PackedCorpusReader* Reader, int32 ShardIndex, std::vector<WorkItem>* OutWork, CorpusStats* OutStats)
+{
+	PackedCorpusRecord Record;
+	while (Reader->Next(&Record))
+	{
+		if (Record.Kind == PCRK_Source)
+		{
+			OutWork->push_back(WorkItem{ ShardIndex, WIK_SourceRecord, Record.Data, Record.Length, std::string() });
+		}
+		else if (Record.Kind == PCRK_Metadata)
+		{
+			OutWork->push_back(WorkItem{ ShardIndex, WIK_MetadataRecord, Record.Data, Record.Length, std::string() });
+		}
+		else if (Record.Kind == PCRK_Variant)
+		{
+			OutStats->NumVariants++;
+		}
+	}
+}
+
+static bool ScanSeedCorpus(const char* Path, CorpusStats* Stats)
+{
+	FILE* f = fopen(Path, "rb");
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	SeedCorpusFileHeader Header;
+	if (fread(&Header, sizeof(Header), 1, f) != 1 || memcmp(Header.Magic, SEED_CORPUS_MAGIC, sizeof(Header.Magic)) != 0
+		|| Header.Version != SEED_CORPUS_VERSION)
+	{
+		fclose(f);
+		return false;
+	}
+
+	std::vector<SeedCorpusEntry> Entries(64 * 1024);
+	size_t NumRead = 0;
+	while ((NumRead = fread(Entries.data(), sizeof(SeedCorpusEntry), Entries.size(), f)) > 0)
+	{
+		for (size_t i = 0; i < NumRead; i++)
+		{
+			const SeedCorpusEntry& Entry = Entries[i];
+			if (Entry.SourceLength == 0)
+			{
+				Stats->NumFailed++;
+				continue;
+			}
+
+			Stats->NumShaders++;
+			Stats->NumMetadata++;
+			Stats->SourceBytes.Add(Entry.SourceLength);
+			Stats->ALUCost.Add(Entry.EstimatedALUCost);
+			Stats->PeakRegisters.Add(Entry.EstimatedPeakRegisters);
+		}
+	}
+
+	const bool bSuccess = (ferror(f) == 0);
+	fclose(f);
+	return bSuccess;
+}
+
+static std::string FormatBucketBound(uint64 Value)
+{
+	static const char* const Suffixes[] = { "", "K", "M", "G", "T", "P", "E" };
+	int32 SuffixIndex = 0;
+	while (Value >= 1024 && (Value % 1024) == 0)
+	{
+		Value /= 1024;
+		SuffixIndex++;
+	}
+	return StringStackBuffer<32>("%llu%s", (unsigned long long)Value, Suffixes[SuffixIndex]).buffer;
+}
+
+static void PrintHistogram(const char* Name, const Histogram& Hist)
+{
+	if (Hist.Count == 0)
+	{
+		return;
+	}
+
+	printf("  %-26s n=%llu min=%llu mean=%.1f max=%llu\n", Name, (unsigned long long)Hist.Count, (unsigned long long)Hist.Min,
+		(double)Hist.Sum / (double)Hist.Count, (unsigned long long)Hist.Max);
+
+	uint64 MaxBucket = 0;
+	for (int32 i = 0; i < Histogram::NumBuckets; i++)
+	{
+		MaxBucket = std::max(MaxBucket, Hist.Buckets[i]);
+	}
+
+	for (int32 i = 0; i < Histogram::NumBuckets; i++)
+	{
+		if (Hist.Buckets[i] == 0)
+		{
+			continue;
+		}
+
+		const std::string Range = (i == 0) ? std::string("0")
+			: (i == 1) ? std::string("1")
+			: "[" + FormatBucketBound(1ULL << (i - 1)) + ", " + (i < 64 ? FormatBucketBound(1ULL << i) : std::string("max")) + ")";
+		const int32 BarLength = (int32)((Hist.Buckets[i] * 40 + MaxBucket - 1) / MaxBucket);
+		printf("    %-16s %12llu %5.1f%% %s\n", Range.c_str(), (unsigned long long)Hist.Buckets[i], 100.0 * (double)Hist.Buckets[i] / (double)Hist.Count,
+			std::string(BarLength, '#').c_str());
+	}
+}
+
+static void PrintNameCounts(const char* Name, const NameCounts& Counts, uint64 Total, int32 MaxNames)
+{
+	if (Counts.empty())
+	{
+		return;
+	}
+
+	std::vector<std::pair<std::string, uint64>> Sorted(Counts.begin(), Counts.end());
+	std::sort(Sorted.begin(), Sorted.end(), [](const std::pair<std::string, uint64>& A, const std::pair<std::string, uint64>& B)
+	{
+		return (A.second != B.second) ? A.second > B.second : A.first < B.first;
+	});
+
+	printf("  %s (%llu distinct)\n", Name, (unsigned long long)Sorted.size());
+	for (int32 i = 0; i < (int32)Sorted.size() && i < MaxNames; i++)
+	{
+		printf("    %-24s %12llu %5.1f%%\n", Sorted[i].first.c_str(), (unsigned long long)Sorted[i].second, (Total > 0) ? 100.0 * (double)Sorted[i].second / (double)Total : 0.0);
+	}
+	if ((int32)Sorted.size() > MaxNames)
+	{
+		printf("    ... %d more\n", (int32)Sorted.size() - MaxNames);
+	}
+}
+
+static void PrintStats(const char* Title, const CorpusStats& Stats, int32 MaxNames)
+{
+	printf("%s\n", Title);
+	printf("  shaders %llu", (unsigned long long)Stats.NumShaders);
+	if (Stats.NumFailed > 0)
+	{
+		printf(", failed %llu", (unsigned long long)Stats.NumFailed);
+	}
+	if (Stats.NumVariants > 0)
+	{
+		printf(", variants %llu", (unsigned long long)Stats.NumVariants);
+	}
+	printf(", %.1f MB of source, metadata for %llu", (double)Stats.SourceBytes.Sum / (1024.0 * 1024.0), (unsigned long long)Stats.NumMetadata);
+	if (Stats.NumHitStepBudget > 0)
+	{
+		printf(", %llu hit the step budget", (unsigned long long)Stats.NumHitStepBudget);
+	}
+	if (Stats.NumHitCostCap > 0)
+	{
+		printf(", %llu fell short of their target cost", (unsigned long long)Stats.NumHitCostCap);
+	}
+	printf("\n");
+
+	PrintHistogram("source bytes", Stats.SourceBytes);
+	PrintHistogram("lines", Stats.Lines);
+	PrintHistogram("statements", Stats.Statements);
+	PrintHistogram("functions", Stats.Functions);
+	PrintHistogram("structs", Stats.Structs);
+	PrintHistogram("calls", Stats.Calls);
+	PrintHistogram("max expression depth", Stats.ShaderExpressionDepth);
+	PrintHistogram("statement expression depth", Stats.StatementExpressionDepth);
+	PrintHistogram("estimated ALU cost", Stats.ALUCost);
+	PrintHistogram("estimated peak registers", Stats.PeakRegisters);
+
+	if (Stats.Calls.Count > 0)
+	{
+		printf("  field/swizzle accesses %llu, indexings %llu\n", (unsigned long long)Stats.NumFieldAccesses, (unsigned long long)Stats.NumIndexings);
+	}
+	// Out of the shaders whose text was scanned, seed corpora don't have any
+	PrintNameCounts("#version", Stats.Versions, Stats.Lines.Count, MaxNames);
+	PrintNameCounts("precision", Stats.Precisions, Stats.Lines.Count, MaxNames);
+	PrintNameCounts("callees", Stats.Callees, Stats.Calls.Sum, MaxNames);
+}
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"usage: gen_stats [--threads N] [--top N] [--total-only] CORPUS...\n"
+		"  Prints histograms of what's in generated corpora, for each CORPUS and for all of them together.\n"
+		"  A CORPUS is a gen_shaders directory (.frag/.vert/.comp files and their .meta files), a packed\n"
+		"  corpus (--packed) or a seed corpus (--seed-corpus, which only has sizes, costs and registers)\n"
+		"  --threads N     scan on N threads (default: one per core)\n"
+		"  --top N         list the N most common callees, versions and precisions (default 24)\n"
+		"  --total-only    only print the totals, not each corpus\n");
+}
+
+int main(int argc, char** argv)
+{
+	int32 NumThreads = (int32)std::max(1u, std::thread::hardware_concurrency());
+	int32 MaxNames = 24;
+	bool bTotalOnly = false;
+
+	int32 NumShardArgs = 0;
+	for (int32 i = 1; i < argc; i++)
+	{
+		const bool bHasValue = (i + 1 < argc);
+		if (strcmp(argv[i], "--threads") == 0 && bHasValue)
+		{
+			NumThreads = atoi(argv[++i]);
+			if (NumThreads < 1)
+			{
+				fprintf(stderr, "Bad thread count '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--top") == 0 && bHasValue)
+		{
+			MaxNames = std::max(0, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--total-only") == 0)
+		{
+			bTotalOnly = true;
+		}
+		else if (argv[i][0] == '-')
+		{
+			PrintUsage();
+			return 1;
+		}
+		else
+		{
+			NumShardArgs++;
+		}
+	}
+
+	if (NumShardArgs == 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	const auto StartTime = std::chrono::steady_clock::now();
+
+	// Readers can't be moved once open, so size this up front
+	std::vector<ShardInfo> Shards(NumShardArgs);
+	std::vector<WorkItem> Work;
+	for (int32 i = 1, ShardIndex = 0; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			i += (strcmp(argv[i], "--total-only") != 0);
+			continue;
+		}
+
+		ShardInfo& Shard = Shards[ShardIndex];
+		Shard.Path = argv[i];
+
+		std::error_code Error;
+		if (std::filesystem::is_directory(Shard.Path, Error))
+		{
+			Shard.Kind = SK_Directory;
+			if (!AddDirectoryWork(Shard.Path, ShardIndex, &Work, &Shard.Stats))
+			{
+				fprintf(stderr, "Could not list %s\n", Shard.Path);
+				return 1;
+			}
+		}
+		else if (Shard.Packed.Open(Shard.Path))
+		{
+			Shard.Kind = SK_Packed;
+			AddPackedWork(&Shard.Packed, ShardIndex, &Work, &Shard.Stats);
+			if (Shard.Packed.bTruncated)
+			{
+				fprintf(stderr, "%s ends partway through a record, counting what's before it\n", Shard.Path);
+			}
+		}
+		else if (ScanSeedCorpus(Shard.Path, &Shard.Stats))
+		{
+			Shard.Kind = SK_SeedCorpus;
+		}
+		else
+		{
+			fprintf(stderr, "%s is not a directory, packed corpus or seed corpus (or could not be read)\n", Shard.Path);
+			return 1;
+		}
+		ShardIndex++;
+	}
+
+	// Threads take items in chunks off a shared counter, so files of very different sizes still spread evenly
+	const size_t ChunkSize = 64;
+	NumThreads = (int32)std::min<size_t>(NumThreads, std::max<size_t>(1, (Work.size() + ChunkSize - 1) / ChunkSize));
+	std::atomic<size_t> NextItem(0);
+	std::atomic<uint64> NumUnreadable(0);
+	std::vector<std::vector<CorpusStats>> ThreadStats(NumThreads, std::vector<CorpusStats>(Shards.size()));
+
+	auto ScanWork = [&](int32 ThreadIndex)
+	{
+		std::vector<CorpusStats>& Stats = ThreadStats[ThreadIndex];
+		std::string FileData;
+		for (;;)
+		{
+			const size_t First = NextItem.fetch_add(ChunkSize);
+			if (First >= Work.size())
+			{
+				break;
+			}
+
+			const size_t Last = std::min(Work.size(), First + ChunkSize);
+			for (size_t i = First; i < Last; i++)
+			{
+				const WorkItem& Item = Work[i];
+				CorpusStats* ShardStats = &Stats[Item.ShardIndex];
+				const char* Data = Item.Data;
+				size_t Length = Item.Length;
+				if (Item.Kind == WIK_SourceFile || Item.Kind == WIK_MetadataFile)
+				{
+					if (!ReadWholeFile(Item.Path, &FileData))
+					{
+						NumUnreadable++;
+						continue;
+					}
+					Data = FileData.data();
+					Length = FileData.size();
+				}
+
+				if (Item.Kind == WIK_SourceFile || Item.Kind == WIK_SourceRecord)
+				{
+					ScanShaderSource(Data, Length, ShardStats);
+				}
+				else
+				{
+					ScanMetadata(Data, Length, ShardStats);
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread> Threads;
+	for (int32 i = 1; i < NumThreads; i++)
+	{
+		Threads.emplace_back(ScanWork, i);
+	}
+	ScanWork(0);
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+
+	CorpusStats Total;
+	for (int32 ShardIndex = 0; ShardIndex < (int32)Shards.size(); ShardIndex++)
+	{
+		ShardInfo& Shard = Shards[ShardIndex];
+		for (int32 ThreadIndex = 0; ThreadIndex < NumThreads; ThreadIndex++)
+		{
+			Shard.Stats.Merge(ThreadStats[ThreadIndex][ShardIndex]);
+		}
+		Total.Merge(Shard.Stats);
+
+		if (!bTotalOnly)
+		{
+			static const char* const KindNames[] = { "directory", "packed corpus", "seed corpus" };
+			PrintStats(StringStackBuffer<4096>("%s (%s)", Shard.Path, KindNames[Shard.Kind]).buffer, Shard.Stats, MaxNames);
+			printf("\n");
+		}
+	}
+
+	if (bTotalOnly || Shards.size() > 1)
+	{
+		PrintStats(StringStackBuffer<256>("total (%d corpora)", (int32)Shards.size()).buffer, Total, MaxNames);
+	}
+
+	fflush(stdout);
+	const double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	fprintf(stderr, "Scanned %llu shaders (%.1f MB) in %.2fs on %d threads\n", (unsigned long long)Total.NumShaders,
+		(double)Total.SourceBytes.Sum / (1024.0 * 1024.0), Seconds, NumThreads);
+	if (NumUnreadable > 0)
+	{
+		fprintf(stderr, "%llu files could not be read\n", (unsigned long long)NumUnreadable.load());
+	}
+	return (NumUnreadable > 0) ? 1 : 0;
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+// Packed corpus: many generated programs in one file, so big batches don't turn into millions of tiny files
+// Layout (native endianness, no padding between records):
+//   PackedCorpusFileHeader
+//   PackedCorpusRecordHeader, then Length bytes of payload (not null-terminated)
+//   PackedCorpusRecordHeader, ...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define PACKED_CORPUS_MAGIC "GSPC"
+#define PACKED_CORPUS_VERSION 1
+
+enum PackedCorpusRecordKind
+{
+	PCRK_Source = 0,
+	// Expected results for the program with the same seed (see preproc_reference.h), or for a shader,
+	// its output over gen_reference's grid as floats (see shader_reference.h)
+	PCRK_Expected = 1,
+	// Transformed copy of the source with the same seed (see --transform-* in gen_c_preproc and
+	// --variants in gen_shader), an input with N variants gets N of these in a row
+	PCRK_Variant = 2,
+	// Text of the .meta sidecar for the shader with the same seed (see --meta in gen_shader)
+	PCRK_Metadata = 3,
+	// Program image of the shader with the same seed (see program_image.h and --image in gen_shader).
+	// Records aren't aligned, copy it out before opening a ProgramImageView on it
+	PCRK_ProgramImage = 4,
+};
+
+struct PackedCorpusFileHeader
+{
+	char Magic[4];
+	uint32_t Version;
+};
+
+struct PackedCorpusRecordHeader
+{
+	uint64_t Seed;
+	uint32_t Kind;
+	uint32_t Length;
+};
+
+struct PackedCorpusWriter
+{
+	FILE* File = nullptr;
+
+	bool Open(const char* Path)
+	{
+		File = fopen(Path, "wb");
+		if (File == nullptr)
+		{
+			return false;
+		}
+
+		PackedCorpusFileHeader Header;
+		memcpy(Header.Magic, PACKED_CORPUS_MAGIC, sizeof(Header.Magic));
+		Header.Version = PACKED_CORPUS_VERSION;
+		return fwrite(&Header, sizeof(Header), 1, File) == 1;
+	}
+
+	bool WriteRecord(uint64_t Seed, uint32_t Kind, const char* Data, uint32_t Length)
+	{
+		PackedCorpusRecordHeader Header;
+		Header.Seed = Seed;
+		Header.Kind = Kind;
+		Header.Length = Length;
+
+		return fwrite(&Header, sizeof(Header), 1, File) == 1
+			&& fwrite(Data, 1, Length, File) == Length;
+	}
+
+	void Close()
+	{
+		if (File != nullptr)
+		{
+			fclose(File);
+			File = nullptr;
+		}
+	}
+};
+
+struct PackedCorpusRecord
+{
+	uint64_t Seed;
+	uint32_t Kind;
+	uint32_t Length;
+	// Points into the reader's view of the file, valid until it's closed
+	const char* Data;
+};
+
+// Reads records straight out of a memory-mapped file (or one big read where there's no mmap),
+// so going through a corpus doesn't copy the payloads
+struct PackedCorpusReader
+{
+	const char* Data = nullptr;
+	size_t Size = 0;
+	size_t Offset = 0;
+	bool bMapped = false;
+	// Set if the file ended partway through a record
+	bool bTruncated = false;
+
+	bool Open(const char* Path)
+	{
+		Close();
+
+#if !defined(_WIN32)
+		int fd = open(Path, O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat Stat;
+		if (fstat(fd, &Stat) != 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		Size = (size_t)Stat.st_size;
+		if (Size > 0)
+		{
+			void* Mapped = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (Mapped != MAP_FAILED)
+			{
+				Data = (const char*)Mapped;
+				bMapped = true;
+				madvise(Mapped, Size, MADV_SEQUENTIAL);
+			}
+		}
+		close(fd);
+#endif
+
+		if (Data == nullptr)
+		{
+			FILE* f = fopen(Path, "rb");
+			if (f == nullptr)
+			{
+				return false;
+			}
+
+			fseek(f, 0, SEEK_END);
+			Size = (size_t)ftell(f);
+			fseek(f, 0, SEEK_SET);
+
+			char* Buffer = (char*)malloc(Size > 0 ? Size : 1);
+			const bool bRead = (fread(Buffer, 1, Size, f) == Size);
+			fclose(f);
+
+			Data = Buffer;
+			if (!bRead)
+			{
+				Close();
+				return false;
+			}
+		}
+
+		PackedCorpusFileHeader Header;
+		if (Size < sizeof(Header))
+		{
+			Close();
+			return false;
+		}
+
+		memcpy(&Header, Data, sizeof(Header));
+		if (memcmp(Header.Magic, PACKED_CORPUS_MAGIC, sizeof(Header.Magic)) != 0 || Header.Version != PACKED_CORPUS_VERSION)
+		{
+			Close();
+			return false;
+		}
+
+		Offset = sizeof(Header);
+		return true;
+	}
+
+	// Returns false once there are no more (complete) records
+	bool Next(PackedCorpusRecord* OutRecord)
+	{
+		// Records aren't aligned, so the header gets copied out
+		PackedCorpusRecordHeader Header;
+		if (Data == nullptr || Size - Offset < sizeof(Header))
+		{
+			bTruncated = (Data != nullptr && Offset != Size);
+			return false;
+		}
+
+		memcpy(&Header, Data + Offset, sizeof(Header));
+		if (Size - Offset - sizeof(Header) < Header.Length)
+		{
+			bTruncated = true;
+			return false;
+		}
+
+		OutRecord->Seed = Header.Seed;
+		OutRecord->Kind = Header.Kind;
+		OutRecord->Length = Header.Length;
+		OutRecord->Data = Data + Offset + sizeof(Header);
+
+		Offset += sizeof(Header) + Header.Length;
+		return true;
+	}
+
+	void Close()
+	{
+		if (Data != nullptr)
+		{
+#if !defined(_WIN32)
+			if (bMapped)
+			{
+				munmap((void*)Data, Size);
+			}
+			else
+#endif
+			{
+				free((void*)Data);
+			}
+		}
+
+		Data = nullptr;
+		Size = 0;
+		Offset = 0;
+		bMapped = false;
+		bTruncated = false;
+	}
+
+	~PackedCorpusReader()
+	{
+		Close();
+	}
+};
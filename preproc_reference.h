@@ -0,0 +1,742 @@
+#pragma once
+
+// Reference evaluator for the programs gen_c_preproc generates.
+// The generator reports each directive as it emits it, and this tracks macro definitions
+// (respecting skipped #if groups) and evaluates #if conditions and the final expr with
+// C-preprocessor semantics, so the expected results come out at generation speed.
+//
+// What "C semantics" means here, since the generated programs lean towards GLSL in places:
+//  - Identifiers left after expansion (including true/false) are 0
+//  - Everything is intmax_t (int64), comparisons and logical ops give 0/1
+//  - && and || short-circuit, so e.g. "0 && 1/0" is fine but "1/0" is an error
+//  - Signed overflow wraps like GCC/Clang do, but is flagged as undefined
+//  - "defined" coming out of a macro expansion (or substituted in as a macro arg) is undefined behaviour.
+//    We evaluate it the way GCC/Clang do (the operand after it isn't expanded) and flag it
+//  - A #if that fails to evaluate makes the program ill-formed. We carry on as if it were false,
+//    but what preprocessors do after the error varies, so later results are only a best guess
+//  - Expansions bigger than MaxExpansionTokens aren't evaluated, they're reported as unknown,
+//    which is treated as false the same way
+//
+// Results are one line per #if / #line / final expr, keyed by physical line number (1-based):
+//   if <line> value <n>
+//   if <line> skipped
+//   if <line> error <reason>
+//   if <line> unknown <reason>
+//   line <line> error <reason>      (#line arguments that aren't valid C)
+//   final <line> value <n>
+// with " ub <reason>" appended when the value relied on undefined behaviour.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+enum PreprocTokenKind : uint8_t {
+	PPTK_Ident,
+	PPTK_Number,
+	PPTK_Punct,
+	// Index into the macro's params, only in macro bodies
+	PPTK_Param,
+	// Pushed under a macro's expansion, re-enables the macro once the expansion has been read
+	PPTK_EndOfMacro,
+	PPTK_End
+};
+
+enum PreprocPunct : uint8_t {
+	PPP_LParen, PPP_RParen, PPP_Comma,
+	PPP_Plus, PPP_Minus, PPP_Star, PPP_Slash, PPP_Percent,
+	PPP_Shl, PPP_Shr,
+	PPP_Lt, PPP_Gt, PPP_Le, PPP_Ge, PPP_Eq, PPP_Ne,
+	PPP_BitAnd, PPP_BitXor, PPP_BitOr, PPP_LogicalAnd, PPP_LogicalOr,
+	PPP_Not, PPP_Tilde,
+	// Anything else, which is always a syntax error in an #if
+	PPP_Other
+};
+
+struct PreprocToken {
+	PreprocTokenKind Kind = PPTK_End;
+	PreprocPunct Punct = PPP_Other;
+	// Name can't be expanded anymore, since it was seen while its macro was being expanded
+	bool bPainted = false;
+	// Came out of a macro expansion (body or substituted arg)
+	bool bFromMacro = false;
+	// Name ID for idents and end-of-macro markers, param index for params
+	int32_t NameID = -1;
+	int64_t Value = 0;
+};
+
+enum PreprocUBFlags {
+	PPUB_DefinedFromMacro = 1 << 0,
+	PPUB_SignedOverflow = 1 << 1,
+	PPUB_BadShift = 1 << 2,
+};
+
+struct PreprocMacro {
+	bool bDefined = false;
+	bool bFunctionLike = false;
+	int32_t NumParams = 0;
+	// How many expansions of this macro are currently being read, if > 0 its name gets painted
+	int32_t DisableCount = 0;
+	std::vector<PreprocToken> Body;
+};
+
+struct PreprocReference {
+	// Generous, but stops the exponential stress programs from taking forever
+	int64_t MaxExpansionTokens = 1 << 22;
+
+	std::string Results;
+
+	std::unordered_map<std::string, int32_t> NameIDs;
+	std::vector<PreprocMacro> Macros;
+	int32_t DefinedNameID = -1;
+
+	// One entry per open #if: is the group being processed
+	std::vector<bool> GroupActive;
+
+	// Expansion state for the expr currently being evaluated, a stack so the top is the next token
+	std::vector<PreprocToken> Pending;
+	int64_t NumExpansionTokens = 0;
+	const char* EvalError = nullptr;
+	// EvalError is about our limits, not the program
+	bool bEvalGaveUp = false;
+	uint32_t EvalUBFlags = 0;
+
+	void Reset() {
+		Results.clear();
+
+		// Keep the interned names around between programs, unless they've piled up a lot
+		if (NameIDs.size() > (1 << 20)) {
+			NameIDs.clear();
+			Macros.clear();
+		}
+
+		for (PreprocMacro& Macro : Macros) {
+			Macro.bDefined = false;
+			Macro.DisableCount = 0;
+			Macro.Body.clear();
+		}
+		GroupActive.clear();
+		DefinedNameID = InternName("defined", 7);
+	}
+
+	bool IsActive() const {
+		return GroupActive.size() == 0 || GroupActive.back();
+	}
+
+	int32_t InternName(const char* Name, size_t Length) {
+		auto Result = NameIDs.emplace(std::string(Name, Length), (int32_t)NameIDs.size());
+		if (Result.second) {
+			Macros.emplace_back();
+		}
+		return Result.first->second;
+	}
+
+	static bool IsIdentStart(char C) {
+		return (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z') || C == '_';
+	}
+
+	static bool IsDigit(char C) {
+		return C >= '0' && C <= '9';
+	}
+
+	// Appends the tokens in [Text, Text+Length) to OutTokens
+	void Tokenize(const char* Text, size_t Length, std::vector<PreprocToken>* OutTokens) {
+		const char* Cursor = Text;
+		const char* End = Text + Length;
+		while (Cursor < End) {
+			if (*Cursor == ' ' || *Cursor == '\t') {
+				Cursor++;
+				continue;
+			}
+
+			PreprocToken Token;
+			if (IsIdentStart(*Cursor)) {
+				const char* Start = Cursor;
+				while (Cursor < End && (IsIdentStart(*Cursor) || IsDigit(*Cursor))) {
+					Cursor++;
+				}
+				Token.Kind = PPTK_Ident;
+				Token.NameID = InternName(Start, Cursor - Start);
+			}
+			else if (IsDigit(*Cursor)) {
+				// Only decimal literals get generated, they can't overflow
+				Token.Kind = PPTK_Number;
+				while (Cursor < End && IsDigit(*Cursor)) {
+					Token.Value = Token.Value * 10 + (*Cursor - '0');
+					Cursor++;
+				}
+			}
+			else {
+				struct PunctSpelling { const char* Spelling; PreprocPunct Punct; };
+				// Longest first
+				static const PunctSpelling Spellings[] = {
+					{ "<<", PPP_Shl }, { ">>", PPP_Shr }, { "<=", PPP_Le }, { ">=", PPP_Ge },
+					{ "==", PPP_Eq }, { "!=", PPP_Ne }, { "&&", PPP_LogicalAnd }, { "||", PPP_LogicalOr },
+					{ "(", PPP_LParen }, { ")", PPP_RParen }, { ",", PPP_Comma },
+					{ "+", PPP_Plus }, { "-", PPP_Minus }, { "*", PPP_Star }, { "/", PPP_Slash }, { "%", PPP_Percent },
+					{ "<", PPP_Lt }, { ">", PPP_Gt }, { "&", PPP_BitAnd }, { "^", PPP_BitXor }, { "|", PPP_BitOr },
+					{ "!", PPP_Not }, { "~", PPP_Tilde },
+				};
+
+				Token.Kind = PPTK_Punct;
+				Token.Punct = PPP_Other;
+				size_t SpellingLength = 1;
+				for (const PunctSpelling& Spelling : Spellings) {
+					const size_t Len = strlen(Spelling.Spelling);
+					if ((size_t)(End - Cursor) >= Len && memcmp(Cursor, Spelling.Spelling, Len) == 0) {
+						Token.Punct = Spelling.Punct;
+						SpellingLength = Len;
+						break;
+					}
+				}
+				Cursor += SpellingLength;
+			}
+
+			OutTokens->push_back(Token);
+		}
+	}
+
+	void OnDefine(const char* Name, bool bFunctionLike, const char* const* ParamNames, int32_t NumParams, const char* Body, size_t BodyLength) {
+		if (!IsActive()) {
+			return;
+		}
+
+		// Everything that can intern a name goes first, since that can grow Macros
+		std::vector<PreprocToken> BodyTokens;
+		Tokenize(Body, BodyLength, &BodyTokens);
+
+		for (int32_t i = 0; i < NumParams; i++) {
+			const int32_t ParamID = InternName(ParamNames[i], strlen(ParamNames[i]));
+			for (PreprocToken& Token : BodyTokens) {
+				if (Token.Kind == PPTK_Ident && Token.NameID == ParamID) {
+					Token.Kind = PPTK_Param;
+					Token.NameID = i;
+				}
+			}
+		}
+
+		PreprocMacro& Macro = Macros[InternName(Name, strlen(Name))];
+		Macro.bDefined = true;
+		Macro.bFunctionLike = bFunctionLike;
+		Macro.NumParams = NumParams;
+		Macro.Body.swap(BodyTokens);
+	}
+
+	void OnUndef(const char* Name) {
+		if (!IsActive()) {
+			return;
+		}
+
+		PreprocMacro& Macro = Macros[InternName(Name, strlen(Name))];
+		Macro.bDefined = false;
+		Macro.Body.clear();
+	}
+
+	void OnIf(int32_t Line, const char* Expr, size_t Length) {
+		if (!IsActive()) {
+			// Skipped groups don't evaluate anything, including nested #if's
+			GroupActive.push_back(false);
+			AppendResultLine("if %d skipped\n", Line);
+			return;
+		}
+
+		int64_t Value = 0;
+		const bool bSuccess = Evaluate(Expr, Length, &Value);
+		AppendEvalResult("if", Line, bSuccess, Value);
+		GroupActive.push_back(bSuccess && Value != 0);
+	}
+
+	void OnEndif() {
+		if (GroupActive.size() > 0) {
+			GroupActive.pop_back();
+		}
+	}
+
+	void OnLine(int32_t Line, int64_t LineNumber, bool bHasSecondArg) {
+		if (!IsActive()) {
+			return;
+		}
+
+		// C wants a digit sequence in [1, 2147483647], optionally followed by a string literal
+		if (LineNumber < 0) {
+			AppendResultLine("line %d error line-number-not-digit-sequence\n", Line);
+		}
+		else if (bHasSecondArg) {
+			AppendResultLine("line %d error filename-not-string-literal\n", Line);
+		}
+		else if (LineNumber == 0) {
+			AppendResultLine("line %d ub line-number-zero\n", Line);
+		}
+	}
+
+	void OnFinalExpr(int32_t Line, const char* Expr, size_t Length) {
+		int64_t Value = 0;
+		const bool bSuccess = Evaluate(Expr, Length, &Value);
+		AppendEvalResult("final", Line, bSuccess, Value);
+	}
+
+	void AppendResultLine(const char* Format, int32_t Line) {
+		char Buffer[128];
+		snprintf(Buffer, sizeof(Buffer), Format, Line);
+		Results.append(Buffer);
+	}
+
+	void AppendEvalResult(const char* Directive, int32_t Line, bool bSuccess, int64_t Value) {
+		char Buffer[256];
+		if (bSuccess) {
+			snprintf(Buffer, sizeof(Buffer), "%s %d value %lld", Directive, Line, (long long)Value);
+		}
+		else if (bEvalGaveUp) {
+			snprintf(Buffer, sizeof(Buffer), "%s %d unknown %s", Directive, Line, EvalError);
+		}
+		else {
+			snprintf(Buffer, sizeof(Buffer), "%s %d error %s", Directive, Line, EvalError);
+		}
+		Results.append(Buffer);
+
+		if ((EvalUBFlags & PPUB_DefinedFromMacro) != 0) {
+			Results.append(" ub defined-from-macro");
+		}
+		if ((EvalUBFlags & PPUB_SignedOverflow) != 0) {
+			Results.append(" ub signed-overflow");
+		}
+		if ((EvalUBFlags & PPUB_BadShift) != 0) {
+			Results.append(" ub shift-out-of-range");
+		}
+		Results.append("\n");
+	}
+
+	//////////////////////////////
+	// Expansion
+
+	void SetError(const char* Error) {
+		if (EvalError == nullptr) {
+			EvalError = Error;
+		}
+	}
+
+	// Looks at the next real token without consuming anything
+	const PreprocToken* PeekRaw() const {
+		for (size_t i = Pending.size(); i > 0; i--) {
+			if (Pending[i - 1].Kind != PPTK_EndOfMacro) {
+				return &Pending[i - 1];
+			}
+		}
+		return nullptr;
+	}
+
+	// Next token before macro expansion, end-of-macro markers are processed along the way
+	PreprocToken NextRaw() {
+		while (Pending.size() > 0) {
+			PreprocToken Token = Pending.back();
+			Pending.pop_back();
+			if (Token.Kind == PPTK_EndOfMacro) {
+				Macros[Token.NameID].DisableCount--;
+				continue;
+			}
+			return Token;
+		}
+
+		return PreprocToken();
+	}
+
+	// Pushes the expansion of MacroID so it's read next. Tokens are in reading order
+	void PushExpansion(int32_t MacroID, const std::vector<PreprocToken>& Tokens) {
+		NumExpansionTokens += (int64_t)Tokens.size();
+		if (NumExpansionTokens > MaxExpansionTokens) {
+			if (EvalError == nullptr) {
+				bEvalGaveUp = true;
+			}
+			SetError("expansion-too-large");
+			return;
+		}
+
+		PreprocToken Marker;
+		Marker.Kind = PPTK_EndOfMacro;
+		Marker.NameID = MacroID;
+		Pending.push_back(Marker);
+
+		for (size_t i = Tokens.size(); i > 0; i--) {
+			Pending.push_back(Tokens[i - 1]);
+			Pending.back().bFromMacro = true;
+		}
+
+		Macros[MacroID].DisableCount++;
+	}
+
+	// Fully macro-expands an arg on its own, the way args are before substitution
+	std::vector<PreprocToken> ExpandArg(const std::vector<PreprocToken>& Arg) {
+		std::vector<PreprocToken> SavedPending;
+		SavedPending.swap(Pending);
+		for (size_t i = Arg.size(); i > 0; i--) {
+			Pending.push_back(Arg[i - 1]);
+		}
+
+		std::vector<PreprocToken> Result;
+		while (EvalError == nullptr) {
+			PreprocToken Token = Next(true);
+			if (Token.Kind == PPTK_End) {
+				break;
+			}
+			Result.push_back(Token);
+		}
+
+		// Only non-empty if there was an error, but the end-of-macro markers still need handling
+		while (Pending.size() > 0) {
+			NextRaw();
+		}
+
+		Pending.swap(SavedPending);
+		return Result;
+	}
+
+	// Next token after macro expansion (if bExpand)
+	PreprocToken Next(bool bExpand) {
+		while (EvalError == nullptr) {
+			PreprocToken Token = NextRaw();
+			if (Token.Kind != PPTK_Ident || !bExpand || Token.bPainted) {
+				return Token;
+			}
+
+			const int32_t MacroID = Token.NameID;
+			if (!Macros[MacroID].bDefined) {
+				return Token;
+			}
+
+			if (Macros[MacroID].DisableCount > 0) {
+				Token.bPainted = true;
+				return Token;
+			}
+
+			if (!Macros[MacroID].bFunctionLike) {
+				PushExpansion(MacroID, Macros[MacroID].Body);
+				continue;
+			}
+
+			// Function-like macros are only invoked if the next token is a '(', otherwise it's just a name
+			const PreprocToken* NextToken = PeekRaw();
+			if (NextToken == nullptr || NextToken->Kind != PPTK_Punct || NextToken->Punct != PPP_LParen) {
+				return Token;
+			}
+			NextRaw();
+
+			std::vector<std::vector<PreprocToken>> Args(1);
+			int32_t ParenDepth = 0;
+			while (true) {
+				PreprocToken ArgToken = NextRaw();
+				if (ArgToken.Kind == PPTK_End) {
+					SetError("unterminated-macro-args");
+					return ArgToken;
+				}
+
+				if (ArgToken.Kind == PPTK_Punct) {
+					if (ArgToken.Punct == PPP_LParen) {
+						ParenDepth++;
+					}
+					else if (ArgToken.Punct == PPP_RParen) {
+						if (ParenDepth == 0) {
+							break;
+						}
+						ParenDepth--;
+					}
+					else if (ArgToken.Punct == PPP_Comma && ParenDepth == 0) {
+						Args.emplace_back();
+						continue;
+					}
+				}
+
+				Args.back().push_back(ArgToken);
+			}
+
+			// "f()" is one empty arg, which is what a 0 param macro takes
+			const PreprocMacro& Macro = Macros[MacroID];
+			const bool bArgCountMatches = (Macro.NumParams == 0)
+				? (Args.size() == 1 && Args[0].size() == 0)
+				: ((int32_t)Args.size() == Macro.NumParams);
+			if (!bArgCountMatches) {
+				SetError("macro-arg-count-mismatch");
+				return PreprocToken();
+			}
+
+			std::vector<std::vector<PreprocToken>> ExpandedArgs;
+			for (const auto& Arg : Args) {
+				ExpandedArgs.push_back(ExpandArg(Arg));
+			}
+
+			std::vector<PreprocToken> Substituted;
+			for (const PreprocToken& BodyToken : Macros[MacroID].Body) {
+				if (BodyToken.Kind == PPTK_Param) {
+					const auto& ExpandedArg = ExpandedArgs[BodyToken.NameID];
+					Substituted.insert(Substituted.end(), ExpandedArg.begin(), ExpandedArg.end());
+				}
+				else {
+					Substituted.push_back(BodyToken);
+				}
+			}
+
+			PushExpansion(MacroID, Substituted);
+		}
+
+		return PreprocToken();
+	}
+
+	//////////////////////////////
+	// Evaluation
+
+	// One token of lookahead for the parser
+	PreprocToken Lookahead;
+
+	void Advance() {
+		Lookahead = Next(true);
+	}
+
+	bool IsPunct(PreprocPunct Punct) const {
+		return Lookahead.Kind == PPTK_Punct && Lookahead.Punct == Punct;
+	}
+
+	static int32_t GetBinaryPrecedence(PreprocPunct Punct) {
+		switch (Punct) {
+		case PPP_Star: case PPP_Slash: case PPP_Percent: return 10;
+		case PPP_Plus: case PPP_Minus: return 9;
+		case PPP_Shl: case PPP_Shr: return 8;
+		case PPP_Lt: case PPP_Gt: case PPP_Le: case PPP_Ge: return 7;
+		case PPP_Eq: case PPP_Ne: return 6;
+		case PPP_BitAnd: return 5;
+		case PPP_BitXor: return 4;
+		case PPP_BitOr: return 3;
+		case PPP_LogicalAnd: return 2;
+		case PPP_LogicalOr: return 1;
+		default: return -1;
+		}
+	}
+
+	void FlagOverflow(bool bEvaluated) {
+		if (bEvaluated) {
+			EvalUBFlags |= PPUB_SignedOverflow;
+		}
+	}
+
+	int64_t ApplyBinaryOp(PreprocPunct Op, int64_t A, int64_t B, bool bEvaluated) {
+		// Wrapping arithmetic is done unsigned, then we check whether it overflowed
+		const uint64_t UA = (uint64_t)A;
+		const uint64_t UB = (uint64_t)B;
+		switch (Op) {
+		case PPP_Plus: {
+			if ((B > 0 && A > INT64_MAX - B) || (B < 0 && A < INT64_MIN - B)) {
+				FlagOverflow(bEvaluated);
+			}
+			return (int64_t)(UA + UB);
+		}
+		case PPP_Minus: {
+			if ((B < 0 && A > INT64_MAX + B) || (B > 0 && A < INT64_MIN + B)) {
+				FlagOverflow(bEvaluated);
+			}
+			return (int64_t)(UA - UB);
+		}
+		case PPP_Star: {
+			if (A != 0 && B != 0) {
+				const bool bOverflows = (A > 0)
+					? ((B > 0) ? (A > INT64_MAX / B) : (B < INT64_MIN / A))
+					: ((B > 0) ? (A < INT64_MIN / B) : (B < INT64_MAX / A));
+				if (bOverflows) {
+					FlagOverflow(bEvaluated);
+				}
+			}
+			return (int64_t)(UA * UB);
+		}
+		case PPP_Slash:
+		case PPP_Percent: {
+			if (B == 0) {
+				if (bEvaluated) {
+					SetError("division-by-zero");
+				}
+				return 0;
+			}
+			if (A == INT64_MIN && B == -1) {
+				FlagOverflow(bEvaluated);
+				return (Op == PPP_Slash) ? A : 0;
+			}
+			return (Op == PPP_Slash) ? (A / B) : (A % B);
+		}
+		case PPP_Shl:
+		case PPP_Shr: {
+			if (B < 0 || B >= 64) {
+				if (bEvaluated) {
+					EvalUBFlags |= PPUB_BadShift;
+				}
+				return 0;
+			}
+			return (Op == PPP_Shl) ? (int64_t)(UA << B) : (A >> B);
+		}
+		case PPP_Lt: return A < B;
+		case PPP_Gt: return A > B;
+		case PPP_Le: return A <= B;
+		case PPP_Ge: return A >= B;
+		case PPP_Eq: return A == B;
+		case PPP_Ne: return A != B;
+		case PPP_BitAnd: return A & B;
+		case PPP_BitXor: return A ^ B;
+		case PPP_BitOr: return A | B;
+		default: {
+			SetError("syntax-error");
+			return 0;
+		}
+		}
+	}
+
+	int64_t ParseUnary(bool bEvaluated) {
+		if (EvalError != nullptr) {
+			return 0;
+		}
+
+		if (Lookahead.Kind == PPTK_Number) {
+			const int64_t Value = Lookahead.Value;
+			Advance();
+			return Value;
+		}
+
+		if (Lookahead.Kind == PPTK_Ident) {
+			if (Lookahead.NameID != DefinedNameID) {
+				// Anything still an identifier after expansion is 0
+				Advance();
+				return 0;
+			}
+
+			if (Lookahead.bFromMacro) {
+				EvalUBFlags |= PPUB_DefinedFromMacro;
+			}
+
+			// The operand of defined is never expanded
+			PreprocToken Operand = Next(false);
+			bool bHasParens = false;
+			if (Operand.Kind == PPTK_Punct && Operand.Punct == PPP_LParen) {
+				bHasParens = true;
+				Operand = Next(false);
+			}
+
+			if (Operand.Kind != PPTK_Ident) {
+				SetError("bad-defined-operand");
+				return 0;
+			}
+
+			if (bHasParens) {
+				PreprocToken Closing = Next(false);
+				if (Closing.Kind != PPTK_Punct || Closing.Punct != PPP_RParen) {
+					SetError("bad-defined-operand");
+					return 0;
+				}
+			}
+
+			const int64_t Value = Macros[Operand.NameID].bDefined ? 1 : 0;
+			Advance();
+			return Value;
+		}
+
+		if (Lookahead.Kind == PPTK_Punct) {
+			const PreprocPunct Punct = Lookahead.Punct;
+			if (Punct == PPP_LParen) {
+				Advance();
+				const int64_t Value = ParseBinary(0, bEvaluated);
+				if (!IsPunct(PPP_RParen)) {
+					SetError("missing-rparen");
+					return 0;
+				}
+				Advance();
+				return Value;
+			}
+
+			if (Punct == PPP_Minus || Punct == PPP_Plus || Punct == PPP_Not || Punct == PPP_Tilde) {
+				Advance();
+				const int64_t Operand = ParseUnary(bEvaluated);
+				switch (Punct) {
+				case PPP_Minus: {
+					if (Operand == INT64_MIN) {
+						FlagOverflow(bEvaluated);
+					}
+					return (int64_t)(0 - (uint64_t)Operand);
+				}
+				case PPP_Plus: return Operand;
+				case PPP_Not: return Operand == 0;
+				default: return ~Operand;
+				}
+			}
+		}
+
+		SetError("syntax-error");
+		return 0;
+	}
+
+	// Precedence climbing, MinPrecedence 0 means any operator
+	int64_t ParseBinary(int32_t MinPrecedence, bool bEvaluated) {
+		int64_t LHS = ParseUnary(bEvaluated);
+
+		while (EvalError == nullptr && Lookahead.Kind == PPTK_Punct) {
+			const PreprocPunct Op = Lookahead.Punct;
+			const int32_t Precedence = GetBinaryPrecedence(Op);
+			if (Precedence < 0 || Precedence < MinPrecedence) {
+				break;
+			}
+			Advance();
+
+			// The RHS still has to parse, it just isn't evaluated
+			bool bEvaluateRHS = bEvaluated;
+			if (Op == PPP_LogicalAnd && LHS == 0) {
+				bEvaluateRHS = false;
+			}
+			else if (Op == PPP_LogicalOr && LHS != 0) {
+				bEvaluateRHS = false;
+			}
+
+			// All of these are left-associative
+			const int64_t RHS = ParseBinary(Precedence + 1, bEvaluateRHS);
+
+			if (Op == PPP_LogicalAnd) {
+				LHS = (LHS != 0 && RHS != 0);
+			}
+			else if (Op == PPP_LogicalOr) {
+				LHS = (LHS != 0 || RHS != 0);
+			}
+			else {
+				LHS = ApplyBinaryOp(Op, LHS, RHS, bEvaluateRHS);
+			}
+		}
+
+		return LHS;
+	}
+
+	bool Evaluate(const char* Expr, size_t Length, int64_t* OutValue) {
+		EvalError = nullptr;
+		bEvalGaveUp = false;
+		EvalUBFlags = 0;
+		NumExpansionTokens = 0;
+
+		std::vector<PreprocToken> Tokens;
+		Tokenize(Expr, Length, &Tokens);
+
+		Pending.clear();
+		for (size_t i = Tokens.size(); i > 0; i--) {
+			Pending.push_back(Tokens[i - 1]);
+		}
+
+		if (Tokens.size() == 0) {
+			SetError("empty-expr");
+		}
+		else {
+			Advance();
+			*OutValue = ParseBinary(0, true);
+			if (EvalError == nullptr && Lookahead.Kind != PPTK_End) {
+				SetError("syntax-error");
+			}
+		}
+
+		// Anything left over still has end-of-macro markers in it
+		while (Pending.size() > 0) {
+			NextRaw();
+		}
+
+		return EvalError == nullptr;
+	}
+};
@@ -0,0 +1,341 @@
+#pragma once
+
+// Program image: a generated shader in a compact binary form, for storing programs and getting them
+// back without generating them again or parsing GLSL. GenShader_GetProgramImage writes one for the
+// last shader a context generated, ProgramImageView reads one in place (no copies, no allocations).
+// Layout (native endianness, every section 8-byte aligned, offsets from the start of the image):
+//   ProgramImageHeader
+//   ProgramImageType[NumTypes], every type the program has, indices are the generator's TypeIDs
+//   ProgramImageField[NumFields], the types' fields, each type's in a row
+//   ProgramImageTransform[NumTransforms], the transforms this program added (user funcs, struct and
+//     array constructors, field access, indexing). The built-in ones are the same for every program
+//   ProgramImageSymbol[NumSymbols], each distinct token, most used first. Symbol i's text is string i
+//   uint32 StringOffsets[NumStrings], into StringData. The symbols' strings, then the ones only the tables use
+//   StringData, null-terminated strings
+//   Tokens, the source as LEB128 varints of symbol indices, so the common ones take a byte
+// The source is exactly the concatenation of its tokens' text, whitespace included, so re-emitting
+// gives back the same bytes. Symbols for identifiers that name a type or a user function point into
+// those tables, so passes over the tokens can tell what they refer to (or swap them) without parsing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#define PROGRAM_IMAGE_MAGIC "GSPI"
+#define PROGRAM_IMAGE_VERSION 1
+#define PROGRAM_IMAGE_MAX_ARITY 8
+#define PROGRAM_IMAGE_ALIGNMENT 8
+// Types and transforms past this can't be symbol targets, their names come out as PITK_Ident
+#define PROGRAM_IMAGE_MAX_SYMBOL_TARGET 0xFFFF
+
+enum ProgramImageTokenKind
+{
+	// Whitespace and punctuation between identifiers and numbers
+	PITK_Glue = 0,
+	// Identifier that isn't a type or user function (variables, fields, built-in funcs, keywords)
+	PITK_Ident = 1,
+	PITK_Number = 2,
+	// Target is a type
+	PITK_Type = 3,
+	// Target is a transform (a user function, called or defined)
+	PITK_Transform = 4,
+};
+
+// Same values as the generator's DataTransformationType
+enum ProgramImageTransformType
+{
+	PITT_Func = 0,
+	PITT_Op = 1,
+	PITT_FieldAccess = 2,
+	PITT_ConstIndex = 3,
+	PITT_DynamicIndex = 4,
+};
+
+struct ProgramImageSymbol
+{
+	// ProgramImageTokenKind
+	uint8_t Kind;
+	uint8_t Padding;
+	// Index into the types or transforms for PITK_Type and PITK_Transform, 0 otherwise
+	uint16_t Target;
+};
+
+struct ProgramImageSection
+{
+	uint32_t Offset;
+	uint32_t Count;
+};
+
+struct ProgramImageHeader
+{
+	char Magic[4];
+	uint32_t Version;
+	uint32_t GeneratorVersion;
+	// GenShaderType
+	uint32_t ShaderType;
+	// 0 for shaders generated from decision bytes
+	uint64_t Seed;
+	// Same as GenShaderMetadata
+	uint64_t EstimatedALUCost;
+	uint32_t EstimatedPeakRegisters;
+	uint32_t SourceLength;
+	ProgramImageSection Types;
+	ProgramImageSection Fields;
+	ProgramImageSection Transforms;
+	ProgramImageSection Symbols;
+	ProgramImageSection StringOffsets;
+	// Counts in bytes for these two
+	ProgramImageSection StringData;
+	ProgramImageSection Tokens;
+	uint32_t NumTokens;
+	uint32_t TotalSize;
+};
+
+struct ProgramImageType
+{
+	uint32_t Name;
+	uint32_t FirstField;
+	uint32_t NumFields;
+	int32_t NumScalarComponents;
+	// > 0 for arrays, whose fields are their elements
+	int32_t ArrayCount;
+	int32_t ElementType;
+};
+
+struct ProgramImageField
+{
+	uint32_t Name;
+	int32_t Type;
+};
+
+struct ProgramImageTransform
+{
+	uint32_t Name;
+	// ProgramImageTransformType
+	uint8_t TransformType;
+	uint8_t NumSrcTypes;
+	uint16_t Padding;
+	int32_t DstType;
+	int32_t SrcTypes[PROGRAM_IMAGE_MAX_ARITY];
+	int32_t ALUCost;
+	int32_t RegisterFootprint;
+	// -1 if it isn't a user function
+	int32_t UserFuncIndex;
+};
+
+inline uint32_t AlignProgramImageOffset(uint32_t Offset)
+{
+	return (Offset + (PROGRAM_IMAGE_ALIGNMENT - 1)) & ~(uint32_t)(PROGRAM_IMAGE_ALIGNMENT - 1);
+}
+
+// Reads an image in place, Data has to outlive the view and be 8-byte aligned
+struct ProgramImageView
+{
+	const ProgramImageHeader* Header = nullptr;
+	const ProgramImageType* Types = nullptr;
+	const ProgramImageField* Fields = nullptr;
+	const ProgramImageTransform* Transforms = nullptr;
+	const ProgramImageSymbol* Symbols = nullptr;
+	const uint32_t* StringOffsets = nullptr;
+	const char* StringData = nullptr;
+	const uint8_t* Tokens = nullptr;
+
+	// Checks that everything the tables point at is inside the image, so nothing past here needs to.
+	// Tokens are only checked as they're read
+	bool Open(const void* Data, size_t Size, std::string* OutError)
+	{
+		Header = nullptr;
+		if (((uintptr_t)Data % PROGRAM_IMAGE_ALIGNMENT) != 0)
+		{
+			*OutError = "isn't aligned";
+			return false;
+		}
+
+		const ProgramImageHeader* InHeader = (const ProgramImageHeader*)Data;
+		if (Size < sizeof(ProgramImageHeader) || memcmp(InHeader->Magic, PROGRAM_IMAGE_MAGIC, sizeof(InHeader->Magic)) != 0
+			|| InHeader->Version != PROGRAM_IMAGE_VERSION)
+		{
+			*OutError = "not a program image, or from another version of the format";
+			return false;
+		}
+
+		auto IsInside = [InHeader](const ProgramImageSection& Section, size_t ElementSize)
+		{
+			return (Section.Offset % PROGRAM_IMAGE_ALIGNMENT) == 0 && Section.Offset >= sizeof(ProgramImageHeader)
+				&& (uint64_t)Section.Offset + (uint64_t)Section.Count * ElementSize <= InHeader->TotalSize;
+		};
+		if (InHeader->TotalSize > Size || !IsInside(InHeader->Types, sizeof(ProgramImageType)) || !IsInside(InHeader->Fields, sizeof(ProgramImageField))
+			|| !IsInside(InHeader->Transforms, sizeof(ProgramImageTransform)) || !IsInside(InHeader->Symbols, sizeof(ProgramImageSymbol))
+			|| !IsInside(InHeader->StringOffsets, sizeof(uint32_t))
+			|| !IsInside(InHeader->StringData, 1) || !IsInside(InHeader->Tokens, 1))
+		{
+			*OutError = "truncated, or a section runs past its end";
+			return false;
+		}
+
+		const uint8_t* Bytes = (const uint8_t*)Data;
+		Types = (const ProgramImageType*)(Bytes + InHeader->Types.Offset);
+		Fields = (const ProgramImageField*)(Bytes + InHeader->Fields.Offset);
+		Transforms = (const ProgramImageTransform*)(Bytes + InHeader->Transforms.Offset);
+		Symbols = (const ProgramImageSymbol*)(Bytes + InHeader->Symbols.Offset);
+		StringOffsets = (const uint32_t*)(Bytes + InHeader->StringOffsets.Offset);
+		StringData = (const char*)(Bytes + InHeader->StringData.Offset);
+		Tokens = Bytes + InHeader->Tokens.Offset;
+
+		// Every string ends before the end of the data, so the last byte has to end one
+		const uint32_t NumStrings = InHeader->StringOffsets.Count;
+		if (NumStrings > 0 && (InHeader->StringData.Count == 0 || StringData[InHeader->StringData.Count - 1] != '\0'))
+		{
+			*OutError = "bad string table";
+			return false;
+		}
+		for (uint32_t i = 0; i < NumStrings; i++)
+		{
+			if (StringOffsets[i] >= InHeader->StringData.Count)
+			{
+				*OutError = "bad string table";
+				return false;
+			}
+		}
+
+		const uint32_t NumTypes = InHeader->Types.Count;
+		auto IsType = [NumTypes](int32_t Type)
+		{
+			return Type >= 0 && (uint32_t)Type < NumTypes;
+		};
+		for (uint32_t i = 0; i < NumTypes; i++)
+		{
+			const ProgramImageType& Type = Types[i];
+			if (Type.Name >= NumStrings || (uint64_t)Type.FirstField + Type.NumFields > InHeader->Fields.Count
+				|| (Type.ArrayCount > 0 && !IsType(Type.ElementType)))
+			{
+				*OutError = "bad type table";
+				return false;
+			}
+		}
+		for (uint32_t i = 0; i < InHeader->Fields.Count; i++)
+		{
+			if (Fields[i].Name >= NumStrings || !IsType(Fields[i].Type))
+			{
+				*OutError = "bad field table";
+				return false;
+			}
+		}
+		for (uint32_t i = 0; i < InHeader->Transforms.Count; i++)
+		{
+			const ProgramImageTransform& Transform = Transforms[i];
+			bool bValid = Transform.Name < NumStrings && Transform.NumSrcTypes <= PROGRAM_IMAGE_MAX_ARITY && IsType(Transform.DstType);
+			for (uint32_t s = 0; bValid && s < Transform.NumSrcTypes; s++)
+			{
+				bValid = IsType(Transform.SrcTypes[s]);
+			}
+			if (!bValid)
+			{
+				*OutError = "bad transform table";
+				return false;
+			}
+		}
+
+		bool bValidSymbols = InHeader->Symbols.Count <= NumStrings;
+		for (uint32_t i = 0; bValidSymbols && i < InHeader->Symbols.Count; i++)
+		{
+			const ProgramImageSymbol& Symbol = Symbols[i];
+			switch (Symbol.Kind)
+			{
+			case PITK_Glue:
+			case PITK_Ident:
+			case PITK_Number: break;
+			case PITK_Type: bValidSymbols = IsType(Symbol.Target); break;
+			case PITK_Transform: bValidSymbols = Symbol.Target < InHeader->Transforms.Count; break;
+			default: bValidSymbols = false; break;
+			}
+		}
+		if (!bValidSymbols)
+		{
+			*OutError = "bad symbol table";
+			return false;
+		}
+
+		Header = InHeader;
+		return true;
+	}
+
+	const char* GetString(uint32_t Index) const
+	{
+		return StringData + StringOffsets[Index];
+	}
+
+	// Calls Fn(SymbolIndex, const ProgramImageSymbol&) for each token in order, GetString(SymbolIndex)
+	// is its text. False if the stream is malformed, Fn has seen every token before the bad one then
+	template<typename FuncType>
+	bool ForEachToken(FuncType&& Fn) const
+	{
+		const uint8_t* Cursor = Tokens;
+		const uint8_t* End = Tokens + Header->Tokens.Count;
+		for (uint32_t t = 0; t < Header->NumTokens; t++)
+		{
+			uint32_t Value = 0;
+			for (int32_t Shift = 0;; Shift += 7)
+			{
+				if (Cursor == End || Shift > 28)
+				{
+					return false;
+				}
+				const uint8_t Byte = *Cursor++;
+				Value |= (uint32_t)(Byte & 0x7F) << Shift;
+				if ((Byte & 0x80) == 0)
+				{
+					break;
+				}
+			}
+
+			if (Value >= Header->Symbols.Count)
+			{
+				return false;
+			}
+			Fn(Value, Symbols[Value]);
+		}
+		return Cursor == End;
+	}
+
+	// Appends the source the image was made from
+	bool AppendSource(std::string* Out) const
+	{
+		Out->reserve(Out->size() + Header->SourceLength);
+		return ForEachToken([this, Out](uint32_t SymbolIndex, const ProgramImageSymbol&)
+		{
+			Out->append(GetString(SymbolIndex));
+		});
+	}
+};
+
+// Reads a whole image file into OutData with a single read, ready for ProgramImageView::Open.
+// Backed by uint64_t so it's aligned
+inline bool ReadProgramImageFile(const char* Path, std::vector<uint64_t>* OutData, size_t* OutSize)
+{
+	FILE* f = fopen(Path, "rb");
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	fseek(f, 0, SEEK_END);
+	const long Size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (Size < 0)
+	{
+		fclose(f);
+		return false;
+	}
+
+	OutData->resize(((size_t)Size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+	const bool bRead = (Size == 0) || fread(OutData->data(), (size_t)Size, 1, f) == 1;
+	fclose(f);
+
+	*OutSize = (size_t)Size;
+	return bRead;
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+// Seed corpus: a shader corpus that only stores what it takes to generate each shader again,
+// since the generator is deterministic for a given seed, options and generator version.
+// Layout (native endianness):
+//   SeedCorpusFileHeader, with the options every shader was generated with
+//   SeedCorpusEntry, SeedCorpusEntry, ... (32 bytes per shader, against a few KB of text)
+// SeedCorpusReader regenerates ("materializes") shaders on demand, with an LRU cache of the text
+// for callers that go back to the same ones. Each entry has a hash of the source it stood for,
+// so a generator that no longer makes the same shader gets caught instead of handing out different ones.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gen_shader.h"
+#include "batch_manifest.h"
+
+#define SEED_CORPUS_MAGIC "GSSC"
+#define SEED_CORPUS_VERSION 1
+
+// The options that change what gets generated, fixed-size so it can go in the file as is
+struct SeedCorpusProfile
+{
+	uint32_t ShaderType;
+	uint32_t StraightLineALUStatements;
+	uint32_t LoopNestDepth;
+	uint32_t LoopTripCount;
+	uint32_t TargetALUCost;
+	uint32_t KeepAllCodeLive;
+	uint32_t SubexpressionReusePercent;
+	uint32_t MaxGeneratorSteps;
+	uint32_t NumArrayTypes;
+	uint32_t LargeUniformArraySize;
+};
+
+struct SeedCorpusFileHeader
+{
+	char Magic[4];
+	uint32_t Version;
+	uint32_t GeneratorVersion;
+	uint32_t ProfileSize;
+	// FNV-1a over the generator version and the profile, quick to compare between corpora
+	uint64_t Fingerprint;
+	SeedCorpusProfile Profile;
+};
+
+struct SeedCorpusEntry
+{
+	uint64_t Seed;
+	// HashBatchOutput of the source, starting from BATCH_MANIFEST_HASH_INIT
+	uint64_t SourceHash;
+	uint64_t EstimatedALUCost;
+	uint32_t EstimatedPeakRegisters;
+	// 0 if generating failed, which it will do again
+	uint32_t SourceLength;
+};
+
+inline SeedCorpusProfile MakeSeedCorpusProfile(const GenShaderOptions& Options)
+{
+	SeedCorpusProfile Profile;
+	memset(&Profile, 0, sizeof(Profile));
+	Profile.ShaderType = (uint32_t)Options.ShaderType;
+	Profile.StraightLineALUStatements = Options.StraightLineALUStatements;
+	Profile.LoopNestDepth = Options.LoopNestDepth;
+	Profile.LoopTripCount = Options.LoopTripCount;
+	Profile.TargetALUCost = Options.TargetALUCost;
+	Profile.KeepAllCodeLive = Options.KeepAllCodeLive;
+	Profile.SubexpressionReusePercent = Options.SubexpressionReusePercent;
+	Profile.MaxGeneratorSteps = Options.MaxGeneratorSteps;
+	Profile.NumArrayTypes = Options.NumArrayTypes;
+	Profile.LargeUniformArraySize = Options.LargeUniformArraySize;
+	return Profile;
+}
+
+inline void GetSeedCorpusOptions(const SeedCorpusProfile& Profile, GenShaderOptions* OutOptions)
+{
+	GenShader_InitOptions(OutOptions);
+	OutOptions->ShaderType = (GenShaderType)Profile.ShaderType;
+	OutOptions->StraightLineALUStatements = Profile.StraightLineALUStatements;
+	OutOptions->LoopNestDepth = Profile.LoopNestDepth;
+	OutOptions->LoopTripCount = Profile.LoopTripCount;
+	OutOptions->TargetALUCost = Profile.TargetALUCost;
+	OutOptions->KeepAllCodeLive = Profile.KeepAllCodeLive;
+	OutOptions->SubexpressionReusePercent = Profile.SubexpressionReusePercent;
+	OutOptions->MaxGeneratorSteps = Profile.MaxGeneratorSteps;
+	OutOptions->NumArrayTypes = Profile.NumArrayTypes;
+	OutOptions->LargeUniformArraySize = Profile.LargeUniformArraySize;
+}
+
+inline void InitSeedCorpusFileHeader(const GenShaderOptions& Options, SeedCorpusFileHeader* OutHeader)
+{
+	memset(OutHeader, 0, sizeof(*OutHeader));
+	memcpy(OutHeader->Magic, SEED_CORPUS_MAGIC, sizeof(OutHeader->Magic));
+	OutHeader->Version = SEED_CORPUS_VERSION;
+	OutHeader->GeneratorVersion = GenShader_GetGeneratorVersion();
+	OutHeader->ProfileSize = sizeof(SeedCorpusProfile);
+	OutHeader->Profile = MakeSeedCorpusProfile(Options);
+	OutHeader->Fingerprint = HashBatchOutput(BATCH_MANIFEST_HASH_INIT, OutHeader->GeneratorVersion, (const char*)&OutHeader->Profile, sizeof(OutHeader->Profile));
+}
+
+enum SeedCorpusMaterializeResult
+{
+	SCMR_Ok,
+	// Generating this seed failed when the corpus was written too, there's no source
+	SCMR_GenerationFailed,
+	// The generator made something other than what the corpus recorded
+	SCMR_Mismatch
+};
+
+// Not thread-safe (it has one GenShaderContext), use a reader per thread
+struct SeedCorpusReader
+{
+	SeedCorpusFileHeader Header;
+	std::vector<SeedCorpusEntry> Entries;
+	// Entries are usually written in seed order, FindSeed binary searches them if so
+	bool bSortedBySeed = true;
+
+	GenShaderContext* Ctx = nullptr;
+
+	// Most recently used first, each with its text
+	struct CachedSource
+	{
+		size_t Index;
+		std::string Source;
+	};
+	std::list<CachedSource> Cache;
+	std::unordered_map<size_t, std::list<CachedSource>::iterator> CacheLookup;
+	size_t MaxCachedBytes = 0;
+	size_t CachedBytes = 0;
+	// Where the last uncached materialize goes when there's no cache
+	std::string Scratch;
+
+	// OutError gets why it couldn't be read. MaxCachedBytes of 0 keeps no cache
+	bool Open(const char* Path, size_t InMaxCachedBytes, std::string* OutError)
+	{
+		Close();
+		MaxCachedBytes = InMaxCachedBytes;
+
+		FILE* f = fopen(Path, "rb");
+		if (f == nullptr)
+		{
+			*OutError = "could not open it";
+			return false;
+		}
+
+		const bool bHeaderRead = (fread(&Header, sizeof(Header), 1, f) == 1);
+		if (!bHeaderRead || memcmp(Header.Magic, SEED_CORPUS_MAGIC, sizeof(Header.Magic)) != 0
+			|| Header.Version != SEED_CORPUS_VERSION || Header.ProfileSize != sizeof(SeedCorpusProfile))
+		{
+			fclose(f);
+			*OutError = "not a seed corpus, or from another version of the format";
+			return false;
+		}
+
+		// Regenerating with another generator would give different shaders, so there's nothing to read
+		if (Header.GeneratorVersion != GenShader_GetGeneratorVersion())
+		{
+			fclose(f);
+			*OutError = "written by generator version " + std::to_string(Header.GeneratorVersion) + ", this is " + std::to_string(GenShader_GetGeneratorVersion());
+			return false;
+		}
+
+		SeedCorpusEntry Entry;
+		size_t NumRead = 0;
+		while ((NumRead = fread(&Entry, 1, sizeof(Entry), f)) == sizeof(Entry))
+		{
+			bSortedBySeed = bSortedBySeed && (Entries.size() == 0 || Entries.back().Seed < Entry.Seed);
+			Entries.push_back(Entry);
+		}
+		fclose(f);
+
+		if (NumRead != 0)
+		{
+			*OutError = "ends partway through an entry";
+			Close();
+			return false;
+		}
+
+		GenShaderOptions Options;
+		GetSeedCorpusOptions(Header.Profile, &Options);
+		Ctx = GenShader_CreateContext(&Options);
+		if (Ctx == nullptr)
+		{
+			*OutError = "its options are invalid";
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		if (Ctx != nullptr)
+		{
+			GenShader_DestroyContext(Ctx);
+			Ctx = nullptr;
+		}
+		Entries.clear();
+		bSortedBySeed = true;
+		Cache.clear();
+		CacheLookup.clear();
+		CachedBytes = 0;
+	}
+
+	~SeedCorpusReader()
+	{
+		Close();
+	}
+
+	size_t GetNumEntries() const
+	{
+		return Entries.size();
+	}
+
+	const SeedCorpusEntry& GetEntry(size_t Index) const
+	{
+		return Entries[Index];
+	}
+
+	// Returns the index of Seed's entry, or -1
+	int64_t FindSeed(uint64_t Seed) const
+	{
+		if (bSortedBySeed)
+		{
+			auto It = std::lower_bound(Entries.begin(), Entries.end(), Seed, [](const SeedCorpusEntry& Entry, uint64_t Value)
+			{
+				return Entry.Seed < Value;
+			});
+			return (It != Entries.end() && It->Seed == Seed) ? (int64_t)(It - Entries.begin()) : -1;
+		}
+
+		for (size_t i = 0; i < Entries.size(); i++)
+		{
+			if (Entries[i].Seed == Seed)
+			{
+				return (int64_t)i;
+			}
+		}
+		return -1;
+	}
+
+	// Regenerates entry Index (or takes it from the cache). *OutSource stays valid until the next call
+	SeedCorpusMaterializeResult Materialize(size_t Index, const std::string** OutSource)
+	{
+		auto Cached = CacheLookup.find(Index);
+		if (Cached != CacheLookup.end())
+		{
+			Cache.splice(Cache.begin(), Cache, Cached->second);
+			*OutSource = &Cached->second->Source;
+			return SCMR_Ok;
+		}
+
+		const SeedCorpusEntry& Entry = Entries[Index];
+		Scratch.clear();
+		const GenShaderResult Result = GenShader_GenerateToCallback(Ctx, Entry.Seed, [](const char* Source, size_t Length, void* UserData)
+		{
+			((std::string*)UserData)->assign(Source, Length);
+		}, &Scratch);
+
+		if (Result != GENSHADER_OK)
+		{
+			return (Entry.SourceLength == 0) ? SCMR_GenerationFailed : SCMR_Mismatch;
+		}
+		if (Scratch.size() != Entry.SourceLength || HashBatchOutput(BATCH_MANIFEST_HASH_INIT, Entry.Seed, Scratch.data(), Scratch.size()) != Entry.SourceHash)
+		{
+			return SCMR_Mismatch;
+		}
+
+		if (MaxCachedBytes == 0 || Scratch.size() > MaxCachedBytes)
+		{
+			*OutSource = &Scratch;
+			return SCMR_Ok;
+		}
+
+		while (CachedBytes + Scratch.size() > MaxCachedBytes)
+		{
+			CachedBytes -= Cache.back().Source.size();
+			CacheLookup.erase(Cache.back().Index);
+			Cache.pop_back();
+		}
+
+		Cache.push_front(CachedSource{ Index, Scratch });
+		CacheLookup[Index] = Cache.begin();
+		CachedBytes += Scratch.size();
+		*OutSource = &Cache.front().Source;
+		return SCMR_Ok;
+	}
+};
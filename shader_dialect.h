@@ -0,0 +1,1090 @@
+#pragma once
+
+// Shader dialects: the generated GLSL re-emitted as HLSL, MSL or C++, so the same programs can go through
+// each language's front end (or, for C++, run natively as a reference, see shader_reference.h). The generator only writes GLSL; ShaderDialectSource analyses that once
+// (declarations, and the code as a token stream with what each identifier refers to), and
+// EmitShaderDialect<Policy> walks the result for each dialect. Policies are plain structs of static
+// functions picked at compile time, so the per-token work inlines instead of going through a vtable,
+// and however many dialects get emitted, the generation and the analysis only happen once.
+// What changes between dialects:
+//   vecN types are floatN, and HLSL can't splat with a one-argument constructor, so vec3(x) becomes ((float3)(x))
+//   main() becomes main_body(), called from an entry point that copies the stage inputs into the globals
+//     (HLSL: static globals, MSL: members of a ShaderProgram struct the whole program is wrapped in,
+//     since MSL has no mutable program-scope variables) and the outputs back out
+//   uniforms are global uniforms in HLSL, and in MSL a ShaderUniforms struct in buffer(0)
+//   storage buffers are RWStructuredBuffers in HLSL and device pointers in MSL (at buffer(binding + 1))
+// Struct-typed inputs can't be interpolated in either, so they come in as uniforms.
+// C++ keeps the GLSL names (vecN and the builtins come from shader_reference.h), wraps the program in a
+// ShaderProgram struct like MSL, writes multi-component swizzles as .swizzle<...>() and instead of an entry
+// point has RunShaderGrid, which sets the inputs for each point of a grid and collects the output.
+// It has no compute shaders (nothing to run them over).
+// Array types have no translation yet (HLSL functions can't return them), analysing a shader with any fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "gen_shader.h"
+
+enum DialectTokenKind
+{
+	// Copied as is
+	DTK_Text = 0,
+	// vecN, Aux is N
+	DTK_VectorType = 1,
+	// vecN with one argument, Aux is N. Its closing paren is a DTK_SplatClose
+	DTK_SplatVectorType = 2,
+	DTK_SplatClose = 3,
+	// "main", where main is defined
+	DTK_EntryPoint = 4,
+	// Field of a storage buffer (loose field or its data array), Aux is the buffer. Unsized arrays are
+	// buffers of their own in both dialects, so they stay plain text
+	DTK_BufferField = 5,
+	// Global the entry point doesn't copy in, Aux is the global
+	DTK_Uniform = 6,
+	// Components after a '.', Aux is them 2 bits each (x = 0 to w = 3) from the lowest bits up
+	DTK_Swizzle = 7,
+	// A number with a fraction, which GLSL makes a float (C++ a double)
+	DTK_FloatLiteral = 8,
+};
+
+enum DialectGlobalKind
+{
+	DGK_Input = 0,
+	DGK_Output = 1,
+	DGK_Uniform = 2,
+};
+
+struct DialectToken
+{
+	uint32_t Start;
+	uint32_t Length;
+	// DialectTokenKind
+	uint16_t Kind;
+	uint16_t Aux;
+};
+
+struct DialectDecl
+{
+	std::string Type;
+	std::string Name;
+};
+
+struct DialectGlobal
+{
+	DialectDecl Decl;
+	// DialectGlobalKind
+	int32_t Kind = DGK_Input;
+};
+
+struct DialectStruct
+{
+	std::string Name;
+	std::vector<DialectDecl> Fields;
+};
+
+struct DialectBuffer
+{
+	std::string Name;
+	int32_t Binding = 0;
+	std::vector<DialectDecl> Fields;
+	// The array at the end of the block, 0 elements if it's unsized
+	DialectDecl Data;
+	int32_t NumDataElements = 0;
+};
+
+// The GLSL, analysed once for any number of dialects
+struct ShaderDialectSource
+{
+	const char* Source = nullptr;
+	GenShaderType Stage = GENSHADER_TYPE_FRAG;
+	int32_t LocalSize[3] = { 1, 1, 1 };
+
+	std::vector<DialectStruct> Structs;
+	std::vector<DialectGlobal> Globals;
+	std::vector<DialectBuffer> Buffers;
+
+	// The functions, from the first one to the end
+	std::vector<DialectToken> Tokens;
+
+	// Kept between analyses so the allocations get reused
+	std::unordered_map<std::string_view, DialectToken> Identifiers;
+	struct OpenParen
+	{
+		int32_t SplatToken;
+		bool bHasComma;
+	};
+	std::vector<OpenParen> OpenParens;
+
+	// Source has to stay alive (and unchanged) while this is used
+	bool Analyse(const char* InSource, size_t Length, GenShaderType InStage, std::string* OutError)
+	{
+		Source = InSource;
+		Stage = InStage;
+		LocalSize[0] = LocalSize[1] = LocalSize[2] = 1;
+		Structs.clear();
+		Globals.clear();
+		Buffers.clear();
+		Tokens.clear();
+		Identifiers.clear();
+		OpenParens.clear();
+
+		const char* End = InSource + Length;
+		const char* Line = InSource;
+		auto NextLine = [&]()
+		{
+			const char* LineEnd = (const char*)memchr(Line, '\n', End - Line);
+			Line = (LineEnd != nullptr) ? LineEnd + 1 : End;
+		};
+		auto LineStartsWith = [&](const char* Prefix)
+		{
+			const size_t PrefixLength = strlen(Prefix);
+			return (size_t)(End - Line) >= PrefixLength && memcmp(Line, Prefix, PrefixLength) == 0;
+		};
+		// "\tT N;" or "T N;" up to the end of the line
+		auto ParseDecl = [&](const char* From, DialectDecl* OutDecl)
+		{
+			while (From < End && (*From == '\t' || *From == ' '))
+			{
+				From++;
+			}
+			const char* TypeEnd = From;
+			while (TypeEnd < End && *TypeEnd != ' ' && *TypeEnd != '\n')
+			{
+				TypeEnd++;
+			}
+			const char* NameEnd = TypeEnd + 1;
+			while (NameEnd < End && *NameEnd != ';' && *NameEnd != '\n')
+			{
+				NameEnd++;
+			}
+			if (TypeEnd >= End || *TypeEnd != ' ' || NameEnd >= End || *NameEnd != ';')
+			{
+				return false;
+			}
+			OutDecl->Type.assign(From, TypeEnd);
+			OutDecl->Name.assign(TypeEnd + 1, NameEnd);
+			return true;
+		};
+		auto IsArrayDecl = [](const DialectDecl& Decl)
+		{
+			return Decl.Type.find('[') != std::string::npos || Decl.Name.find('[') != std::string::npos;
+		};
+
+		// Declarations, one per line, in the order the generator writes them
+		while (Line < End)
+		{
+			if (*Line == '\n' || LineStartsWith("#version") || LineStartsWith("precision "))
+			{
+				NextLine();
+			}
+			else if (LineStartsWith("layout(local_size_x"))
+			{
+				if (sscanf(Line, "layout(local_size_x = %d, local_size_y = %d, local_size_z = %d)", &LocalSize[0], &LocalSize[1], &LocalSize[2]) != 3)
+				{
+					*OutError = "unexpected local size declaration";
+					return false;
+				}
+				NextLine();
+			}
+			else if (LineStartsWith("struct "))
+			{
+				Structs.emplace_back();
+				DialectStruct& Struct = Structs.back();
+				const char* NameEnd = (const char*)memchr(Line + 7, ' ', End - (Line + 7));
+				if (NameEnd == nullptr)
+				{
+					*OutError = "unexpected struct declaration";
+					return false;
+				}
+				Struct.Name.assign(Line + 7, NameEnd);
+
+				for (NextLine(); Line < End && !LineStartsWith("};"); NextLine())
+				{
+					Struct.Fields.emplace_back();
+					if (!ParseDecl(Line, &Struct.Fields.back()) || IsArrayDecl(Struct.Fields.back()))
+					{
+						*OutError = "unsupported struct field (array types have no translation)";
+						return false;
+					}
+				}
+				NextLine();
+			}
+			else if (LineStartsWith("layout(std430"))
+			{
+				Buffers.emplace_back();
+				DialectBuffer& Buffer = Buffers.back();
+				char Name[64];
+				if (sscanf(Line, "layout(std430, binding = %d) buffer %63s", &Buffer.Binding, Name) != 2)
+				{
+					*OutError = "unexpected storage buffer declaration";
+					return false;
+				}
+				Buffer.Name = Name;
+
+				for (NextLine(); Line < End && !LineStartsWith("};"); NextLine())
+				{
+					DialectDecl Decl;
+					if (!ParseDecl(Line, &Decl))
+					{
+						*OutError = "unexpected storage buffer field";
+						return false;
+					}
+
+					// The data array comes last
+					const size_t Bracket = Decl.Name.find('[');
+					if (Bracket == std::string::npos)
+					{
+						Buffer.Fields.push_back(Decl);
+					}
+					else
+					{
+						Buffer.NumDataElements = atoi(Decl.Name.c_str() + Bracket + 1);
+						Decl.Name.resize(Bracket);
+						Buffer.Data = Decl;
+					}
+				}
+				NextLine();
+			}
+			else if (LineStartsWith("in ") || LineStartsWith("out ") || LineStartsWith("uniform ") || LineStartsWith("varying ") || LineStartsWith("attribute "))
+			{
+				const char* StorageEnd = (const char*)memchr(Line, ' ', End - Line);
+				const std::string_view Storage(Line, StorageEnd - Line);
+
+				DialectGlobal Global;
+				if (!ParseDecl(StorageEnd + 1, &Global.Decl))
+				{
+					*OutError = "unexpected global declaration";
+					return false;
+				}
+				if (IsArrayDecl(Global.Decl))
+				{
+					*OutError = "array types have no translation";
+					return false;
+				}
+
+				// varying is an output of vertex shaders and an input of fragment ones
+				if (Storage == "uniform")
+				{
+					Global.Kind = DGK_Uniform;
+				}
+				else if (Storage == "out" || (Storage == "varying" && Stage == GENSHADER_TYPE_VERT))
+				{
+					Global.Kind = DGK_Output;
+				}
+				else
+				{
+					Global.Kind = IsStructType(Global.Decl.Type) ? DGK_Uniform : DGK_Input;
+				}
+				Globals.push_back(Global);
+				NextLine();
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		// What each identifier the dialects care about refers to
+		for (int32_t i = 2; i <= 4; i++)
+		{
+			static const char* VectorTypeNames[] = { "vec2", "vec3", "vec4" };
+			Identifiers[VectorTypeNames[i - 2]] = DialectToken{ 0, 0, DTK_VectorType, (uint16_t)i };
+		}
+		Identifiers["main"] = DialectToken{ 0, 0, DTK_EntryPoint, 0 };
+		for (size_t b = 0; b < Buffers.size(); b++)
+		{
+			for (const DialectDecl& Field : Buffers[b].Fields)
+			{
+				Identifiers[Field.Name] = DialectToken{ 0, 0, DTK_BufferField, (uint16_t)b };
+			}
+			if (Buffers[b].NumDataElements > 0)
+			{
+				Identifiers[Buffers[b].Data.Name] = DialectToken{ 0, 0, DTK_BufferField, (uint16_t)b };
+			}
+		}
+		for (size_t g = 0; g < Globals.size(); g++)
+		{
+			if (Globals[g].Kind == DGK_Uniform)
+			{
+				Identifiers[Globals[g].Decl.Name] = DialectToken{ 0, 0, DTK_Uniform, (uint16_t)g };
+			}
+		}
+		std::vector<std::string_view> TypeNames = { "float", "int", "uint", "bool", "vec2", "vec3", "vec4" };
+		for (const DialectStruct& Struct : Structs)
+		{
+			TypeNames.push_back(Struct.Name);
+		}
+
+		// The functions: identifiers get looked up, everything between them is text.
+		// Parens are tracked to find single-argument vector constructors
+		auto IsIdentStart = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; };
+		auto IsIdentChar = [&](char c) { return IsIdentStart(c) || (c >= '0' && c <= '9'); };
+		auto AppendText = [&](const char* From, const char* To)
+		{
+			if (!Tokens.empty() && Tokens.back().Kind == DTK_Text && Source + Tokens.back().Start + Tokens.back().Length == From)
+			{
+				Tokens.back().Length += (uint32_t)(To - From);
+			}
+			else
+			{
+				Tokens.push_back(DialectToken{ (uint32_t)(From - Source), (uint32_t)(To - From), DTK_Text, 0 });
+			}
+		};
+
+		const char* Cursor = Line;
+		while (Cursor < End)
+		{
+			const char c = *Cursor;
+			if (IsIdentStart(c))
+			{
+				const char* IdentEnd = Cursor + 1;
+				while (IdentEnd < End && IsIdentChar(*IdentEnd))
+				{
+					IdentEnd++;
+				}
+				const std::string_view Ident(Cursor, IdentEnd - Cursor);
+
+				if (IdentEnd < End && *IdentEnd == '[')
+				{
+					for (const std::string_view& TypeName : TypeNames)
+					{
+						if (Ident == TypeName)
+						{
+							*OutError = "array types have no translation";
+							return false;
+						}
+					}
+				}
+
+				auto It = Identifiers.find(Ident);
+				uint16_t SwizzleComponents = 0;
+				if (Cursor > Source && Cursor[-1] == '.' && ParseSwizzle(Ident, &SwizzleComponents))
+				{
+					Tokens.push_back(DialectToken{ (uint32_t)(Cursor - Source), (uint32_t)Ident.size(), DTK_Swizzle, SwizzleComponents });
+				}
+				else if (It == Identifiers.end())
+				{
+					AppendText(Cursor, IdentEnd);
+				}
+				else
+				{
+					Tokens.push_back(DialectToken{ (uint32_t)(Cursor - Source), (uint32_t)Ident.size(), It->second.Kind, It->second.Aux });
+				}
+				Cursor = IdentEnd;
+			}
+			else if (c >= '0' && c <= '9')
+			{
+				// Numbers, with whatever suffix or fraction they have
+				const char* NumberEnd = Cursor + 1;
+				bool bHasFraction = false;
+				while (NumberEnd < End && (IsIdentChar(*NumberEnd) || *NumberEnd == '.'))
+				{
+					bHasFraction |= (*NumberEnd == '.');
+					NumberEnd++;
+				}
+				if (bHasFraction)
+				{
+					Tokens.push_back(DialectToken{ (uint32_t)(Cursor - Source), (uint32_t)(NumberEnd - Cursor), DTK_FloatLiteral, 0 });
+				}
+				else
+				{
+					AppendText(Cursor, NumberEnd);
+				}
+				Cursor = NumberEnd;
+			}
+			else if (c == '(')
+			{
+				const bool bAfterVectorType = !Tokens.empty() && Tokens.back().Kind == DTK_VectorType && Source + Tokens.back().Start + Tokens.back().Length == Cursor;
+				OpenParens.push_back(OpenParen{ bAfterVectorType ? (int32_t)Tokens.size() - 1 : -1, false });
+				AppendText(Cursor, Cursor + 1);
+				Cursor++;
+			}
+			else if (c == ')' && !OpenParens.empty() && OpenParens.back().SplatToken >= 0 && !OpenParens.back().bHasComma)
+			{
+				Tokens[OpenParens.back().SplatToken].Kind = DTK_SplatVectorType;
+				Tokens.push_back(DialectToken{ (uint32_t)(Cursor - Source), 1, DTK_SplatClose, 0 });
+				OpenParens.pop_back();
+				Cursor++;
+			}
+			else
+			{
+				if (c == ')' && !OpenParens.empty())
+				{
+					OpenParens.pop_back();
+				}
+				else if (c == ',' && !OpenParens.empty())
+				{
+					OpenParens.back().bHasComma = true;
+				}
+				AppendText(Cursor, Cursor + 1);
+				Cursor++;
+			}
+		}
+
+		return true;
+	}
+
+	// Struct fields are all field_N, so anything made of xyzw after a '.' is a swizzle
+	static bool ParseSwizzle(std::string_view Ident, uint16_t* OutComponents)
+	{
+		if (Ident.size() > 4)
+		{
+			return false;
+		}
+
+		uint16_t Components = 0;
+		for (size_t i = 0; i < Ident.size(); i++)
+		{
+			const char* Component = (const char*)memchr("xyzw", Ident[i], 4);
+			if (Component == nullptr)
+			{
+				return false;
+			}
+			Components |= (uint16_t)((Component - "xyzw") << (2 * i));
+		}
+		*OutComponents = Components;
+		return true;
+	}
+
+	const DialectStruct* FindStruct(const std::string& Type) const
+	{
+		for (const DialectStruct& Struct : Structs)
+		{
+			if (Struct.Name == Type)
+			{
+				return &Struct;
+			}
+		}
+		return nullptr;
+	}
+
+	bool IsStructType(const std::string& Type) const
+	{
+		return FindStruct(Type) != nullptr;
+	}
+
+	bool HasGlobals(DialectGlobalKind Kind) const
+	{
+		for (const DialectGlobal& Global : Globals)
+		{
+			if (Global.Kind == Kind)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+inline void AppendDialectTypeName(std::string* Out, const std::string& Type)
+{
+	if (Type.size() == 4 && Type.compare(0, 3, "vec") == 0)
+	{
+		*Out += "float";
+		*Out += Type[3];
+	}
+	else
+	{
+		*Out += Type;
+	}
+}
+
+inline void AppendDialectDecl(std::string* Out, const char* Indent, const DialectDecl& Decl, std::string_view Suffix)
+{
+	*Out += Indent;
+	AppendDialectTypeName(Out, Decl.Type);
+	*Out += ' ';
+	*Out += Decl.Name;
+	*Out += Suffix;
+}
+
+struct HLSLDialect
+{
+	static constexpr const char* VectorTypePrefix = "float";
+	static constexpr const char* FloatLiteralSuffix = "";
+
+	static void AppendTypeName(std::string* Out, const std::string& Type)
+	{
+		AppendDialectTypeName(Out, Type);
+	}
+
+	static void AppendSwizzle(std::string* Out, std::string_view Components, uint16_t Packed)
+	{
+		*Out += Components;
+	}
+
+	static void AppendPrologue(const ShaderDialectSource& Src, std::string* Out)
+	{
+	}
+
+	static void AppendSplatOpen(std::string* Out, int32_t NumComponents)
+	{
+		*Out += "((float";
+		*Out += (char)('0' + NumComponents);
+		*Out += ')';
+	}
+
+	static void AppendSplatClose(std::string* Out)
+	{
+		*Out += "))";
+	}
+
+	static void AppendBufferFieldAccess(const ShaderDialectSource& Src, std::string* Out, int32_t BufferIndex, std::string_view Field)
+	{
+		*Out += Src.Buffers[BufferIndex].Name;
+		*Out += "[0].";
+		*Out += Field;
+	}
+
+	static void AppendUniformAccess(const ShaderDialectSource& Src, std::string* Out, std::string_view Name)
+	{
+		*Out += Name;
+	}
+
+	// Everything the functions refer to: buffers, uniforms, and statics for the stage's inputs and outputs
+	static void AppendGlobals(const ShaderDialectSource& Src, std::string* Out)
+	{
+		for (const DialectBuffer& Buffer : Src.Buffers)
+		{
+			if (Buffer.NumDataElements > 0)
+			{
+				*Out += "struct " + Buffer.Name + "_t {\n";
+				for (const DialectDecl& Field : Buffer.Fields)
+				{
+					AppendDialectDecl(Out, "\t", Field, ";\n");
+				}
+				AppendDialectDecl(Out, "\t", Buffer.Data, "[" + std::to_string(Buffer.NumDataElements) + "];\n};\n");
+				*Out += "RWStructuredBuffer<" + Buffer.Name + "_t> " + Buffer.Name + " : register(u" + std::to_string(Buffer.Binding) + ");\n";
+			}
+			else
+			{
+				*Out += "RWStructuredBuffer<";
+				AppendDialectTypeName(Out, Buffer.Data.Type);
+				*Out += "> " + Buffer.Data.Name + " : register(u" + std::to_string(Buffer.Binding) + ");\n";
+			}
+		}
+
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			AppendDialectDecl(Out, (Global.Kind == DGK_Uniform) ? "uniform " : "static ", Global.Decl, ";\n");
+		}
+
+		if (Src.Stage == GENSHADER_TYPE_FRAG)
+		{
+			*Out += "static float4 gl_FragColor;\n";
+		}
+		else if (Src.Stage == GENSHADER_TYPE_VERT)
+		{
+			*Out += "static float4 gl_Position;\n";
+		}
+		else
+		{
+			*Out += "static uint gl_LocalInvocationIndex;\n";
+		}
+		*Out += '\n';
+	}
+
+	static void AppendEntryPoint(const ShaderDialectSource& Src, std::string* Out)
+	{
+		if (Src.Stage == GENSHADER_TYPE_COMPUTE)
+		{
+			char NumThreads[96];
+			snprintf(NumThreads, sizeof(NumThreads), "[numthreads(%d, %d, %d)]\n", Src.LocalSize[0], Src.LocalSize[1], Src.LocalSize[2]);
+			*Out += NumThreads;
+			*Out += "void main(uint LocalIndex : SV_GroupIndex)\n{\n\tgl_LocalInvocationIndex = LocalIndex;\n\tmain_body();\n}\n";
+			return;
+		}
+
+		// Interpolants get TEXCOORDn in declaration order, inputs and outputs numbered separately
+		const bool bHasInputs = Src.HasGlobals(DGK_Input);
+		if (bHasInputs)
+		{
+			*Out += "struct StageInput {\n";
+			int32_t Semantic = 0;
+			for (const DialectGlobal& Global : Src.Globals)
+			{
+				if (Global.Kind == DGK_Input)
+				{
+					AppendDialectDecl(Out, "\t", Global.Decl, " : TEXCOORD" + std::to_string(Semantic++) + ";\n");
+				}
+			}
+			*Out += "};\n";
+		}
+
+		*Out += bHasInputs ? "\nstruct StageOutput {\n" : "struct StageOutput {\n";
+		*Out += (Src.Stage == GENSHADER_TYPE_FRAG) ? "\tfloat4 gl_FragColor : SV_Target;\n" : "\tfloat4 gl_Position : SV_Position;\n";
+		int32_t Semantic = 0;
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			if (Global.Kind == DGK_Output)
+			{
+				AppendDialectDecl(Out, "\t", Global.Decl, " : TEXCOORD" + std::to_string(Semantic++) + ";\n");
+			}
+		}
+		*Out += "};\n";
+
+		*Out += bHasInputs ? "\nStageOutput main(StageInput stage_in)\n{\n" : "\nStageOutput main()\n{\n";
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			if (Global.Kind == DGK_Input)
+			{
+				*Out += "\t" + Global.Decl.Name + " = stage_in." + Global.Decl.Name + ";\n";
+			}
+		}
+		*Out += "\tmain_body();\n\tStageOutput stage_out;\n";
+		*Out += (Src.Stage == GENSHADER_TYPE_FRAG) ? "\tstage_out.gl_FragColor = gl_FragColor;\n" : "\tstage_out.gl_Position = gl_Position;\n";
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			if (Global.Kind == DGK_Output)
+			{
+				*Out += "\tstage_out." + Global.Decl.Name + " = " + Global.Decl.Name + ";\n";
+			}
+		}
+		*Out += "\treturn stage_out;\n}\n";
+	}
+};
+
+struct MSLDialect
+{
+	static constexpr const char* VectorTypePrefix = "float";
+	static constexpr const char* FloatLiteralSuffix = "";
+
+	static void AppendTypeName(std::string* Out, const std::string& Type)
+	{
+		AppendDialectTypeName(Out, Type);
+	}
+
+	static void AppendSwizzle(std::string* Out, std::string_view Components, uint16_t Packed)
+	{
+		*Out += Components;
+	}
+
+	static void AppendPrologue(const ShaderDialectSource& Src, std::string* Out)
+	{
+		*Out += "#include <metal_stdlib>\nusing namespace metal;\n\n";
+	}
+
+	// Metal vectors splat from one scalar
+	static void AppendSplatOpen(std::string* Out, int32_t NumComponents)
+	{
+		*Out += "float";
+		*Out += (char)('0' + NumComponents);
+	}
+
+	static void AppendSplatClose(std::string* Out)
+	{
+		*Out += ')';
+	}
+
+	static void AppendBufferFieldAccess(const ShaderDialectSource& Src, std::string* Out, int32_t BufferIndex, std::string_view Field)
+	{
+		*Out += Src.Buffers[BufferIndex].Name;
+		*Out += "->";
+		*Out += Field;
+	}
+
+	static void AppendUniformAccess(const ShaderDialectSource& Src, std::string* Out, std::string_view Name)
+	{
+		*Out += "uniforms->";
+		*Out += Name;
+	}
+
+	// The buffer and uniform structs, then the opening of the struct the program lives in, with the
+	// globals as its members (set up by the entry point)
+	static void AppendGlobals(const ShaderDialectSource& Src, std::string* Out)
+	{
+		for (const DialectBuffer& Buffer : Src.Buffers)
+		{
+			if (Buffer.NumDataElements > 0)
+			{
+				*Out += "struct " + Buffer.Name + "_t {\n";
+				for (const DialectDecl& Field : Buffer.Fields)
+				{
+					AppendDialectDecl(Out, "\t", Field, ";\n");
+				}
+				AppendDialectDecl(Out, "\t", Buffer.Data, "[" + std::to_string(Buffer.NumDataElements) + "];\n};\n\n");
+			}
+		}
+
+		const bool bHasUniforms = Src.HasGlobals(DGK_Uniform);
+		if (bHasUniforms)
+		{
+			*Out += "struct ShaderUniforms {\n";
+			for (const DialectGlobal& Global : Src.Globals)
+			{
+				if (Global.Kind == DGK_Uniform)
+				{
+					AppendDialectDecl(Out, "\t", Global.Decl, ";\n");
+				}
+			}
+			*Out += "};\n\n";
+		}
+
+		*Out += "struct ShaderProgram {\n";
+		if (bHasUniforms)
+		{
+			*Out += "constant ShaderUniforms* uniforms;\n";
+		}
+		for (const DialectBuffer& Buffer : Src.Buffers)
+		{
+			if (Buffer.NumDataElements > 0)
+			{
+				*Out += "device " + Buffer.Name + "_t* " + Buffer.Name + ";\n";
+			}
+			else
+			{
+				*Out += "device ";
+				AppendDialectTypeName(Out, Buffer.Data.Type);
+				*Out += "* " + Buffer.Data.Name + ";\n";
+			}
+		}
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			if (Global.Kind != DGK_Uniform)
+			{
+				AppendDialectDecl(Out, "", Global.Decl, ";\n");
+			}
+		}
+
+		if (Src.Stage == GENSHADER_TYPE_FRAG)
+		{
+			*Out += "float4 gl_FragColor;\n";
+		}
+		else if (Src.Stage == GENSHADER_TYPE_VERT)
+		{
+			*Out += "float4 gl_Position;\n";
+		}
+		else
+		{
+			*Out += "uint gl_LocalInvocationIndex;\n";
+		}
+		*Out += '\n';
+	}
+
+	static void AppendEntryPoint(const ShaderDialectSource& Src, std::string* Out)
+	{
+		*Out += "};\n";
+
+		const bool bHasInputs = Src.HasGlobals(DGK_Input);
+		const bool bHasUniforms = Src.HasGlobals(DGK_Uniform);
+
+		// Entry point params, then the lines that set the program up from them
+		std::string Params;
+		std::string Setup = "\tShaderProgram Program;\n";
+		if (bHasUniforms)
+		{
+			Params += "constant ShaderUniforms& uniforms [[buffer(0)]]";
+			Setup += "\tProgram.uniforms = &uniforms;\n";
+		}
+
+		if (Src.Stage == GENSHADER_TYPE_COMPUTE)
+		{
+			for (const DialectBuffer& Buffer : Src.Buffers)
+			{
+				const std::string& Name = (Buffer.NumDataElements > 0) ? Buffer.Name : Buffer.Data.Name;
+				Params += Params.empty() ? "" : ", ";
+				Params += "device ";
+				if (Buffer.NumDataElements > 0)
+				{
+					Params += Buffer.Name + "_t";
+				}
+				else
+				{
+					AppendDialectTypeName(&Params, Buffer.Data.Type);
+				}
+				Params += "* " + Name + " [[buffer(" + std::to_string(Buffer.Binding + 1) + ")]]";
+				Setup += "\tProgram." + Name + " = " + Name + ";\n";
+			}
+			Params += Params.empty() ? "" : ", ";
+			Params += "uint LocalIndex [[thread_index_in_threadgroup]]";
+			Setup += "\tProgram.gl_LocalInvocationIndex = LocalIndex;\n";
+
+			char ThreadgroupSize[96];
+			snprintf(ThreadgroupSize, sizeof(ThreadgroupSize), "\n// Dispatch with %dx%dx%d threads per threadgroup\n", Src.LocalSize[0], Src.LocalSize[1], Src.LocalSize[2]);
+			*Out += ThreadgroupSize;
+			*Out += "kernel void main0(" + Params + ")\n{\n" + Setup + "\tProgram.main_body();\n}\n";
+			return;
+		}
+
+		const bool bIsFrag = (Src.Stage == GENSHADER_TYPE_FRAG);
+		if (bHasInputs)
+		{
+			*Out += "\nstruct StageInput {\n";
+			int32_t Location = 0;
+			for (const DialectGlobal& Global : Src.Globals)
+			{
+				if (Global.Kind == DGK_Input)
+				{
+					const std::string Attribute = bIsFrag ? "user(locn" + std::to_string(Location++) + ")" : "attribute(" + std::to_string(Location++) + ")";
+					AppendDialectDecl(Out, "\t", Global.Decl, " [[" + Attribute + "]];\n");
+					Setup += "\tProgram." + Global.Decl.Name + " = stage_in." + Global.Decl.Name + ";\n";
+				}
+			}
+			*Out += "};\n";
+			Params = "StageInput stage_in [[stage_in]]" + (Params.empty() ? "" : ", " + Params);
+		}
+
+		*Out += "\nstruct StageOutput {\n";
+		*Out += bIsFrag ? "\tfloat4 gl_FragColor [[color(0)]];\n" : "\tfloat4 gl_Position [[position]];\n";
+		std::string CopyOut = bIsFrag ? "\tstage_out.gl_FragColor = Program.gl_FragColor;\n" : "\tstage_out.gl_Position = Program.gl_Position;\n";
+		int32_t Location = 0;
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			if (Global.Kind == DGK_Output)
+			{
+				AppendDialectDecl(Out, "\t", Global.Decl, " [[user(locn" + std::to_string(Location++) + ")]];\n");
+				CopyOut += "\tstage_out." + Global.Decl.Name + " = Program." + Global.Decl.Name + ";\n";
+			}
+		}
+		*Out += "};\n";
+
+		*Out += bIsFrag ? "\nfragment StageOutput main0(" : "\nvertex StageOutput main0(";
+		*Out += Params + ")\n{\n" + Setup + "\tProgram.main_body();\n\tStageOutput stage_out;\n" + CopyOut + "\treturn stage_out;\n}\n";
+	}
+};
+
+struct CPPDialect
+{
+	static constexpr const char* VectorTypePrefix = "vec";
+	// Otherwise float math with a literal in it happens in double, and rounds differently from GLSL's
+	static constexpr const char* FloatLiteralSuffix = "f";
+
+	static void AppendTypeName(std::string* Out, const std::string& Type)
+	{
+		*Out += Type;
+	}
+
+	// Single components are members of the vector types, the rest go through their swizzle()
+	static void AppendSwizzle(std::string* Out, std::string_view Components, uint16_t Packed)
+	{
+		if (Components.size() == 1)
+		{
+			*Out += Components;
+			return;
+		}
+
+		*Out += "swizzle<";
+		for (size_t i = 0; i < Components.size(); i++)
+		{
+			if (i > 0)
+			{
+				*Out += ", ";
+			}
+			*Out += (char)('0' + ((Packed >> (2 * i)) & 3));
+		}
+		*Out += ">()";
+	}
+
+	// Each program gets a namespace of its own (so a batch of them can share a translation unit) inside
+	// GenShaderReference, where the builtins are, so they hide the C library's abs, sin and so on
+	static void AppendPrologue(const ShaderDialectSource& Src, std::string* Out)
+	{
+		*Out += "#include \"shader_reference.h\"\n\n"
+			"#ifndef SHADER_REFERENCE_NAMESPACE\n#define SHADER_REFERENCE_NAMESPACE shader\n#endif\n\n"
+			"namespace GenShaderReference {\nnamespace SHADER_REFERENCE_NAMESPACE {\n\n";
+	}
+
+	static void AppendSplatOpen(std::string* Out, int32_t NumComponents)
+	{
+		*Out += "vec";
+		*Out += (char)('0' + NumComponents);
+	}
+
+	static void AppendSplatClose(std::string* Out)
+	{
+		*Out += ')';
+	}
+
+	// Only compute shaders have buffers, and they have no C++ translation
+	static void AppendBufferFieldAccess(const ShaderDialectSource& Src, std::string* Out, int32_t BufferIndex, std::string_view Field)
+	{
+		*Out += Field;
+	}
+
+	static void AppendUniformAccess(const ShaderDialectSource& Src, std::string* Out, std::string_view Name)
+	{
+		*Out += Name;
+	}
+
+	// The opening of ShaderProgram, with every global (RunShaderGrid sets them) as a member
+	static void AppendGlobals(const ShaderDialectSource& Src, std::string* Out)
+	{
+		*Out += "struct ShaderProgram {\n";
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			*Out += Global.Decl.Type + ' ' + Global.Decl.Name + ";\n";
+		}
+		*Out += (Src.Stage == GENSHADER_TYPE_FRAG) ? "vec4 gl_FragColor;\n\n" : "vec4 gl_Position;\n\n";
+	}
+
+	// Sets Target, a global or a field of one, to the grid values numbered from *Component on (see shader_reference.h)
+	static void AppendGridValues(const ShaderDialectSource& Src, std::string* Out, const char* Indent, const std::string& Target,
+		const std::string& Type, bool bInput, int32_t* Component)
+	{
+		const DialectStruct* Struct = Src.FindStruct(Type);
+		if (Struct != nullptr)
+		{
+			for (const DialectDecl& Field : Struct->Fields)
+			{
+				AppendGridValues(Src, Out, Indent, Target + '.' + Field.Name, Field.Type, bInput, Component);
+			}
+			return;
+		}
+
+		const bool bVector = (Type.size() == 4 && Type.compare(0, 3, "vec") == 0);
+		const int32_t NumComponents = bVector ? Type[3] - '0' : 1;
+		const char* ScalarType = (Type == "int") ? "Int" : (Type == "bool") ? "Bool" : "Float";
+
+		*Out += Indent + Target + " = ";
+		*Out += bVector ? Type + '(' : std::string();
+		for (int32_t c = 0; c < NumComponents; c++)
+		{
+			*Out += (c > 0) ? ", " : "";
+			*Out += bInput ? "GetGridInput" : "GetGridUniform";
+			*Out += ScalarType;
+			*Out += bInput ? "(X, Y, Width, Height, " : "(";
+			*Out += std::to_string((*Component)++) + ')';
+		}
+		*Out += bVector ? ");\n" : ";\n";
+	}
+
+	static void AppendEntryPoint(const ShaderDialectSource& Src, std::string* Out)
+	{
+		*Out += "};\n\n";
+
+		const char* Output = (Src.Stage == GENSHADER_TYPE_FRAG) ? "gl_FragColor" : "gl_Position";
+		*Out += "// Runs the shader for each point of a Width x Height grid, row by row, writing its ";
+		*Out += Output;
+		*Out += " to Out (4 floats a point)\n";
+		*Out += "inline void RunShaderGrid(int32_t Width, int32_t Height, float* Out)\n{\n\tShaderProgram Program;\n";
+
+		int32_t Component = 0;
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			// A variant's (see GenShader_GetVariant) has to stay 0, and isn't numbered so the rest match the original's
+			if (Global.Kind == DGK_Uniform && Global.Decl.Name == "variant_zero")
+			{
+				*Out += "\tProgram.variant_zero = 0.0f;\n";
+			}
+			else if (Global.Kind == DGK_Uniform)
+			{
+				AppendGridValues(Src, Out, "\t", "Program." + Global.Decl.Name, Global.Decl.Type, false, &Component);
+			}
+		}
+
+		*Out += "\tfor (int32_t Y = 0; Y < Height; Y++)\n\t{\n\t\tfor (int32_t X = 0; X < Width; X++)\n\t\t{\n";
+		Component = 0;
+		for (const DialectGlobal& Global : Src.Globals)
+		{
+			if (Global.Kind == DGK_Input)
+			{
+				AppendGridValues(Src, Out, "\t\t\t", "Program." + Global.Decl.Name, Global.Decl.Type, true, &Component);
+			}
+		}
+
+		*Out += "\t\t\tProgram.main_body();\n\t\t\tfloat* Point = Out + 4 * ((size_t)Y * Width + X);\n";
+		for (int32_t c = 0; c < 4; c++)
+		{
+			*Out += "\t\t\tPoint[" + std::to_string(c) + "] = Program." + Output + '[' + std::to_string(c) + "];\n";
+		}
+		*Out += "\t\t}\n\t}\n}\n\n}\n}\n";
+	}
+};
+
+// Src in the dialect DialectPolicy describes
+template<typename DialectPolicy>
+void EmitShaderDialect(const ShaderDialectSource& Src, std::string* Out)
+{
+	Out->clear();
+	DialectPolicy::AppendPrologue(Src, Out);
+
+	for (const DialectStruct& Struct : Src.Structs)
+	{
+		*Out += "struct " + Struct.Name + " {\n";
+		for (const DialectDecl& Field : Struct.Fields)
+		{
+			*Out += '\t';
+			DialectPolicy::AppendTypeName(Out, Field.Type);
+			*Out += ' ' + Field.Name + ";\n";
+		}
+		*Out += "};\n\n";
+	}
+
+	DialectPolicy::AppendGlobals(Src, Out);
+
+	for (const DialectToken& Token : Src.Tokens)
+	{
+		const std::string_view Text(Src.Source + Token.Start, Token.Length);
+		switch ((DialectTokenKind)Token.Kind)
+		{
+		case DTK_Text:
+			*Out += Text;
+			break;
+		case DTK_VectorType:
+			*Out += DialectPolicy::VectorTypePrefix;
+			*Out += (char)('0' + Token.Aux);
+			break;
+		case DTK_SplatVectorType:
+			DialectPolicy::AppendSplatOpen(Out, Token.Aux);
+			break;
+		case DTK_SplatClose:
+			DialectPolicy::AppendSplatClose(Out);
+			break;
+		case DTK_EntryPoint:
+			*Out += "main_body";
+			break;
+		case DTK_BufferField:
+			DialectPolicy::AppendBufferFieldAccess(Src, Out, Token.Aux, Text);
+			break;
+		case DTK_Uniform:
+			DialectPolicy::AppendUniformAccess(Src, Out, Text);
+			break;
+		case DTK_Swizzle:
+			DialectPolicy::AppendSwizzle(Out, Text, Token.Aux);
+			break;
+		case DTK_FloatLiteral:
+			*Out += Text;
+			*Out += DialectPolicy::FloatLiteralSuffix;
+			break;
+		}
+	}
+
+	DialectPolicy::AppendEntryPoint(Src, Out);
+}
+
+// For picking the dialect at run time, once per shader. False if the dialect can't have this stage
+inline bool EmitShaderDialect(GenShaderDialect Dialect, const ShaderDialectSource& Src, std::string* Out)
+{
+	switch (Dialect)
+	{
+	case GENSHADER_DIALECT_HLSL: EmitShaderDialect<HLSLDialect>(Src, Out); return true;
+	case GENSHADER_DIALECT_MSL: EmitShaderDialect<MSLDialect>(Src, Out); return true;
+	case GENSHADER_DIALECT_CPP:
+		if (Src.Stage == GENSHADER_TYPE_COMPUTE)
+		{
+			return false;
+		}
+		EmitShaderDialect<CPPDialect>(Src, Out);
+		return true;
+	default: return false;
+	}
+}
+
+inline const char* GetShaderDialectExtension(GenShaderDialect Dialect)
+{
+	switch (Dialect)
+	{
+	case GENSHADER_DIALECT_GLSL: return "";
+	case GENSHADER_DIALECT_HLSL: return ".hlsl";
+	case GENSHADER_DIALECT_MSL: return ".metal";
+	case GENSHADER_DIALECT_CPP: return ".cpp";
+	default: return nullptr;
+	}
+}
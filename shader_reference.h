@@ -0,0 +1,258 @@
+#pragma once
+
+// Shader reference: what generated shaders translated to C++ (GENSHADER_DIALECT_CPP, see shader_dialect.h)
+// need to compile and run natively, for reference results without an interpreter or a GPU.
+// It has vec2/vec3/vec4 and exactly the operations InitProgramState registers for them: +, - and *
+// componentwise, vector * scalar, swizzles, and abs, sin, cos, sqrt, pow, clamp, dot and cross.
+// Math is in float, with the C library's functions, so pow of a negative number or sqrt of one is NaN
+// (GLSL leaves those undefined, and a GPU can give anything). int arithmetic is meant to wrap like
+// GLSL's, so compile with -fwrapv, and with -fno-math-errno since nothing reads errno. GCC 12's
+// mod/ref analysis loses stores to the program's variables around the libm calls at -O1 and up
+// (outputs come out zero), so optimize only with -fno-ipa-modref there (gen_reference adds it), or not at all.
+//
+// What a program's inputs and uniforms are set to when it runs over a grid (RunShaderGrid), which
+// a GPU run has to set the same way to compare against it: scalar components are numbered from 0 in
+// declaration order, going through struct fields and vector components, separately for uniforms and
+// for inputs, and each gets the value of GetGridUniform*/GetGridInput* for its number (and, for
+// inputs, its grid point). The exception is a variant's variant_zero (see GenShader_GetVariant), which
+// is always 0 and doesn't get a number, so a variant's other uniforms get the same values as the original's.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#include <type_traits>
+
+namespace GenShaderReference
+{
+
+template<int32_t NumComponents>
+struct VecOf;
+
+// The generated code never reads a variable before assigning it, the zeroes are only so a translation
+// bug that does gives the same result every time. operator[] picks the member rather than indexing
+// off &x, which is out of bounds past x as far as the optimizer is concerned
+struct vec2
+{
+	float x = 0.0f;
+	float y = 0.0f;
+
+	vec2() = default;
+	explicit vec2(float s) : x(s), y(s) {}
+	vec2(float InX, float InY) : x(InX), y(InY) {}
+
+	float& operator[](int32_t i) { return (i == 0) ? x : y; }
+	float operator[](int32_t i) const { return (i == 0) ? x : y; }
+
+	template<int32_t... Components>
+	typename VecOf<sizeof...(Components)>::Type swizzle() const;
+};
+
+struct vec3
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float z = 0.0f;
+
+	vec3() = default;
+	explicit vec3(float s) : x(s), y(s), z(s) {}
+	vec3(float InX, float InY, float InZ) : x(InX), y(InY), z(InZ) {}
+
+	float& operator[](int32_t i) { return (i == 0) ? x : (i == 1) ? y : z; }
+	float operator[](int32_t i) const { return (i == 0) ? x : (i == 1) ? y : z; }
+
+	template<int32_t... Components>
+	typename VecOf<sizeof...(Components)>::Type swizzle() const;
+};
+
+struct vec4
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float z = 0.0f;
+	float w = 0.0f;
+
+	vec4() = default;
+	explicit vec4(float s) : x(s), y(s), z(s), w(s) {}
+	vec4(float InX, float InY, float InZ, float InW) : x(InX), y(InY), z(InZ), w(InW) {}
+
+	float& operator[](int32_t i) { return (i == 0) ? x : (i == 1) ? y : (i == 2) ? z : w; }
+	float operator[](int32_t i) const { return (i == 0) ? x : (i == 1) ? y : (i == 2) ? z : w; }
+
+	template<int32_t... Components>
+	typename VecOf<sizeof...(Components)>::Type swizzle() const;
+};
+
+template<> struct VecOf<2> { using Type = vec2; };
+template<> struct VecOf<3> { using Type = vec3; };
+template<> struct VecOf<4> { using Type = vec4; };
+
+template<typename T> struct VecTraits { static constexpr int32_t NumComponents = 0; };
+template<> struct VecTraits<vec2> { static constexpr int32_t NumComponents = 2; };
+template<> struct VecTraits<vec3> { static constexpr int32_t NumComponents = 3; };
+template<> struct VecTraits<vec4> { static constexpr int32_t NumComponents = 4; };
+
+// Only the vector types, so none of this gets picked for scalars
+template<typename T>
+using EnableIfVec = typename std::enable_if<(VecTraits<T>::NumComponents > 0), T>::type;
+
+template<int32_t... Components>
+typename VecOf<sizeof...(Components)>::Type vec2::swizzle() const
+{
+	return typename VecOf<sizeof...(Components)>::Type((*this)[Components]...);
+}
+
+template<int32_t... Components>
+typename VecOf<sizeof...(Components)>::Type vec3::swizzle() const
+{
+	return typename VecOf<sizeof...(Components)>::Type((*this)[Components]...);
+}
+
+template<int32_t... Components>
+typename VecOf<sizeof...(Components)>::Type vec4::swizzle() const
+{
+	return typename VecOf<sizeof...(Components)>::Type((*this)[Components]...);
+}
+
+// Componentwise F over A (and B and C, for the ones that take more)
+template<typename T, typename Func>
+inline EnableIfVec<T> MapComponents(const T& A, Func F)
+{
+	T Result;
+	for (int32_t i = 0; i < VecTraits<T>::NumComponents; i++)
+	{
+		Result[i] = F(A[i]);
+	}
+	return Result;
+}
+
+template<typename T, typename Func>
+inline EnableIfVec<T> MapComponents(const T& A, const T& B, Func F)
+{
+	T Result;
+	for (int32_t i = 0; i < VecTraits<T>::NumComponents; i++)
+	{
+		Result[i] = F(A[i], B[i]);
+	}
+	return Result;
+}
+
+template<typename T, typename Func>
+inline EnableIfVec<T> MapComponents(const T& A, const T& B, const T& C, Func F)
+{
+	T Result;
+	for (int32_t i = 0; i < VecTraits<T>::NumComponents; i++)
+	{
+		Result[i] = F(A[i], B[i], C[i]);
+	}
+	return Result;
+}
+
+template<typename T>
+inline EnableIfVec<T> operator+(const T& A, const T& B)
+{
+	return MapComponents(A, B, [](float a, float b) { return a + b; });
+}
+
+template<typename T>
+inline EnableIfVec<T> operator-(const T& A, const T& B)
+{
+	return MapComponents(A, B, [](float a, float b) { return a - b; });
+}
+
+template<typename T>
+inline EnableIfVec<T> operator*(const T& A, const T& B)
+{
+	return MapComponents(A, B, [](float a, float b) { return a * b; });
+}
+
+template<typename T>
+inline EnableIfVec<T> operator*(const T& A, float B)
+{
+	return MapComponents(A, [B](float a) { return a * B; });
+}
+
+// For the --live sinks
+template<typename T>
+inline EnableIfVec<T>& operator+=(T& A, const T& B)
+{
+	A = A + B;
+	return A;
+}
+
+inline float abs(float x) { return ::fabsf(x); }
+inline float sin(float x) { return ::sinf(x); }
+inline float cos(float x) { return ::cosf(x); }
+inline float sqrt(float x) { return ::sqrtf(x); }
+inline float pow(float x, float y) { return ::powf(x, y); }
+// min(max()) as GLSL defines it, so it's still defined when lo > hi
+inline float clamp(float x, float lo, float hi) { return fminf(fmaxf(x, lo), hi); }
+
+template<typename T> inline EnableIfVec<T> abs(const T& x) { return MapComponents(x, [](float a) { return abs(a); }); }
+template<typename T> inline EnableIfVec<T> sin(const T& x) { return MapComponents(x, [](float a) { return sin(a); }); }
+template<typename T> inline EnableIfVec<T> cos(const T& x) { return MapComponents(x, [](float a) { return cos(a); }); }
+template<typename T> inline EnableIfVec<T> sqrt(const T& x) { return MapComponents(x, [](float a) { return sqrt(a); }); }
+template<typename T> inline EnableIfVec<T> pow(const T& x, const T& y) { return MapComponents(x, y, [](float a, float b) { return pow(a, b); }); }
+template<typename T> inline EnableIfVec<T> clamp(const T& x, const T& lo, const T& hi) { return MapComponents(x, lo, hi, [](float a, float l, float h) { return clamp(a, l, h); }); }
+
+template<typename T>
+inline typename std::enable_if<(VecTraits<T>::NumComponents > 0), float>::type dot(const T& A, const T& B)
+{
+	float Result = 0.0f;
+	for (int32_t i = 0; i < VecTraits<T>::NumComponents; i++)
+	{
+		Result += A[i] * B[i];
+	}
+	return Result;
+}
+
+inline vec3 cross(const vec3& A, const vec3& B)
+{
+	return vec3(A.y * B.z - A.z * B.y, A.z * B.x - A.x * B.z, A.x * B.y - A.y * B.x);
+}
+
+// Input component Component at point (X, Y) of a Width x Height grid: even components follow the point's
+// x across (0, 1), odd ones its y, and each pair after the first is 0.25 further along
+inline float GetGridInputFloat(int32_t X, int32_t Y, int32_t Width, int32_t Height, int32_t Component)
+{
+	const float U = ((float)X + 0.5f) / (float)Width;
+	const float V = ((float)Y + 0.5f) / (float)Height;
+	return ((Component & 1) ? V : U) + 0.25f * (float)(Component >> 1);
+}
+
+inline int32_t GetGridInputInt(int32_t X, int32_t Y, int32_t Width, int32_t Height, int32_t Component)
+{
+	return (int32_t)(GetGridInputFloat(X, Y, Width, Height, Component) * 8.0f);
+}
+
+inline bool GetGridInputBool(int32_t X, int32_t Y, int32_t Width, int32_t Height, int32_t Component)
+{
+	return GetGridInputFloat(X, Y, Width, Height, Component) > 0.5f;
+}
+
+// Uniforms cycle through -1 to 1 in steps of 0.25, ints through -3 to 3, bools alternate
+inline float GetGridUniformFloat(int32_t Component)
+{
+	return 0.25f * (float)(Component % 9 - 4);
+}
+
+inline int32_t GetGridUniformInt(int32_t Component)
+{
+	return Component % 7 - 3;
+}
+
+inline bool GetGridUniformBool(int32_t Component)
+{
+	return (Component & 1) != 0;
+}
+
+// What gen_reference looks up in the shared objects it builds: every unit has an array of these
+typedef void (*RunShaderGridFunc)(int32_t Width, int32_t Height, float* Out);
+
+struct ShaderReferenceEntry
+{
+	uint64_t Seed;
+	RunShaderGridFunc RunShaderGrid;
+};
+
+}
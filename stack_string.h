@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <string.h>
 
 template<int capacity>
 struct StringStackBuffer {
@@ -27,6 +28,14 @@ struct StringStackBuffer {
 		va_end(varArgs);
 	}
 
+	// From a buffer of another size, cut short if it doesn't fit
+	template<int otherCapacity>
+	explicit StringStackBuffer(const StringStackBuffer<otherCapacity>& other) {
+		length = (other.length < capacity - 1) ? other.length : capacity - 1;
+		memcpy(buffer, other.buffer, length);
+		buffer[length] = '\0';
+	}
+
 	void Clear() {
 		buffer[0] = '\0';
 		length = 0;
@@ -0,0 +1,190 @@
+#pragma once
+
+// Verdict cache: what a compiler made of each shader it was given, keyed by the shader's content and
+// the compiler's identity, so a run over a corpus only compiles what it hasn't seen with that compiler.
+// Layout (native endianness), append-only and flushed after every record, so a run that gets killed
+// loses at most the record it was writing:
+//   VerdictCacheFileHeader
+//   VerdictCacheRecord, VerdictCacheRecord, ...
+// A later record for the same key replaces an earlier one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "batch_manifest.h"
+
+#define VERDICT_CACHE_MAGIC "GSVC"
+#define VERDICT_CACHE_VERSION 1
+
+enum CompileVerdict
+{
+	// Exited with 0
+	CV_Accept = 0,
+	// Exited with anything else, i.e. the compiler reported an error
+	CV_Reject = 1,
+	// Killed by a signal the harness didn't send, e.g. a segfault or an abort from running out of memory under the limit
+	CV_Crash = 2,
+	// Ran past the time limit and got killed
+	CV_Timeout = 3,
+	CV_Count
+};
+
+inline const char* GetCompileVerdictName(CompileVerdict Verdict)
+{
+	switch (Verdict)
+	{
+	case CV_Accept: return "accept";
+	case CV_Reject: return "reject";
+	case CV_Crash: return "crash";
+	case CV_Timeout: return "timeout";
+	default: return "unknown";
+	}
+}
+
+// Content hash of a shader, same hash as the manifests use but without a seed, so identical
+// shaders from different seeds share a key
+inline uint64_t HashShaderContent(const char* Source, size_t Length)
+{
+	return HashBatchOutput(BATCH_MANIFEST_HASH_INIT, 0, Source, Length);
+}
+
+struct VerdictCacheFileHeader
+{
+	char Magic[4];
+	uint32_t Version;
+};
+
+struct VerdictCacheRecord
+{
+	uint64_t ContentHash;
+	uint64_t CompilerID;
+	uint32_t ContentLength;
+	// CompileVerdict
+	uint16_t Verdict;
+	// Exit code for CV_Reject, signal for CV_Crash, 0 otherwise
+	uint16_t Detail;
+};
+
+struct VerdictCache
+{
+	struct Key
+	{
+		uint64_t ContentHash;
+		uint64_t CompilerID;
+		uint32_t ContentLength;
+
+		bool operator==(const Key& Other) const
+		{
+			return ContentHash == Other.ContentHash && CompilerID == Other.CompilerID && ContentLength == Other.ContentLength;
+		}
+	};
+
+	struct KeyHasher
+	{
+		size_t operator()(const Key& InKey) const
+		{
+			return (size_t)(InKey.ContentHash ^ (InKey.CompilerID * 0x9E3779B97F4A7C15ULL) ^ InKey.ContentLength);
+		}
+	};
+
+	std::unordered_map<Key, VerdictCacheRecord, KeyHasher> Records;
+	FILE* File = nullptr;
+
+	// Loads what's in Path (if it exists) and opens it to append to. A trailing partial record,
+	// from a run that was killed mid-write, gets cut off
+	bool Open(const char* Path, std::string* OutError)
+	{
+		Close();
+
+		size_t ValidLength = 0;
+		FILE* Existing = fopen(Path, "rb");
+		if (Existing != nullptr)
+		{
+			VerdictCacheFileHeader Header;
+			if (fread(&Header, sizeof(Header), 1, Existing) != 1 || memcmp(Header.Magic, VERDICT_CACHE_MAGIC, sizeof(Header.Magic)) != 0
+				|| Header.Version != VERDICT_CACHE_VERSION)
+			{
+				fclose(Existing);
+				*OutError = "not a verdict cache, or from another version of the format";
+				return false;
+			}
+
+			ValidLength = sizeof(Header);
+			VerdictCacheRecord Record;
+			while (fread(&Record, sizeof(Record), 1, Existing) == 1)
+			{
+				Records[Key{ Record.ContentHash, Record.CompilerID, Record.ContentLength }] = Record;
+				ValidLength += sizeof(Record);
+			}
+			fclose(Existing);
+		}
+
+		// "r+b" so appending starts after the last whole record instead of after a torn one
+		File = fopen(Path, (ValidLength > 0) ? "r+b" : "wb");
+		if (File == nullptr)
+		{
+			*OutError = "could not open it for writing";
+			return false;
+		}
+
+		if (ValidLength == 0)
+		{
+			VerdictCacheFileHeader Header;
+			memcpy(Header.Magic, VERDICT_CACHE_MAGIC, sizeof(Header.Magic));
+			Header.Version = VERDICT_CACHE_VERSION;
+			if (fwrite(&Header, sizeof(Header), 1, File) != 1)
+			{
+				*OutError = "could not write to it";
+				Close();
+				return false;
+			}
+		}
+		else if (fseek(File, (long)ValidLength, SEEK_SET) != 0)
+		{
+			*OutError = "could not seek in it";
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		if (File != nullptr)
+		{
+			fclose(File);
+			File = nullptr;
+		}
+		Records.clear();
+	}
+
+	~VerdictCache()
+	{
+		Close();
+	}
+
+	const VerdictCacheRecord* Find(uint64_t ContentHash, uint64_t CompilerID, uint32_t ContentLength) const
+	{
+		auto It = Records.find(Key{ ContentHash, CompilerID, ContentLength });
+		return (It != Records.end()) ? &It->second : nullptr;
+	}
+
+	// Records and appends it, flushed right away so a kill loses at most this one (a record is nothing
+	// next to the compile it stands for)
+	bool Add(const VerdictCacheRecord& Record)
+	{
+		Records[Key{ Record.ContentHash, Record.CompilerID, Record.ContentLength }] = Record;
+		return File != nullptr && fwrite(&Record, sizeof(Record), 1, File) == 1 && fflush(File) == 0;
+	}
+
+	bool Flush()
+	{
+		return File != nullptr && fflush(File) == 0;
+	}
+};